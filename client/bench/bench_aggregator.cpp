@@ -0,0 +1,107 @@
+// Per-device aggregation benchmark.
+//
+// Usage: bench_aggregator [devices] [rounds]
+//
+// Every round updates each device once, in a scattered order, with a
+// reading that has all 27 fields present; timestamps advance one minute per
+// round, so the 5 min windows roll over every fifth round. Reports state
+// memory per device and reading updates / field values per second.
+
+#include "bench_util.h"
+#include "device_aggregator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+static void countWindow(uint64_t, uint32_t, const AggregateWindow &aggregate,
+                        void *user) {
+  *(uint64_t *)user += aggregate.count[FLAG_PM_25];
+}
+
+static SensorReading makeFullReading(uint32_t seed) {
+  SensorReading reading;
+  initSensorReading(&reading);
+  for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    setFlag(&reading, (SensorFlag)flag);
+    setSensorFieldValue(reading, (SensorFlag)flag, 0,
+                        (int64_t)((seed * 2654435761u + flag * 40503u) % 3000));
+  }
+  return reading;
+}
+
+int main(int argc, char **argv) {
+  uint32_t devices = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 1000000;
+  uint32_t rounds = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 10;
+
+  const uint32_t kVariants = 256;
+  std::vector<SensorReading> readings;
+  for (uint32_t i = 0; i < kVariants; i++) {
+    readings.push_back(makeFullReading(i));
+  }
+
+  uint64_t emitted_values = 0;
+  DeviceAggregator aggregator;
+  AggregatorConfig config = DeviceAggregator::defaultConfig();
+  config.expected_devices = devices;
+  aggregator.init(config, countWindow, &emitted_values);
+
+  // Every device once per round, in a shuffled (cache-hostile) order
+  std::vector<uint32_t> order(devices);
+  uint64_t seed = 88172645463325252ULL;
+  for (uint32_t i = 0; i < devices; i++) {
+    order[i] = i;
+  }
+  for (uint32_t i = devices - 1; i > 0; i--) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    std::swap(order[i], order[seed % (i + 1)]);
+  }
+
+  printf("devices=%u rounds=%u windows=5m,1h fields=%d\n", devices, rounds,
+         SENSOR_FIELD_COUNT);
+  printf("%-6s %12s %14s %14s\n", "round", "ms", "updates/s", "values/s");
+
+  uint64_t start_ms = 1700000000000ULL;
+  uint64_t total_ns = 0;
+  uint64_t total_updates = 0;
+  for (uint32_t round = 0; round < rounds; round++) {
+    uint64_t now_ms = start_ms + round * 60000ULL;
+    AggregatorStats before = aggregator.getStats();
+    uint64_t begin = benchNowNs();
+    for (uint32_t i = 0; i < devices; i++) {
+      uint32_t device = order[i];
+      aggregator.update(device, now_ms + i % 60000,
+                        readings[(device + round) % kVariants]);
+    }
+    uint64_t elapsed = benchNowNs() - begin;
+    AggregatorStats after = aggregator.getStats();
+
+    // Round 0 inserts every device; report it but keep it out of the total
+    if (round > 0) {
+      total_ns += elapsed;
+      total_updates += after.updates - before.updates;
+    }
+    printf("%-6u %12.1f %14.0f %14.0f\n", round, elapsed / 1e6,
+           (after.updates - before.updates) / (elapsed / 1e9),
+           (after.values - before.values) / (elapsed / 1e9));
+  }
+
+  aggregator.flush();
+  benchDoNotOptimize(emitted_values);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  AggregatorStats stats = aggregator.getStats();
+  printf("\nstate memory: %.1f MB, %.0f bytes/device (window block %zu bytes)\n",
+         aggregator.getMemoryUsage() / 1e6,
+         (double)aggregator.getMemoryUsage() / devices, sizeof(AggregateWindow));
+  printf("peak RSS: %.1f MB\n", usage.ru_maxrss / 1e3);
+  printf("steady state: %.0f updates/s, %.0f field values/s\n",
+         total_ns ? total_updates / (total_ns / 1e9) : 0.0,
+         total_ns ? total_updates * SENSOR_FIELD_COUNT * config.window_count /
+                        (total_ns / 1e9)
+                  : 0.0);
+  printf("windows emitted: %llu\n", (unsigned long long)stats.emitted);
+  return 0;
+}
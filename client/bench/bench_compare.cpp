@@ -0,0 +1,200 @@
+// Regression check between two benchmark JSON result files.
+//
+// Usage: bench_compare BASELINE CURRENT [threshold_percent]
+//
+// Reads files written by bench_encoder (a "results" array of objects with
+// "name", "median" and "p99", in the file's "unit") and prints, for every
+// case in both, the median change. A case whose median grew by more than
+// the threshold (default 10%) is a regression. Cases measured in different
+// units (a --counters run against a timed one) are listed and skipped.
+// Exits 1 if there is any regression, and 2 if no case could be compared,
+// so the check can gate a build.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+typedef struct {
+  std::string name;
+  std::string unit; // "ns_per_batch" or "instructions_per_batch"
+  double median;
+  double p99;
+} CaseResult;
+
+// String value of "key": within [begin, end)
+static bool findString(const char *begin, const char *end, const char *key,
+                       std::string *value) {
+  std::string quoted = std::string("\"") + key + "\"";
+  const char *p = strstr(begin, quoted.c_str());
+  if (p == nullptr || p >= end) {
+    return false;
+  }
+  p = strchr(p + quoted.size(), '"');
+  const char *value_end = p != nullptr ? strchr(p + 1, '"') : nullptr;
+  if (value_end == nullptr || value_end >= end) {
+    return false;
+  }
+  value->assign(p + 1, value_end);
+  return true;
+}
+
+// Column label for a unit
+static const char *unitLabel(const std::string &unit) {
+  if (unit == "ns_per_batch") {
+    return "ns";
+  }
+  if (unit == "instructions_per_batch") {
+    return "instr";
+  }
+  return unit.c_str();
+}
+
+// Number following "key": within [begin, end)
+static bool findNumber(const char *begin, const char *end, const char *key,
+                       double *value) {
+  std::string quoted = std::string("\"") + key + "\"";
+  const char *p = strstr(begin, quoted.c_str());
+  if (p == nullptr || p >= end) {
+    return false;
+  }
+  p = strchr(p + quoted.size(), ':');
+  if (p == nullptr || p >= end) {
+    return false;
+  }
+  char *number_end;
+  *value = strtod(p + 1, &number_end);
+  return number_end != p + 1;
+}
+
+// Case objects of a result file; the format is the one bench_encoder writes
+static bool readResults(const char *path, std::vector<CaseResult> *results) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  std::string text;
+  char chunk[4096];
+  size_t length;
+  while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    text.append(chunk, length);
+  }
+  fclose(file);
+
+  const char *p = strstr(text.c_str(), "\"results\"");
+  if (p == nullptr) {
+    return false;
+  }
+  // A case may carry its own "unit"; files from before it was written
+  // were timed
+  std::string file_unit = "ns_per_batch";
+  findString(text.c_str(), p, "unit", &file_unit);
+  while ((p = strchr(p, '{')) != nullptr) {
+    const char *end = strchr(p, '}');
+    if (end == nullptr) {
+      return false;
+    }
+    const char *name = strstr(p, "\"name\"");
+    if (name == nullptr || name > end) {
+      return false;
+    }
+    name = strchr(name + 6, '"');
+    const char *name_end = name != nullptr ? strchr(name + 1, '"') : nullptr;
+    CaseResult result;
+    if (name_end == nullptr || name_end > end ||
+        !findNumber(p, end, "median", &result.median) ||
+        !findNumber(p, end, "p99", &result.p99)) {
+      return false;
+    }
+    result.name.assign(name + 1, name_end);
+    if (!findString(p, end, "unit", &result.unit)) {
+      result.unit = file_unit;
+    }
+    results->push_back(result);
+    p = end + 1;
+  }
+  return !results->empty();
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "usage: %s BASELINE CURRENT [threshold_percent]\n",
+            argv[0]);
+    return 2;
+  }
+  double threshold = argc > 3 ? atof(argv[3]) : 10.0;
+
+  std::vector<CaseResult> baseline, current;
+  if (!readResults(argv[1], &baseline)) {
+    fprintf(stderr, "cannot read results from %s\n", argv[1]);
+    return 2;
+  }
+  if (!readResults(argv[2], &current)) {
+    fprintf(stderr, "cannot read results from %s\n", argv[2]);
+    return 2;
+  }
+
+  uint32_t regressions = 0, improvements = 0, missing = 0, compared = 0;
+  uint32_t mismatched = 0;
+  std::string base_label = std::string("base_") + unitLabel(baseline[0].unit);
+  std::string now_label = std::string("now_") + unitLabel(current[0].unit);
+  printf("%-28s %10s %10s %8s %8s\n", "case", base_label.c_str(),
+         now_label.c_str(), "median", "p99");
+  for (size_t i = 0; i < current.size(); i++) {
+    const CaseResult *base = nullptr;
+    for (size_t j = 0; j < baseline.size() && base == nullptr; j++) {
+      if (baseline[j].name == current[i].name) {
+        base = &baseline[j];
+      }
+    }
+    if (base == nullptr) {
+      printf("%-28s %10s %10.1f  (new)\n", current[i].name.c_str(), "-",
+             current[i].median);
+      continue;
+    }
+    if (base->unit != current[i].unit) {
+      printf("%-28s  (%s against %s, skipped)\n", current[i].name.c_str(),
+             current[i].unit.c_str(), base->unit.c_str());
+      mismatched++;
+      continue;
+    }
+    compared++;
+    double change = base->median > 0
+                        ? (current[i].median / base->median - 1) * 100
+                        : 0;
+    double p99_change =
+        base->p99 > 0 ? (current[i].p99 / base->p99 - 1) * 100 : 0;
+    const char *verdict = "";
+    if (change > threshold) {
+      verdict = "  REGRESSION";
+      regressions++;
+    } else if (change < -threshold) {
+      verdict = "  improved";
+      improvements++;
+    }
+    printf("%-28s %10.1f %10.1f %+7.1f%% %+7.1f%%%s\n",
+           current[i].name.c_str(), base->median, current[i].median, change,
+           p99_change, verdict);
+  }
+  for (size_t j = 0; j < baseline.size(); j++) {
+    bool found = false;
+    for (size_t i = 0; i < current.size() && !found; i++) {
+      found = baseline[j].name == current[i].name;
+    }
+    if (!found) {
+      printf("%-28s  (missing from %s)\n", baseline[j].name.c_str(), argv[2]);
+      missing++;
+    }
+  }
+
+  printf("%u regressions, %u improvements above %.1f%%, %u missing, "
+         "%u in different units\n",
+         regressions, improvements, fabs(threshold), missing, mismatched);
+  if (compared == 0) {
+    fprintf(stderr, "no case to compare in the same unit\n");
+    return 2;
+  }
+  return regressions > 0 ? 1 : 0;
+}
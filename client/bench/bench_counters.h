@@ -0,0 +1,107 @@
+#ifndef BENCH_COUNTERS_H
+#define BENCH_COUNTERS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// User-space hardware event counts
+typedef struct {
+  uint64_t instructions;
+  uint64_t branches;
+  uint64_t branch_misses;
+} BenchCounts;
+
+// Retired instructions, branches and branch misses of the calling thread,
+// counted in user space only (perf_event_open). Counting fails on
+// non-Linux hosts and in VMs or containers without a virtual PMU.
+class BenchCounters {
+public:
+  BenchCounters() : group(-1) {
+    fds[0] = fds[1] = fds[2] = -1;
+  }
+  ~BenchCounters() { close(); }
+
+  // Returns: false if the counters are not available
+  bool open() {
+#ifdef __linux__
+    static const uint64_t kEvents[3] = {PERF_COUNT_HW_INSTRUCTIONS,
+                                        PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+                                        PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < 3; i++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = kEvents[i];
+      attr.disabled = i == 0 ? 1 : 0; // The group follows its leader
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+      if (fds[i] < 0) {
+        close();
+        return false;
+      }
+      if (i == 0) {
+        group = fds[0];
+      }
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void close() {
+#ifdef __linux__
+    for (int i = 2; i >= 0; i--) {
+      if (fds[i] >= 0) {
+        ::close(fds[i]);
+        fds[i] = -1;
+      }
+    }
+#endif
+    group = -1;
+  }
+
+  void start() {
+#ifdef __linux__
+    ioctl(group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  BenchCounts stop() {
+    BenchCounts counts;
+    memset(&counts, 0, sizeof(counts));
+#ifdef __linux__
+    ioctl(group, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t value;
+    if (read(fds[0], &value, sizeof(value)) == sizeof(value)) {
+      counts.instructions = value;
+    }
+    if (read(fds[1], &value, sizeof(value)) == sizeof(value)) {
+      counts.branches = value;
+    }
+    if (read(fds[2], &value, sizeof(value)) == sizeof(value)) {
+      counts.branch_misses = value;
+    }
+#endif
+    return counts;
+  }
+
+private:
+  BenchCounters(const BenchCounters &);
+  BenchCounters &operator=(const BenchCounters &);
+
+  int fds[3];
+  int group;
+};
+
+#endif // BENCH_COUNTERS_H
@@ -0,0 +1,143 @@
+// Decode plan benchmark.
+//
+// Usage: bench_decode_plan [payloads] [passes]
+//
+// Payloads follow a fleet-like mask distribution: a few device profiles
+// (indoor, outdoor dual-channel, dedicated temp/hum, solar, gas AFE), each
+// with some sensors missing, for a few dozen distinct combinations drawn
+// with Zipf-like weights. Each payload has 1-5 readings. Reports readings/s
+// decoding field by field and with a DecodePlanCache, plus the hit rate.
+
+#include "bench_util.h"
+#include "decode_plan.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  uint32_t mask;
+  bool dual;
+  bool dedicated;
+} Layout;
+
+static std::vector<Layout> makeLayouts() {
+  const uint32_t kIndoor = FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_HUM) |
+                           FLAG_BIT(FLAG_CO2) | FLAG_BIT(FLAG_TVOC) |
+                           FLAG_BIT(FLAG_TVOC_RAW) | FLAG_BIT(FLAG_NOX) |
+                           FLAG_BIT(FLAG_NOX_RAW) | FLAG_BIT(FLAG_PM_01) |
+                           FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_PM_10) |
+                           FLAG_BIT(FLAG_PM_03_PC) | FLAG_BIT(FLAG_SIGNAL);
+  const uint32_t kOutdoor = kIndoor & ~FLAG_BIT(FLAG_CO2);
+  const uint32_t kSolar = kOutdoor | FLAG_BIT(FLAG_VBAT) | FLAG_BIT(FLAG_VPANEL);
+  const uint32_t kAfe = kIndoor | FLAG_BIT(FLAG_O3_WE) | FLAG_BIT(FLAG_O3_AE) |
+                        FLAG_BIT(FLAG_NO2_WE) | FLAG_BIT(FLAG_NO2_AE) |
+                        FLAG_BIT(FLAG_AFE_TEMP);
+  const Layout kProfiles[5] = {{kIndoor, false, false},
+                               {kOutdoor, true, false},
+                               {kOutdoor, true, true},
+                               {kSolar, true, false},
+                               {kAfe, false, false}};
+  // Sensors that drop out: CO2, TVOC, NOx, particle count
+  const uint32_t kMissing[8] = {
+      0,
+      FLAG_BIT(FLAG_CO2),
+      FLAG_BIT(FLAG_TVOC) | FLAG_BIT(FLAG_TVOC_RAW),
+      FLAG_BIT(FLAG_NOX) | FLAG_BIT(FLAG_NOX_RAW),
+      FLAG_BIT(FLAG_PM_03_PC),
+      FLAG_BIT(FLAG_TVOC) | FLAG_BIT(FLAG_NOX),
+      FLAG_BIT(FLAG_SIGNAL),
+      FLAG_BIT(FLAG_PM_01) | FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_PM_10) |
+          FLAG_BIT(FLAG_PM_03_PC)};
+
+  std::vector<Layout> layouts;
+  for (uint32_t m = 0; m < 8; m++) {
+    for (uint32_t p = 0; p < 5; p++) {
+      Layout layout = kProfiles[p];
+      if ((layout.mask & kMissing[m]) == 0 && m != 0)
+        continue;
+      layout.mask &= ~kMissing[m];
+      layouts.push_back(layout);
+    }
+  }
+  return layouts;
+}
+
+static std::vector<uint8_t> makePayload(const Layout &layout, uint32_t seed) {
+  PayloadEncoder encoder;
+  PayloadHeader header = {1, layout.dual, layout.dedicated, 5};
+  encoder.init(header);
+  uint32_t readings = 1 + seed % 5;
+  for (uint32_t i = 0; i < readings; i++) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    reading.presence_mask = layout.mask;
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+      for (uint8_t channel = 0; channel < 2; channel++) {
+        setSensorFieldValue(reading, (SensorFlag)flag, channel,
+                            (seed * 2654435761u + flag * 40503u + i) % 3000);
+      }
+    }
+    encoder.addReading(reading);
+  }
+  std::vector<uint8_t> payload(MAX_PAYLOAD_SIZE);
+  payload.resize((size_t)encoder.encode(payload.data(), payload.size()));
+  return payload;
+}
+
+static uint64_t run(PayloadDecoder &decoder,
+                    const std::vector<std::vector<uint8_t> > &payloads,
+                    uint32_t passes) {
+  uint64_t readings = 0;
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (size_t i = 0; i < payloads.size(); i++) {
+      int32_t count =
+          decoder.decode(payloads[i].data(), (uint32_t)payloads[i].size());
+      benchDoNotOptimize(decoder.getReading(0).presence_mask);
+      readings += (uint64_t)count;
+    }
+  }
+  return readings;
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 20000;
+  uint32_t passes = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 50;
+
+  std::vector<Layout> layouts = makeLayouts();
+  double total_weight = 0;
+  for (size_t i = 0; i < layouts.size(); i++)
+    total_weight += 1.0 / (i + 1);
+
+  std::vector<std::vector<uint8_t> > payloads;
+  srand(1);
+  for (uint32_t i = 0; i < count; i++) {
+    double pick = rand() / (RAND_MAX + 1.0) * total_weight;
+    size_t layout = 0;
+    while (layout + 1 < layouts.size() && (pick -= 1.0 / (layout + 1)) > 0)
+      layout++;
+    payloads.push_back(makePayload(layouts[layout], i));
+  }
+  printf("payloads=%u passes=%u combinations=%zu\n", count, passes,
+         layouts.size());
+
+  PayloadDecoder by_field;
+  uint64_t start = benchNowNs();
+  uint64_t readings = run(by_field, payloads, passes);
+  double field_seconds = (benchNowNs() - start) / 1e9;
+
+  DecodePlanCache cache;
+  PayloadDecoder by_plan;
+  by_plan.setPlanCache(&cache);
+  start = benchNowNs();
+  run(by_plan, payloads, passes);
+  double plan_seconds = (benchNowNs() - start) / 1e9;
+
+  printf("%12s %14s\n", "decoder", "readings/s");
+  printf("%12s %14.0f\n", "by field", readings / field_seconds);
+  printf("%12s %14.0f  (%.2fx)\n", "plan cache", readings / plan_seconds,
+         field_seconds / plan_seconds);
+  printf("plans=%u hit rate=%.4f%%\n", cache.size(),
+         100.0 * cache.hits() / (cache.hits() + cache.misses()));
+  return 0;
+}
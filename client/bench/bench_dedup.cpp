@@ -0,0 +1,103 @@
+// Duplicate filter benchmark.
+//
+// Usage: bench_dedup [keys] [threads] [fp_rate]
+//
+// Sizes the filter for keys spread over its 5 buckets, inserts them (one
+// bucket after another, as receive time moves on) from the given number of
+// threads, then looks up as many keys never inserted. Reports inserts/s,
+// lookups/s, memory and the measured false positive rate next to the
+// configured and estimated ones.
+
+#include "bench_util.h"
+#include "payload_dedup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#define BENCH_BUCKETS 5
+
+static void insertRange(DuplicateFilter *filter, uint64_t first, uint64_t end,
+                        uint64_t keys_per_bucket) {
+  for (uint64_t i = first; i < end; i++) {
+    uint64_t bucket = i / keys_per_bucket;
+    filter->checkAndInsert(i, bucket * 60000 + 1);
+  }
+}
+
+static void probeRange(const DuplicateFilter *filter, uint64_t first,
+                       uint64_t end, uint64_t *found) {
+  uint64_t count = 0;
+  for (uint64_t i = first; i < end; i++) {
+    count += filter->contains(i | (1ull << 63)) ? 1 : 0;
+  }
+  *found = count;
+}
+
+int main(int argc, char **argv) {
+  uint64_t keys = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+  uint32_t threads = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 1;
+  double rate = argc > 3 ? atof(argv[3]) : 0.001;
+  if (threads == 0) {
+    threads = 1;
+  }
+
+  DuplicateFilterConfig config = DuplicateFilter::defaultConfig();
+  config.keys_per_bucket = keys / BENCH_BUCKETS;
+  config.false_positive_rate = rate;
+  config.buckets = BENCH_BUCKETS;
+  DuplicateFilter filter;
+  if (!filter.init(config)) {
+    fprintf(stderr, "invalid configuration\n");
+    return 1;
+  }
+
+  // Threads insert the same bucket together, then move on to the next
+  uint64_t start = benchNowNs();
+  for (uint32_t b = 0; b < BENCH_BUCKETS; b++) {
+    uint64_t first = b * config.keys_per_bucket;
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++) {
+      uint64_t share = config.keys_per_bucket / threads;
+      uint64_t end = t + 1 == threads ? first + config.keys_per_bucket
+                                      : first + (t + 1) * share;
+      workers.push_back(std::thread(insertRange, &filter, first + t * share,
+                                    end, config.keys_per_bucket));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+      workers[t].join();
+    }
+  }
+  double insert_seconds = (benchNowNs() - start) / 1e9;
+  uint64_t inserted = config.keys_per_bucket * BENCH_BUCKETS;
+  DuplicateFilterStats stats = filter.getStats();
+
+  std::vector<uint64_t> found(threads);
+  start = benchNowNs();
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < threads; t++) {
+    workers.push_back(std::thread(probeRange, &filter, inserted * t / threads,
+                                  inserted * (t + 1) / threads, &found[t]));
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+  double lookup_seconds = (benchNowNs() - start) / 1e9;
+  uint64_t false_positives = 0;
+  for (uint32_t t = 0; t < threads; t++) {
+    false_positives += found[t];
+  }
+
+  printf("keys=%llu threads=%u buckets=%u memory=%.1f MB (%u bits/key, "
+         "%u hashes)\n",
+         (unsigned long long)inserted, threads, BENCH_BUCKETS,
+         stats.memory_bytes / 1e6, stats.bits_per_key, stats.hash_count);
+  printf("inserts/s=%.0f lookups/s=%.0f\n", inserted / insert_seconds,
+         inserted / lookup_seconds);
+  printf("fp rate: target=%.6f expected=%.6f estimated=%.6f measured=%.6f\n",
+         rate, stats.expected_fp_rate, stats.estimated_fp_rate,
+         (double)false_positives / inserted);
+  printf("duplicates seen while inserting distinct keys: %llu\n",
+         (unsigned long long)stats.duplicates);
+  return 0;
+}
@@ -0,0 +1,67 @@
+// Derived metrics benchmark.
+//
+// Usage: bench_derived_metrics [rows] [passes]
+//
+// Computes corrected PM2.5, AQI, O3 and NO2 over columns of random readings
+// (all fields present) with the scalar kernels and, when the CPU has it,
+// AVX2. Reports rows/s and output values/s (four per row).
+
+#include "bench_util.h"
+#include "derived_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static double run(const MetricInputs &inputs, const DerivedMetricsConfig &config,
+                  const MetricOutputs &outputs, uint32_t passes) {
+  uint64_t start = benchNowNs();
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    computeDerivedMetrics(inputs, config, outputs);
+    benchDoNotOptimize(outputs.o3_ppb);
+  }
+  return (benchNowNs() - start) / 1e9;
+}
+
+int main(int argc, char **argv) {
+  uint32_t rows = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 100000;
+  uint32_t passes = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 200;
+
+  MetricColumns columns;
+  srand(36);
+  for (uint32_t i = 0; i < rows; i++) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    reading.presence_mask = FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_HUM) |
+                            FLAG_BIT(FLAG_AFE_TEMP) | FLAG_BIT(FLAG_O3_WE) |
+                            FLAG_BIT(FLAG_O3_AE) | FLAG_BIT(FLAG_NO2_WE) |
+                            FLAG_BIT(FLAG_NO2_AE);
+    reading.pm_25[0] = (uint16_t)(rand() % 3000);
+    reading.hum[0] = (uint16_t)(rand() % 10000);
+    reading.afe_temp = (uint16_t)(rand() % 500);
+    reading.o3_we = 180000 + (uint32_t)(rand() % 200000);
+    reading.o3_ae = 200000 + (uint32_t)(rand() % 100000);
+    reading.no2_we = 180000 + (uint32_t)(rand() % 200000);
+    reading.no2_ae = 200000 + (uint32_t)(rand() % 100000);
+    columns.append(reading);
+  }
+  MetricInputs inputs = columns.inputs();
+
+  DerivedMetricsConfig config;
+  initDerivedMetricsConfig(config);
+  std::vector<float> corrected(rows), aqi(rows), o3(rows), no2(rows);
+  MetricOutputs outputs = {corrected.data(), aqi.data(), o3.data(), no2.data()};
+
+  printf("rows=%u passes=%u\n", rows, passes);
+  printf("%8s %14s %14s\n", "kernel", "rows/s", "values/s");
+  metricsForceScalar(true);
+  double scalar = run(inputs, config, outputs, passes);
+  printf("%8s %14.0f %14.0f\n", "scalar", rows * (double)passes / scalar,
+         4.0 * rows * passes / scalar);
+  metricsForceScalar(false);
+  if (metricsHaveAvx2()) {
+    double simd = run(inputs, config, outputs, passes);
+    printf("%8s %14.0f %14.0f  (%.1fx)\n", "avx2", rows * (double)passes / simd,
+           4.0 * rows * passes / simd, scalar / simd);
+  }
+  return 0;
+}
@@ -0,0 +1,170 @@
+// Sampling stalls while a batch is transmitted.
+//
+// Usage: bench_double_buffer [readings] [sample_us] [transmit_us]
+//
+// A sampling thread adds a reading every sample_us while a transmit thread
+// encodes each full batch and sleeps for transmit_us, standing in for a
+// modem send. Compares a single PayloadEncoder behind a mutex held
+// through encode and send, with DoubleBufferedEncoder. Reports the
+// addReading() latency seen by the sampler and the readings that found no
+// room (dropped rather than waited for).
+
+#include "bench_util.h"
+#include "double_buffered_encoder.h"
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+typedef struct {
+  std::vector<uint64_t> latencies;
+  uint64_t dropped;
+  uint64_t payloads;
+} RunResult;
+
+static SensorReading benchReading(uint32_t i) {
+  SensorReading reading;
+  initSensorReading(&reading);
+  setFlag(&reading, FLAG_TEMP);
+  setFlag(&reading, FLAG_HUM);
+  setFlag(&reading, FLAG_CO2);
+  setFlag(&reading, FLAG_PM_25);
+  reading.temp[0] = (int16_t)(2000 + i % 100);
+  reading.hum[0] = 5000;
+  reading.co2 = (uint16_t)(400 + i % 50);
+  reading.pm_25[0] = 120;
+  return reading;
+}
+
+// Sleep rather than spin, so the two threads share one core fairly
+static void sleepUntil(uint64_t deadline_ns) {
+  uint64_t now = benchNowNs();
+  if (now < deadline_ns) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(deadline_ns - now));
+  }
+}
+
+static void poll() { std::this_thread::sleep_for(std::chrono::microseconds(20)); }
+
+static void printResult(const char *name, RunResult &result) {
+  printf("%-14s addReading p50=%lluns p99=%lluns max=%lluns "
+         "dropped=%llu payloads=%llu\n",
+         name, (unsigned long long)benchPercentile(result.latencies, 50),
+         (unsigned long long)benchPercentile(result.latencies, 99),
+         (unsigned long long)benchPercentile(result.latencies, 100),
+         (unsigned long long)result.dropped,
+         (unsigned long long)result.payloads);
+}
+
+static RunResult runLocked(uint32_t readings, uint64_t sample_ns,
+                           uint64_t transmit_ns) {
+  PayloadHeader header = {1, false, false, 5};
+  PayloadEncoder encoder;
+  encoder.init(header);
+  std::mutex mutex;
+  std::atomic<bool> done(false);
+  RunResult result;
+  result.dropped = result.payloads = 0;
+  result.latencies.reserve(readings);
+
+  std::thread transmitter([&]() {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    while (!done.load()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (encoder.getReadingCount() >= MAX_BATCH_SIZE) {
+          benchDoNotOptimize(encoder.encode(buffer, sizeof(buffer)));
+          sleepUntil(benchNowNs() + transmit_ns); // Send with the batch held
+          encoder.init(header);
+          result.payloads++;
+        }
+      }
+      poll();
+    }
+  });
+
+  uint64_t next = benchNowNs();
+  for (uint32_t i = 0; i < readings; i++) {
+    next = std::max(next + sample_ns, benchNowNs()); // Late ticks are skipped
+    sleepUntil(next);
+    SensorReading reading = benchReading(i);
+    uint64_t start = benchNowNs();
+    bool added;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      added = encoder.addReading(reading);
+    }
+    result.latencies.push_back(benchNowNs() - start);
+    result.dropped += added ? 0 : 1;
+  }
+  done.store(true);
+  transmitter.join();
+  return result;
+}
+
+static RunResult runDoubleBuffered(uint32_t readings, uint64_t sample_ns,
+                                   uint64_t transmit_ns) {
+  PayloadHeader header = {1, false, false, 5};
+  DoubleBufferedEncoder encoder;
+  encoder.init(header);
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> filled(0); // Readings in the active batch, as a hint
+  RunResult result;
+  result.dropped = result.payloads = 0;
+  result.latencies.reserve(readings);
+
+  std::thread transmitter([&]() {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    while (!done.load()) {
+      PayloadEncoder *batch = nullptr;
+      if (filled.load(std::memory_order_relaxed) >= MAX_BATCH_SIZE) {
+        batch = encoder.acquireBatch();
+      }
+      if (batch == nullptr) {
+        poll();
+        continue;
+      }
+      filled.store(0, std::memory_order_relaxed);
+      benchDoNotOptimize(batch->encode(buffer, sizeof(buffer)));
+      sleepUntil(benchNowNs() + transmit_ns);
+      encoder.releaseBatch();
+      result.payloads++;
+    }
+  });
+
+  uint64_t next = benchNowNs();
+  for (uint32_t i = 0; i < readings; i++) {
+    next = std::max(next + sample_ns, benchNowNs()); // Late ticks are skipped
+    sleepUntil(next);
+    SensorReading reading = benchReading(i);
+    uint64_t start = benchNowNs();
+    bool added = encoder.addReading(reading);
+    result.latencies.push_back(benchNowNs() - start);
+    if (added) {
+      filled.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      result.dropped++;
+    }
+  }
+  done.store(true);
+  transmitter.join();
+  return result;
+}
+
+int main(int argc, char **argv) {
+  uint32_t readings = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 20000;
+  uint64_t sample_us = argc > 2 ? strtoull(argv[2], nullptr, 10) : 50;
+  uint64_t transmit_us = argc > 3 ? strtoull(argv[3], nullptr, 10) : 500;
+
+  printf("readings=%u sample_us=%llu transmit_us=%llu (batch fills in %llu us)\n",
+         readings, (unsigned long long)sample_us,
+         (unsigned long long)transmit_us,
+         (unsigned long long)(sample_us * MAX_BATCH_SIZE));
+  RunResult locked = runLocked(readings, sample_us * 1000, transmit_us * 1000);
+  printResult("mutex", locked);
+  RunResult buffered =
+      runDoubleBuffered(readings, sample_us * 1000, transmit_us * 1000);
+  printResult("double-buffer", buffered);
+  return 0;
+}
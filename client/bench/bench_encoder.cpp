@@ -0,0 +1,395 @@
+// Encoder benchmark.
+//
+// Usage: bench_encoder [repetitions] [json_file] [filter]
+//        bench_encoder --counters [repetitions] [json_file] [filter]
+//        bench_encoder --cachegrind [iterations] [filter]
+//
+// Measures PayloadEncoder over a matrix of field masks (sparse, typical,
+// full), headers (single, dual, dedicated temp/hum) and batch sizes (1, 5,
+// 20):
+//   add    - init() plus addReading() for the whole batch
+//   size   - calculateTotalSize() of a filled encoder
+//   encode - encode() of a filled encoder
+//   add_alarm - add with urgent thresholds set (checked, never reached)
+//   urgent - encodeUrgent() of a filled encoder
+//
+// By default each case is warmed up, then timed repetitions times; each
+// repetition runs the operation enough times to take about 20 us. Median
+// and p99 are reported in ns per batch.
+//
+// --counters counts retired instructions, branches and branch misses in
+// user space with perf_event_open, over a fixed number of calls per
+// repetition, and reports them per batch. Instruction counts do not depend
+// on clock speed or load, so they stand in for cost on a microcontroller
+// and repeat exactly from run to run.
+//
+// Where hardware counters are not available (non-Linux, or a VM without a
+// PMU), --cachegrind runs the selected cases a fixed number of times for
+// valgrind; with valgrind 3.22 or later only those calls are instrumented
+// (run with --tool=cachegrind --cache-sim=no --instr-at-start=no and a
+// filter naming one case, e.g. encode/typical/dual/5). Divide the reported
+// I refs by the iterations for instructions per batch.
+//
+// With json_file the results are also written as JSON for bench_compare
+// ("median"/"p99" are ns or instructions per batch, as "unit" says);
+// filter keeps only cases whose name contains it.
+
+#include "bench_counters.h"
+#include "bench_util.h"
+#include "payload_encoder.h"
+#include "sensor_fields.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__has_include)
+#if __has_include(<valgrind/cachegrind.h>)
+#include <valgrind/cachegrind.h>
+#endif
+#endif
+#ifndef CACHEGRIND_START_INSTRUMENTATION
+#define CACHEGRIND_START_INSTRUMENTATION
+#define CACHEGRIND_STOP_INSTRUMENTATION
+#endif
+
+#define WARMUP_REPETITIONS 20
+#define TARGET_SAMPLE_NS 20000
+#define COUNTER_ITERATIONS 1000
+
+typedef enum {
+  OP_ADD = 0,
+  OP_SIZE = 1,
+  OP_ENCODE = 2,
+  OP_ADD_ALARM = 3,
+  OP_URGENT = 4,
+  OP_COUNT = 5
+} EncoderOp;
+
+typedef enum { MODE_TIME, MODE_COUNTERS, MODE_CACHEGRIND } BenchMode;
+
+typedef struct {
+  const char *name;
+  uint32_t mask;
+} MaskCase;
+
+typedef struct {
+  const char *name;
+  bool dual_mode;
+  bool dedicated_temphum_sensor;
+} HeaderCase;
+
+typedef struct {
+  std::string name;
+  double median;
+  double p99;
+  double branches;      // Counter mode only
+  double branch_misses; // Counter mode only
+  uint32_t payload_bytes;
+} BenchResult;
+
+// Encoder state for one case of the matrix
+typedef struct {
+  PayloadHeader header;
+  SensorReading readings[MAX_BATCH_SIZE];
+  uint32_t batch;
+  PayloadEncoder encoder; // Filled with the batch, first reading urgent
+  PayloadEncoder scratch; // Refilled by OP_ADD
+  PayloadEncoder alarmed; // Refilled by OP_ADD_ALARM
+  uint8_t buffer[MAX_PAYLOAD_SIZE];
+} BenchCase;
+
+#define B(flag) FLAG_BIT(FLAG_##flag)
+
+static const MaskCase kMasks[] = {
+    {"sparse", B(TEMP) | B(HUM) | B(PM_25)},
+    {"typical", B(TEMP) | B(HUM) | B(CO2) | B(TVOC) | B(NOX) | B(PM_01) |
+                    B(PM_25) | B(PM_10) | B(PM_03_PC) | B(SIGNAL)},
+    {"full", (1u << SENSOR_FIELD_COUNT) - 1},
+};
+
+#undef B
+
+static const HeaderCase kHeaders[] = {
+    {"single", false, false},
+    {"dual", true, false},
+    {"dedicated", true, true},
+};
+
+static const uint32_t kBatches[] = {1, 5, 20};
+
+static const char *kOps[OP_COUNT] = {"add", "size", "encode", "add_alarm",
+                                     "urgent"};
+
+// Readings with every field set to varying values; only the mask differs
+static void makeReadings(uint32_t mask, SensorReading *readings,
+                         uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    memset(&readings[i], 0, sizeof(SensorReading));
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+      for (uint8_t channel = 0; channel < 2; channel++) {
+        setSensorFieldValue(readings[i], (SensorFlag)flag, channel,
+                            (int64_t)(100 + 7 * i + 3 * flag + channel));
+      }
+    }
+    readings[i].presence_mask = mask;
+  }
+}
+
+template <int Op> static inline void runOp(BenchCase &c) {
+  if (Op == OP_ADD) {
+    c.scratch.init(c.header);
+    for (uint32_t i = 0; i < c.batch; i++) {
+      c.scratch.addReading(c.readings[i]);
+    }
+    benchDoNotOptimize(c.scratch);
+  } else if (Op == OP_SIZE) {
+    uint32_t size = c.encoder.calculateTotalSize();
+    benchDoNotOptimize(size);
+  } else if (Op == OP_ENCODE) {
+    int32_t length = c.encoder.encode(c.buffer, sizeof(c.buffer));
+    benchDoNotOptimize(length);
+    benchDoNotOptimize(c.buffer[0]);
+  } else if (Op == OP_ADD_ALARM) {
+    c.alarmed.init(c.header);
+    for (uint32_t i = 0; i < c.batch; i++) {
+      c.alarmed.addReading(c.readings[i]);
+    }
+    benchDoNotOptimize(c.alarmed);
+  } else {
+    int32_t length = c.encoder.encodeUrgent(c.buffer, sizeof(c.buffer));
+    benchDoNotOptimize(length);
+    benchDoNotOptimize(c.buffer[0]);
+  }
+}
+
+// Time warmup plus repetitions samples of enough calls to fill one sample
+template <int Op>
+static void measureTime(BenchCase &c, uint32_t repetitions,
+                        BenchResult *result) {
+  uint32_t iterations = 1;
+  for (;;) {
+    uint64_t start = benchNowNs();
+    for (uint32_t i = 0; i < iterations; i++) {
+      runOp<Op>(c);
+    }
+    if (benchNowNs() - start >= TARGET_SAMPLE_NS || iterations >= (1u << 20)) {
+      break;
+    }
+    iterations *= 2;
+  }
+
+  std::vector<uint64_t> samples;
+  for (uint32_t r = 0; r < WARMUP_REPETITIONS + repetitions; r++) {
+    uint64_t start = benchNowNs();
+    for (uint32_t i = 0; i < iterations; i++) {
+      runOp<Op>(c);
+    }
+    uint64_t elapsed = benchNowNs() - start;
+    if (r >= WARMUP_REPETITIONS) {
+      samples.push_back(elapsed);
+    }
+  }
+  result->median = (double)benchPercentile(samples, 50) / iterations;
+  result->p99 = (double)benchPercentile(samples, 99) / iterations;
+}
+
+// Count events over warmup plus repetitions runs of a fixed number of calls
+template <int Op>
+static void measureCounters(BenchCase &c, BenchCounters &counters,
+                            uint32_t repetitions, BenchResult *result) {
+  std::vector<uint64_t> instructions, branches, misses;
+  for (uint32_t r = 0; r < WARMUP_REPETITIONS + repetitions; r++) {
+    counters.start();
+    for (uint32_t i = 0; i < COUNTER_ITERATIONS; i++) {
+      runOp<Op>(c);
+    }
+    BenchCounts counts = counters.stop();
+    if (r >= WARMUP_REPETITIONS) {
+      instructions.push_back(counts.instructions);
+      branches.push_back(counts.branches);
+      misses.push_back(counts.branch_misses);
+    }
+  }
+  result->median =
+      (double)benchPercentile(instructions, 50) / COUNTER_ITERATIONS;
+  result->p99 = (double)benchPercentile(instructions, 99) / COUNTER_ITERATIONS;
+  result->branches = (double)benchPercentile(branches, 50) / COUNTER_ITERATIONS;
+  result->branch_misses =
+      (double)benchPercentile(misses, 50) / COUNTER_ITERATIONS;
+}
+
+// Run calls under cachegrind, instrumenting only the loop when possible
+template <int Op> static void runCachegrind(BenchCase &c, uint32_t iterations) {
+  CACHEGRIND_START_INSTRUMENTATION;
+  for (uint32_t i = 0; i < iterations; i++) {
+    runOp<Op>(c);
+  }
+  CACHEGRIND_STOP_INSTRUMENTATION;
+}
+
+static bool writeJson(const char *path, BenchMode mode, uint32_t repetitions,
+                      const std::vector<BenchResult> &results) {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    return false;
+  }
+  fprintf(file, "{\n  \"benchmark\": \"bench_encoder\",\n");
+  fprintf(file, "  \"unit\": \"%s\",\n",
+          mode == MODE_COUNTERS ? "instructions_per_batch" : "ns_per_batch");
+  fprintf(file, "  \"repetitions\": %u,\n  \"results\": [\n", repetitions);
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &result = results[i];
+    fprintf(file, "    {\"name\": \"%s\", \"median\": %.2f, \"p99\": %.2f, ",
+            result.name.c_str(), result.median, result.p99);
+    if (mode == MODE_COUNTERS) {
+      fprintf(file, "\"branches\": %.2f, \"branch_misses\": %.2f, ",
+              result.branches, result.branch_misses);
+    }
+    fprintf(file, "\"bytes\": %u}%s\n", result.payload_bytes,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+int main(int argc, char **argv) {
+  BenchMode mode = MODE_TIME;
+  int arg = 1;
+  if (argc > 1 && strcmp(argv[1], "--counters") == 0) {
+    mode = MODE_COUNTERS;
+    arg++;
+  } else if (argc > 1 && strcmp(argv[1], "--cachegrind") == 0) {
+    mode = MODE_CACHEGRIND;
+    arg++;
+  }
+  uint32_t repetitions =
+      argc > arg ? (uint32_t)strtoul(argv[arg], nullptr, 10) : 0;
+  const char *json_path = nullptr;
+  const char *filter = nullptr;
+  if (mode == MODE_CACHEGRIND) {
+    filter = argc > arg + 1 ? argv[arg + 1] : nullptr;
+    if (repetitions == 0) {
+      repetitions = COUNTER_ITERATIONS;
+    }
+  } else {
+    json_path = argc > arg + 1 ? argv[arg + 1] : nullptr;
+    filter = argc > arg + 2 ? argv[arg + 2] : nullptr;
+    if (repetitions == 0) {
+      repetitions = mode == MODE_COUNTERS ? 20 : 200;
+    }
+  }
+
+  BenchCounters counters;
+  if (mode == MODE_COUNTERS && !counters.open()) {
+    fprintf(stderr,
+            "hardware counters are not available here; run under valgrind "
+            "instead:\n  valgrind --tool=cachegrind --cache-sim=no "
+            "--instr-at-start=no %s --cachegrind 1000 CASE\n",
+            argv[0]);
+    return 1;
+  }
+
+  std::vector<BenchResult> results;
+  BenchCase *c = new BenchCase();
+  UrgentThresholds never = {UINT16_MAX, 0, UINT16_MAX, 0};
+  UrgentThresholds always = {1, 0, 1, 0};
+  c->alarmed.setUrgentThresholds(never);
+  if (mode == MODE_TIME) {
+    printf("%-28s %10s %10s %8s\n", "case", "median_ns", "p99_ns", "bytes");
+  } else if (mode == MODE_COUNTERS) {
+    printf("%-28s %10s %10s %10s %8s\n", "case", "instr", "branches",
+           "misses", "bytes");
+  }
+
+  for (size_t m = 0; m < sizeof(kMasks) / sizeof(kMasks[0]); m++) {
+    for (size_t h = 0; h < sizeof(kHeaders) / sizeof(kHeaders[0]); h++) {
+      for (size_t b = 0; b < sizeof(kBatches) / sizeof(kBatches[0]); b++) {
+        c->batch = kBatches[b];
+        c->header.version = 1;
+        c->header.dual_mode = kHeaders[h].dual_mode;
+        c->header.dedicated_temphum_sensor =
+            kHeaders[h].dedicated_temphum_sensor;
+        c->header.interval_minutes = 1;
+        makeReadings(kMasks[m].mask, c->readings, c->batch);
+        c->encoder.init(c->header);
+        c->encoder.setUrgentThresholds(always);
+        for (uint32_t i = 0; i < c->batch; i++) {
+          c->encoder.addReading(c->readings[i]);
+        }
+        uint32_t bytes = (uint32_t)c->encoder.encode(c->buffer,
+                                                     sizeof(c->buffer));
+
+        for (int op = 0; op < OP_COUNT; op++) {
+          char name[64];
+          snprintf(name, sizeof(name), "%s/%s/%s/%u", kOps[op], kMasks[m].name,
+                   kHeaders[h].name, c->batch);
+          if (filter != nullptr && strstr(name, filter) == nullptr) {
+            continue;
+          }
+
+          BenchResult result;
+          result.name = name;
+          result.median = result.p99 = 0;
+          result.branches = result.branch_misses = 0;
+          result.payload_bytes = bytes;
+          if (mode == MODE_CACHEGRIND) {
+            if (op == OP_ADD) {
+              runCachegrind<OP_ADD>(*c, repetitions);
+            } else if (op == OP_SIZE) {
+              runCachegrind<OP_SIZE>(*c, repetitions);
+            } else if (op == OP_ENCODE) {
+              runCachegrind<OP_ENCODE>(*c, repetitions);
+            } else if (op == OP_ADD_ALARM) {
+              runCachegrind<OP_ADD_ALARM>(*c, repetitions);
+            } else {
+              runCachegrind<OP_URGENT>(*c, repetitions);
+            }
+            printf("%s x %u\n", name, repetitions);
+            continue;
+          }
+
+          if (mode == MODE_TIME) {
+            if (op == OP_ADD) {
+              measureTime<OP_ADD>(*c, repetitions, &result);
+            } else if (op == OP_SIZE) {
+              measureTime<OP_SIZE>(*c, repetitions, &result);
+            } else if (op == OP_ENCODE) {
+              measureTime<OP_ENCODE>(*c, repetitions, &result);
+            } else if (op == OP_ADD_ALARM) {
+              measureTime<OP_ADD_ALARM>(*c, repetitions, &result);
+            } else {
+              measureTime<OP_URGENT>(*c, repetitions, &result);
+            }
+            printf("%-28s %10.1f %10.1f %8u\n", name, result.median,
+                   result.p99, bytes);
+          } else {
+            if (op == OP_ADD) {
+              measureCounters<OP_ADD>(*c, counters, repetitions, &result);
+            } else if (op == OP_SIZE) {
+              measureCounters<OP_SIZE>(*c, counters, repetitions, &result);
+            } else if (op == OP_ENCODE) {
+              measureCounters<OP_ENCODE>(*c, counters, repetitions, &result);
+            } else if (op == OP_ADD_ALARM) {
+              measureCounters<OP_ADD_ALARM>(*c, counters, repetitions,
+                                            &result);
+            } else {
+              measureCounters<OP_URGENT>(*c, counters, repetitions, &result);
+            }
+            printf("%-28s %10.1f %10.1f %10.2f %8u\n", name, result.median,
+                   result.branches, result.branch_misses, bytes);
+          }
+          results.push_back(result);
+        }
+      }
+    }
+  }
+  delete c;
+
+  if (json_path != nullptr && !writeJson(json_path, mode, repetitions, results)) {
+    fprintf(stderr, "cannot write %s\n", json_path);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+// Fleet analyzer benchmark.
+//
+// Usage: bench_fleet_analyzer [payloads] [max_threads] [directory]
+//
+// Writes fleet-generator payloads to an archive segment, then reports
+// payloads/s for FleetAnalyzer::addPayload() in memory on one thread and
+// records/s and MB/s for analyzeArchiveFiles() with 1, 2, 4, ... threads.
+
+#include "bench_util.h"
+#include "fleet_analyzer.h"
+#include "fleet_generator.h"
+#include "payload_archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+  uint64_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+  uint32_t max_threads = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10)
+                                  : std::thread::hardware_concurrency();
+  std::string directory = argc > 3 ? argv[3] : ".";
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  FleetConfig fleet;
+  initFleetConfig(fleet);
+  fleet.devices = 10000;
+  FleetGenerator generator;
+  generator.init(fleet);
+
+  std::string segment = directory + "/bench_fleet_analyzer.seg";
+  ArchiveWriter writer;
+  if (!writer.open(segment.c_str())) {
+    fprintf(stderr, "cannot write %s\n", segment.c_str());
+    return 1;
+  }
+  std::vector<uint8_t> payloads;
+  std::vector<uint32_t> lengths;
+  uint8_t payload[MAX_PAYLOAD_SIZE];
+  for (uint64_t i = 0; i < count; i++) {
+    FleetPayloadInfo info;
+    int32_t length = generator.generate((uint32_t)(i % fleet.devices), payload,
+                                        sizeof(payload), &info);
+    PayloadRecordHeader header;
+    header.length = (uint32_t)length;
+    header.sequence = i + 1;
+    header.device_id = info.device_id;
+    header.timestamp_ms = info.timestamp_ms;
+    writer.write(header, payload);
+    payloads.insert(payloads.end(), payload, payload + length);
+    lengths.push_back((uint32_t)length);
+  }
+  uint64_t segment_bytes = writer.getOffset();
+  if (!writer.close()) {
+    fprintf(stderr, "cannot write %s\n", segment.c_str());
+    return 1;
+  }
+  printf("payloads=%llu segment=%.1f MB\n", (unsigned long long)count,
+         segment_bytes / 1e6);
+
+  // In memory, one thread
+  FleetAnalyzer analyzer;
+  uint64_t offset = 0;
+  uint64_t start = benchNowNs();
+  for (uint64_t i = 0; i < count; i++) {
+    analyzer.addPayload(&payloads[offset], lengths[i]);
+    offset += lengths[i];
+  }
+  double seconds = (benchNowNs() - start) / 1e9;
+  benchDoNotOptimize(analyzer.getTotals().payload_bytes);
+  printf("in memory: payloads/s=%.0f readings/s=%.0f\n", count / seconds,
+         analyzer.getTotals().readings / seconds);
+
+  // Segment, by thread count
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+    FleetScanConfig config = defaultFleetScanConfig();
+    config.threads = threads;
+    config.chunk_bytes = 8ULL << 20;
+    FleetAnalyzer result;
+    FleetScanStats stats;
+    start = benchNowNs();
+    bool ok = analyzeArchiveFiles(std::vector<std::string>(1, segment), config,
+                                  &result, &stats);
+    seconds = (benchNowNs() - start) / 1e9;
+    if (!ok) {
+      fprintf(stderr, "analysis failed\n");
+      remove(segment.c_str());
+      return 1;
+    }
+    printf("segment threads=%u records/s=%.0f MB/s=%.0f\n", threads,
+           stats.records / seconds, stats.input_bytes / seconds / 1e6);
+  }
+  remove(segment.c_str());
+  return 0;
+}
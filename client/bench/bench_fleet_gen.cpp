@@ -0,0 +1,80 @@
+// Fleet traffic generator benchmark.
+//
+// Usage: bench_fleet_gen [devices] [payloads_per_device] [max_threads]
+//
+// Generates the same payloads with 1, 2, 4, ... max_threads threads, each
+// owning a contiguous range of devices, and reports payloads/s, readings/s
+// and the payload bytes produced. Payloads are encoded and discarded.
+
+#include "bench_util.h"
+#include "fleet_generator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+static void generateRange(FleetGenerator *generator, uint32_t first,
+                          uint32_t end, uint32_t count, uint64_t *readings,
+                          uint64_t *bytes) {
+  uint8_t buffer[MAX_PAYLOAD_SIZE];
+  uint64_t reading_total = 0, byte_total = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    for (uint32_t d = first; d < end; d++) {
+      FleetPayloadInfo info;
+      int32_t length = generator->generate(d, buffer, sizeof(buffer), &info);
+      benchDoNotOptimize(buffer[0]);
+      reading_total += info.reading_count;
+      byte_total += (uint32_t)length;
+    }
+  }
+  *readings = reading_total;
+  *bytes = byte_total;
+}
+
+int main(int argc, char **argv) {
+  uint32_t devices = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 100000;
+  uint32_t count = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 20;
+  uint32_t max_threads = argc > 3 ? (uint32_t)strtoul(argv[3], nullptr, 10)
+                                  : std::thread::hardware_concurrency();
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  FleetConfig config;
+  initFleetConfig(config);
+  config.devices = devices;
+
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+    // Fresh devices each round, so every thread count does the same work
+    FleetGenerator generator;
+    if (!generator.init(config)) {
+      fprintf(stderr, "invalid configuration\n");
+      return 1;
+    }
+    std::vector<uint64_t> readings(threads), bytes(threads);
+    uint64_t start = benchNowNs();
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++) {
+      workers.push_back(std::thread(
+          generateRange, &generator, (uint32_t)((uint64_t)devices * t / threads),
+          (uint32_t)((uint64_t)devices * (t + 1) / threads), count,
+          &readings[t], &bytes[t]));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+      workers[t].join();
+    }
+    double seconds = (benchNowNs() - start) / 1e9;
+
+    uint64_t payloads = (uint64_t)devices * count;
+    uint64_t reading_total = 0, byte_total = 0;
+    for (uint32_t t = 0; t < threads; t++) {
+      reading_total += readings[t];
+      byte_total += bytes[t];
+    }
+    printf("threads=%u payloads=%llu payloads/s=%.0f readings/s=%.0f "
+           "avg_bytes=%.1f\n",
+           threads, (unsigned long long)payloads, payloads / seconds,
+           reading_total / seconds, (double)byte_total / payloads);
+  }
+  return 0;
+}
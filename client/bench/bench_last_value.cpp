@@ -0,0 +1,125 @@
+// Last-value cache benchmark.
+//
+// Usage: bench_last_value [devices] [writers] [readers] [seconds]
+//
+// Fills the cache, then measures getLatest() alone, update() alone, and
+// writers and readers running together for the given time (readers pick
+// random devices, as dashboard polls do). Reports operations/s and how
+// often a read had to retry because a write overlapped it.
+
+#include "bench_util.h"
+#include "last_value_cache.h"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+static SensorReading makeReading(uint64_t value) {
+  SensorReading reading;
+  memset(&reading, 0, sizeof(reading));
+  reading.presence_mask = 0x040003FFu;
+  reading.co2 = (uint16_t)value;
+  reading.pm_25[0] = (uint16_t)(value * 3);
+  return reading;
+}
+
+static inline uint64_t nextRandom(uint64_t &state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+typedef struct {
+  LastValueCache *cache;
+  uint32_t devices;
+  std::atomic<bool> *stop;
+  uint64_t operations;
+  uint64_t seed;
+} Worker;
+
+static void writeLoop(Worker *worker) {
+  uint64_t t = 1000000;
+  uint64_t state = worker->seed;
+  SensorReading reading = makeReading(worker->seed);
+  while (!worker->stop->load(std::memory_order_relaxed)) {
+    for (int i = 0; i < 256; i++) {
+      worker->cache->update(nextRandom(state) % worker->devices, t++, reading);
+    }
+    worker->operations += 256;
+  }
+}
+
+static void readLoop(Worker *worker) {
+  uint64_t state = worker->seed;
+  LastValue value;
+  uint64_t found = 0;
+  while (!worker->stop->load(std::memory_order_relaxed)) {
+    for (int i = 0; i < 256; i++) {
+      found += worker->cache->getLatest(nextRandom(state) % worker->devices,
+                                        &value);
+    }
+    worker->operations += 256;
+  }
+  benchDoNotOptimize(found);
+}
+
+// Run writers and readers for seconds; prints their rates
+static void run(LastValueCache &cache, uint32_t devices, uint32_t writers,
+                uint32_t readers, double seconds) {
+  std::atomic<bool> stop(false);
+  std::vector<Worker> workers(writers + readers);
+  std::vector<std::thread> threads;
+  uint64_t retries = cache.getStats().read_retries;
+  uint64_t start = benchNowNs();
+  for (uint32_t i = 0; i < workers.size(); i++) {
+    Worker worker = {&cache, devices, &stop, 0, 0x9E3779B97F4A7C15ull + i};
+    workers[i] = worker;
+    threads.push_back(std::thread(i < writers ? writeLoop : readLoop,
+                                  &workers[i]));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds((int)(seconds * 1000)));
+  stop.store(true);
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  double elapsed = (benchNowNs() - start) / 1e9;
+
+  uint64_t writes = 0;
+  uint64_t reads = 0;
+  for (uint32_t i = 0; i < workers.size(); i++) {
+    (i < writers ? writes : reads) += workers[i].operations;
+  }
+  retries = cache.getStats().read_retries - retries;
+  printf("%8u %8u %14.0f %14.0f %10.4f%%\n", writers, readers,
+         writes / elapsed, reads / elapsed,
+         reads > 0 ? 100.0 * retries / reads : 0.0);
+}
+
+int main(int argc, char **argv) {
+  uint32_t devices = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 65536;
+  uint32_t writers = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 1;
+  uint32_t readers = argc > 3 ? (uint32_t)strtoul(argv[3], nullptr, 10) : 1;
+  double seconds = argc > 4 ? atof(argv[4]) : 1.0;
+
+  LastValueCache cache;
+  LastValueConfig config = LastValueCache::defaultConfig();
+  config.max_devices = devices;
+  if (!cache.init(config)) {
+    fprintf(stderr, "invalid configuration\n");
+    return 1;
+  }
+  for (uint32_t device = 0; device < devices; device++) {
+    cache.update(device, 1, makeReading(device));
+  }
+  printf("devices=%u history=%u memory=%.1f MB\n", devices,
+         config.history_length, cache.getMemoryUsage() / 1e6);
+  printf("%8s %8s %14s %14s %11s\n", "writers", "readers", "writes/s",
+         "reads/s", "retries");
+  run(cache, devices, 0, readers > 0 ? readers : 1, seconds);
+  run(cache, devices, writers > 0 ? writers : 1, 0, seconds);
+  run(cache, devices, writers, readers, seconds);
+  return 0;
+}
@@ -0,0 +1,119 @@
+// Legacy text transcoder benchmark.
+//
+// Usage: bench_legacy [payloads] [max_threads] [directory]
+//
+// Formats fleet-generator payloads as a legacy text archive, then reports
+// records/s for transcoding lines in memory on one thread and for
+// transcodeLegacyFiles() with 1, 2, 4, ... threads, writing archive segments
+// only and archive segments plus rollups.
+
+#include "bench_util.h"
+#include "fleet_generator.h"
+#include "legacy_transcoder.h"
+#include "payload_decoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+  uint64_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+  uint32_t max_threads = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10)
+                                  : std::thread::hardware_concurrency();
+  std::string directory = argc > 3 ? argv[3] : ".";
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  FleetConfig fleet;
+  initFleetConfig(fleet);
+  fleet.devices = 10000;
+  FleetGenerator generator;
+  generator.init(fleet);
+  LegacyLayout layout;
+  initLegacyLayout(layout);
+
+  // Legacy archive text, and where each payload starts and ends in it
+  std::string text;
+  std::vector<uint64_t> starts, ends;
+  PayloadDecoder decoder;
+  uint8_t payload[MAX_PAYLOAD_SIZE];
+  SensorReading readings[MAX_BATCH_SIZE];
+  char prefix[48];
+  for (uint64_t i = 0; i < count; i++) {
+    FleetPayloadInfo info;
+    int32_t length = generator.generate((uint32_t)(i % fleet.devices), payload,
+                                        sizeof(payload), &info);
+    int32_t readings_count = decoder.decode(payload, (uint32_t)length);
+    for (int32_t r = 0; r < readings_count; r++) {
+      readings[r] = decoder.getReading((uint8_t)r);
+    }
+    snprintf(prefix, sizeof(prefix), "%llu %llu ",
+             (unsigned long long)info.device_id,
+             (unsigned long long)info.timestamp_ms);
+    text += prefix;
+    starts.push_back(text.size());
+    formatLegacyPayload(decoder.getHeader(), readings, (uint32_t)readings_count,
+                        layout, &text);
+    ends.push_back(text.size());
+    text += '\n';
+  }
+
+  std::string input = directory + "/bench_legacy_input.txt";
+  FILE *file = fopen(input.c_str(), "w");
+  if (file == nullptr ||
+      fwrite(text.data(), 1, text.size(), file) != text.size() ||
+      fclose(file) != 0) {
+    fprintf(stderr, "cannot write %s\n", input.c_str());
+    return 1;
+  }
+  printf("payloads=%llu text=%.1f MB (%.0f bytes/payload)\n",
+         (unsigned long long)count, text.size() / 1e6,
+         (double)text.size() / count);
+
+  // In memory, one thread
+  LegacyTranscoder transcoder;
+  uint64_t bytes = 0;
+  uint64_t start = benchNowNs();
+  for (uint64_t i = 0; i < count; i++) {
+    uint32_t length = (uint32_t)(ends[i] - starts[i]);
+    int32_t written = transcoder.transcode(text.data() + starts[i], length,
+                                           payload, sizeof(payload));
+    benchDoNotOptimize(payload[0]);
+    bytes += (uint32_t)written;
+  }
+  double seconds = (benchNowNs() - start) / 1e9;
+  printf("in memory: records/s=%.0f text MB/s=%.0f binary=%.1f MB\n",
+         count / seconds, text.size() / seconds / 1e6, bytes / 1e6);
+
+  // Files, by thread count
+  std::string output = directory + "/bench_legacy_out";
+  for (int rollup = 0; rollup < 2; rollup++) {
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+      LegacyBulkConfig config = defaultLegacyBulkConfig();
+      config.threads = threads;
+      config.write_rollup = rollup != 0;
+      LegacyBulkStats stats;
+      std::vector<std::string> outputs;
+      start = benchNowNs();
+      bool ok = transcodeLegacyFiles(std::vector<std::string>(1, input),
+                                     output.c_str(), config, &stats, &outputs);
+      seconds = (benchNowNs() - start) / 1e9;
+      for (size_t i = 0; i < outputs.size(); i++) {
+        remove(outputs[i].c_str());
+      }
+      if (!ok) {
+        fprintf(stderr, "transcoding failed\n");
+        remove(input.c_str());
+        return 1;
+      }
+      printf("%s threads=%u records/s=%.0f readings/s=%.0f malformed=%llu\n",
+             rollup ? "archive+rollup" : "archive", threads,
+             stats.payloads / seconds, stats.readings / seconds,
+             (unsigned long long)stats.malformed);
+    }
+  }
+  remove(input.c_str());
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Structural index benchmark.
+//
+// Usage: bench_payload_index [payloads] [passes]
+//
+// Payloads hold MAX_BATCH_SIZE readings with a few different masks (half
+// in dual mode). Reports the index pass alone, then the cost of getting the
+// last reading of each payload (or just its PM2.5 value) by a full decode
+// and through the index.
+
+#include "bench_util.h"
+#include "decode_plan.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+#include "payload_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const uint32_t kOptional[4] = {
+    0, FLAG_BIT(FLAG_PM_03_PC), FLAG_BIT(FLAG_VBAT) | FLAG_BIT(FLAG_VPANEL),
+    0x01E00000u | FLAG_BIT(FLAG_AFE_TEMP)};
+
+static std::vector<uint8_t> makePayload(uint32_t seed) {
+  PayloadEncoder encoder;
+  PayloadHeader header = {1, (seed & 1) != 0, false, 5};
+  encoder.init(header);
+  for (uint32_t i = 0; i < MAX_BATCH_SIZE; i++) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    // Typical fields always, one of a few optional groups now and then
+    reading.presence_mask = 0x040003FFu | kOptional[(seed + i / 4) % 4];
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+      setSensorFieldValue(reading, (SensorFlag)flag, 0, (seed + flag + i) % 3000);
+      setSensorFieldValue(reading, (SensorFlag)flag, 1, (seed + flag) % 3000);
+    }
+    encoder.addReading(reading);
+  }
+  std::vector<uint8_t> payload(MAX_PAYLOAD_SIZE);
+  payload.resize((size_t)encoder.encode(payload.data(), payload.size()));
+  return payload;
+}
+
+static void printRow(const char *label, uint64_t payloads, uint64_t bytes,
+                     uint64_t elapsed_ns) {
+  double seconds = elapsed_ns / 1e9;
+  printf("%24s %12.0f %10.2f %10.1f\n", label, payloads / seconds,
+         bytes / seconds / 1e9, (double)elapsed_ns / payloads);
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 10000;
+  uint32_t passes = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 50;
+
+  std::vector<std::vector<uint8_t> > payloads;
+  uint64_t input_bytes = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    payloads.push_back(makePayload(i));
+    input_bytes += payloads.back().size();
+  }
+  uint64_t total = (uint64_t)count * passes;
+  printf("payloads=%u readings/payload=%d passes=%u\n", count, MAX_BATCH_SIZE,
+         passes);
+  printf("%24s %12s %10s %10s\n", "operation", "payloads/s", "GB/s",
+         "ns/payload");
+
+  PayloadIndex index;
+  uint64_t start = benchNowNs();
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (uint32_t i = 0; i < count; i++) {
+      indexPayload(payloads[i].data(), (uint32_t)payloads[i].size(), index);
+      benchDoNotOptimize(index.offsets[MAX_BATCH_SIZE]);
+    }
+  }
+  printRow("index", total, input_bytes * passes, benchNowNs() - start);
+
+  PayloadDecoder decoder;
+  start = benchNowNs();
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (uint32_t i = 0; i < count; i++) {
+      decoder.decode(payloads[i].data(), (uint32_t)payloads[i].size());
+      benchDoNotOptimize(decoder.getReading(MAX_BATCH_SIZE - 1).presence_mask);
+    }
+  }
+  printRow("last reading: decode all", total, input_bytes * passes,
+           benchNowNs() - start);
+
+  DecodePlanCache plans;
+  SensorReading reading;
+  start = benchNowNs();
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (uint32_t i = 0; i < count; i++) {
+      indexPayload(payloads[i].data(), (uint32_t)payloads[i].size(), index);
+      decodeIndexedReading(payloads[i].data(), index, MAX_BATCH_SIZE - 1,
+                           reading, &plans);
+      benchDoNotOptimize(reading.presence_mask);
+    }
+  }
+  printRow("last reading: indexed", total, input_bytes * passes,
+           benchNowNs() - start);
+
+  int64_t value = 0;
+  start = benchNowNs();
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (uint32_t i = 0; i < count; i++) {
+      indexPayload(payloads[i].data(), (uint32_t)payloads[i].size(), index);
+      readIndexedField(payloads[i].data(), index, MAX_BATCH_SIZE - 1,
+                       FLAG_PM_25, 0, &value);
+      benchDoNotOptimize(value);
+    }
+  }
+  printRow("last pm25: indexed", total, input_bytes * passes,
+           benchNowNs() - start);
+  return 0;
+}
@@ -0,0 +1,175 @@
+// Offline payload queue: enqueue cost, drain throughput and mount time.
+//
+// Usage: bench_payload_queue [payloads] [burst_bytes] [program_size]
+//
+// The queue runs on a RAM-backed flash region with 4 KB sectors, sized to
+// hold every payload, so the numbers are the queue's own CPU cost without
+// flash timing. Payloads are 40-400 bytes, like batches of 2-20 readings.
+// Reports enqueue latency percentiles and the bytes programmed per payload
+// (headers, CRCs and padding included), then drains the queue in bursts of
+// burst_bytes with a commit per burst, then mounts the full region again.
+// A last pass keeps enqueueing into the full ring, where every new sector
+// overwrites the oldest one.
+
+#include "bench_util.h"
+#include "payload_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static const uint32_t kSectorSize = 4096;
+
+typedef struct {
+  std::vector<uint8_t> bytes;
+} RamFlash;
+
+static bool ramRead(void *context, uint32_t address, uint8_t *data,
+                    uint32_t length) {
+  RamFlash *flash = (RamFlash *)context;
+  memcpy(data, &flash->bytes[address], length);
+  return true;
+}
+
+static bool ramProgram(void *context, uint32_t address, const uint8_t *data,
+                       uint32_t length) {
+  RamFlash *flash = (RamFlash *)context;
+  for (uint32_t i = 0; i < length; i++) {
+    flash->bytes[address + i] &= data[i];
+  }
+  return true;
+}
+
+static bool ramErase(void *context, uint32_t sector) {
+  RamFlash *flash = (RamFlash *)context;
+  memset(&flash->bytes[sector * kSectorSize], 0xFF, kSectorSize);
+  return true;
+}
+
+static void report(const char *name, std::vector<uint64_t> &samples) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    total += samples[i];
+  }
+  printf("%-20s mean %6.0f ns  p50 %6llu ns  p99 %6llu ns  max %7llu ns\n",
+         name, samples.empty() ? 0.0 : (double)total / samples.size(),
+         (unsigned long long)benchPercentile(samples, 50),
+         (unsigned long long)benchPercentile(samples, 99),
+         (unsigned long long)benchPercentile(samples, 100));
+}
+
+int main(int argc, char **argv) {
+  uint32_t payload_count = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+  uint32_t burst_size = argc > 2 ? (uint32_t)atoi(argv[2]) : 4096;
+  uint32_t program_size = argc > 3 ? (uint32_t)atoi(argv[3]) : 16;
+
+  std::vector<std::vector<uint8_t> > payloads(payload_count);
+  uint64_t payload_bytes = 0;
+  srand(1);
+  for (uint32_t i = 0; i < payload_count; i++) {
+    payloads[i].resize(40 + rand() % 361);
+    for (size_t b = 0; b < payloads[i].size(); b++) {
+      payloads[i][b] = (uint8_t)rand();
+    }
+    payloads[i][0] = 0x01;
+    payloads[i][1] = 0x05;
+    payload_bytes += payloads[i].size();
+  }
+
+  // Room for all payloads with their records and padding, and a spare sector
+  uint32_t sector_count =
+      (uint32_t)((payload_bytes + payload_count * 48) / (kSectorSize - 256) + 2);
+  RamFlash ram;
+  ram.bytes.assign((size_t)sector_count * kSectorSize, 0xFF);
+  FlashRegion region;
+  region.sector_size = kSectorSize;
+  region.sector_count = sector_count;
+  region.program_size = program_size;
+  region.read = ramRead;
+  region.program = ramProgram;
+  region.erase = ramErase;
+  region.context = &ram;
+
+  PayloadQueue queue;
+  if (!queue.mount(region)) {
+    fprintf(stderr, "invalid geometry\n");
+    return 1;
+  }
+  printf("%u payloads, %llu bytes, %u sectors of %u bytes, program unit %u\n",
+         payload_count, (unsigned long long)payload_bytes, sector_count,
+         kSectorSize, program_size);
+
+  std::vector<uint64_t> samples;
+  samples.reserve(payload_count);
+  for (uint32_t i = 0; i < payload_count; i++) {
+    uint64_t begin = benchNowNs();
+    bool ok = queue.enqueue(payloads[i].data(), (uint32_t)payloads[i].size());
+    samples.push_back(benchNowNs() - begin);
+    if (!ok) {
+      fprintf(stderr, "enqueue failed\n");
+      return 1;
+    }
+  }
+  report("enqueue", samples);
+  const PayloadQueueStats &stats = queue.getStats();
+  printf("programmed %.1f bytes/payload (%.1f%% over the payload), "
+         "%llu erases, %llu dropped\n",
+         (double)stats.bytes_programmed / payload_count,
+         100.0 * ((double)stats.bytes_programmed - payload_bytes) /
+             payload_bytes,
+         (unsigned long long)stats.erases,
+         (unsigned long long)stats.dropped);
+
+  uint64_t begin = benchNowNs();
+  PayloadQueue mounted;
+  mounted.mount(region);
+  uint64_t mount_ns = benchNowNs() - begin;
+  printf("mount                %.2f ms for %u pending\n", mount_ns / 1e6,
+         mounted.pendingCount());
+
+  std::vector<uint8_t> burst(burst_size);
+  uint64_t drained_bytes = 0;
+  uint32_t drained = 0, bursts = 0;
+  samples.clear();
+  begin = benchNowNs();
+  for (;;) {
+    uint32_t count;
+    int32_t size = mounted.drain(burst.data(), burst_size, &count);
+    if (size <= 0) {
+      if (size < 0) {
+        fprintf(stderr, "burst of %u bytes too small\n", burst_size);
+        return 1;
+      }
+      break;
+    }
+    benchDoNotOptimize(burst[0]);
+    uint64_t commit = benchNowNs();
+    mounted.commitDrain();
+    samples.push_back(benchNowNs() - commit);
+    drained_bytes += (uint32_t)size;
+    drained += count;
+    bursts++;
+  }
+  uint64_t drain_ns = benchNowNs() - begin;
+  printf("drain                %.1f MB/s, %u payloads in %u bursts of up to "
+         "%u bytes (%.1f payloads/burst)\n",
+         drained_bytes / (drain_ns / 1e9) / 1e6, drained, bursts, burst_size,
+         bursts ? (double)drained / bursts : 0.0);
+  report("commit", samples);
+
+  // Full ring: every sector opened erases and scans the oldest one
+  for (uint32_t i = 0; i < payload_count; i++) {
+    mounted.enqueue(payloads[i].data(), (uint32_t)payloads[i].size());
+  }
+  samples.clear();
+  for (uint32_t i = 0; i < payload_count; i++) {
+    begin = benchNowNs();
+    mounted.enqueue(payloads[i].data(), (uint32_t)payloads[i].size());
+    samples.push_back(benchNowNs() - begin);
+  }
+  report("enqueue (full ring)", samples);
+  printf("dropped %llu of %llu\n",
+         (unsigned long long)mounted.getStats().dropped,
+         (unsigned long long)mounted.getStats().enqueued);
+  return 0;
+}
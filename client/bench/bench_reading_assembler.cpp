@@ -0,0 +1,132 @@
+// Reading assembly from several sensor tasks: lock-free against a mutex.
+//
+// Usage: bench_reading_assembler [parts_per_task] [tasks] [commit_us]
+//
+// Each task contributes parts of 3-4 fields to the shared reading as fast as
+// it can while a commit thread closes a reading every commit_us. The mutex
+// mode runs the same ReadingAssembler with every call under one mutex, so
+// only the synchronization differs. Reports parts/s over all tasks and the
+// contribute() latency percentiles.
+
+#include "bench_util.h"
+#include "reading_assembler.h"
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+// Fields of each task's part, like the PM, gas and electrochemical sensors
+static SensorReading taskPart(uint32_t task, uint32_t i) {
+  SensorReading part;
+  initSensorReading(&part);
+  switch (task % 3) {
+  case 0:
+    setFlag(&part, FLAG_PM_01);
+    setFlag(&part, FLAG_PM_25);
+    setFlag(&part, FLAG_PM_10);
+    setFlag(&part, FLAG_PM_03_PC);
+    part.pm_01[0] = part.pm_25[0] = part.pm_10[0] = (uint16_t)i;
+    part.pm_03_pc[0] = (uint16_t)(i * 3);
+    break;
+  case 1:
+    setFlag(&part, FLAG_CO2);
+    setFlag(&part, FLAG_TVOC);
+    setFlag(&part, FLAG_NOX);
+    part.co2 = part.tvoc = part.nox = (uint16_t)i;
+    break;
+  default:
+    setFlag(&part, FLAG_O3_WE);
+    setFlag(&part, FLAG_O3_AE);
+    setFlag(&part, FLAG_NO2_WE);
+    setFlag(&part, FLAG_NO2_AE);
+    part.o3_we = part.o3_ae = part.no2_we = part.no2_ae = i;
+    break;
+  }
+  return part;
+}
+
+static void run(const char *name, bool locked, uint32_t parts,
+                uint32_t task_count, uint64_t commit_us) {
+  ReadingAssembler assembler;
+  std::mutex mutex;
+  std::atomic<uint32_t> running(task_count);
+  std::vector<std::vector<uint64_t> > latencies(task_count);
+  std::vector<std::thread> tasks;
+
+  uint64_t start = benchNowNs();
+  for (uint32_t t = 0; t < task_count; t++) {
+    tasks.push_back(std::thread([&, t]() {
+      std::vector<uint64_t> &samples = latencies[t];
+      samples.reserve(parts / 16 + 1);
+      for (uint32_t i = 0; i < parts; i++) {
+        SensorReading part = taskPart(t, i);
+        bool timed = (i & 15) == 0; // Timing every call would dominate
+        uint64_t begin = timed ? benchNowNs() : 0;
+        if (locked) {
+          std::lock_guard<std::mutex> lock(mutex);
+          assembler.contribute(part);
+        } else {
+          assembler.contribute(part);
+        }
+        if (timed) {
+          samples.push_back(benchNowNs() - begin);
+        }
+      }
+      running.fetch_sub(1);
+    }));
+  }
+
+  uint64_t readings = 0, retries = 0;
+  while (running.load() != 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(commit_us));
+    SensorReading reading;
+    int32_t result;
+    do {
+      if (locked) {
+        std::lock_guard<std::mutex> lock(mutex);
+        result = assembler.commit(&reading);
+      } else {
+        result = assembler.commit(&reading);
+      }
+      if (result < 0) {
+        retries++;
+        std::this_thread::yield(); // Let the contribution finish
+      }
+    } while (result < 0);
+    readings += (uint64_t)result;
+  }
+  for (uint32_t t = 0; t < task_count; t++) {
+    tasks[t].join();
+  }
+  uint64_t elapsed = benchNowNs() - start;
+
+  std::vector<uint64_t> all;
+  for (uint32_t t = 0; t < task_count; t++) {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+  }
+  double total = (double)parts * task_count;
+  printf("%-9s parts/s=%.0f contribute p50=%lluns p99=%lluns p99.99=%lluns "
+         "readings=%llu commit_retries=%llu\n",
+         name, total / (elapsed / 1e9),
+         (unsigned long long)benchPercentile(all, 50),
+         (unsigned long long)benchPercentile(all, 99),
+         (unsigned long long)benchPercentile(all, 99.99),
+         (unsigned long long)readings, (unsigned long long)retries);
+}
+
+int main(int argc, char **argv) {
+  uint32_t parts = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 2000000;
+  uint32_t task_count = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 3;
+  uint64_t commit_us = argc > 3 ? strtoull(argv[3], nullptr, 10) : 100;
+  if (task_count == 0) {
+    task_count = 1;
+  }
+
+  printf("tasks=%u parts_per_task=%u commit_us=%llu hardware_threads=%u\n",
+         task_count, parts, (unsigned long long)commit_us,
+         std::thread::hardware_concurrency());
+  run("mutex", true, parts, task_count, commit_us);
+  run("lock-free", false, parts, task_count, commit_us);
+  return 0;
+}
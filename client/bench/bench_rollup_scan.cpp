@@ -0,0 +1,95 @@
+// Columnar rollup predicate scan benchmark.
+//
+// Usage: bench_rollup_scan [rows] [file]
+//
+// Writes a rollup file of synthetic readings, then times range scans over
+// 16-bit (pm25, co2) and 32-bit (o3_we) columns with the AVX2 and scalar
+// kernels. Throughput is packed column bytes per second.
+
+#include "bench_util.h"
+#include "rollup_scan.h"
+#include "rollup_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void runScan(const RollupReader &reader, const char *label,
+                    const RollupPredicate &predicate, bool scalar) {
+  rollupForceScalar(scalar);
+
+  const int kRepetitions = 7;
+  std::vector<uint64_t> samples;
+  RollupScanStats stats;
+  uint64_t matched = 0;
+  for (int r = 0; r < kRepetitions; r++) {
+    uint64_t start = benchNowNs();
+    matched = rollupScan(reader, &predicate, 1, nullptr, nullptr, &stats);
+    samples.push_back(benchNowNs() - start);
+  }
+  uint64_t median = benchPercentile(samples, 50);
+
+  printf("%-18s %-7s %12llu %10.1f %10.3f %10.2f\n", label,
+         scalar ? "scalar" : "avx2", (unsigned long long)matched,
+         stats.bytes_scanned / 1e6, median / 1e6,
+         stats.bytes_scanned / (median / 1e9) / 1e9);
+}
+
+int main(int argc, char **argv) {
+  uint64_t rows = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000000ULL;
+  const char *path = argc > 2 ? argv[2] : "bench_rollup.agr";
+
+  RollupWriter writer;
+  if (!writer.open(path)) {
+    fprintf(stderr, "cannot create %s\n", path);
+    return 1;
+  }
+
+  uint64_t seed = 88172645463325252ULL;
+  for (uint64_t i = 0; i < rows; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_PM_25);
+    setFlag(&reading, FLAG_CO2);
+    reading.pm_25[0] = (uint16_t)(seed % 5000);
+    reading.co2 = (uint16_t)(400 + (seed >> 16) % 2000);
+    if ((seed >> 40) % 4 == 0) {
+      setFlag(&reading, FLAG_O3_WE);
+      reading.o3_we = (uint32_t)(seed >> 8) % 5000000;
+    }
+    writer.addReading(i % 100000, 1700000000000ULL + i * 1000, reading);
+  }
+  if (!writer.close()) {
+    fprintf(stderr, "write failed\n");
+    return 1;
+  }
+
+  RollupReader reader;
+  if (!reader.open(path)) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+
+  printf("rows=%llu file=%.1f MB avx2=%s\n", (unsigned long long)rows,
+         reader.getMappedSize() / 1e6, rollupHaveAvx2() ? "yes" : "no");
+  printf("%-18s %-7s %12s %10s %10s %10s\n", "predicate", "kernel", "matched",
+         "MB", "median_ms", "GB/s");
+
+  RollupPredicate pm = {ROLLUP_COLUMN_FIELD(FLAG_PM_25), 351, INT64_MAX};
+  RollupPredicate co2 = {ROLLUP_COLUMN_FIELD(FLAG_CO2), 1000, 1500};
+  RollupPredicate o3 = {ROLLUP_COLUMN_FIELD(FLAG_O3_WE), 1000000, 2000000};
+
+  for (int scalar = 0; scalar <= 1; scalar++) {
+    runScan(reader, "pm25 > 35.0", pm, scalar == 1);
+    runScan(reader, "co2 in [1000,1500]", co2, scalar == 1);
+    runScan(reader, "o3_we in [1e6,2e6]", o3, scalar == 1);
+  }
+
+  reader.close();
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,101 @@
+// Stream decoder benchmark.
+//
+// Usage: bench_stream [payloads] [passes]
+//
+// Frames a set of payloads (1-10 readings of typical fields, half in dual
+// mode) into one byte stream and feeds it in chunks of 1 byte (a serial
+// link read byte by byte), 64 bytes, 1460 bytes (one TCP segment) and
+// 64 KB. A last run flips one random bit per 10 KB to show resync: frames
+// recovered versus frames sent.
+
+#include "bench_util.h"
+#include "decode_plan.h"
+#include "payload_encoder.h"
+#include "payload_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static std::vector<uint8_t> makePayload(uint32_t seed) {
+  PayloadEncoder encoder;
+  PayloadHeader header = {1, (seed & 1) != 0, false, 5};
+  encoder.init(header);
+  for (uint32_t i = 0; i < 1 + seed % 10; i++) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    reading.presence_mask = 0x040003FFu;
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+      setSensorFieldValue(reading, (SensorFlag)flag, 0, (seed + flag + i) % 3000);
+      setSensorFieldValue(reading, (SensorFlag)flag, 1, (seed + flag) % 3000);
+    }
+    encoder.addReading(reading);
+  }
+  std::vector<uint8_t> payload(MAX_PAYLOAD_SIZE);
+  payload.resize((size_t)encoder.encode(payload.data(), payload.size()));
+  return payload;
+}
+
+static void countReading(const PayloadHeader &, uint8_t, const SensorReading &,
+                         void *user) {
+  ++*(uint64_t *)user;
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 20000;
+  uint32_t passes = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 20;
+
+  std::vector<uint8_t> stream;
+  for (uint32_t i = 0; i < count; i++) {
+    std::vector<uint8_t> payload = makePayload(i);
+    size_t start = stream.size();
+    stream.resize(start + payload.size() + STREAM_FRAME_OVERHEAD);
+    writeStreamFrame(&stream[start], payload.data(), (uint32_t)payload.size());
+  }
+  printf("frames=%u stream=%.1f MB passes=%u\n", count, stream.size() / 1e6,
+         passes);
+  printf("%10s %10s %14s\n", "chunk", "MB/s", "readings/s");
+
+  DecodePlanCache plans;
+  const uint32_t chunks[4] = {1, 64, 1460, 65536};
+  for (int c = 0; c < 4; c++) {
+    uint64_t readings = 0;
+    StreamDecoder decoder;
+    decoder.setCallbacks(countReading, nullptr, &readings);
+    decoder.setPlanCache(&plans);
+    uint32_t chunk_passes = chunks[c] == 1 ? (passes + 9) / 10 : passes;
+    uint64_t start = benchNowNs();
+    for (uint32_t pass = 0; pass < chunk_passes; pass++) {
+      for (size_t offset = 0; offset < stream.size(); offset += chunks[c]) {
+        size_t size = stream.size() - offset;
+        decoder.feed(&stream[offset],
+                     (uint32_t)(size < chunks[c] ? size : chunks[c]));
+      }
+    }
+    double seconds = (benchNowNs() - start) / 1e9;
+    printf("%10u %10.1f %14.0f\n", chunks[c],
+           stream.size() * (double)chunk_passes / seconds / 1e6,
+           readings / seconds);
+  }
+
+  // Corruption: one flipped bit per 10 KB
+  std::vector<uint8_t> damaged = stream;
+  srand(35);
+  for (size_t offset = 0; offset + 10000 <= damaged.size(); offset += 10000) {
+    damaged[offset + (size_t)rand() % 10000] ^= (uint8_t)(1u << (rand() % 8));
+  }
+  uint64_t readings = 0;
+  StreamDecoder decoder;
+  decoder.setCallbacks(countReading, nullptr, &readings);
+  for (size_t offset = 0; offset < damaged.size(); offset += 1460) {
+    size_t size = damaged.size() - offset;
+    decoder.feed(&damaged[offset], (uint32_t)(size < 1460 ? size : 1460));
+  }
+  const StreamDecoderStats &stats = decoder.getStats();
+  uint32_t flips = (uint32_t)(damaged.size() / 10000);
+  printf("corrupted: %u bit flips, frames ok=%llu/%u crc errors=%llu "
+         "malformed=%llu skipped=%llu bytes\n",
+         flips, (unsigned long long)stats.frames, count,
+         (unsigned long long)stats.crc_errors,
+         (unsigned long long)stats.malformed,
+         (unsigned long long)stats.skipped_bytes);
+  return 0;
+}
@@ -0,0 +1,108 @@
+// Latency tracing overhead on decode throughput.
+//
+// Usage: bench_tracing [payloads] [runs]
+//
+// Decodes fleet-generator payloads with PayloadDecoder without tracing and
+// with an IngestTrace per payload (decode stage) sampling every payload,
+// 1 in 16 and 1 in 2^INGEST_DEFAULT_SAMPLE_SHIFT. Modes are interleaved run
+// by run and compared by their median. Exits 1 if the default sampling
+// costs more than 2% of throughput.
+
+#include "bench_util.h"
+#include "fleet_generator.h"
+#include "ingest_metrics.h"
+#include "payload_decoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// Sample shifts of the traced modes; -1 is no tracing
+static const int kModes[4] = {-1, 0, 4, INGEST_DEFAULT_SAMPLE_SHIFT};
+
+static uint64_t decodeAll(const std::vector<uint8_t> &payloads,
+                          const std::vector<uint32_t> &lengths,
+                          PayloadDecoder &decoder, IngestTracer *tracer) {
+  uint64_t readings = 0, offset = 0;
+  uint64_t start = benchNowNs();
+  for (size_t i = 0; i < lengths.size(); i++) {
+    if (tracer != nullptr) {
+      IngestTrace trace(tracer);
+      readings += (uint64_t)decoder.decode(&payloads[offset], lengths[i]);
+      trace.mark(INGEST_STAGE_DECODE);
+    } else {
+      readings += (uint64_t)decoder.decode(&payloads[offset], lengths[i]);
+    }
+    offset += lengths[i];
+  }
+  uint64_t elapsed = benchNowNs() - start;
+  benchDoNotOptimize(readings);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  uint64_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 500000;
+  uint32_t runs = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 15;
+  if (runs == 0) {
+    runs = 1;
+  }
+
+  FleetConfig fleet;
+  initFleetConfig(fleet);
+  fleet.devices = 10000;
+  FleetGenerator generator;
+  generator.init(fleet);
+  std::vector<uint8_t> payloads;
+  std::vector<uint32_t> lengths;
+  uint8_t payload[MAX_PAYLOAD_SIZE];
+  for (uint64_t i = 0; i < count; i++) {
+    FleetPayloadInfo info;
+    int32_t length = generator.generate((uint32_t)(i % fleet.devices), payload,
+                                        sizeof(payload), &info);
+    payloads.insert(payloads.end(), payload, payload + length);
+    lengths.push_back((uint32_t)length);
+  }
+
+  IngestMetrics metrics;
+  IngestTracer *tracers[4] = {nullptr, metrics.addTracer(kModes[1]),
+                              metrics.addTracer(kModes[2]),
+                              metrics.addTracer(kModes[3])};
+  PayloadDecoder decoder;
+  decodeAll(payloads, lengths, decoder, nullptr); // Warm up
+
+  std::vector<uint64_t> times[4];
+  for (uint32_t r = 0; r < runs; r++) {
+    for (int m = 0; m < 4; m++) {
+      times[m].push_back(decodeAll(payloads, lengths, decoder, tracers[m]));
+    }
+  }
+
+  double base = (double)benchPercentile(times[0], 50);
+  double overhead = 0;
+  for (int m = 0; m < 4; m++) {
+    double median = (double)benchPercentile(times[m], 50);
+    overhead = (median / base - 1) * 100;
+    if (kModes[m] < 0) {
+      printf("tracing off:        payloads/s=%.0f ns/payload=%.1f\n",
+             count / (median / 1e9), median / count);
+    } else {
+      printf("sampling 1 in %-5u payloads/s=%.0f ns/payload=%.1f "
+             "overhead=%+.2f%%\n",
+             1u << kModes[m], count / (median / 1e9), median / count,
+             overhead);
+    }
+  }
+
+  metrics.collect();
+  LatencyHistogram decode;
+  metrics.getStage(INGEST_STAGE_DECODE, &decode);
+  printf("decode stage: samples=%llu p50=%lluns p99=%lluns max=%lluns\n",
+         (unsigned long long)decode.getCount(),
+         (unsigned long long)decode.quantile(0.5),
+         (unsigned long long)decode.quantile(0.99),
+         (unsigned long long)decode.getMax());
+  if (overhead > 2.0) {
+    printf("default sampling overhead above 2%%\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <vector>
+
+// Monotonic clock in nanoseconds
+static inline uint64_t benchNowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Value at percentile p (0-100) of samples; sorts samples in place
+static inline uint64_t benchPercentile(std::vector<uint64_t> &samples,
+                                       double p) {
+  if (samples.empty()) {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t index = (size_t)(p / 100.0 * (samples.size() - 1) + 0.5);
+  return samples[std::min(index, samples.size() - 1)];
+}
+
+// Keep the compiler from discarding a computed value
+template <typename T> static inline void benchDoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif // BENCH_UTIL_H
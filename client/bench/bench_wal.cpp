@@ -0,0 +1,164 @@
+// Write-ahead log group commit benchmark.
+//
+// Usage: bench_wal [threads] [payloads_per_thread] [log_path]
+//
+// Runs the same load at several group windows and reports durable
+// payloads/sec and per-append commit latency percentiles. The "fsync" row is
+// the baseline: each payload gets its own write + fdatasync under a mutex.
+// Window 0 flushes as soon as the flusher is free, so groups only form from
+// records that arrive while the previous group is being synced.
+
+#include "bench_util.h"
+#include "payload_encoder.h"
+#include "payload_wal.h"
+#include <fcntl.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+
+static int32_t makeTypicalPayload(uint8_t *buffer) {
+  PayloadEncoder encoder;
+  PayloadHeader header = {1, false, false, 5};
+  encoder.init(header);
+
+  for (int i = 0; i < 5; i++) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_TEMP);
+    setFlag(&reading, FLAG_HUM);
+    setFlag(&reading, FLAG_CO2);
+    setFlag(&reading, FLAG_PM_25);
+    setFlag(&reading, FLAG_SIGNAL);
+    reading.temp[0] = 2500 + i;
+    reading.hum[0] = 5000;
+    reading.co2 = 420;
+    reading.pm_25[0] = 125;
+    reading.signal = -80;
+    encoder.addReading(reading);
+  }
+
+  return encoder.encode(buffer, MAX_PAYLOAD_SIZE);
+}
+
+static void printRow(const char *label, uint64_t records, uint64_t groups,
+                     uint64_t elapsed_ns,
+                     std::vector<std::vector<uint64_t> > &latencies) {
+  std::vector<uint64_t> all;
+  for (size_t t = 0; t < latencies.size(); t++) {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+  }
+
+  printf("%10s %12.0f %8llu %10.1f %10.1f %10.1f %10.1f\n", label,
+         records / (elapsed_ns / 1e9), (unsigned long long)groups,
+         groups ? (double)records / groups : 0.0,
+         benchPercentile(all, 50) / 1e3, benchPercentile(all, 99) / 1e3,
+         benchPercentile(all, 99.9) / 1e3);
+}
+
+// One write + fdatasync per payload, serialized by a mutex
+static int runBaseline(const char *path, int threads, int per_thread,
+                       const uint8_t *payload, int32_t payload_size) {
+  unlink(path);
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+
+  std::mutex mutex;
+  std::vector<std::vector<uint64_t> > latencies(threads);
+  std::vector<std::thread> workers;
+  uint64_t start = benchNowNs();
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(std::thread([&, t]() {
+      uint8_t record[PAYLOAD_RECORD_HEADER_SIZE + MAX_PAYLOAD_SIZE];
+      latencies[t].reserve(per_thread);
+      for (int i = 0; i < per_thread; i++) {
+        uint64_t begin = benchNowNs();
+        PayloadRecordHeader header = {(uint32_t)payload_size, 0, (uint64_t)t,
+                                      (uint64_t)i};
+        uint32_t size = writePayloadRecord(record, header, payload);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (write(fd, record, size) != (ssize_t)size || fdatasync(fd) != 0) {
+            fprintf(stderr, "write failed\n");
+          }
+        }
+        latencies[t].push_back(benchNowNs() - begin);
+      }
+    }));
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+  uint64_t elapsed = benchNowNs() - start;
+  close(fd);
+
+  uint64_t records = (uint64_t)threads * per_thread;
+  printRow("fsync", records, records, elapsed, latencies);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 16;
+  int per_thread = argc > 2 ? atoi(argv[2]) : 500;
+  const char *path = argc > 3 ? argv[3] : "bench_wal.log";
+
+  uint8_t payload[MAX_PAYLOAD_SIZE];
+  int32_t payload_size = makeTypicalPayload(payload);
+
+  const uint32_t windows_us[] = {0, 100, 500, 1000, 5000};
+
+  printf("threads=%d payloads/thread=%d payload=%d bytes sync=on\n", threads,
+         per_thread, payload_size);
+  printf("%10s %12s %8s %10s %10s %10s %10s\n", "window_us", "payloads/s",
+         "groups", "avg_group", "p50_us", "p99_us", "p999_us");
+
+  if (runBaseline(path, threads, per_thread, payload, payload_size) != 0) {
+    return 1;
+  }
+
+  for (size_t w = 0; w < sizeof(windows_us) / sizeof(windows_us[0]); w++) {
+    unlink(path);
+
+    WalConfig config = WriteAheadLog::defaultConfig();
+    config.group_window_us = windows_us[w];
+    config.group_max_records = 1024;
+
+    WriteAheadLog wal;
+    if (!wal.open(path, config)) {
+      fprintf(stderr, "cannot open %s\n", path);
+      return 1;
+    }
+
+    std::vector<std::vector<uint64_t> > latencies(threads);
+    std::vector<std::thread> workers;
+    uint64_t start = benchNowNs();
+    for (int t = 0; t < threads; t++) {
+      workers.push_back(std::thread([&, t]() {
+        latencies[t].reserve(per_thread);
+        for (int i = 0; i < per_thread; i++) {
+          uint64_t begin = benchNowNs();
+          wal.append(t, i, payload, payload_size);
+          latencies[t].push_back(benchNowNs() - begin);
+        }
+      }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+      workers[t].join();
+    }
+    uint64_t elapsed = benchNowNs() - start;
+
+    WalStats stats = wal.getStats();
+    wal.close();
+
+    char label[16];
+    snprintf(label, sizeof(label), "%u", windows_us[w]);
+    printRow(label, stats.records, stats.groups, elapsed, latencies);
+  }
+
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,166 @@
+// Text output benchmark.
+//
+// Usage: bench_writer [payloads] [passes]
+//
+// Writes a set of payloads (half single-channel with five readings of
+// typical fields, half dual-channel with one reading of all 27 fields) as
+// JSON, CSV and line protocol, clearing the output whenever it passes 1 MB
+// as a caller flushing to a socket or file would. The "snprintf" row is the
+// baseline: PayloadDecoder followed by snprintf("%g") per value, JSON only.
+
+#include "bench_util.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+#include "payload_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FLUSH_BYTES (1 << 20)
+
+static std::vector<uint8_t> makePayload(uint32_t seed) {
+  PayloadEncoder encoder;
+  bool dual = (seed & 1) != 0;
+  PayloadHeader header = {1, dual, false, 5};
+  encoder.init(header);
+
+  for (uint32_t i = 0; i < (dual ? 1u : 5u); i++) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+      bool typical = flag <= FLAG_NOX || flag == FLAG_PM_01 ||
+                     flag == FLAG_PM_25 || flag == FLAG_PM_10 ||
+                     flag == FLAG_SIGNAL;
+      if (!dual && !typical)
+        continue;
+      setFlag(&reading, (SensorFlag)flag);
+      for (uint8_t channel = 0; channel < 2; channel++) {
+        int64_t value = (seed * 2654435761u + flag * 40503u + i * 977u +
+                         channel * 131u) % 5000;
+        setSensorFieldValue(reading, (SensorFlag)flag, channel,
+                            flag == FLAG_SIGNAL ? -(value % 120) : value);
+      }
+    }
+    encoder.addReading(reading);
+  }
+
+  std::vector<uint8_t> payload(MAX_PAYLOAD_SIZE);
+  payload.resize((size_t)encoder.encode(payload.data(), payload.size()));
+  return payload;
+}
+
+// Baseline JSON writer: decode, then snprintf every token
+static size_t writeJsonSnprintf(std::vector<char> &out, size_t used,
+                                const uint8_t *payload, uint32_t length) {
+  PayloadDecoder decoder;
+  int32_t count = decoder.decode(payload, length);
+  if (count < 0)
+    return used;
+  if (out.size() < used + 64 * (size_t)length + 512)
+    out.resize(used + 64 * (size_t)length + 512);
+
+  const PayloadHeader &header = decoder.getHeader();
+  char *p = &out[used];
+  p += sprintf(p,
+               "{\"header\":{\"version\":%u,\"dualMode\":%s,"
+               "\"dedicatedTempHumSensor\":%s,\"intervalMinutes\":%u},"
+               "\"readings\":[",
+               header.version, header.dual_mode ? "true" : "false",
+               header.dedicated_temphum_sensor ? "true" : "false",
+               header.interval_minutes);
+  for (int32_t i = 0; i < count; i++) {
+    const SensorReading &reading = decoder.getReading((uint8_t)i);
+    p += sprintf(p, "%s{\"presenceMask\":%u", i ? "," : "",
+                 reading.presence_mask);
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+      if (!IS_FLAG_SET(reading.presence_mask, flag))
+        continue;
+      const SensorFieldInfo &info = kSensorFields[flag];
+      double scale = info.scale;
+      double value = getSensorFieldValue(reading, (SensorFlag)flag, 0) / scale;
+      if (header.dual_mode && decoder.isExpandable((SensorFlag)flag)) {
+        double second =
+            getSensorFieldValue(reading, (SensorFlag)flag, 1) / scale;
+        p += sprintf(p, ",\"%s\":[%.15g,%.15g]", info.name, value, second);
+      } else {
+        p += sprintf(p, ",\"%s\":%.15g", info.name, value);
+      }
+    }
+    *p++ = '}';
+  }
+  p += sprintf(p, "],\"readingCount\":%d}\n", count);
+  return (size_t)(p - &out[0]);
+}
+
+static void printRow(const char *label, uint64_t payloads, uint64_t readings,
+                     uint64_t bytes, uint64_t elapsed_ns) {
+  double seconds = elapsed_ns / 1e9;
+  printf("%14s %10.0f %12.0f %10.1f\n", label, payloads / seconds,
+         readings / seconds, bytes / seconds / 1e6);
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 10000;
+  uint32_t passes = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 50;
+
+  std::vector<std::vector<uint8_t> > payloads;
+  uint64_t input_bytes = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    payloads.push_back(makePayload(i));
+    input_bytes += payloads.back().size();
+  }
+  printf("payloads=%u passes=%u input=%.1f MB\n", count, passes,
+         input_bytes / 1e6);
+  printf("%14s %10s %12s %10s\n", "format", "payloads/s", "readings/s",
+         "out MB/s");
+
+  const OutputFormat formats[3] = {OUTPUT_JSON, OUTPUT_CSV,
+                                   OUTPUT_LINE_PROTOCOL};
+  const char *labels[3] = {"json", "csv", "line protocol"};
+  for (int f = 0; f < 3; f++) {
+    PayloadWriter writer(formats[f]);
+    uint64_t bytes = 0;
+    uint64_t readings = 0;
+    uint64_t start = benchNowNs();
+    for (uint32_t pass = 0; pass < passes; pass++) {
+      for (uint32_t i = 0; i < count; i++) {
+        readings += (uint64_t)writer.write(
+            i, 1700000000000ULL + pass, payloads[i].data(),
+            (uint32_t)payloads[i].size());
+        if (writer.size() >= FLUSH_BYTES) {
+          bytes += writer.size();
+          benchDoNotOptimize(writer.data()[writer.size() - 1]);
+          writer.clear();
+        }
+      }
+    }
+    bytes += writer.size();
+    printRow(labels[f], (uint64_t)count * passes, readings, bytes,
+             benchNowNs() - start);
+  }
+
+  // Baseline: fewer passes, it is much slower
+  uint32_t baseline_passes = passes / 10 > 0 ? passes / 10 : 1;
+  std::vector<char> out;
+  size_t used = 0;
+  uint64_t bytes = 0;
+  uint64_t start = benchNowNs();
+  for (uint32_t pass = 0; pass < baseline_passes; pass++) {
+    for (uint32_t i = 0; i < count; i++) {
+      used = writeJsonSnprintf(out, used, payloads[i].data(),
+                               (uint32_t)payloads[i].size());
+      if (used >= FLUSH_BYTES) {
+        bytes += used;
+        benchDoNotOptimize(out[used - 1]);
+        used = 0;
+      }
+    }
+  }
+  bytes += used;
+  uint64_t elapsed = benchNowNs() - start;
+  uint64_t readings = 0;
+  for (uint32_t i = 0; i < count; i++)
+    readings += (i & 1) ? 1 : 5;
+  printRow("snprintf json", (uint64_t)count * baseline_passes,
+           readings * baseline_passes, bytes, elapsed);
+  return 0;
+}
@@ -0,0 +1,244 @@
+#include "aggregator_snapshot.h"
+#include "crc32c.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+namespace {
+
+// crc32cExtend() takes 32-bit lengths
+uint32_t crcExtend(uint32_t crc, const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (length > 0) {
+    uint32_t chunk = length > (1u << 30) ? (1u << 30) : (uint32_t)length;
+    crc = crc32cExtend(crc, bytes, chunk);
+    bytes += chunk;
+    length -= chunk;
+  }
+  return crc;
+}
+
+bool writeAll(int fd, const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (length > 0) {
+    ssize_t written = ::write(fd, bytes, length);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes += written;
+    length -= (size_t)written;
+  }
+  return true;
+}
+
+bool readAll(int fd, void *data, size_t length, uint64_t offset) {
+  uint8_t *bytes = (uint8_t *)data;
+  while (length > 0) {
+    ssize_t got = ::pread(fd, bytes, length, (off_t)offset);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return false;
+    bytes += got;
+    length -= (size_t)got;
+    offset += (uint64_t)got;
+  }
+  return true;
+}
+
+int syncData(int fd) {
+#ifdef __APPLE__
+  return ::fsync(fd);
+#else
+  return ::fdatasync(fd);
+#endif
+}
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+bool DeviceAggregator::saveSnapshot(const char *path,
+                                    uint64_t wal_sequence) const {
+  if (states == nullptr) {
+    return false;
+  }
+
+  size_t table_bytes = table.size() * sizeof(Slot);
+  size_t ids_bytes = device_ids.size() * sizeof(uint64_t);
+  size_t states_bytes = state_count * sizeof(AggregateWindow);
+  uint64_t used = sizeof(AggregatorSnapshotHeader) + table_bytes + ids_bytes;
+  uint64_t states_offset = alignUp(used, AGGREGATOR_SNAPSHOT_ALIGNMENT);
+  std::vector<uint8_t> padding(states_offset - used, 0);
+
+  AggregatorSnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = AGGREGATOR_SNAPSHOT_MAGIC;
+  header.version = AGGREGATOR_SNAPSHOT_VERSION;
+  header.field_count = SENSOR_FIELD_COUNT;
+  header.window_size = sizeof(AggregateWindow);
+  header.window_count = config.window_count;
+  header.device_count = (uint32_t)device_ids.size();
+  memcpy(header.window_ms, config.window_ms, sizeof(header.window_ms));
+  header.wal_sequence = wal_sequence;
+  header.table_capacity = table.size();
+  header.states_offset = states_offset;
+
+  uint32_t crc = crcExtend(0, &header, sizeof(header));
+  crc = crcExtend(crc, table.data(), table_bytes);
+  crc = crcExtend(crc, device_ids.data(), ids_bytes);
+  crc = crcExtend(crc, padding.data(), padding.size());
+  crc = crcExtend(crc, states, states_bytes);
+  header.crc = crc;
+
+  // Write aside and rename so a crash never leaves a torn snapshot
+  std::string temp_path = std::string(path) + ".tmp";
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = writeAll(fd, &header, sizeof(header)) &&
+            writeAll(fd, table.data(), table_bytes) &&
+            writeAll(fd, device_ids.data(), ids_bytes) &&
+            writeAll(fd, padding.data(), padding.size()) &&
+            writeAll(fd, states, states_bytes) && syncData(fd) == 0;
+  ok = ::close(fd) == 0 && ok;
+  if (ok) {
+    ok = ::rename(temp_path.c_str(), path) == 0;
+  }
+  if (!ok) {
+    ::unlink(temp_path.c_str());
+  }
+  return ok;
+}
+
+bool DeviceAggregator::restoreSnapshot(const char *path,
+                                       uint64_t *wal_sequence) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  AggregatorSnapshotHeader header;
+  if (fstat(fd, &st) != 0 || !readAll(fd, &header, sizeof(header), 0)) {
+    ::close(fd);
+    return false;
+  }
+
+  // Validate the layout before trusting any size in the header
+  size_t states_bytes =
+      (size_t)header.device_count * header.window_count * sizeof(AggregateWindow);
+  uint64_t used = sizeof(AggregatorSnapshotHeader) +
+                  header.table_capacity * sizeof(Slot) +
+                  (uint64_t)header.device_count * sizeof(uint64_t);
+  bool valid = header.table_capacity <= (uint64_t)st.st_size &&
+               header.magic == AGGREGATOR_SNAPSHOT_MAGIC &&
+               header.version == AGGREGATOR_SNAPSHOT_VERSION &&
+               header.field_count == SENSOR_FIELD_COUNT &&
+               header.window_size == sizeof(AggregateWindow) &&
+               header.window_count >= 1 &&
+               header.window_count <= AGGREGATE_MAX_WINDOWS &&
+               header.table_capacity >= 16 &&
+               (header.table_capacity & (header.table_capacity - 1)) == 0 &&
+               header.table_capacity >= 2 * (uint64_t)header.device_count &&
+               header.states_offset ==
+                   alignUp(used, AGGREGATOR_SNAPSHOT_ALIGNMENT) &&
+               (uint64_t)st.st_size == header.states_offset + states_bytes;
+  for (uint32_t w = 0; valid && w < header.window_count; w++) {
+    valid = header.window_ms[w] != 0;
+  }
+  if (!valid) {
+    ::close(fd);
+    return false;
+  }
+
+  std::vector<Slot> new_table(header.table_capacity);
+  std::vector<uint64_t> new_ids(header.device_count);
+  std::vector<uint8_t> padding(header.states_offset - used);
+  uint64_t offset = sizeof(header);
+  valid = readAll(fd, new_table.data(), new_table.size() * sizeof(Slot),
+                  offset);
+  offset += new_table.size() * sizeof(Slot);
+  valid = valid && readAll(fd, new_ids.data(), new_ids.size() * sizeof(uint64_t),
+                           offset);
+  offset += new_ids.size() * sizeof(uint64_t);
+  valid = valid && readAll(fd, padding.data(), padding.size(), offset);
+
+  // Reserve room for the fleet to double, then map the file's state array
+  // copy-on-write over the start of the reservation. No MAP_POPULATE: on a
+  // writable private mapping it copies every page up front, while lazy
+  // faults share the page cache until a device's state is first written.
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t capacity = 2 * (size_t)header.device_count * header.window_count;
+  if (capacity < header.window_count)
+    capacity = header.window_count;
+  size_t bytes = alignUp(capacity * sizeof(AggregateWindow), page);
+  void *region = MAP_FAILED;
+  if (valid) {
+    region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  }
+  if (region != MAP_FAILED && states_bytes > 0) {
+    bool loaded;
+    if (header.states_offset % page == 0) {
+      loaded = mmap(region, states_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, fd,
+                    (off_t)header.states_offset) != MAP_FAILED;
+    } else {
+      // Pages larger than the alignment: read the states in instead
+      loaded = readAll(fd, region, states_bytes, header.states_offset);
+    }
+    if (!loaded) {
+      munmap(region, bytes);
+      region = MAP_FAILED;
+    }
+  }
+  ::close(fd);
+  if (region == MAP_FAILED) {
+    return false;
+  }
+
+  uint32_t stored_crc = header.crc;
+  header.crc = 0;
+  uint32_t crc = crcExtend(0, &header, sizeof(header));
+  crc = crcExtend(crc, new_table.data(), new_table.size() * sizeof(Slot));
+  crc = crcExtend(crc, new_ids.data(), new_ids.size() * sizeof(uint64_t));
+  crc = crcExtend(crc, padding.data(), padding.size());
+  crc = crcExtend(crc, region, states_bytes);
+  if (crc != stored_crc) {
+    munmap(region, bytes);
+    return false;
+  }
+
+  memset(&config, 0, sizeof(config));
+  config.window_count = header.window_count;
+  memcpy(config.window_ms, header.window_ms, sizeof(config.window_ms));
+  config.expected_devices = header.device_count;
+  table.swap(new_table);
+  device_ids.swap(new_ids);
+  releaseStates();
+  states = (AggregateWindow *)region;
+  state_count = states_bytes / sizeof(AggregateWindow);
+  state_capacity = bytes / sizeof(AggregateWindow);
+  region_bytes = bytes;
+  cursor = 0;
+  memset(&stats, 0, sizeof(stats));
+
+  if (wal_sequence != nullptr) {
+    *wal_sequence = header.wal_sequence;
+  }
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef AGGREGATOR_SNAPSHOT_H
+#define AGGREGATOR_SNAPSHOT_H
+
+#include "device_aggregator.h"
+
+// Aggregator snapshot file ("AGSN"), written by
+// DeviceAggregator::saveSnapshot(). Host byte order; a snapshot is only
+// restored on the machine type that wrote it.
+//
+//   AggregatorSnapshotHeader
+//   table      table_capacity x 16-byte slots (device id, state index)
+//   device_ids device_count x uint64
+//   (zero padding to AGGREGATOR_SNAPSHOT_ALIGNMENT)
+//   states     device_count x window_count x AggregateWindow
+//
+// The state array is last and aligned to 64 KB, the largest common page
+// size (arm64 kernels run with 4, 16 or 64 KB pages), so it can be mapped
+// in place. On a system whose page size does not divide the offset it is
+// read into memory instead.
+// crc is CRC-32C over the header (crc field zero) and everything after it.
+// A snapshot with another version, window block size or field count is
+// rejected and the caller falls back to a full WAL replay.
+
+#define AGGREGATOR_SNAPSHOT_MAGIC 0x4e534741u // "AGSN" little-endian
+#define AGGREGATOR_SNAPSHOT_VERSION 2
+#define AGGREGATOR_SNAPSHOT_ALIGNMENT 65536
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t field_count;  // SENSOR_FIELD_COUNT
+  uint32_t window_size;  // sizeof(AggregateWindow)
+  uint32_t window_count;
+  uint32_t device_count;
+  uint64_t window_ms[AGGREGATE_MAX_WINDOWS];
+  uint64_t wal_sequence; // Last WAL record included in the state
+  uint64_t table_capacity;
+  uint64_t states_offset;
+  uint32_t crc;
+  uint32_t reserved;
+} AggregatorSnapshotHeader;
+
+#endif // AGGREGATOR_SNAPSHOT_H
@@ -0,0 +1,410 @@
+#include "archive_compactor.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// Inputs are handed to run generation threads in ranges of this size
+#define COMPACTION_CHUNK_BYTES (64ULL << 20)
+
+// Smallest per-reader buffer during merge
+#define COMPACTION_MIN_READ_BUFFER (64u << 10)
+
+namespace {
+
+typedef struct {
+  uint64_t device_id;
+  uint64_t timestamp_ms;
+  uint64_t sequence;
+} SortKey;
+
+inline bool keyLess(const SortKey &a, const SortKey &b) {
+  if (a.device_id != b.device_id)
+    return a.device_id < b.device_id;
+  if (a.timestamp_ms != b.timestamp_ms)
+    return a.timestamp_ms < b.timestamp_ms;
+  return a.sequence < b.sequence;
+}
+
+// A buffered record: its key and where its bytes sit in the arena
+typedef struct {
+  SortKey key;
+  uint64_t offset;
+  uint32_t size;
+} SortEntry;
+
+typedef struct {
+  const std::string *path;
+  uint64_t begin;
+  uint64_t end;
+} InputChunk;
+
+// State shared by the run generation threads
+struct RunGeneration {
+  std::vector<InputChunk> chunks;
+  std::atomic<size_t> next_chunk;
+  uint64_t thread_budget;
+  std::string run_prefix;
+
+  std::mutex mutex; // Guards everything below
+  std::vector<std::string> runs;
+  uint64_t records;
+  uint64_t bytes;
+  uint64_t skipped;
+  bool failed;
+
+  RunGeneration()
+      : next_chunk(0), thread_budget(0), records(0), bytes(0), skipped(0),
+        failed(false) {}
+};
+
+std::string runPath(const std::string &prefix, uint64_t number) {
+  char name[32];
+  snprintf(name, sizeof(name), "-%06llu.run", (unsigned long long)number);
+  return prefix + name;
+}
+
+bool spillRun(RunGeneration &state, std::vector<SortEntry> &entries,
+              const std::vector<uint8_t> &arena) {
+  std::sort(entries.begin(), entries.end(),
+            [](const SortEntry &a, const SortEntry &b) {
+              return keyLess(a.key, b.key);
+            });
+
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    path = runPath(state.run_prefix, state.runs.size());
+    state.runs.push_back(path);
+  }
+
+  ArchiveWriter writer;
+  bool ok = writer.open(path.c_str());
+  for (size_t i = 0; ok && i < entries.size(); i++) {
+    ok = writer.writeRaw(&arena[entries[i].offset], entries[i].size);
+  }
+  return writer.close() && ok;
+}
+
+void runGenerationThread(RunGeneration *state) {
+  std::vector<SortEntry> entries;
+  std::vector<uint8_t> arena;
+  arena.reserve(state->thread_budget);
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  uint64_t skipped = 0;
+  bool ok = true;
+
+  size_t chunk;
+  while (ok && (chunk = state->next_chunk++) < state->chunks.size()) {
+    const InputChunk &input = state->chunks[chunk];
+    ArchiveReader reader;
+    if (!reader.openRange(input.path->c_str(), input.begin, input.end)) {
+      ok = false;
+      break;
+    }
+
+    PayloadRecordHeader header;
+    const uint8_t *payload;
+    const uint8_t *record;
+    uint32_t size;
+    while (reader.next(&header, &payload, &record, &size) == 1) {
+      // Entries are part of the budget too
+      uint64_t used = arena.size() + (entries.size() + 1) * sizeof(SortEntry);
+      if (used + size > state->thread_budget && !entries.empty()) {
+        ok = spillRun(*state, entries, arena);
+        entries.clear();
+        arena.clear();
+        if (!ok)
+          break;
+      }
+
+      SortEntry entry = {{header.device_id, header.timestamp_ms,
+                          header.sequence},
+                         arena.size(),
+                         size};
+      arena.insert(arena.end(), record, record + size);
+      entries.push_back(entry);
+      records++;
+      bytes += size;
+    }
+    skipped += reader.getSkippedBytes();
+  }
+
+  if (ok && !entries.empty()) {
+    ok = spillRun(*state, entries, arena);
+  }
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  state->records += records;
+  state->bytes += bytes;
+  state->skipped += skipped;
+  state->failed = state->failed || !ok;
+}
+
+// Receives merged records in key order
+class MergeSink {
+public:
+  virtual ~MergeSink() {}
+  virtual bool put(const PayloadRecordHeader &header, const uint8_t *record,
+                   uint32_t size) = 0;
+};
+
+// Single output file (intermediate merge passes)
+class RunSink : public MergeSink {
+public:
+  bool open(const std::string &path) { return writer.open(path.c_str()); }
+  bool close() { return writer.close(); }
+  bool put(const PayloadRecordHeader &, const uint8_t *record, uint32_t size) {
+    return writer.writeRaw(record, size);
+  }
+
+private:
+  ArchiveWriter writer;
+};
+
+// Final segments with per-device indexes
+class SegmentSink : public MergeSink {
+public:
+  SegmentSink(const char *prefix, uint64_t segment_bytes,
+              std::vector<std::string> *outputs)
+      : prefix(prefix), segment_bytes(segment_bytes), outputs(outputs),
+        open_segment(false), segments(0), bytes(0), devices(0) {}
+
+  bool put(const PayloadRecordHeader &header, const uint8_t *record,
+           uint32_t size) {
+    bool new_device =
+        index.empty() || index.back().device_id != header.device_id;
+    if (new_device) {
+      devices++;
+      if (open_segment && writer.getOffset() >= segment_bytes && !finish())
+        return false;
+    }
+    if (!open_segment) {
+      char name[32];
+      snprintf(name, sizeof(name), "-%05llu.seg",
+               (unsigned long long)segments);
+      path = prefix + name;
+      if (!writer.open(path.c_str()))
+        return false;
+      open_segment = true;
+      new_device = true;
+    }
+
+    if (new_device) {
+      ArchiveIndexEntry entry;
+      memset(&entry, 0, sizeof(entry));
+      entry.device_id = header.device_id;
+      entry.first_timestamp_ms = header.timestamp_ms;
+      entry.offset = writer.getOffset();
+      index.push_back(entry);
+    }
+    ArchiveIndexEntry &entry = index.back();
+    entry.last_timestamp_ms = header.timestamp_ms;
+    entry.bytes += size;
+    entry.record_count++;
+    return writer.writeRaw(record, size);
+  }
+
+  // Close the open segment and write its index
+  bool finish() {
+    if (!open_segment)
+      return true;
+    open_segment = false;
+    bytes += writer.getOffset();
+    segments++;
+    if (outputs != nullptr)
+      outputs->push_back(path);
+    bool ok = writer.close() && writeArchiveIndex((path + ".idx").c_str(), index);
+    index.clear();
+    return ok;
+  }
+
+  uint64_t getSegments() const { return segments; }
+  uint64_t getBytes() const { return bytes; }
+  uint64_t getDevices() const { return devices; }
+
+private:
+  std::string prefix;
+  uint64_t segment_bytes;
+  std::vector<std::string> *outputs;
+
+  ArchiveWriter writer;
+  std::string path;
+  bool open_segment;
+  std::vector<ArchiveIndexEntry> index;
+  uint64_t segments;
+  uint64_t bytes;
+  uint64_t devices;
+};
+
+// Current head record of one merge input
+typedef struct {
+  PayloadRecordHeader header;
+  const uint8_t *record;
+  uint32_t size;
+} MergeHead;
+
+bool mergeRuns(const std::vector<std::string> &runs, uint64_t memory_budget,
+               MergeSink *sink) {
+  uint64_t share = memory_budget / (runs.size() ? runs.size() : 1);
+  uint32_t buffer_size = share < COMPACTION_MIN_READ_BUFFER
+                             ? COMPACTION_MIN_READ_BUFFER
+                             : (uint32_t)std::min<uint64_t>(share, 16u << 20);
+
+  std::vector<ArchiveReader> readers(runs.size());
+  std::vector<MergeHead> heads(runs.size());
+  std::vector<uint32_t> heap;
+  heap.reserve(runs.size());
+
+  // Min-heap of reader indexes ordered by head key
+  auto greater = [&heads](uint32_t a, uint32_t b) {
+    const PayloadRecordHeader &x = heads[a].header;
+    const PayloadRecordHeader &y = heads[b].header;
+    SortKey ka = {x.device_id, x.timestamp_ms, x.sequence};
+    SortKey kb = {y.device_id, y.timestamp_ms, y.sequence};
+    return keyLess(kb, ka);
+  };
+
+  const uint8_t *payload;
+  for (uint32_t i = 0; i < runs.size(); i++) {
+    if (!readers[i].open(runs[i].c_str(), buffer_size))
+      return false;
+    if (readers[i].next(&heads[i].header, &payload, &heads[i].record,
+                        &heads[i].size) == 1) {
+      heap.push_back(i);
+    }
+  }
+  std::make_heap(heap.begin(), heap.end(), greater);
+
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), greater);
+    uint32_t i = heap.back();
+    if (!sink->put(heads[i].header, heads[i].record, heads[i].size))
+      return false;
+
+    if (readers[i].next(&heads[i].header, &payload, &heads[i].record,
+                        &heads[i].size) == 1) {
+      std::push_heap(heap.begin(), heap.end(), greater);
+    } else {
+      heap.pop_back();
+    }
+  }
+  return true;
+}
+
+void removeFiles(const std::vector<std::string> &paths) {
+  for (size_t i = 0; i < paths.size(); i++) {
+    unlink(paths[i].c_str());
+  }
+}
+
+} // namespace
+
+CompactionConfig defaultCompactionConfig() {
+  CompactionConfig config;
+  config.memory_budget = 256ULL << 20;
+  config.threads = std::thread::hardware_concurrency();
+  if (config.threads == 0)
+    config.threads = 1;
+  config.merge_fan_in = 64;
+  config.output_segment_bytes = 256ULL << 20;
+  return config;
+}
+
+bool compactArchive(const std::vector<std::string> &inputs,
+                    const char *output_prefix, const CompactionConfig &config,
+                    CompactionStats *stats, std::vector<std::string> *outputs) {
+  CompactionStats local;
+  if (stats == nullptr)
+    stats = &local;
+  memset(stats, 0, sizeof(*stats));
+
+  uint32_t threads = config.threads > 0 ? config.threads : 1;
+  uint32_t fan_in = config.merge_fan_in >= 2 ? config.merge_fan_in : 2;
+
+  RunGeneration state;
+  state.thread_budget = config.memory_budget / threads;
+  std::string temp_dir = config.temp_dir;
+  if (temp_dir.empty()) {
+    temp_dir = output_prefix;
+    size_t slash = temp_dir.rfind('/');
+    temp_dir = slash == std::string::npos ? "." : temp_dir.substr(0, slash);
+  }
+  char tag[32];
+  snprintf(tag, sizeof(tag), "/compact-%ld", (long)getpid());
+  state.run_prefix = temp_dir + tag;
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    struct stat st;
+    if (stat(inputs[i].c_str(), &st) != 0)
+      return false;
+    uint64_t size = (uint64_t)st.st_size;
+    for (uint64_t begin = 0; begin < size; begin += COMPACTION_CHUNK_BYTES) {
+      InputChunk chunk = {&inputs[i], begin,
+                          std::min<uint64_t>(size, begin + COMPACTION_CHUNK_BYTES)};
+      state.chunks.push_back(chunk);
+    }
+  }
+
+  // Phase 1: parallel run generation
+  std::vector<std::thread> workers;
+  for (uint32_t t = 1; t < threads && t < state.chunks.size(); t++) {
+    workers.push_back(std::thread(runGenerationThread, &state));
+  }
+  runGenerationThread(&state);
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  stats->input_records = state.records;
+  stats->input_bytes = state.bytes;
+  stats->skipped_bytes = state.skipped;
+  stats->runs = state.runs.size();
+  if (state.failed) {
+    removeFiles(state.runs);
+    return false;
+  }
+
+  // Phase 2: intermediate passes until the runs fit in one merge
+  std::vector<std::string> runs = state.runs;
+  uint64_t next_run = runs.size();
+  bool ok = true;
+  while (ok && runs.size() > fan_in) {
+    std::vector<std::string> merged;
+    for (size_t first = 0; ok && first < runs.size(); first += fan_in) {
+      std::vector<std::string> group(
+          runs.begin() + first,
+          runs.begin() + std::min(runs.size(), first + fan_in));
+      std::string path = runPath(state.run_prefix, next_run++);
+      merged.push_back(path);
+
+      RunSink sink;
+      ok = sink.open(path) && mergeRuns(group, config.memory_budget, &sink);
+      ok = sink.close() && ok;
+      removeFiles(group);
+    }
+    if (!ok)
+      removeFiles(runs); // Runs a failed pass did not reach
+    runs.swap(merged);
+    stats->merge_passes++;
+  }
+
+  // Final pass into indexed segments
+  SegmentSink sink(output_prefix, config.output_segment_bytes, outputs);
+  if (ok) {
+    ok = mergeRuns(runs, config.memory_budget, &sink);
+    ok = sink.finish() && ok;
+    stats->merge_passes++;
+  }
+  removeFiles(runs);
+
+  stats->output_segments = sink.getSegments();
+  stats->output_bytes = sink.getBytes();
+  stats->devices = sink.getDevices();
+  return ok;
+}
@@ -0,0 +1,52 @@
+#ifndef ARCHIVE_COMPACTOR_H
+#define ARCHIVE_COMPACTOR_H
+
+#include "payload_archive.h"
+#include <string>
+#include <vector>
+
+// Offline compaction of arrival-ordered archive segments into segments
+// sorted by (device_id, timestamp_ms, sequence), so the history of one
+// device is a single contiguous, indexed range.
+//
+// This is a bounded-memory external merge sort:
+//  1. Run generation: the inputs are split into byte ranges that worker
+//     threads claim one at a time. Each worker buffers records up to its
+//     share of the memory budget, sorts them and spills a run file.
+//  2. Merge: runs are k-way merged (in several passes if there are more
+//     runs than the fan-in allows) and records are copied verbatim into
+//     output segments, each with a per-device ".idx" index.
+
+typedef struct {
+  uint64_t memory_budget;        // Bytes of buffered records, all threads
+  uint32_t threads;              // Run generation threads
+  uint32_t merge_fan_in;         // Max runs merged at once
+  uint64_t output_segment_bytes; // Target segment size; a segment is only
+                                 // cut between two devices
+  std::string temp_dir;          // Where run files are written
+} CompactionConfig;
+
+typedef struct {
+  uint64_t input_records;
+  uint64_t input_bytes;     // Framed record bytes read
+  uint64_t skipped_bytes;   // Corrupt or torn bytes dropped from the inputs
+  uint64_t runs;            // Sorted runs spilled during run generation
+  uint32_t merge_passes;    // Including the final pass
+  uint64_t output_segments;
+  uint64_t output_bytes;
+  uint64_t devices;
+} CompactionStats;
+
+// Defaults: 256 MiB budget, hardware threads, fan-in 64, 256 MiB segments,
+// temp files next to the output
+CompactionConfig defaultCompactionConfig();
+
+// Compact inputs into "<output_prefix>-NNNNN.seg" segments (plus ".idx"
+// files). outputs, when given, receives the segment paths.
+// Returns: true on success
+bool compactArchive(const std::vector<std::string> &inputs,
+                    const char *output_prefix, const CompactionConfig &config,
+                    CompactionStats *stats,
+                    std::vector<std::string> *outputs = nullptr);
+
+#endif // ARCHIVE_COMPACTOR_H
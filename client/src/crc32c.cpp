@@ -0,0 +1,96 @@
+#include "crc32c.h"
+#include <string.h>
+
+namespace {
+
+const uint32_t kPolynomial = 0x82F63B78;
+
+struct Crc32cTables {
+  uint32_t table[8][256];
+
+  Crc32cTables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? kPolynomial : 0);
+      }
+      table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int slice = 1; slice < 8; slice++) {
+        uint32_t prev = table[slice - 1][i];
+        table[slice][i] = (prev >> 8) ^ table[0][prev & 0xFF];
+      }
+    }
+  }
+};
+
+const Crc32cTables &tables() {
+  static const Crc32cTables instance;
+  return instance;
+}
+
+uint32_t extendSoftware(uint32_t crc, const uint8_t *data, uint32_t length) {
+  const Crc32cTables &t = tables();
+
+  while (length >= 8) {
+    uint32_t low = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                          ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+    crc = t.table[7][low & 0xFF] ^ t.table[6][(low >> 8) & 0xFF] ^
+          t.table[5][(low >> 16) & 0xFF] ^ t.table[4][low >> 24] ^
+          t.table[3][data[4]] ^ t.table[2][data[5]] ^ t.table[1][data[6]] ^
+          t.table[0][data[7]];
+    data += 8;
+    length -= 8;
+  }
+
+  while (length-- > 0) {
+    crc = (crc >> 8) ^ t.table[0][(crc ^ *data++) & 0xFF];
+  }
+
+  return crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_HAVE_HW 1
+
+__attribute__((target("sse4.2"))) uint32_t
+extendHardware(uint32_t crc, const uint8_t *data, uint32_t length) {
+  uint64_t crc64 = crc;
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    data += 8;
+    length -= 8;
+  }
+
+  uint32_t crc32 = (uint32_t)crc64;
+  while (length-- > 0) {
+    crc32 = __builtin_ia32_crc32qi(crc32, *data++);
+  }
+
+  return crc32;
+}
+
+bool hardwareAvailable() {
+  static const bool available = __builtin_cpu_supports("sse4.2");
+  return available;
+}
+#endif
+
+} // namespace
+
+uint32_t crc32cExtend(uint32_t crc, const uint8_t *data, uint32_t length) {
+  crc = ~crc;
+#ifdef CRC32C_HAVE_HW
+  if (hardwareAvailable()) {
+    return ~extendHardware(crc, data, length);
+  }
+#endif
+  return ~extendSoftware(crc, data, length);
+}
+
+uint32_t crc32c(const uint8_t *data, uint32_t length) {
+  return crc32cExtend(0, data, length);
+}
@@ -0,0 +1,14 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78)
+// Uses the SSE4.2 crc32 instruction when the CPU has it, otherwise a
+// slice-by-8 table implementation.
+uint32_t crc32c(const uint8_t *data, uint32_t length);
+
+// Continue a running CRC (start with crc = 0)
+uint32_t crc32cExtend(uint32_t crc, const uint8_t *data, uint32_t length);
+
+#endif // CRC32C_H
@@ -0,0 +1,173 @@
+#include "decode_plan.h"
+#include <string.h>
+
+uint32_t decodePlanKey(uint32_t presence_mask, const PayloadHeader &header) {
+  uint32_t key = presence_mask & ((1u << SENSOR_FIELD_COUNT) - 1);
+  if (header.dual_mode) {
+    key |= 1u << SENSOR_FIELD_COUNT;
+    if (header.dedicated_temphum_sensor)
+      key |= 1u << (SENSOR_FIELD_COUNT + 1);
+  }
+  return key;
+}
+
+void compileDecodePlan(uint32_t presence_mask, const PayloadHeader &header,
+                       DecodePlan &plan) {
+  memset(&plan, 0, sizeof(plan));
+  plan.key = decodePlanKey(presence_mask, header);
+
+  DecodeOp *op = nullptr;
+  for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    if (!IS_FLAG_SET(presence_mask, flag))
+      continue;
+
+    // Must match PayloadDecoder::isExpandable
+    const SensorFieldInfo &info = kSensorFields[flag];
+    bool expandable = info.expandable &&
+                      !((flag == FLAG_TEMP || flag == FLAG_HUM) &&
+                        header.dedicated_temphum_sensor);
+    uint32_t value_count = (expandable && header.dual_mode) ? 2 : 1;
+    uint8_t width = sensorFieldWidth((SensorFlag)flag);
+
+    // Signedness does not matter for a copy, so temperature (int16) and the
+    // uint16 fields can share a run
+    for (uint32_t channel = 0; channel < value_count; channel++) {
+      uint16_t dest = (uint16_t)(info.offset + channel * width);
+      if (op != nullptr && op->width == width && dest > op->dest) {
+        uint32_t gap = dest - op->dest;
+        if (op->count == 1 && gap <= 0xFF) {
+          op->stride = (uint8_t)gap;
+          op->count = 2;
+          continue;
+        }
+        if (gap == (uint32_t)op->count * op->stride) {
+          op->count++;
+          continue;
+        }
+      }
+      op = &plan.ops[plan.op_count++];
+      op->flag = (uint8_t)flag;
+      op->width = width;
+      op->count = 1;
+      op->stride = width;
+      op->dest = dest;
+    }
+    plan.data_size = (uint16_t)(plan.data_size + value_count * width);
+  }
+}
+
+int32_t runDecodePlan(const DecodePlan &plan, const uint8_t *buffer,
+                      uint32_t length, SensorReading &reading) {
+  if (plan.data_size > length)
+    return -1;
+
+  uint8_t *base = (uint8_t *)&reading;
+  const uint8_t *in = buffer;
+  for (uint32_t i = 0; i < plan.op_count; i++) {
+    const DecodeOp &op = plan.ops[i];
+    uint8_t *out = base + op.dest;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Wire and host order agree: a contiguous run is one copy
+    if (op.stride == op.width) {
+      memcpy(out, in, (size_t)op.count * op.width);
+      in += (size_t)op.count * op.width;
+      continue;
+    }
+#endif
+    switch (op.width) {
+    case 1:
+      for (uint32_t j = 0; j < op.count; j++, in++, out += op.stride)
+        *out = *in;
+      break;
+    case 2:
+      for (uint32_t j = 0; j < op.count; j++, in += 2, out += op.stride) {
+        uint16_t value = (uint16_t)(in[0] | (in[1] << 8));
+        memcpy(out, &value, sizeof(value));
+      }
+      break;
+    default:
+      for (uint32_t j = 0; j < op.count; j++, in += 4, out += op.stride) {
+        uint32_t value = (uint32_t)in[0] | ((uint32_t)in[1] << 8) |
+                         ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+        memcpy(out, &value, sizeof(value));
+      }
+      break;
+    }
+  }
+  return plan.data_size;
+}
+
+static uint32_t hashKey(uint32_t key) { return key * 0x9E3779B1u; }
+
+DecodePlanCache::DecodePlanCache(uint32_t capacity)
+    : slot_mask(0), max_plans(capacity > 0 ? capacity : 1), plan_count(0),
+      hit_count(0), miss_count(0) {
+  // At most half full, so probe sequences stay short
+  uint32_t slot_count = 2;
+  while (slot_count < 2 * max_plans)
+    slot_count *= 2;
+  slots.reset(new std::atomic<DecodePlan *>[slot_count]);
+  for (uint32_t i = 0; i < slot_count; i++)
+    slots[i].store(nullptr, std::memory_order_relaxed);
+  slot_mask = slot_count - 1;
+}
+
+DecodePlanCache::~DecodePlanCache() {
+  for (uint32_t i = 0; i <= slot_mask; i++)
+    delete slots[i].load(std::memory_order_relaxed);
+}
+
+const DecodePlan *DecodePlanCache::find(uint32_t presence_mask,
+                                        const PayloadHeader &header) {
+  uint32_t key = decodePlanKey(presence_mask, header);
+  uint32_t pos = (hashKey(key) >> 16) & slot_mask;
+
+  for (;;) {
+    DecodePlan *plan = slots[pos].load(std::memory_order_acquire);
+    if (plan == nullptr)
+      break;
+    if (plan->key == key) {
+      hit_count.fetch_add(1, std::memory_order_relaxed);
+      return plan;
+    }
+    pos = (pos + 1) & slot_mask;
+  }
+  miss_count.fetch_add(1, std::memory_order_relaxed);
+
+  if (plan_count.fetch_add(1, std::memory_order_relaxed) >= max_plans) {
+    plan_count.fetch_sub(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  DecodePlan *compiled = new DecodePlan;
+  compileDecodePlan(presence_mask, header, *compiled);
+
+  // Publish in the first empty slot from pos; if another thread got there
+  // first with the same key, use its plan
+  for (;;) {
+    DecodePlan *expected = nullptr;
+    if (slots[pos].compare_exchange_strong(expected, compiled,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_acquire))
+      return compiled;
+    if (expected->key == key) {
+      delete compiled;
+      plan_count.fetch_sub(1, std::memory_order_relaxed);
+      return expected;
+    }
+    pos = (pos + 1) & slot_mask;
+  }
+}
+
+uint64_t DecodePlanCache::hits() const {
+  return hit_count.load(std::memory_order_relaxed);
+}
+
+uint64_t DecodePlanCache::misses() const {
+  return miss_count.load(std::memory_order_relaxed);
+}
+
+uint32_t DecodePlanCache::size() const {
+  return plan_count.load(std::memory_order_relaxed);
+}
+
+uint32_t DecodePlanCache::capacity() const { return max_plans; }
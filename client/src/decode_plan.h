@@ -0,0 +1,75 @@
+#ifndef DECODE_PLAN_H
+#define DECODE_PLAN_H
+
+#include "sensor_fields.h"
+#include <atomic>
+#include <memory>
+
+// Decode plans: the field layout of one (presence mask, dual mode, dedicated
+// temp/hum) combination compiled once into a short list of copy operations,
+// so readings with a known layout skip the per-bit flag walk.
+
+// Copy `count` wire values of `width` bytes into SensorReading, starting at
+// byte offset `dest` and `stride` bytes apart. Consecutive fields whose
+// destinations are evenly spaced share one op (e.g. all PM fields of a
+// dual-mode reading are a single run of 16-bit values).
+typedef struct {
+  uint8_t flag;   // First field of the run
+  uint8_t width;  // Wire bytes per value: 1, 2 or 4
+  uint8_t count;  // Values in the run
+  uint8_t stride; // Destination bytes between values
+  uint16_t dest;  // Byte offset of the first value in SensorReading
+} DecodeOp;
+
+typedef struct {
+  uint32_t key;       // decodePlanKey() of the combination
+  uint16_t data_size; // Sensor data bytes after the presence mask
+  uint8_t op_count;
+  DecodeOp ops[SENSOR_FIELD_COUNT];
+} DecodePlan;
+
+// Cache key: field bits of the mask plus the header bits that change the
+// layout (dedicated temp/hum only matters in dual mode)
+uint32_t decodePlanKey(uint32_t presence_mask, const PayloadHeader &header);
+
+void compileDecodePlan(uint32_t presence_mask, const PayloadHeader &header,
+                       DecodePlan &plan);
+
+// Decode the sensor data that follows a presence mask. Only the fields in
+// the plan are written; the caller clears the reading.
+// Returns: plan.data_size, or -1 if the buffer is truncated
+int32_t runDecodePlan(const DecodePlan &plan, const uint8_t *buffer,
+                      uint32_t length, SensorReading &reading);
+
+// Fixed-capacity plan cache shared by decoder threads. Lookups are
+// lock-free; a missing plan is compiled and published with a
+// compare-and-swap, and plans stay until the cache is destroyed.
+class DecodePlanCache {
+public:
+  explicit DecodePlanCache(uint32_t capacity = 256);
+  ~DecodePlanCache();
+
+  // Returns: the plan for the combination, compiling it on first use, or
+  // nullptr when the cache is full and the plan is not cached (decode
+  // field by field)
+  const DecodePlan *find(uint32_t presence_mask, const PayloadHeader &header);
+
+  // Lookup counters (relaxed, so approximate while threads are decoding)
+  uint64_t hits() const;
+  uint64_t misses() const;
+  uint32_t size() const;
+  uint32_t capacity() const;
+
+private:
+  DecodePlanCache(const DecodePlanCache &);
+  DecodePlanCache &operator=(const DecodePlanCache &);
+
+  std::unique_ptr<std::atomic<DecodePlan *>[]> slots;
+  uint32_t slot_mask;
+  uint32_t max_plans;
+  std::atomic<uint32_t> plan_count;
+  std::atomic<uint64_t> hit_count;
+  std::atomic<uint64_t> miss_count;
+};
+
+#endif // DECODE_PLAN_H
@@ -0,0 +1,415 @@
+#include "derived_metrics.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define METRICS_HAVE_AVX2_KERNELS 1
+#endif
+
+#define PM_FIELDS (FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_HUM))
+#define NO2_FIELDS                                                             \
+  (FLAG_BIT(FLAG_NO2_WE) | FLAG_BIT(FLAG_NO2_AE) | FLAG_BIT(FLAG_AFE_TEMP))
+#define O3_FIELDS                                                              \
+  (FLAG_BIT(FLAG_O3_WE) | FLAG_BIT(FLAG_O3_AE) | FLAG_BIT(FLAG_AFE_TEMP))
+
+#define AQI_SEGMENTS 6
+#define AQI_MAX_TENTHS 3254.0f // 325.4 ug/m3 is AQI 500
+
+namespace {
+
+bool force_scalar = false;
+
+// PM2.5 breakpoints in tenths of ug/m3 (concentrations are truncated to
+// 0.1 before lookup) and the AQI at the start of each segment
+const float kAqiLow[AQI_SEGMENTS] = {0, 91, 355, 555, 1255, 2255};
+const float kAqiIndex[AQI_SEGMENTS] = {0, 51, 101, 151, 201, 301};
+const float kAqiSlope[AQI_SEGMENTS] = {
+    50.0f / 90, 49.0f / 263, 49.0f / 199, 49.0f / 699, 99.0f / 999,
+    199.0f / 999};
+
+// Per-sensor constants in the form the kernels use
+typedef struct {
+  float we_zero;
+  float ae_zero;
+  float inv_sensitivity;
+  float no2_sensitivity;
+  float n_base[METRIC_TEMP_POINTS - 1];  // n_T at the start of each segment
+  float n_slope[METRIC_TEMP_POINTS - 1]; // Change per 10 C
+} GasConstants;
+
+GasConstants gasConstants(const ElectrochemCalibration &calibration) {
+  GasConstants constants;
+  constants.we_zero = calibration.we_zero_mv;
+  constants.ae_zero = calibration.ae_zero_mv;
+  constants.inv_sensitivity = 1.0f / calibration.sensitivity;
+  constants.no2_sensitivity = calibration.no2_sensitivity;
+  for (int i = 0; i < METRIC_TEMP_POINTS - 1; i++) {
+    constants.n_base[i] = calibration.n_temp[i];
+    constants.n_slope[i] = calibration.n_temp[i + 1] - calibration.n_temp[i];
+  }
+  return constants;
+}
+
+// Scalar kernels. Each step matches the AVX2 kernels operation for
+// operation (no fused multiply-add), so both give identical results.
+
+inline float clampf(float x, float lo, float hi) {
+  return fminf(fmaxf(x, lo), hi);
+}
+
+inline float epaCorrect(float pa, float rh) {
+  // Blend weights of the 30-50 and 210-260 ug/m3 transitions
+  float w1 = clampf(pa * (1.0f / 20) - 1.5f, 0.0f, 1.0f);
+  float w2 = clampf(pa * (1.0f / 50) - 4.2f, 0.0f, 1.0f);
+  float slope = 0.524f + 0.262f * w1;
+  float low = slope * pa + (5.75f - 0.0862f * rh);
+  float high = 2.966f + 0.69f * pa + 8.84e-4f * (pa * pa);
+  return fmaxf(low + w2 * (high - low), 0.0f);
+}
+
+inline float usAqi(float tenths) {
+  float t = fminf(tenths, AQI_MAX_TENTHS);
+  float low = kAqiLow[0];
+  float index = kAqiIndex[0];
+  float slope = kAqiSlope[0];
+  for (int k = 1; k < AQI_SEGMENTS; k++) {
+    bool above = t >= kAqiLow[k];
+    low = above ? kAqiLow[k] : low;
+    index = above ? kAqiIndex[k] : index;
+    slope = above ? kAqiSlope[k] : slope;
+  }
+  return floorf(slope * (t - low) + index + 0.5f);
+}
+
+inline float uint32ToFloat(uint32_t value) {
+  return (float)(int32_t)(value >> 16) * 65536.0f +
+         (float)(int32_t)(value & 0xFFFF);
+}
+
+// Electrode difference corrected for temperature, mV
+inline float electrodeSignal(const GasConstants &gas, float temperature,
+                             uint32_t we_raw, uint32_t ae_raw) {
+  float x = clampf((temperature + 30.0f) * 0.1f, 0.0f,
+                   (float)(METRIC_TEMP_POINTS - 1));
+  float base = gas.n_base[0];
+  float slope = gas.n_slope[0];
+  float segment = 0.0f;
+  for (int k = 1; k < METRIC_TEMP_POINTS - 1; k++) {
+    bool above = x >= (float)k;
+    base = above ? gas.n_base[k] : base;
+    slope = above ? gas.n_slope[k] : slope;
+    segment = above ? (float)k : segment;
+  }
+  float n = base + (x - segment) * slope;
+  float we = uint32ToFloat(we_raw) * 0.001f - gas.we_zero;
+  float ae = uint32ToFloat(ae_raw) * 0.001f - gas.ae_zero;
+  return we - n * ae;
+}
+
+void pmScalar(const MetricInputs &in, bool from_corrected, uint32_t first,
+              const MetricOutputs &out) {
+  for (uint32_t row = first; row < in.rows; row++) {
+    uint32_t mask = in.presence_mask[row];
+    float tenths = (float)in.pm25[row];
+    float corrected =
+        epaCorrect(tenths * 0.1f, (float)in.hum[row] * 0.01f);
+    bool has_pm = (mask & FLAG_BIT(FLAG_PM_25)) != 0;
+    bool has_both = (mask & PM_FIELDS) == PM_FIELDS;
+    if (out.pm25_corrected != nullptr)
+      out.pm25_corrected[row] = has_both ? corrected : NAN;
+    if (out.aqi != nullptr) {
+      float aqi = usAqi(from_corrected ? floorf(corrected * 10.0f) : tenths);
+      out.aqi[row] = (from_corrected ? has_both : has_pm) ? aqi : NAN;
+    }
+  }
+}
+
+void gasScalar(const MetricInputs &in, const GasConstants &o3,
+               const GasConstants &no2, uint32_t first,
+               const MetricOutputs &out) {
+  for (uint32_t row = first; row < in.rows; row++) {
+    uint32_t mask = in.presence_mask[row];
+    float temperature = (float)in.afe_temp[row] * 0.1f;
+    float no2_ppb =
+        electrodeSignal(no2, temperature, in.no2_we[row], in.no2_ae[row]) *
+        no2.inv_sensitivity;
+    float o3_ppb =
+        (electrodeSignal(o3, temperature, in.o3_we[row], in.o3_ae[row]) -
+         no2_ppb * o3.no2_sensitivity) *
+        o3.inv_sensitivity;
+    bool has_no2 = (mask & NO2_FIELDS) == NO2_FIELDS;
+    bool has_o3 = (mask & O3_FIELDS) == O3_FIELDS &&
+                  (has_no2 || o3.no2_sensitivity == 0.0f);
+    if (out.no2_ppb != nullptr)
+      out.no2_ppb[row] = has_no2 ? no2_ppb : NAN;
+    if (out.o3_ppb != nullptr) {
+      // Without NO2 the cross term is zero when it is not needed
+      out.o3_ppb[row] = has_o3 ? (has_no2 ? o3_ppb
+                                          : electrodeSignal(o3, temperature,
+                                                            in.o3_we[row],
+                                                            in.o3_ae[row]) *
+                                                o3.inv_sensitivity)
+                               : NAN;
+    }
+  }
+}
+
+} // namespace
+
+#ifdef METRICS_HAVE_AVX2_KERNELS
+
+namespace {
+
+__attribute__((target("avx2"))) inline __m256
+clamp8(__m256 x, __m256 lo, __m256 hi) {
+  return _mm256_min_ps(_mm256_max_ps(x, lo), hi);
+}
+
+// Rows whose presence mask has all bits of fields
+__attribute__((target("avx2"))) inline __m256
+present8(__m256i mask, uint32_t fields) {
+  __m256i bits = _mm256_set1_epi32((int)fields);
+  return _mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(_mm256_and_si256(mask, bits), bits));
+}
+
+__attribute__((target("avx2"))) inline __m256 load16x8(const uint16_t *data) {
+  __m128i raw = _mm_loadu_si128((const __m128i *)data);
+  return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(raw));
+}
+
+__attribute__((target("avx2"))) inline __m256 load32x8(const uint32_t *data) {
+  __m256i raw = _mm256_loadu_si256((const __m256i *)data);
+  __m256 high = _mm256_cvtepi32_ps(_mm256_srli_epi32(raw, 16));
+  __m256 low = _mm256_cvtepi32_ps(
+      _mm256_and_si256(raw, _mm256_set1_epi32(0xFFFF)));
+  return _mm256_add_ps(_mm256_mul_ps(high, _mm256_set1_ps(65536.0f)), low);
+}
+
+__attribute__((target("avx2"))) inline __m256 epaCorrect8(__m256 pa,
+                                                          __m256 rh) {
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 w1 = clamp8(_mm256_sub_ps(_mm256_mul_ps(pa, _mm256_set1_ps(1.0f / 20)),
+                                   _mm256_set1_ps(1.5f)),
+                     zero, one);
+  __m256 w2 = clamp8(_mm256_sub_ps(_mm256_mul_ps(pa, _mm256_set1_ps(1.0f / 50)),
+                                   _mm256_set1_ps(4.2f)),
+                     zero, one);
+  __m256 slope = _mm256_add_ps(_mm256_set1_ps(0.524f),
+                               _mm256_mul_ps(_mm256_set1_ps(0.262f), w1));
+  __m256 low = _mm256_add_ps(
+      _mm256_mul_ps(slope, pa),
+      _mm256_sub_ps(_mm256_set1_ps(5.75f),
+                    _mm256_mul_ps(_mm256_set1_ps(0.0862f), rh)));
+  __m256 high = _mm256_add_ps(
+      _mm256_add_ps(_mm256_set1_ps(2.966f),
+                    _mm256_mul_ps(_mm256_set1_ps(0.69f), pa)),
+      _mm256_mul_ps(_mm256_set1_ps(8.84e-4f), _mm256_mul_ps(pa, pa)));
+  return _mm256_max_ps(
+      _mm256_add_ps(low, _mm256_mul_ps(w2, _mm256_sub_ps(high, low))), zero);
+}
+
+__attribute__((target("avx2"))) inline __m256 usAqi8(__m256 tenths) {
+  __m256 t = _mm256_min_ps(tenths, _mm256_set1_ps(AQI_MAX_TENTHS));
+  __m256 low = _mm256_set1_ps(kAqiLow[0]);
+  __m256 index = _mm256_set1_ps(kAqiIndex[0]);
+  __m256 slope = _mm256_set1_ps(kAqiSlope[0]);
+  for (int k = 1; k < AQI_SEGMENTS; k++) {
+    __m256 above = _mm256_cmp_ps(t, _mm256_set1_ps(kAqiLow[k]), _CMP_GE_OQ);
+    low = _mm256_blendv_ps(low, _mm256_set1_ps(kAqiLow[k]), above);
+    index = _mm256_blendv_ps(index, _mm256_set1_ps(kAqiIndex[k]), above);
+    slope = _mm256_blendv_ps(slope, _mm256_set1_ps(kAqiSlope[k]), above);
+  }
+  __m256 value = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(slope, _mm256_sub_ps(t, low)), index),
+      _mm256_set1_ps(0.5f));
+  return _mm256_floor_ps(value);
+}
+
+__attribute__((target("avx2"))) inline __m256
+electrodeSignal8(const GasConstants &gas, __m256 temperature, __m256 we_raw,
+                 __m256 ae_raw) {
+  __m256 x = clamp8(_mm256_mul_ps(_mm256_add_ps(temperature,
+                                                _mm256_set1_ps(30.0f)),
+                                  _mm256_set1_ps(0.1f)),
+                    _mm256_setzero_ps(),
+                    _mm256_set1_ps((float)(METRIC_TEMP_POINTS - 1)));
+  __m256 base = _mm256_set1_ps(gas.n_base[0]);
+  __m256 slope = _mm256_set1_ps(gas.n_slope[0]);
+  __m256 segment = _mm256_setzero_ps();
+  for (int k = 1; k < METRIC_TEMP_POINTS - 1; k++) {
+    __m256 above = _mm256_cmp_ps(x, _mm256_set1_ps((float)k), _CMP_GE_OQ);
+    base = _mm256_blendv_ps(base, _mm256_set1_ps(gas.n_base[k]), above);
+    slope = _mm256_blendv_ps(slope, _mm256_set1_ps(gas.n_slope[k]), above);
+    segment = _mm256_blendv_ps(segment, _mm256_set1_ps((float)k), above);
+  }
+  __m256 n = _mm256_add_ps(base,
+                           _mm256_mul_ps(_mm256_sub_ps(x, segment), slope));
+  __m256 milli = _mm256_set1_ps(0.001f);
+  __m256 we = _mm256_sub_ps(_mm256_mul_ps(we_raw, milli),
+                            _mm256_set1_ps(gas.we_zero));
+  __m256 ae = _mm256_sub_ps(_mm256_mul_ps(ae_raw, milli),
+                            _mm256_set1_ps(gas.ae_zero));
+  return _mm256_sub_ps(we, _mm256_mul_ps(n, ae));
+}
+
+__attribute__((target("avx2"))) uint32_t
+pmAvx2(const MetricInputs &in, bool from_corrected, const MetricOutputs &out) {
+  const __m256 nan = _mm256_set1_ps(NAN);
+  uint32_t blocks = in.rows / 8;
+  for (uint32_t b = 0; b < blocks; b++) {
+    uint32_t row = b * 8;
+    __m256i mask =
+        _mm256_loadu_si256((const __m256i *)(in.presence_mask + row));
+    __m256 tenths = load16x8(in.pm25 + row);
+    __m256 corrected =
+        epaCorrect8(_mm256_mul_ps(tenths, _mm256_set1_ps(0.1f)),
+                    _mm256_mul_ps(load16x8(in.hum + row),
+                                  _mm256_set1_ps(0.01f)));
+    __m256 has_pm = present8(mask, FLAG_BIT(FLAG_PM_25));
+    __m256 has_both = present8(mask, PM_FIELDS);
+    if (out.pm25_corrected != nullptr)
+      _mm256_storeu_ps(out.pm25_corrected + row,
+                       _mm256_blendv_ps(nan, corrected, has_both));
+    if (out.aqi != nullptr) {
+      __m256 aqi = usAqi8(
+          from_corrected
+              ? _mm256_floor_ps(_mm256_mul_ps(corrected, _mm256_set1_ps(10.0f)))
+              : tenths);
+      _mm256_storeu_ps(out.aqi + row, _mm256_blendv_ps(
+                                          nan, aqi,
+                                          from_corrected ? has_both : has_pm));
+    }
+  }
+  return blocks * 8;
+}
+
+__attribute__((target("avx2"))) uint32_t
+gasAvx2(const MetricInputs &in, const GasConstants &o3,
+        const GasConstants &no2, const MetricOutputs &out) {
+  const __m256 nan = _mm256_set1_ps(NAN);
+  uint32_t blocks = in.rows / 8;
+  for (uint32_t b = 0; b < blocks; b++) {
+    uint32_t row = b * 8;
+    __m256i mask =
+        _mm256_loadu_si256((const __m256i *)(in.presence_mask + row));
+    __m256 temperature = _mm256_mul_ps(load16x8(in.afe_temp + row),
+                                       _mm256_set1_ps(0.1f));
+    __m256 no2_ppb = _mm256_mul_ps(
+        electrodeSignal8(no2, temperature, load32x8(in.no2_we + row),
+                         load32x8(in.no2_ae + row)),
+        _mm256_set1_ps(no2.inv_sensitivity));
+    __m256 o3_signal = electrodeSignal8(o3, temperature,
+                                        load32x8(in.o3_we + row),
+                                        load32x8(in.o3_ae + row));
+    __m256 o3_ppb = _mm256_mul_ps(
+        _mm256_sub_ps(o3_signal, _mm256_mul_ps(
+                                     no2_ppb,
+                                     _mm256_set1_ps(o3.no2_sensitivity))),
+        _mm256_set1_ps(o3.inv_sensitivity));
+    __m256 has_no2 = present8(mask, NO2_FIELDS);
+    __m256 has_o3 = present8(mask, O3_FIELDS);
+    if (out.no2_ppb != nullptr)
+      _mm256_storeu_ps(out.no2_ppb + row,
+                       _mm256_blendv_ps(nan, no2_ppb, has_no2));
+    if (out.o3_ppb != nullptr) {
+      __m256 o3_alone =
+          _mm256_mul_ps(o3_signal, _mm256_set1_ps(o3.inv_sensitivity));
+      __m256 value = _mm256_blendv_ps(
+          o3.no2_sensitivity == 0.0f ? o3_alone : nan, o3_ppb, has_no2);
+      _mm256_storeu_ps(out.o3_ppb + row, _mm256_blendv_ps(nan, value, has_o3));
+    }
+  }
+  return blocks * 8;
+}
+
+} // namespace
+
+#endif // METRICS_HAVE_AVX2_KERNELS
+
+void initDerivedMetricsConfig(DerivedMetricsConfig &config) {
+  // OX-B431 and NO2-B43F data sheets; sensitivities include the AFE gain
+  static const ElectrochemCalibration kO3 = {
+      220.0f, 230.0f, -0.45f, -0.40f,
+      {0.9f, 0.9f, 1.0f, 1.3f, 1.5f, 1.7f, 2.0f, 2.5f, 3.7f}};
+  static const ElectrochemCalibration kNo2 = {
+      225.0f, 236.0f, -0.35f, 0.0f,
+      {1.3f, 1.3f, 1.3f, 1.3f, 1.0f, 0.6f, 0.4f, 0.2f, -1.5f}};
+  config.o3 = kO3;
+  config.no2 = kNo2;
+  config.aqi_from_corrected = true;
+}
+
+MetricColumns::MetricColumns(SensorFlag pm_flag) : pm_flag(pm_flag) {}
+
+void MetricColumns::append(const SensorReading &reading) {
+  // The kernels look for PM2.5 under FLAG_PM_25 whichever field feeds it
+  uint32_t mask = reading.presence_mask & ~FLAG_BIT(FLAG_PM_25);
+  if (IS_FLAG_SET(reading.presence_mask, pm_flag))
+    mask |= FLAG_BIT(FLAG_PM_25);
+  presence_mask.push_back(mask);
+  pm25.push_back((uint16_t)getSensorFieldValue(reading, pm_flag, 0));
+  hum.push_back(reading.hum[0]);
+  afe_temp.push_back(reading.afe_temp);
+  o3_we.push_back(reading.o3_we);
+  o3_ae.push_back(reading.o3_ae);
+  no2_we.push_back(reading.no2_we);
+  no2_ae.push_back(reading.no2_ae);
+}
+
+void MetricColumns::clear() {
+  presence_mask.clear();
+  pm25.clear();
+  hum.clear();
+  afe_temp.clear();
+  o3_we.clear();
+  o3_ae.clear();
+  no2_we.clear();
+  no2_ae.clear();
+}
+
+uint32_t MetricColumns::size() const { return (uint32_t)presence_mask.size(); }
+
+MetricInputs MetricColumns::inputs() const {
+  MetricInputs inputs = {size(),          presence_mask.data(), pm25.data(),
+                         hum.data(),      afe_temp.data(),      o3_we.data(),
+                         o3_ae.data(),    no2_we.data(),        no2_ae.data()};
+  return inputs;
+}
+
+bool metricsHaveAvx2() {
+#ifdef METRICS_HAVE_AVX2_KERNELS
+  static const bool available = __builtin_cpu_supports("avx2");
+  return available;
+#else
+  return false;
+#endif
+}
+
+void metricsForceScalar(bool force) { force_scalar = force; }
+
+void computeDerivedMetrics(const MetricInputs &inputs,
+                           const DerivedMetricsConfig &config,
+                           const MetricOutputs &outputs) {
+  bool pm = outputs.pm25_corrected != nullptr || outputs.aqi != nullptr;
+  bool gas = outputs.o3_ppb != nullptr || outputs.no2_ppb != nullptr;
+  GasConstants o3 = gasConstants(config.o3);
+  GasConstants no2 = gasConstants(config.no2);
+
+  uint32_t pm_done = 0;
+  uint32_t gas_done = 0;
+#ifdef METRICS_HAVE_AVX2_KERNELS
+  if (!force_scalar && metricsHaveAvx2()) {
+    if (pm)
+      pm_done = pmAvx2(inputs, config.aqi_from_corrected, outputs);
+    if (gas)
+      gas_done = gasAvx2(inputs, o3, no2, outputs);
+  }
+#endif
+  if (pm)
+    pmScalar(inputs, config.aqi_from_corrected, pm_done, outputs);
+  if (gas)
+    gasScalar(inputs, o3, no2, gas_done, outputs);
+}
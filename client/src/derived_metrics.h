@@ -0,0 +1,99 @@
+#ifndef DERIVED_METRICS_H
+#define DERIVED_METRICS_H
+
+#include "sensor_fields.h"
+#include <vector>
+
+// Derived metrics computed over columns of decoded readings, eight rows at a
+// time with AVX2 when the CPU has it:
+//
+//   pm25_corrected  US EPA humidity correction (Barkjohn et al. 2021, with
+//                   the smoke fit blended in above 210 ug/m3), ug/m3
+//   aqi             US AQI for PM2.5 (2024 breakpoints), 0-500
+//   no2_ppb, o3_ppb Alphasense 4-electrode conversion with the
+//                   temperature-dependent AE correction n_T; o3 subtracts
+//                   the NO2 response of the OX sensor
+//
+// Piecewise formulas (AQI breakpoints, the correction's concentration
+// ranges, the n_T table) are evaluated with selects and clamps rather than
+// branches. Outputs are NaN where a required field is absent.
+
+// n_T is given at -30, -20 .. 50 C and interpolated linearly
+#define METRIC_TEMP_POINTS 9
+
+typedef struct {
+  float we_zero_mv;      // Working electrode electronic zero
+  float ae_zero_mv;      // Auxiliary electrode electronic zero
+  float sensitivity;     // WE sensitivity, mV/ppb
+  float no2_sensitivity; // OX sensor only: WE response to NO2, mV/ppb
+  float n_temp[METRIC_TEMP_POINTS];
+} ElectrochemCalibration;
+
+typedef struct {
+  ElectrochemCalibration o3;  // OX-B431
+  ElectrochemCalibration no2; // NO2-B43F
+  bool aqi_from_corrected;    // AQI from corrected (true) or raw PM2.5
+} DerivedMetricsConfig;
+
+// Typical Alphasense values; real deployments use each sensor's
+// calibration sheet
+void initDerivedMetricsConfig(DerivedMetricsConfig &config);
+
+// Input columns, raw values as on the wire (scales as in kSensorFields)
+typedef struct {
+  uint32_t rows;
+  const uint32_t *presence_mask;
+  const uint16_t *pm25;     // PM2.5 * 10
+  const uint16_t *hum;      // Humidity * 100
+  const uint16_t *afe_temp; // AFE temperature * 10
+  const uint32_t *o3_we;    // Electrode mV * 1000
+  const uint32_t *o3_ae;
+  const uint32_t *no2_we;
+  const uint32_t *no2_ae;
+} MetricInputs;
+
+// Output columns of inputs.rows floats; nullptr outputs are not computed
+typedef struct {
+  float *pm25_corrected;
+  float *aqi;
+  float *o3_ppb;
+  float *no2_ppb;
+} MetricOutputs;
+
+// Gathers metric inputs from decoded readings (channel 0). The EPA
+// correction is defined on CF=1 values, so pass FLAG_PM_25_SP as pm_flag
+// for sensors that report them.
+class MetricColumns {
+public:
+  explicit MetricColumns(SensorFlag pm_flag = FLAG_PM_25);
+
+  void append(const SensorReading &reading);
+  void clear();
+  uint32_t size() const;
+
+  // Valid until the next append() or clear()
+  MetricInputs inputs() const;
+
+private:
+  SensorFlag pm_flag;
+  std::vector<uint32_t> presence_mask;
+  std::vector<uint16_t> pm25;
+  std::vector<uint16_t> hum;
+  std::vector<uint16_t> afe_temp;
+  std::vector<uint32_t> o3_we;
+  std::vector<uint32_t> o3_ae;
+  std::vector<uint32_t> no2_we;
+  std::vector<uint32_t> no2_ae;
+};
+
+// True if the CPU supports AVX2 (and the stage uses the AVX2 kernels)
+bool metricsHaveAvx2();
+
+// Force the scalar kernels even when AVX2 is available (for comparisons)
+void metricsForceScalar(bool force);
+
+void computeDerivedMetrics(const MetricInputs &inputs,
+                           const DerivedMetricsConfig &config,
+                           const MetricOutputs &outputs);
+
+#endif // DERIVED_METRICS_H
@@ -0,0 +1,326 @@
+#include "device_aggregator.h"
+#include "payload_decoder.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define EMPTY_SLOT UINT32_MAX
+#define MAX_COUNT UINT16_MAX
+
+// Every field value fits in int32 once uint32 fields are shifted down by
+// 2^31, which keeps min/max at 4 bytes and preserves ordering
+static inline int64_t fieldBias(uint32_t flag) {
+  return kSensorFields[flag].type == FIELD_UINT32 ? 2147483648LL : 0;
+}
+
+// MurmurHash3 finalizer: device ids are often sequential
+static inline uint64_t hashDevice(uint64_t device_id) {
+  device_id ^= device_id >> 33;
+  device_id *= 0xff51afd7ed558ccdULL;
+  device_id ^= device_id >> 33;
+  device_id *= 0xc4ceb9fe1a85ec53ULL;
+  device_id ^= device_id >> 33;
+  return device_id;
+}
+
+static inline void resetWindow(AggregateWindow &aggregate, uint64_t start_ms) {
+  aggregate.start_ms = start_ms;
+  aggregate.field_mask = 0;
+  memset(aggregate.count, 0, sizeof(aggregate.count));
+}
+
+DeviceAggregator::DeviceAggregator()
+    : callback(nullptr), user(nullptr), states(nullptr), state_count(0),
+      state_capacity(0), region_bytes(0), cursor(0) {
+  memset(&config, 0, sizeof(config));
+  memset(&stats, 0, sizeof(stats));
+}
+
+DeviceAggregator::~DeviceAggregator() { releaseStates(); }
+
+// States live in an anonymous mapping rather than a vector so that a
+// snapshot can be mapped over its beginning (see restoreSnapshot()). Fresh
+// pages are zero, which is an empty window.
+bool DeviceAggregator::reserveStates(size_t capacity) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t bytes = (capacity * sizeof(AggregateWindow) + page - 1) / page * page;
+  void *region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    return false;
+  }
+  if (state_count > 0) {
+    memcpy(region, states, state_count * sizeof(AggregateWindow));
+  }
+  releaseStates();
+  states = (AggregateWindow *)region;
+  state_capacity = bytes / sizeof(AggregateWindow);
+  region_bytes = bytes;
+  return true;
+}
+
+void DeviceAggregator::releaseStates() {
+  if (states != nullptr) {
+    munmap(states, region_bytes);
+  }
+  states = nullptr;
+  state_capacity = 0;
+  region_bytes = 0;
+}
+
+AggregatorConfig DeviceAggregator::defaultConfig() {
+  AggregatorConfig config;
+  memset(&config, 0, sizeof(config));
+  config.window_count = 2;
+  config.window_ms[0] = 5 * 60 * 1000;
+  config.window_ms[1] = 60 * 60 * 1000;
+  config.expected_devices = 1024;
+  return config;
+}
+
+bool DeviceAggregator::init(const AggregatorConfig &config,
+                            AggregateCallback callback, void *user) {
+  if (config.window_count == 0 || config.window_count > AGGREGATE_MAX_WINDOWS) {
+    return false;
+  }
+  for (uint32_t w = 0; w < config.window_count; w++) {
+    if (config.window_ms[w] == 0) {
+      return false;
+    }
+  }
+
+  this->config = config;
+  this->callback = callback;
+  this->user = user;
+
+  // Keep the load factor at or below 1/2
+  size_t capacity = 16;
+  while (capacity < 2 * (size_t)config.expected_devices) {
+    capacity *= 2;
+  }
+  Slot empty = {0, EMPTY_SLOT, 0};
+  table.assign(capacity, empty);
+  device_ids.clear();
+  device_ids.reserve(config.expected_devices);
+  state_count = 0;
+  releaseStates();
+  size_t windows = (size_t)config.expected_devices * config.window_count;
+  if (!reserveStates(windows > 0 ? windows : config.window_count)) {
+    return false;
+  }
+  cursor = 0;
+  memset(&stats, 0, sizeof(stats));
+  return true;
+}
+
+uint32_t DeviceAggregator::findOrInsert(uint64_t device_id) {
+  size_t mask = table.size() - 1;
+  size_t pos = hashDevice(device_id) & mask;
+  while (table[pos].index != EMPTY_SLOT) {
+    if (table[pos].device_id == device_id) {
+      return table[pos].index;
+    }
+    pos = (pos + 1) & mask;
+  }
+
+  if (2 * (device_ids.size() + 1) > table.size()) {
+    grow();
+    return findOrInsert(device_id);
+  }
+
+  if (state_count + config.window_count > state_capacity &&
+      !reserveStates(2 * state_capacity)) {
+    return EMPTY_SLOT;
+  }
+
+  uint32_t index = (uint32_t)device_ids.size();
+  table[pos].device_id = device_id;
+  table[pos].index = index;
+  device_ids.push_back(device_id);
+  state_count += config.window_count; // Already zero: empty windows
+  return index;
+}
+
+void DeviceAggregator::grow() {
+  Slot empty = {0, EMPTY_SLOT, 0};
+  table.assign(table.size() * 2, empty);
+  size_t mask = table.size() - 1;
+  for (uint32_t index = 0; index < device_ids.size(); index++) {
+    size_t pos = hashDevice(device_ids[index]) & mask;
+    while (table[pos].index != EMPTY_SLOT) {
+      pos = (pos + 1) & mask;
+    }
+    table[pos].device_id = device_ids[index];
+    table[pos].index = index;
+  }
+}
+
+void DeviceAggregator::emit(uint32_t index, uint32_t window) {
+  if (callback != nullptr) {
+    callback(device_ids[index], window,
+             states[(size_t)index * config.window_count + window], user);
+  }
+  stats.emitted++;
+}
+
+void DeviceAggregator::update(uint64_t device_id, uint64_t timestamp_ms,
+                              const SensorReading &reading) {
+  uint32_t index = findOrInsert(device_id);
+  if (index == EMPTY_SLOT) {
+    return; // Out of memory
+  }
+  AggregateWindow *windows = &states[(size_t)index * config.window_count];
+
+  // Decode the present fields once, biased for min/max
+  uint32_t present = reading.presence_mask & ((1u << SENSOR_FIELD_COUNT) - 1);
+  int64_t values[SENSOR_FIELD_COUNT];
+  int32_t biased[SENSOR_FIELD_COUNT];
+  for (uint32_t bits = present; bits != 0; bits &= bits - 1) {
+    uint32_t flag = (uint32_t)__builtin_ctz(bits);
+    values[flag] = getSensorFieldValue(reading, (SensorFlag)flag, 0);
+    biased[flag] = (int32_t)(values[flag] - fieldBias(flag));
+  }
+  stats.updates++;
+
+  for (uint32_t w = 0; w < config.window_count; w++) {
+    AggregateWindow &aggregate = windows[w];
+    uint64_t start_ms = timestamp_ms - timestamp_ms % config.window_ms[w];
+    if (start_ms < aggregate.start_ms) {
+      stats.late++;
+      continue;
+    }
+    if (start_ms > aggregate.start_ms) {
+      if (aggregate.field_mask != 0) {
+        emit(index, w);
+      }
+      resetWindow(aggregate, start_ms);
+    }
+
+    aggregate.field_mask |= present;
+    for (uint32_t bits = present; bits != 0; bits &= bits - 1) {
+      uint32_t flag = (uint32_t)__builtin_ctz(bits);
+      uint16_t count = aggregate.count[flag];
+      if (count == 0) {
+        aggregate.sum[flag] = values[flag];
+        aggregate.min[flag] = biased[flag];
+        aggregate.max[flag] = biased[flag];
+      } else if (count == MAX_COUNT) {
+        continue;
+      } else {
+        aggregate.sum[flag] += values[flag];
+        if (biased[flag] < aggregate.min[flag])
+          aggregate.min[flag] = biased[flag];
+        if (biased[flag] > aggregate.max[flag])
+          aggregate.max[flag] = biased[flag];
+      }
+      aggregate.count[flag] = count + 1;
+      stats.values++;
+    }
+  }
+}
+
+int32_t DeviceAggregator::updatePayload(uint64_t device_id,
+                                       uint64_t received_ms,
+                                       const uint8_t *payload,
+                                       uint32_t length) {
+  PayloadDecoder decoder;
+  decoder.setPlanCache(&plans);
+  int32_t count = decoder.decode(payload, length);
+  if (count < 0) {
+    return -1;
+  }
+
+  uint64_t interval_ms = decoder.getHeader().interval_minutes * 60000ULL;
+  for (int32_t i = 0; i < count; i++) {
+    uint64_t age_ms = (uint64_t)(count - 1 - i) * interval_ms;
+    update(device_id, received_ms > age_ms ? received_ms - age_ms : 0,
+           decoder.getReading((uint8_t)i));
+  }
+  return count;
+}
+
+uint32_t DeviceAggregator::advance(uint64_t now_ms, uint32_t max_devices) {
+  uint32_t device_count = (uint32_t)device_ids.size();
+  if (device_count == 0) {
+    return 0;
+  }
+  if (max_devices > device_count) {
+    max_devices = device_count;
+  }
+
+  uint32_t closed = 0;
+  for (uint32_t visited = 0; visited < max_devices; visited++) {
+    if (cursor >= device_count) {
+      cursor = 0;
+    }
+    AggregateWindow *windows = &states[(size_t)cursor * config.window_count];
+    for (uint32_t w = 0; w < config.window_count; w++) {
+      AggregateWindow &aggregate = windows[w];
+      uint64_t end_ms = aggregate.start_ms + config.window_ms[w];
+      if (aggregate.field_mask != 0 && end_ms <= now_ms) {
+        emit(cursor, w);
+        // Readings for the closed window now count as late
+        resetWindow(aggregate, end_ms);
+        closed++;
+      }
+    }
+    cursor++;
+  }
+  return closed;
+}
+
+void DeviceAggregator::flush() {
+  for (uint32_t index = 0; index < device_ids.size(); index++) {
+    for (uint32_t w = 0; w < config.window_count; w++) {
+      AggregateWindow &aggregate =
+          states[(size_t)index * config.window_count + w];
+      if (aggregate.field_mask != 0) {
+        emit(index, w);
+        resetWindow(aggregate, aggregate.start_ms + config.window_ms[w]);
+      }
+    }
+  }
+}
+
+const AggregateWindow *DeviceAggregator::find(uint64_t device_id,
+                                              uint32_t window) const {
+  if (table.empty() || window >= config.window_count) {
+    return nullptr;
+  }
+  size_t mask = table.size() - 1;
+  size_t pos = hashDevice(device_id) & mask;
+  while (table[pos].index != EMPTY_SLOT) {
+    if (table[pos].device_id == device_id) {
+      return &states[(size_t)table[pos].index * config.window_count + window];
+    }
+    pos = (pos + 1) & mask;
+  }
+  return nullptr;
+}
+
+uint32_t DeviceAggregator::getDeviceCount() const {
+  return (uint32_t)device_ids.size();
+}
+
+uint64_t DeviceAggregator::getMemoryUsage() const {
+  return table.capacity() * sizeof(Slot) +
+         device_ids.capacity() * sizeof(uint64_t) +
+         region_bytes;
+}
+
+AggregatorStats DeviceAggregator::getStats() const { return stats; }
+
+double aggregateMean(const AggregateWindow &aggregate, SensorFlag flag) {
+  if (aggregate.count[flag] == 0) {
+    return 0;
+  }
+  return (double)aggregate.sum[flag] / aggregate.count[flag];
+}
+
+int64_t aggregateMin(const AggregateWindow &aggregate, SensorFlag flag) {
+  return aggregate.min[flag] + fieldBias(flag);
+}
+
+int64_t aggregateMax(const AggregateWindow &aggregate, SensorFlag flag) {
+  return aggregate.max[flag] + fieldBias(flag);
+}
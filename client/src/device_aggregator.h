@@ -0,0 +1,141 @@
+#ifndef DEVICE_AGGREGATOR_H
+#define DEVICE_AGGREGATOR_H
+
+#include "decode_plan.h"
+#include "sensor_fields.h"
+#include <stddef.h>
+#include <vector>
+
+// Tumbling-window mean/min/max per device and field, computed from decoded
+// readings. Windows are aligned to multiples of their length (a 5 min window
+// covers [12:00, 12:05)), and several window lengths are kept side by side.
+
+#define AGGREGATE_MAX_WINDOWS 4
+
+// Accumulators of one device for one window, stored as arrays indexed by
+// SensorFlag so an update touches a few contiguous cache lines
+typedef struct {
+  uint64_t start_ms;                  // Window start
+  uint32_t field_mask;                // Fields with at least one value
+  uint16_t count[SENSOR_FIELD_COUNT]; // Saturates at 65535 values
+  int64_t sum[SENSOR_FIELD_COUNT];
+  int32_t min[SENSOR_FIELD_COUNT];    // Biased, read with aggregateMin()
+  int32_t max[SENSOR_FIELD_COUNT];    // Biased, read with aggregateMax()
+} AggregateWindow;
+
+typedef struct {
+  uint32_t window_count;                    // 1..AGGREGATE_MAX_WINDOWS
+  uint64_t window_ms[AGGREGATE_MAX_WINDOWS];
+  uint32_t expected_devices;                // Presizes the state table
+} AggregatorConfig;
+
+typedef struct {
+  uint64_t updates; // Readings applied
+  uint64_t values;  // Field values accumulated (per window)
+  uint64_t late;    // Readings older than a device's open window, per window
+  uint64_t emitted; // Closed windows delivered to the callback
+} AggregatorStats;
+
+// Called when a window closes; window is the index into window_ms
+typedef void (*AggregateCallback)(uint64_t device_id, uint32_t window,
+                                  const AggregateWindow &aggregate, void *user);
+
+// Aggregation state for many devices. Devices are found through a flat
+// open-addressing table (linear probing) that maps a device id to a dense
+// state index; the per-window accumulators of all devices live in one
+// page-aligned region, which a snapshot can be mapped into directly.
+// Not thread-safe: shard devices across instances to scale out.
+class DeviceAggregator {
+public:
+  DeviceAggregator();
+  ~DeviceAggregator();
+
+  // Defaults: 5 min and 1 h windows, 1024 devices
+  static AggregatorConfig defaultConfig();
+
+  // Reset all state. callback may be nullptr.
+  // Returns: false if the configuration is invalid
+  bool init(const AggregatorConfig &config, AggregateCallback callback,
+            void *user);
+
+  // Apply one reading (channel 0 of dual-channel fields). A reading in a
+  // later window closes the device's open window first; a reading older than
+  // the open window is dropped for that window.
+  void update(uint64_t device_id, uint64_t timestamp_ms,
+              const SensorReading &reading);
+
+  // Decode a payload and apply its readings. The last reading is taken at
+  // received_ms and earlier ones one measurement interval apart.
+  // Returns: number of readings applied, or -1 if the payload is malformed
+  int32_t updatePayload(uint64_t device_id, uint64_t received_ms,
+                        const uint8_t *payload, uint32_t length);
+
+  // Close windows that ended at or before now_ms, visiting at most
+  // max_devices devices per call (a cursor carries over between calls) so
+  // rollover of a large fleet is spread over many small steps
+  // Returns: number of windows closed
+  uint32_t advance(uint64_t now_ms, uint32_t max_devices);
+
+  // Close every open window
+  void flush();
+
+  // Open window of a device, or nullptr if the device is unknown
+  const AggregateWindow *find(uint64_t device_id, uint32_t window) const;
+
+  uint32_t getDeviceCount() const;
+
+  // Bytes reserved for the table and device state
+  uint64_t getMemoryUsage() const;
+
+  AggregatorStats getStats() const;
+
+  // Write all state to path (via a temporary file and rename) together with
+  // the last WAL sequence it includes. See aggregator_snapshot.h.
+  // Returns: true on success
+  bool saveSnapshot(const char *path, uint64_t wal_sequence) const;
+
+  // Replace all state with a snapshot. The state array is mapped from the
+  // file copy-on-write, so restore cost is mostly the checksum pass. The
+  // callback set by init() is kept; on failure nothing is changed.
+  // Returns: true on success; wal_sequence receives the snapshot's sequence
+  bool restoreSnapshot(const char *path, uint64_t *wal_sequence);
+
+private:
+  DeviceAggregator(const DeviceAggregator &);
+  DeviceAggregator &operator=(const DeviceAggregator &);
+
+  typedef struct {
+    uint64_t device_id;
+    uint32_t index; // Dense state index, or UINT32_MAX if the slot is empty
+    uint32_t reserved;
+  } Slot;
+
+  uint32_t findOrInsert(uint64_t device_id);
+  void grow();
+  void emit(uint32_t index, uint32_t window);
+  bool reserveStates(size_t capacity);
+  void releaseStates();
+
+  AggregatorConfig config;
+  AggregateCallback callback;
+  void *user;
+
+  std::vector<Slot> table;             // Power-of-two capacity
+  std::vector<uint64_t> device_ids;    // Dense index -> device id
+  AggregateWindow *states;             // Dense index * window_count + window
+  size_t state_count;                  // Windows in use
+  size_t state_capacity;               // Windows the region can hold
+  size_t region_bytes;                 // Size of the states mapping
+  uint32_t cursor;                     // Next device visited by advance()
+  AggregatorStats stats;
+  DecodePlanCache plans;               // Used by updatePayload()
+};
+
+// Mean of a field in raw units (divide by kSensorFields[flag].scale)
+double aggregateMean(const AggregateWindow &aggregate, SensorFlag flag);
+
+// Min / max of a field in raw units
+int64_t aggregateMin(const AggregateWindow &aggregate, SensorFlag flag);
+int64_t aggregateMax(const AggregateWindow &aggregate, SensorFlag flag);
+
+#endif // DEVICE_AGGREGATOR_H
@@ -0,0 +1,60 @@
+#include "double_buffered_encoder.h"
+#include <string.h>
+
+// State word bits
+#define STATE_ACTIVE 1u  // Index of the batch the sampling task writes
+#define STATE_BUSY 2u    // addReading() is writing the active batch
+#define STATE_PENDING 4u // The active batch has readings
+
+DoubleBufferedEncoder::DoubleBufferedEncoder() : state(0), acquired(false) {
+  memset(&header, 0, sizeof(header));
+}
+
+void DoubleBufferedEncoder::init(const PayloadHeader &header) {
+  this->header = header;
+  batches[0].init(header);
+  batches[1].init(header);
+  acquired = false;
+  state.store(0, std::memory_order_release);
+}
+
+bool DoubleBufferedEncoder::addReading(const SensorReading &reading) {
+  // Announce the write first: a swap seen after this waits for the release
+  // below. PENDING is right even if the add fails, a full batch not being
+  // empty.
+  uint32_t current =
+      state.fetch_or(STATE_BUSY | STATE_PENDING, std::memory_order_acquire);
+  bool added = batches[current & STATE_ACTIVE].addReading(reading);
+  state.fetch_and(~STATE_BUSY, std::memory_order_release);
+  return added;
+}
+
+PayloadEncoder *DoubleBufferedEncoder::acquireBatch() {
+  if (acquired) {
+    return nullptr;
+  }
+  uint32_t current = state.load(std::memory_order_relaxed);
+  if ((current & STATE_PENDING) == 0 || (current & STATE_BUSY) != 0) {
+    return nullptr;
+  }
+  // Fails if addReading() started in between; the caller retries later
+  // rather than spinning against a task it may be preempting
+  uint32_t swapped = (current ^ STATE_ACTIVE) & ~STATE_PENDING;
+  if (!state.compare_exchange_strong(current, swapped,
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  acquired = true;
+  return &batches[current & STATE_ACTIVE];
+}
+
+void DoubleBufferedEncoder::releaseBatch() {
+  if (!acquired) {
+    return;
+  }
+  // Published to the sampling task by the next swap's release
+  uint32_t active = state.load(std::memory_order_relaxed) & STATE_ACTIVE;
+  batches[active ^ STATE_ACTIVE].init(header);
+  acquired = false;
+}
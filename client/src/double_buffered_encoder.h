@@ -0,0 +1,48 @@
+#ifndef DOUBLE_BUFFERED_ENCODER_H
+#define DOUBLE_BUFFERED_ENCODER_H
+
+#include "payload_encoder.h"
+#include <atomic>
+
+// Two PayloadEncoder batches in ping-pong: the sampling task adds readings
+// to the active one while the transmit task encodes and sends the other.
+// acquireBatch() swaps the active batch into the transmit slot with one
+// compare-and-swap on a state word, so neither batch is copied and
+// addReading() never waits, however long the transmission takes.
+//
+// One sampling task and one transmit task. init() must not run
+// concurrently with anything else.
+class DoubleBufferedEncoder {
+public:
+  DoubleBufferedEncoder();
+
+  // Reset both batches and set their header
+  void init(const PayloadHeader &header);
+
+  // Sampling task: add a reading to the active batch
+  // Returns: false if the active batch is full (the transmit task has not
+  // taken it yet)
+  bool addReading(const SensorReading &reading);
+
+  // Transmit task: take the active batch for encode() and transmission.
+  // The sampling task continues in the other batch, which must have been
+  // handed back with releaseBatch().
+  // Returns: the batch, or nullptr if it has no readings, the previous batch
+  // was not released, or a reading is being added at this instant (retry)
+  PayloadEncoder *acquireBatch();
+
+  // Transmit task: clear the acquired batch so the next swap can reuse it
+  void releaseBatch();
+
+private:
+  DoubleBufferedEncoder(const DoubleBufferedEncoder &);
+  DoubleBufferedEncoder &operator=(const DoubleBufferedEncoder &);
+
+  PayloadEncoder batches[2];
+  PayloadHeader header;
+  // Active batch index, plus the busy/pending bits in the .cpp
+  std::atomic<uint32_t> state;
+  bool acquired; // Transmit task only
+};
+
+#endif // DOUBLE_BUFFERED_ENCODER_H
@@ -0,0 +1,176 @@
+#include "file_flash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+bool readAt(int fd, uint8_t *data, uint32_t length, uint64_t offset) {
+  while (length > 0) {
+    ssize_t got = ::pread(fd, data, length, (off_t)offset);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return false;
+    data += got;
+    length -= (uint32_t)got;
+    offset += (uint64_t)got;
+  }
+  return true;
+}
+
+bool writeAt(int fd, const uint8_t *data, uint32_t length, uint64_t offset) {
+  while (length > 0) {
+    ssize_t written = ::pwrite(fd, data, length, (off_t)offset);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    length -= (uint32_t)written;
+    offset += (uint64_t)written;
+  }
+  return true;
+}
+
+} // namespace
+
+FileFlash::FileFlash()
+    : fd(-1), sector_size(0), sector_count(0), program_size(0),
+      cut_after(UINT64_MAX), cut(false) {}
+
+FileFlash::~FileFlash() { close(); }
+
+bool FileFlash::open(const char *path, uint32_t sector_size,
+                     uint32_t sector_count, uint32_t program_size) {
+  close();
+  if (sector_size == 0 || sector_count == 0 || program_size == 0) {
+    return false;
+  }
+  fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  this->sector_size = sector_size;
+  this->sector_count = sector_count;
+  this->program_size = program_size;
+  erase_counts.assign(sector_count, 0);
+  scratch.assign(sector_size, 0xFF);
+  cut_after = UINT64_MAX;
+  cut = false;
+
+  struct stat st;
+  uint64_t size = (uint64_t)sector_size * sector_count;
+  if (::fstat(fd, &st) != 0) {
+    close();
+    return false;
+  }
+  if ((uint64_t)st.st_size != size) {
+    if (::ftruncate(fd, 0) != 0) {
+      close();
+      return false;
+    }
+    for (uint32_t sector = 0; sector < sector_count; sector++) {
+      if (!writeAt(fd, scratch.data(), sector_size,
+                   (uint64_t)sector * sector_size)) {
+        close();
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void FileFlash::close() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+FlashRegion FileFlash::region() {
+  FlashRegion region;
+  region.sector_size = sector_size;
+  region.sector_count = sector_count;
+  region.program_size = program_size;
+  region.read = readFlash;
+  region.program = programFlash;
+  region.erase = eraseFlash;
+  region.context = this;
+  return region;
+}
+
+uint32_t FileFlash::eraseCount(uint32_t sector) const {
+  return sector < erase_counts.size() ? erase_counts[sector] : 0;
+}
+
+void FileFlash::setPowerCut(uint64_t program_bytes) {
+  cut_after = program_bytes;
+  cut = false;
+}
+
+bool FileFlash::powerCut() const { return cut; }
+
+bool FileFlash::readFlash(void *context, uint32_t address, uint8_t *data,
+                          uint32_t length) {
+  FileFlash *flash = (FileFlash *)context;
+  if (flash->fd < 0 ||
+      (uint64_t)address + length >
+          (uint64_t)flash->sector_size * flash->sector_count) {
+    return false;
+  }
+  return readAt(flash->fd, data, length, address);
+}
+
+bool FileFlash::programFlash(void *context, uint32_t address,
+                             const uint8_t *data, uint32_t length) {
+  FileFlash *flash = (FileFlash *)context;
+  if (flash->fd < 0 || flash->cut || address % flash->program_size != 0 ||
+      length % flash->program_size != 0 ||
+      address / flash->sector_size !=
+          (address + length - 1) / flash->sector_size ||
+      (uint64_t)address + length >
+          (uint64_t)flash->sector_size * flash->sector_count) {
+    return false;
+  }
+
+  // NOR: only erased bytes can be programmed
+  uint8_t *current = flash->scratch.data();
+  if (!readAt(flash->fd, current, length, address)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < length; i++) {
+    if (current[i] != 0xFF) {
+      return false;
+    }
+  }
+
+  uint32_t count = length;
+  if (flash->cut_after < length) {
+    count = (uint32_t)flash->cut_after;
+    flash->cut = true;
+  }
+  if (flash->cut_after != UINT64_MAX) {
+    flash->cut_after -= count;
+  }
+  if (!writeAt(flash->fd, data, count, address)) {
+    return false;
+  }
+  return !flash->cut;
+}
+
+bool FileFlash::eraseFlash(void *context, uint32_t sector) {
+  FileFlash *flash = (FileFlash *)context;
+  if (flash->fd < 0 || flash->cut || sector >= flash->sector_count) {
+    return false;
+  }
+  memset(flash->scratch.data(), 0xFF, flash->sector_size);
+  if (!writeAt(flash->fd, flash->scratch.data(), flash->sector_size,
+               (uint64_t)sector * flash->sector_size)) {
+    return false;
+  }
+  flash->erase_counts[sector]++;
+  return true;
+}
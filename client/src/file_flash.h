@@ -0,0 +1,56 @@
+#ifndef FILE_FLASH_H
+#define FILE_FLASH_H
+
+#include "payload_queue.h"
+#include <vector>
+
+// NOR flash emulated in a file, to run PayloadQueue on a host. program()
+// refuses bytes that are not erased and erase() fills a sector with 0xFF;
+// erase counts per sector are kept in memory. A power cut can be set up to
+// happen after a number of programmed bytes: the program() that reaches it
+// writes only the bytes before it, and later programs and erases fail.
+class FileFlash {
+public:
+  FileFlash();
+  ~FileFlash();
+
+  // Open or create path as sector_count sectors. A new file, or one of
+  // another size, starts erased.
+  // Returns: false if the file cannot be opened or sized
+  bool open(const char *path, uint32_t sector_size, uint32_t sector_count,
+            uint32_t program_size);
+
+  void close();
+
+  // Callbacks for PayloadQueue::mount(), bound to this object
+  FlashRegion region();
+
+  uint32_t eraseCount(uint32_t sector) const;
+
+  // Cut power once this many more bytes are programmed; UINT64_MAX never
+  // cuts (and restores power after a cut)
+  void setPowerCut(uint64_t program_bytes);
+
+  bool powerCut() const;
+
+private:
+  FileFlash(const FileFlash &);
+  FileFlash &operator=(const FileFlash &);
+
+  static bool readFlash(void *context, uint32_t address, uint8_t *data,
+                        uint32_t length);
+  static bool programFlash(void *context, uint32_t address,
+                           const uint8_t *data, uint32_t length);
+  static bool eraseFlash(void *context, uint32_t sector);
+
+  int fd;
+  uint32_t sector_size;
+  uint32_t sector_count;
+  uint32_t program_size;
+  std::vector<uint32_t> erase_counts;
+  std::vector<uint8_t> scratch; // One sector
+  uint64_t cut_after;           // Bytes left before the power cut
+  bool cut;
+};
+
+#endif // FILE_FLASH_H
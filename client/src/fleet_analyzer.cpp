@@ -0,0 +1,481 @@
+#include "fleet_analyzer.h"
+#include "decode_plan.h"
+#include "payload_record.h"
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <memory>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// Field bits of a presence mask
+#define FLEET_FIELD_BITS ((1u << SENSOR_FIELD_COUNT) - 1)
+
+// Header bits of a combination key, above the field bits
+#define FLEET_KEY_DUAL (1u << SENSOR_FIELD_COUNT)
+#define FLEET_KEY_DEDICATED (1u << (SENSOR_FIELD_COUNT + 1))
+
+const char *fleetVariantName(FleetVariant variant) {
+  switch (variant) {
+  case FLEET_VARIANT_MASK_ELISION:
+    return "mask_elision";
+  case FLEET_VARIANT_DELTA:
+    return "delta";
+  case FLEET_VARIANT_BITPACK:
+    return "bitpack";
+  case FLEET_VARIANT_COMBINED:
+    return "combined";
+  default:
+    return "unknown";
+  }
+}
+
+// Bytes of a zigzag-encoded LEB128 varint
+static inline uint32_t zigzagVarintSize(int64_t value) {
+  uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  uint32_t bits = zigzag != 0 ? 64 - __builtin_clzll(zigzag) : 1;
+  return (bits + 6) / 7;
+}
+
+FleetAnalyzer::FleetAnalyzer() { reset(); }
+
+void FleetAnalyzer::setPlanCache(DecodePlanCache *cache) {
+  decoder.setPlanCache(cache);
+}
+
+void FleetAnalyzer::reset() {
+  decoder.reset();
+  memset(&totals, 0, sizeof(totals));
+  masks.clear();
+}
+
+bool FleetAnalyzer::addPayload(const uint8_t *payload, uint32_t length) {
+  int32_t count = decoder.decode(payload, length);
+  if (count < 0) {
+    totals.malformed++;
+    return false;
+  }
+
+  const PayloadHeader &header = decoder.getHeader();
+  uint8_t widths[SENSOR_FIELD_COUNT];
+  uint8_t channels[SENSOR_FIELD_COUNT];
+  for (uint8_t f = 0; f < SENSOR_FIELD_COUNT; f++) {
+    widths[f] = sensorFieldWidth((SensorFlag)f);
+    channels[f] =
+        header.dual_mode && decoder.isExpandable((SensorFlag)f) ? 2 : 1;
+  }
+  uint32_t key_bits = (header.dual_mode ? FLEET_KEY_DUAL : 0) |
+                      (header.dedicated_temphum_sensor ? FLEET_KEY_DEDICATED : 0);
+
+  // Attribution: per reading, per field and per combination. Consecutive
+  // readings usually share a combination, so the last one is kept at hand
+  // (map nodes do not move on rehash).
+  uint32_t fields = 0, first_mask = 0;
+  bool same_mask = true;
+  FleetMaskProfile *profile = nullptr;
+  for (int32_t i = 0; i < count; i++) {
+    uint32_t mask =
+        decoder.getReading((uint8_t)i).presence_mask & FLEET_FIELD_BITS;
+    if (i == 0) {
+      first_mask = mask;
+    } else {
+      same_mask = same_mask && mask == first_mask;
+    }
+    fields |= mask;
+
+    uint32_t bytes = 4;
+    for (uint32_t bits = mask; bits != 0; bits &= bits - 1) {
+      uint32_t f = (uint32_t)__builtin_ctz(bits);
+      uint32_t size = (uint32_t)widths[f] * channels[f];
+      totals.field_readings[f]++;
+      totals.field_bytes[f] += size;
+      bytes += size;
+    }
+
+    if (profile == nullptr || profile->presence_mask != mask) {
+      uint32_t key = mask | key_bits;
+      std::unordered_map<uint32_t, FleetMaskProfile>::iterator it =
+          masks.find(key);
+      if (it == masks.end()) {
+        FleetMaskProfile added;
+        added.presence_mask = mask;
+        added.dual_mode = header.dual_mode;
+        added.dedicated_temphum_sensor = header.dedicated_temphum_sensor;
+        added.readings = 0;
+        added.bytes = 0;
+        it = masks.insert(std::make_pair(key, added)).first;
+      }
+      profile = &it->second;
+    }
+    profile->readings++;
+    profile->bytes += bytes;
+  }
+
+  // Variants: every field channel of the payload as one series
+  uint64_t delta_bytes = 0, bitpack_bytes = 0, best_bytes = 0;
+  uint32_t field_channels = 0;
+  for (uint32_t bits = fields; bits != 0; bits &= bits - 1) {
+    SensorFlag flag = (SensorFlag)__builtin_ctz(bits);
+    uint32_t width = widths[flag];
+    for (uint8_t channel = 0; channel < channels[flag]; channel++) {
+      uint32_t n = 0, delta = width;
+      int64_t previous = 0, low = 0, high = 0;
+      for (int32_t i = 0; i < count; i++) {
+        const SensorReading &reading = decoder.getReading((uint8_t)i);
+        if (!IS_FLAG_SET(reading.presence_mask, flag)) {
+          continue;
+        }
+        int64_t value = getSensorFieldValue(reading, flag, channel);
+        if (n == 0) {
+          low = high = value;
+        } else {
+          delta += zigzagVarintSize(value - previous);
+          low = std::min(low, value);
+          high = std::max(high, value);
+        }
+        previous = value;
+        n++;
+      }
+      uint64_t range = (uint64_t)(high - low);
+      uint32_t range_bits = range != 0 ? 64 - __builtin_clzll(range) : 0;
+      uint32_t bitpack = n > 1 ? width + 1 + (n * range_bits + 7) / 8 : width;
+
+      totals.field_delta_bytes[flag] += delta;
+      totals.field_bitpack_bytes[flag] += bitpack;
+      delta_bytes += delta;
+      bitpack_bytes += bitpack;
+      best_bytes += std::min(delta, bitpack);
+      field_channels++;
+    }
+  }
+
+  uint64_t mask_bytes = 4 * (uint64_t)count;
+  uint64_t elided_mask_bytes = same_mask && count > 1 ? 4 : mask_bytes;
+  totals.payloads++;
+  totals.readings += (uint64_t)count;
+  totals.payload_bytes += length;
+  totals.header_bytes += 2;
+  totals.mask_bytes += mask_bytes;
+  totals.variant_bytes[FLEET_VARIANT_MASK_ELISION] +=
+      length - mask_bytes + elided_mask_bytes;
+  totals.variant_bytes[FLEET_VARIANT_DELTA] += 2 + mask_bytes + delta_bytes;
+  totals.variant_bytes[FLEET_VARIANT_BITPACK] += 2 + mask_bytes + bitpack_bytes;
+  totals.variant_bytes[FLEET_VARIANT_COMBINED] +=
+      2 + elided_mask_bytes + best_bytes + (field_channels + 7) / 8;
+  return true;
+}
+
+void FleetAnalyzer::merge(const FleetAnalyzer &other) {
+  // FleetTotals is all uint64_t counters
+  static_assert(sizeof(FleetTotals) % sizeof(uint64_t) == 0,
+                "FleetTotals must only hold uint64_t counters");
+  uint64_t *sum = (uint64_t *)&totals;
+  const uint64_t *add = (const uint64_t *)&other.totals;
+  for (size_t i = 0; i < sizeof(FleetTotals) / sizeof(uint64_t); i++) {
+    sum[i] += add[i];
+  }
+
+  for (std::unordered_map<uint32_t, FleetMaskProfile>::const_iterator it =
+           other.masks.begin();
+       it != other.masks.end(); ++it) {
+    std::unordered_map<uint32_t, FleetMaskProfile>::iterator found =
+        masks.find(it->first);
+    if (found == masks.end()) {
+      masks.insert(*it);
+    } else {
+      found->second.readings += it->second.readings;
+      found->second.bytes += it->second.bytes;
+    }
+  }
+}
+
+const FleetTotals &FleetAnalyzer::getTotals() const { return totals; }
+
+static bool moreBytes(const FleetMaskProfile &a, const FleetMaskProfile &b) {
+  if (a.bytes != b.bytes) {
+    return a.bytes > b.bytes;
+  }
+  if (a.presence_mask != b.presence_mask) {
+    return a.presence_mask < b.presence_mask;
+  }
+  if (a.dual_mode != b.dual_mode) {
+    return b.dual_mode;
+  }
+  return b.dedicated_temphum_sensor && !a.dedicated_temphum_sensor;
+}
+
+void FleetAnalyzer::getMasks(std::vector<FleetMaskProfile> *out) const {
+  out->clear();
+  out->reserve(masks.size());
+  for (std::unordered_map<uint32_t, FleetMaskProfile>::const_iterator it =
+           masks.begin();
+       it != masks.end(); ++it) {
+    out->push_back(it->second);
+  }
+  std::sort(out->begin(), out->end(), moreBytes);
+}
+
+FleetScanConfig defaultFleetScanConfig() {
+  FleetScanConfig config;
+  config.threads = std::thread::hardware_concurrency();
+  if (config.threads == 0) {
+    config.threads = 1;
+  }
+  config.chunk_bytes = 64ULL << 20;
+  return config;
+}
+
+namespace {
+
+struct ScanFile {
+  const uint8_t *data;
+  uint64_t size;
+};
+
+struct ScanChunk {
+  uint32_t file;
+  uint64_t begin;
+  uint64_t end;
+};
+
+struct ScanWorker {
+  FleetAnalyzer analyzer;
+  FleetScanStats stats;
+};
+
+} // namespace
+
+// Offset of the first valid record at or after pos, or size
+static uint64_t findRecord(const uint8_t *data, uint64_t size, uint64_t pos) {
+  while (pos + PAYLOAD_RECORD_HEADER_SIZE <= size) {
+    const uint8_t *magic = (const uint8_t *)memchr(
+        data + pos, PAYLOAD_RECORD_MAGIC & 0xFF, size - pos);
+    if (magic == nullptr) {
+      break;
+    }
+    pos = (uint64_t)(magic - data);
+    uint64_t remaining = size - pos;
+    uint32_t available = remaining < (1u << 30) ? (uint32_t)remaining : 1u << 30;
+    if (readPayloadRecord(data + pos, available, nullptr, nullptr) > 0) {
+      return pos;
+    }
+    pos++;
+  }
+  return size;
+}
+
+// Profile the records that start in [begin, end) of a mapped segment. A
+// chunk that has found a record owns the bytes up to the next valid record,
+// even past its end, so skipped bytes are counted exactly once.
+static void scanChunk(ScanWorker *worker, const ScanFile &file, uint64_t begin,
+                      uint64_t end) {
+  bool synced = begin == 0;
+  uint64_t pos = begin;
+  while (pos < file.size) {
+    uint64_t remaining = file.size - pos;
+    uint32_t available = remaining < (1u << 30) ? (uint32_t)remaining : 1u << 30;
+    PayloadRecordHeader header;
+    const uint8_t *payload;
+    int32_t size = readPayloadRecord(file.data + pos, available, &header,
+                                     &payload);
+    if (size > 0) {
+      if (pos >= end) {
+        break; // First record of a later chunk
+      }
+      worker->analyzer.addPayload(payload, header.length);
+      worker->stats.records++;
+      pos += (uint64_t)size;
+      synced = true;
+      continue;
+    }
+    uint64_t next = size == 0 ? file.size // Torn record at end of file
+                              : findRecord(file.data, file.size, pos + 1);
+    if (synced) {
+      worker->stats.skipped_bytes += next - pos;
+    }
+    pos = next;
+  }
+}
+
+static void scanChunks(ScanWorker *worker, const std::vector<ScanFile> *files,
+                       const std::vector<ScanChunk> *chunks,
+                       std::atomic<size_t> *next_chunk) {
+  size_t index;
+  while ((index = next_chunk->fetch_add(1)) < chunks->size()) {
+    const ScanChunk &chunk = (*chunks)[index];
+    scanChunk(worker, (*files)[chunk.file], chunk.begin, chunk.end);
+  }
+}
+
+bool analyzeArchiveFiles(const std::vector<std::string> &inputs,
+                         const FleetScanConfig &config, FleetAnalyzer *result,
+                         FleetScanStats *stats) {
+  uint32_t threads = config.threads > 0 ? config.threads : 1;
+  uint64_t chunk_bytes = config.chunk_bytes > 0 ? config.chunk_bytes : 1;
+  memset(stats, 0, sizeof(*stats));
+
+  std::vector<ScanFile> files;
+  std::vector<ScanChunk> chunks;
+  bool ok = true;
+  for (size_t f = 0; f < inputs.size(); f++) {
+    int fd = ::open(inputs[f].c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      ok = false;
+      break;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    if (size == 0) {
+      ::close(fd);
+      continue;
+    }
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      ok = false;
+      break;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    stats->input_bytes += size;
+
+    ScanFile file = {(const uint8_t *)mapping, size};
+    for (uint64_t begin = 0; begin < size; begin += chunk_bytes) {
+      ScanChunk chunk = {(uint32_t)files.size(), begin,
+                         std::min(size, begin + chunk_bytes)};
+      chunks.push_back(chunk);
+    }
+    files.push_back(file);
+  }
+
+  if (ok) {
+    DecodePlanCache plans;
+    std::unique_ptr<ScanWorker[]> workers(new ScanWorker[threads]);
+    std::atomic<size_t> next_chunk(0);
+    std::vector<std::thread> running;
+    for (uint32_t t = 0; t < threads; t++) {
+      workers[t].analyzer.setPlanCache(&plans);
+      memset(&workers[t].stats, 0, sizeof(workers[t].stats));
+      running.push_back(std::thread(scanChunks, &workers[t], &files, &chunks,
+                                    &next_chunk));
+    }
+    for (size_t t = 0; t < running.size(); t++) {
+      running[t].join();
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+      result->merge(workers[t].analyzer);
+      stats->records += workers[t].stats.records;
+      stats->skipped_bytes += workers[t].stats.skipped_bytes;
+    }
+  }
+
+  for (size_t f = 0; f < files.size(); f++) {
+    munmap((void *)files[f].data, files[f].size);
+  }
+  return ok;
+}
+
+static void appendf(std::string *out, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string *out, const char *format, ...) {
+  char text[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (length > 0) {
+    out->append(text, std::min((size_t)length, sizeof(text) - 1));
+  }
+}
+
+static double share(uint64_t part, uint64_t whole) {
+  return whole > 0 ? (double)part / (double)whole : 0.0;
+}
+
+void formatFleetReportJson(const FleetAnalyzer &analyzer,
+                           const FleetScanStats *scan, uint32_t max_masks,
+                           std::string *out) {
+  const FleetTotals &t = analyzer.getTotals();
+  uint64_t data_bytes = t.payload_bytes - t.header_bytes - t.mask_bytes;
+
+  out->append("{\n");
+  if (scan != nullptr) {
+    appendf(out,
+            "  \"input_bytes\": %llu,\n  \"records\": %llu,\n"
+            "  \"skipped_bytes\": %llu,\n",
+            (unsigned long long)scan->input_bytes,
+            (unsigned long long)scan->records,
+            (unsigned long long)scan->skipped_bytes);
+  }
+  appendf(out,
+          "  \"payloads\": %llu,\n  \"readings\": %llu,\n"
+          "  \"malformed\": %llu,\n",
+          (unsigned long long)t.payloads, (unsigned long long)t.readings,
+          (unsigned long long)t.malformed);
+  appendf(out,
+          "  \"payload_bytes\": %llu,\n  \"header_bytes\": %llu,\n"
+          "  \"mask_bytes\": %llu,\n  \"data_bytes\": %llu,\n",
+          (unsigned long long)t.payload_bytes,
+          (unsigned long long)t.header_bytes, (unsigned long long)t.mask_bytes,
+          (unsigned long long)data_bytes);
+  appendf(out, "  \"header_share\": %.6f,\n  \"mask_share\": %.6f,\n",
+          share(t.header_bytes, t.payload_bytes),
+          share(t.mask_bytes, t.payload_bytes));
+
+  out->append("  \"fields\": [");
+  bool first = true;
+  for (uint8_t f = 0; f < SENSOR_FIELD_COUNT; f++) {
+    if (t.field_readings[f] == 0) {
+      continue;
+    }
+    appendf(out,
+            "%s\n    {\"name\": \"%s\", \"readings\": %llu, \"bytes\": %llu, "
+            "\"share\": %.6f, ",
+            first ? "" : ",", kSensorFields[f].name,
+            (unsigned long long)t.field_readings[f],
+            (unsigned long long)t.field_bytes[f],
+            share(t.field_bytes[f], t.payload_bytes));
+    appendf(out, "\"delta_bytes\": %llu, \"bitpack_bytes\": %llu}",
+            (unsigned long long)t.field_delta_bytes[f],
+            (unsigned long long)t.field_bitpack_bytes[f]);
+    first = false;
+  }
+  out->append(first ? "],\n" : "\n  ],\n");
+
+  out->append("  \"variants\": [");
+  for (uint8_t v = 0; v < FLEET_VARIANT_COUNT; v++) {
+    int64_t saved = (int64_t)t.payload_bytes - (int64_t)t.variant_bytes[v];
+    appendf(out,
+            "%s\n    {\"name\": \"%s\", \"bytes\": %llu, \"saved\": %lld, "
+            "\"saved_share\": %.6f}",
+            v > 0 ? "," : "", fleetVariantName((FleetVariant)v),
+            (unsigned long long)t.variant_bytes[v], (long long)saved,
+            t.payload_bytes > 0 ? (double)saved / (double)t.payload_bytes
+                                : 0.0);
+  }
+  out->append("\n  ],\n");
+
+  std::vector<FleetMaskProfile> masks;
+  analyzer.getMasks(&masks);
+  appendf(out, "  \"combinations\": %llu,\n  \"masks\": [",
+          (unsigned long long)masks.size());
+  for (size_t i = 0; i < masks.size() && i < max_masks; i++) {
+    const FleetMaskProfile &m = masks[i];
+    appendf(out,
+            "%s\n    {\"mask\": \"0x%07x\", \"dual\": %s, \"dedicated\": %s, "
+            "\"readings\": %llu, \"bytes\": %llu, \"share\": %.6f}",
+            i > 0 ? "," : "", m.presence_mask, m.dual_mode ? "true" : "false",
+            m.dedicated_temphum_sensor ? "true" : "false",
+            (unsigned long long)m.readings, (unsigned long long)m.bytes,
+            share(m.bytes, t.payload_bytes));
+  }
+  out->append(masks.empty() || max_masks == 0 ? "]\n}\n" : "\n  ]\n}\n");
+}
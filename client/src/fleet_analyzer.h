@@ -0,0 +1,121 @@
+#ifndef FLEET_ANALYZER_H
+#define FLEET_ANALYZER_H
+
+#include "payload_decoder.h"
+#include "sensor_fields.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class DecodePlanCache;
+
+// Where the bytes of a fleet's payloads go: (presence mask, dual mode,
+// dedicated temp/hum) combinations, bytes per sensor field, header and mask
+// overhead, and what alternative encodings would save.
+
+// Format variants whose payload size is estimated. Header and masks are
+// kept unless stated; a "field channel" is one field's values on one
+// channel within a payload.
+typedef enum {
+  // One mask per payload when all its readings share it (a reserved
+  // metadata bit would flag this)
+  FLEET_VARIANT_MASK_ELISION = 0,
+  // First value of each field channel at full width, the rest as zigzag
+  // varint differences to the previous reading
+  FLEET_VARIANT_DELTA = 1,
+  // Per field channel: the minimum at full width, a bit-width byte and the
+  // offsets from the minimum packed at that width
+  FLEET_VARIANT_BITPACK = 2,
+  // Mask elision plus the smaller of delta and bit-packing for each field
+  // channel, with one selector bit per field channel
+  FLEET_VARIANT_COMBINED = 3,
+  FLEET_VARIANT_COUNT = 4
+} FleetVariant;
+
+// Name used in reports ("mask_elision", "delta", ...)
+const char *fleetVariantName(FleetVariant variant);
+
+typedef struct {
+  uint64_t payloads;
+  uint64_t readings;
+  uint64_t malformed;     // Payloads the decoder rejected (not counted below)
+  uint64_t payload_bytes; // Header + masks + sensor data
+  uint64_t header_bytes;
+  uint64_t mask_bytes;
+  uint64_t field_readings[SENSOR_FIELD_COUNT]; // Readings with the field
+  uint64_t field_bytes[SENSOR_FIELD_COUNT];    // Wire bytes of the field
+  uint64_t field_delta_bytes[SENSOR_FIELD_COUNT];   // Field under DELTA
+  uint64_t field_bitpack_bytes[SENSOR_FIELD_COUNT]; // Field under BITPACK
+  uint64_t variant_bytes[FLEET_VARIANT_COUNT]; // Payload bytes per variant
+} FleetTotals;
+
+// Readings and bytes (mask + sensor data) of one combination
+typedef struct {
+  uint32_t presence_mask;
+  bool dual_mode;
+  bool dedicated_temphum_sensor;
+  uint64_t readings;
+  uint64_t bytes;
+} FleetMaskProfile;
+
+// Accumulates the profile of payloads. One analyzer per thread; merge()
+// them at the end.
+class FleetAnalyzer {
+public:
+  FleetAnalyzer();
+
+  // Decode with compiled plans from a shared cache (nullptr: field by field)
+  void setPlanCache(DecodePlanCache *cache);
+
+  // Returns: false if the payload is malformed
+  bool addPayload(const uint8_t *payload, uint32_t length);
+
+  // Add the counts of another analyzer
+  void merge(const FleetAnalyzer &other);
+
+  void reset();
+
+  const FleetTotals &getTotals() const;
+
+  // Combinations seen, most bytes first
+  void getMasks(std::vector<FleetMaskProfile> *masks) const;
+
+private:
+  FleetAnalyzer(const FleetAnalyzer &);
+  FleetAnalyzer &operator=(const FleetAnalyzer &);
+
+  PayloadDecoder decoder;
+  FleetTotals totals;
+  std::unordered_map<uint32_t, FleetMaskProfile> masks;
+};
+
+typedef struct {
+  uint32_t threads;
+  uint64_t chunk_bytes; // Work unit; threads claim chunks of the inputs
+} FleetScanConfig;
+
+typedef struct {
+  uint64_t input_bytes;
+  uint64_t records;
+  uint64_t skipped_bytes; // Corrupt or torn bytes between records
+} FleetScanStats;
+
+// Defaults: hardware threads, 64 MiB chunks
+FleetScanConfig defaultFleetScanConfig();
+
+// Profile every payload of archive segments (payload_archive.h). Inputs are
+// mapped with mmap and split into chunks; a thread takes the records that
+// start in its chunk, resyncing at the chunk start like
+// ArchiveReader::openRange.
+// Returns: false if an input cannot be read
+bool analyzeArchiveFiles(const std::vector<std::string> &inputs,
+                         const FleetScanConfig &config, FleetAnalyzer *result,
+                         FleetScanStats *stats);
+
+// Append a JSON report: totals and shares, fields with any readings,
+// variants, and the max_masks largest combinations. scan may be nullptr.
+void formatFleetReportJson(const FleetAnalyzer &analyzer,
+                           const FleetScanStats *scan, uint32_t max_masks,
+                           std::string *out);
+
+#endif // FLEET_ANALYZER_H
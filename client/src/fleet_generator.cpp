@@ -0,0 +1,312 @@
+#include "fleet_generator.h"
+#include "payload_encoder.h"
+#include <math.h>
+#include <string.h>
+
+#define MINUTES_PER_DAY 1440
+
+typedef struct {
+  const char *name;
+  bool dual_mode;
+  bool dedicated_temphum_sensor;
+  uint8_t interval_minutes;
+  uint8_t min_batch, max_batch;
+  uint32_t fields;   // Fields the hardware reports
+  uint32_t optional; // Fields that drop out (sensor warming up, I2C errors)
+} ProfileInfo;
+
+#define B(flag) FLAG_BIT(FLAG_##flag)
+
+static const ProfileInfo kProfiles[FLEET_PROFILE_COUNT] = {
+    {"indoor", false, false, 1, 1, 3,
+     B(TEMP) | B(HUM) | B(CO2) | B(TVOC) | B(TVOC_RAW) | B(NOX) | B(NOX_RAW) |
+         B(PM_01) | B(PM_25) | B(PM_10) | B(PM_03_PC) | B(SIGNAL),
+     B(CO2) | B(TVOC) | B(TVOC_RAW) | B(NOX) | B(NOX_RAW) | B(PM_03_PC)},
+    {"outdoor", true, false, 1, 1, 5,
+     B(TEMP) | B(HUM) | B(PM_01) | B(PM_25) | B(PM_10) | B(PM_01_SP) |
+         B(PM_25_SP) | B(PM_10_SP) | B(PM_03_PC) | B(PM_05_PC) | B(PM_01_PC) |
+         B(PM_25_PC) | B(TVOC_RAW) | B(NOX_RAW) | B(SIGNAL),
+     B(PM_01_SP) | B(PM_25_SP) | B(PM_10_SP) | B(PM_05_PC) | B(PM_01_PC) |
+         B(PM_25_PC) | B(TVOC_RAW) | B(NOX_RAW)},
+    {"solar", false, false, 5, 6, 20,
+     B(TEMP) | B(HUM) | B(PM_25) | B(PM_03_PC) | B(VBAT) | B(VPANEL) |
+         B(SIGNAL),
+     B(PM_03_PC) | B(VPANEL)},
+    {"gas", false, true, 2, 1, 10,
+     B(TEMP) | B(HUM) | B(PM_25) | B(O3_WE) | B(O3_AE) | B(NO2_WE) |
+         B(NO2_AE) | B(AFE_TEMP) | B(SIGNAL),
+     B(PM_25) | B(AFE_TEMP)},
+};
+
+#undef B
+
+// Daily cycle by minute of day: -1 before dawn, +1 mid afternoon
+static const float *dailyCycle() {
+  static struct Table {
+    float value[MINUTES_PER_DAY];
+    Table() {
+      for (int m = 0; m < MINUTES_PER_DAY; m++) {
+        value[m] = (float)cos(2 * M_PI * (m - 15 * 60) / MINUTES_PER_DAY);
+      }
+    }
+  } table;
+  return table.value;
+}
+
+// xorshift64*
+static inline uint64_t nextRandom(uint64_t &state) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1Dull;
+}
+
+// Uniform in [0, 1)
+static inline float uniform(uint64_t &state) {
+  return (float)(nextRandom(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+// Roughly normal, mean 0, standard deviation 1 (sum of four uniforms)
+static inline float noise(uint64_t &state) {
+  uint64_t r = nextRandom(state);
+  float sum = (float)((r & 0xFFFF) + ((r >> 16) & 0xFFFF) +
+                      ((r >> 32) & 0xFFFF) + (r >> 48));
+  return (sum * (1.0f / 65536.0f) - 2.0f) * 1.7320508f;
+}
+
+static inline uint64_t splitMix(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+static inline uint16_t toUint16(float value) {
+  return value <= 0 ? 0 : value >= 65535 ? 65535 : (uint16_t)(value + 0.5f);
+}
+
+static inline int16_t toInt16(float value) {
+  return value <= -32768 ? -32768
+                         : value >= 32767 ? 32767 : (int16_t)lrintf(value);
+}
+
+static inline float drift(float previous, uint64_t &state) {
+  return 0.95f * previous + 0.3f * noise(state);
+}
+
+const char *fleetProfileName(FleetProfile profile) {
+  return profile < FLEET_PROFILE_COUNT ? kProfiles[profile].name : "unknown";
+}
+
+void initFleetConfig(FleetConfig &config) {
+  config.devices = 1000;
+  config.seed = 1;
+  config.first_device_id = 1;
+  config.start_ms = 1704067200000ull; // 2024-01-01T00:00:00Z
+  config.mix[FLEET_INDOOR] = 50;
+  config.mix[FLEET_OUTDOOR] = 30;
+  config.mix[FLEET_SOLAR] = 10;
+  config.mix[FLEET_GAS] = 10;
+  config.dropout = 0.02;
+}
+
+FleetGenerator::FleetGenerator() { initFleetConfig(config); }
+
+bool FleetGenerator::init(const FleetConfig &config) {
+  uint32_t total = 0;
+  for (int p = 0; p < FLEET_PROFILE_COUNT; p++) {
+    total += config.mix[p];
+  }
+  if (config.devices == 0 || total == 0 ||
+      !(config.dropout >= 0 && config.dropout <= 1)) {
+    return false;
+  }
+  this->config = config;
+  dailyCycle();
+
+  devices.resize(config.devices);
+  for (uint32_t i = 0; i < config.devices; i++) {
+    Device &device = devices[i];
+    device.rng = splitMix(config.seed ^ splitMix(i)) | 1;
+
+    uint32_t pick = (uint32_t)(nextRandom(device.rng) % total);
+    int p = 0;
+    while (pick >= config.mix[p]) {
+      pick -= config.mix[p++];
+    }
+    device.profile = (FleetProfile)p;
+    const ProfileInfo &info = kProfiles[p];
+    device.header.version = 1;
+    device.header.dual_mode = info.dual_mode;
+    device.header.dedicated_temphum_sensor = info.dedicated_temphum_sensor;
+    device.header.interval_minutes = info.interval_minutes;
+
+    bool indoor = device.profile == FLEET_INDOOR;
+    device.phase_min = (uint32_t)(nextRandom(device.rng) % 180);
+    device.temp_base = indoor ? 21 + 2 * noise(device.rng)
+                              : 12 + 8 * noise(device.rng);
+    device.hum_base = 50 + 10 * noise(device.rng);
+    // Log-normal site PM2.5 around 8 ug/m3
+    device.pm_base = (indoor ? 6.0f : 10.0f) * expf(0.7f * noise(device.rng));
+    device.co2_base = indoor ? 450 + 50 * uniform(device.rng) : 420;
+    device.channel_bias = 1 + 0.05f * noise(device.rng);
+    device.drift_temp = device.drift_hum = device.drift_pm = 0;
+    device.drift_co2 = device.drift_gas = 0;
+    device.signal = -75 + 8 * noise(device.rng);
+    device.battery = 3700 + 300 * uniform(device.rng);
+
+    // Stagger first sends over one payload period
+    uint32_t span = info.max_batch - info.min_batch + 1;
+    device.batch = (uint8_t)(info.min_batch + nextRandom(device.rng) % span);
+    uint64_t period_ms = (uint64_t)device.batch * info.interval_minutes * 60000;
+    device.next_send_ms = config.start_ms + nextRandom(device.rng) % period_ms;
+  }
+  return true;
+}
+
+uint32_t FleetGenerator::getDeviceCount() const {
+  return (uint32_t)devices.size();
+}
+
+uint64_t FleetGenerator::nextSendTime(uint32_t device) const {
+  return devices[device].next_send_ms;
+}
+
+void FleetGenerator::nextReading(Device &device, uint64_t time_ms,
+                                 SensorReading &reading) {
+  const ProfileInfo &info = kProfiles[device.profile];
+  uint64_t &rng = device.rng;
+  uint32_t minute =
+      (uint32_t)((time_ms / 60000 + device.phase_min) % MINUTES_PER_DAY);
+  float day = dailyCycle()[minute];
+  float occupancy = dailyCycle()[(minute + 240) % MINUTES_PER_DAY];
+
+  device.drift_temp = drift(device.drift_temp, rng);
+  device.drift_hum = drift(device.drift_hum, rng);
+  device.drift_pm = drift(device.drift_pm, rng);
+  device.drift_co2 = drift(device.drift_co2, rng);
+  device.drift_gas = drift(device.drift_gas, rng);
+
+  // Indoor climate follows the day weakly; humidity falls as it warms
+  float swing = device.profile == FLEET_INDOOR ? 1.0f : 5.0f;
+  float temp = device.temp_base + swing * day + 0.8f * device.drift_temp;
+  float hum = device.hum_base - 3 * swing * day - 3 * device.drift_temp +
+              4 * device.drift_hum;
+  hum = hum < 5 ? 5 : hum > 99 ? 99 : hum;
+
+  // PM builds up overnight, with occasional short events
+  float pm25 = device.pm_base * (1 - 0.3f * day) * (1 + 0.35f * device.drift_pm);
+  if (pm25 < 0.05f * device.pm_base) {
+    pm25 = 0.05f * device.pm_base;
+  }
+  if (uniform(rng) < 0.003f) {
+    pm25 *= 3 + 5 * uniform(rng);
+  }
+  float cf1 = 1 + 0.5f * (pm25 < 100 ? pm25 : 100) / 100;
+  float pm03 = 150 * pm25 + 200;
+
+  uint32_t mask = info.fields;
+  if (config.dropout > 0) {
+    for (uint32_t bits = info.optional; bits != 0; bits &= bits - 1) {
+      if (uniform(rng) < config.dropout) {
+        mask &= ~(bits & (0u - bits));
+      }
+    }
+  }
+  reading.presence_mask = mask;
+
+  for (int channel = 0; channel < 2; channel++) {
+    float bias = channel == 0 ? 1.0f : device.channel_bias;
+    reading.temp[channel] = toInt16(temp * 100 * bias);
+    reading.hum[channel] = toUint16(hum * 100 * bias);
+    reading.pm_01[channel] = toUint16(0.68f * pm25 * 10 * bias);
+    reading.pm_25[channel] = toUint16(pm25 * 10 * bias);
+    reading.pm_10[channel] = toUint16(1.3f * pm25 * 10 * bias);
+    reading.pm_01_sp[channel] = toUint16(0.68f * pm25 * cf1 * 10 * bias);
+    reading.pm_25_sp[channel] = toUint16(pm25 * cf1 * 10 * bias);
+    reading.pm_10_sp[channel] = toUint16(1.3f * pm25 * cf1 * 10 * bias);
+    reading.pm_03_pc[channel] = toUint16(pm03 * bias);
+    reading.pm_05_pc[channel] = toUint16(0.3f * pm03 * bias);
+    reading.pm_01_pc[channel] = toUint16(0.06f * pm03 * bias);
+    reading.pm_25_pc[channel] = toUint16(0.008f * pm03 * bias);
+    reading.pm_5_pc[channel] = toUint16(0.001f * pm03 * bias);
+    reading.pm_10_pc[channel] = toUint16(0.0003f * pm03 * bias);
+  }
+
+  float people = occupancy > 0 ? occupancy : 0;
+  reading.co2 = toUint16(device.co2_base + 700 * people + 30 * device.drift_co2);
+  reading.tvoc = toUint16(100 + 60 * people + 20 * device.drift_co2);
+  reading.tvoc_raw = toUint16(31000 - 1500 * people - 400 * device.drift_co2);
+  reading.nox = toUint16(1 + fabsf(device.drift_gas));
+  reading.nox_raw = toUint16(16500 + 300 * device.drift_gas);
+
+  // Batteries charge while the sun is up and drain at night
+  float sun = day > 0 ? day : 0;
+  device.battery += 6 * sun - 2;
+  device.battery = device.battery < 3300 ? 3300
+                                         : device.battery > 4200 ? 4200
+                                                                 : device.battery;
+  reading.vbat = toUint16(device.battery);
+  reading.vpanel = toUint16(6000 * sun + 50 * uniform(rng));
+
+  // Electrode voltages (mV * 1000) for ozone peaking in the afternoon and
+  // NO2 with the rush hours
+  float o3_ppb = 30 + 25 * day + 5 * device.drift_gas;
+  float no2_ppb = 18 - 8 * day + 4 * noise(rng);
+  o3_ppb = o3_ppb < 0 ? 0 : o3_ppb;
+  no2_ppb = no2_ppb < 0 ? 0 : no2_ppb;
+  float o3_ae = 230 + 0.5f * noise(rng);
+  float no2_ae = 236 + 0.5f * noise(rng);
+  reading.o3_ae = (uint32_t)(o3_ae * 1000);
+  reading.o3_we = (uint32_t)((220 + (o3_ae - 230) - 0.45f * o3_ppb -
+                              0.40f * no2_ppb) * 1000);
+  reading.no2_ae = (uint32_t)(no2_ae * 1000);
+  reading.no2_we = (uint32_t)((225 + (no2_ae - 236) - 0.35f * no2_ppb) * 1000);
+  reading.afe_temp = toUint16((temp + 3) * 10);
+
+  device.signal += noise(rng);
+  device.signal = device.signal < -110 ? -110
+                                       : device.signal > -50 ? -50
+                                                             : device.signal;
+  reading.signal = (int8_t)lrintf(device.signal);
+}
+
+int32_t FleetGenerator::generate(uint32_t index, uint8_t *buffer,
+                                 uint32_t size, FleetPayloadInfo *info) {
+  Device &device = devices[index];
+  const ProfileInfo &profile = kProfiles[device.profile];
+  Device saved = device;
+
+  uint8_t count = device.batch;
+  uint64_t interval_ms = (uint64_t)profile.interval_minutes * 60000;
+  uint64_t send_ms = device.next_send_ms;
+
+  PayloadEncoder encoder;
+  encoder.init(device.header);
+  SensorReading reading;
+  memset(&reading, 0, sizeof(reading));
+  for (uint8_t i = 0; i < count; i++) {
+    nextReading(device, send_ms - (uint64_t)(count - 1 - i) * interval_ms,
+                reading);
+    encoder.addReading(reading);
+  }
+  int32_t length = encoder.encode(buffer, size);
+  if (length < 0) {
+    device = saved;
+    return -1;
+  }
+
+  // The next payload holds the readings taken after this one was sent
+  uint32_t span = profile.max_batch - profile.min_batch + 1;
+  device.batch = (uint8_t)(profile.min_batch + nextRandom(device.rng) % span);
+  device.next_send_ms = send_ms + device.batch * interval_ms;
+
+  if (info != nullptr) {
+    info->device_id = config.first_device_id + index;
+    info->timestamp_ms = send_ms;
+    info->length = (uint32_t)length;
+    info->reading_count = count;
+    info->profile = device.profile;
+  }
+  return length;
+}
@@ -0,0 +1,96 @@
+#ifndef FLEET_GENERATOR_H
+#define FLEET_GENERATOR_H
+
+#include "payload_types.h"
+#include <vector>
+
+// Synthetic device fleet for load tests. Each device follows one of a few
+// hardware profiles (header flags, fields, batch sizes) and produces
+// correlated time series: a daily cycle shifted per device, slow AR(1)
+// drift, and fields derived from each other as real sensors report them
+// (humidity against temperature, PM1/PM10 and particle counts from PM2.5,
+// the second channel of dual-mode devices close to the first).
+//
+// Devices are independent: each has its own random state seeded from
+// (seed, device index), so a device's payloads do not depend on which
+// thread generates them or in what order devices are visited. Distinct
+// devices may be generated from different threads at once.
+
+typedef enum {
+  FLEET_INDOOR = 0,  // CO2, TVOC/NOx, PM; 1-3 readings per payload
+  FLEET_OUTDOOR = 1, // Dual-channel PM and temp/hum; 1-5 readings
+  FLEET_SOLAR = 2,   // Battery/panel powered outdoor; 6-20 readings
+  FLEET_GAS = 3,     // Electrochemical O3/NO2 with a dedicated temp/hum
+                     // sensor; 1-10 readings
+  FLEET_PROFILE_COUNT = 4
+} FleetProfile;
+
+typedef struct {
+  uint32_t devices;
+  uint64_t seed;
+  uint64_t first_device_id;             // Devices get consecutive ids
+  uint64_t start_ms;                    // Simulated start time
+  uint32_t mix[FLEET_PROFILE_COUNT];    // Relative share of each profile
+  double dropout;                       // Chance an optional field is
+                                        // missing from a reading
+} FleetConfig;
+
+typedef struct {
+  uint64_t device_id;
+  uint64_t timestamp_ms; // Send time: the time of the last reading
+  uint32_t length;
+  uint8_t reading_count;
+  FleetProfile profile;
+} FleetPayloadInfo;
+
+// Profile names ("indoor", "outdoor", "solar", "gas")
+const char *fleetProfileName(FleetProfile profile);
+
+// Defaults: 1000 devices, seed 1, ids from 1, start 2024-01-01, mix
+// 50/30/10/10, dropout 0.02
+void initFleetConfig(FleetConfig &config);
+
+class FleetGenerator {
+public:
+  FleetGenerator();
+
+  // Set up every device; not thread-safe
+  // Returns: false if the config is invalid
+  bool init(const FleetConfig &config);
+
+  uint32_t getDeviceCount() const;
+
+  // Simulated time of the device's next payload
+  uint64_t nextSendTime(uint32_t device) const;
+
+  // Encode the device's next payload into buffer (MAX_PAYLOAD_SIZE bytes
+  // always suffice) and advance its clock
+  // Returns: payload length, or -1 if buffer is too small (the device does
+  // not advance)
+  int32_t generate(uint32_t device, uint8_t *buffer, uint32_t size,
+                   FleetPayloadInfo *info);
+
+private:
+  typedef struct {
+    uint64_t rng;
+    uint64_t next_send_ms;
+    uint8_t batch; // Readings in the next payload
+    FleetProfile profile;
+    PayloadHeader header;
+    uint32_t phase_min;        // Shift of the daily cycle, minutes
+    float temp_base, hum_base; // Site climate
+    float pm_base;             // Typical PM2.5, ug/m3
+    float co2_base;
+    float channel_bias;        // Second channel relative to the first
+    float drift_temp, drift_hum, drift_pm, drift_co2, drift_gas;
+    float signal;              // dBm, random walk
+    float battery;             // mV
+  } Device;
+
+  void nextReading(Device &device, uint64_t time_ms, SensorReading &reading);
+
+  FleetConfig config;
+  std::vector<Device> devices;
+};
+
+#endif // FLEET_GENERATOR_H
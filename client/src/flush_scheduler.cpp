@@ -0,0 +1,174 @@
+#include "flush_scheduler.h"
+
+// Payload header bytes (metadata + interval)
+#define FLUSH_HEADER_BYTES 2
+
+FlushScheduler::FlushScheduler() { init(defaultConfig()); }
+
+FlushPolicyConfig FlushScheduler::defaultConfig() {
+  FlushPolicyConfig config;
+  config.session_cost = 2000000;
+  config.byte_cost = 50;
+  config.max_age_s = 3600;
+  config.max_bytes = MAX_PAYLOAD_SIZE;
+  config.good_signal_dbm = -85;
+  config.poor_signal_dbm = -110;
+  config.poor_signal_cost_pct = 400;
+  config.poor_signal_defer_s = 900;
+  config.signal_aware = true;
+  return config;
+}
+
+bool FlushScheduler::init(const FlushPolicyConfig &config) {
+  if (config.max_age_s == 0 || config.max_bytes <= FLUSH_HEADER_BYTES ||
+      config.good_signal_dbm <= config.poor_signal_dbm ||
+      config.poor_signal_cost_pct < 100) {
+    return false;
+  }
+  this->config = config;
+  batch_bytes = 0;
+  batch_readings = 0;
+  oldest_s = 0;
+  last_reading_s = 0;
+  interval_s = 0;
+  reading_bytes = 0;
+  signal_dbm = 0;
+  current_pct = 100;
+  average_pct = 100;
+  variance = 0;
+  covariance = 0;
+  has_reading = false;
+  has_signal = false;
+  return true;
+}
+
+uint32_t FlushScheduler::signalCostPct(int8_t signal_dbm) const {
+  if (signal_dbm >= config.good_signal_dbm) {
+    return 100;
+  }
+  if (signal_dbm <= config.poor_signal_dbm) {
+    return config.poor_signal_cost_pct;
+  }
+  // Linear in dBm between the two points
+  uint32_t below = (uint32_t)(config.good_signal_dbm - signal_dbm);
+  uint32_t range =
+      (uint32_t)(config.good_signal_dbm - config.poor_signal_dbm);
+  return 100 + below * (config.poor_signal_cost_pct - 100u) / range;
+}
+
+uint64_t FlushScheduler::sessionCost(uint32_t bytes, int8_t signal_dbm) const {
+  uint64_t cost = config.session_cost + (uint64_t)config.byte_cost * bytes;
+  return cost * signalCostPct(signal_dbm) / 100;
+}
+
+void FlushScheduler::onReading(const SensorReading &reading,
+                               uint32_t batch_bytes, uint8_t batch_readings,
+                               uint32_t now_s) {
+  if (IS_FLAG_SET(reading.presence_mask, FLAG_SIGNAL)) {
+    signal_dbm = reading.signal;
+    uint32_t previous_pct = current_pct;
+    current_pct = signalCostPct(reading.signal);
+    if (!has_signal) {
+      average_pct = current_pct;
+      previous_pct = current_pct;
+    }
+    // Long-run moving averages (about 64 readings) of the multiplier, its
+    // variance and its covariance with the previous reading
+    average_pct = (average_pct * 63 + current_pct + 32) / 64;
+    int64_t deviation = (int64_t)current_pct - average_pct;
+    int64_t previous_deviation = (int64_t)previous_pct - average_pct;
+    variance = (variance * 63 + deviation * deviation) / 64;
+    covariance = (covariance * 63 + deviation * previous_deviation) / 64;
+    has_signal = true;
+  }
+  if (has_reading && now_s >= last_reading_s) {
+    uint32_t delta = now_s - last_reading_s;
+    interval_s = interval_s == 0 ? delta : (interval_s * 7 + delta + 4) / 8;
+  }
+  last_reading_s = now_s;
+  has_reading = true;
+
+  if (batch_readings <= 1) {
+    oldest_s = now_s; // First reading of the batch
+  }
+  if (batch_readings > 0 && batch_bytes > FLUSH_HEADER_BYTES) {
+    reading_bytes = (batch_bytes - FLUSH_HEADER_BYTES + batch_readings - 1) /
+                    batch_readings;
+  }
+  this->batch_bytes = batch_bytes;
+  this->batch_readings = batch_readings;
+}
+
+FlushDecision FlushScheduler::decide(uint32_t now_s) const {
+  if (batch_readings == 0) {
+    return FLUSH_WAIT;
+  }
+  if (batch_readings >= MAX_BATCH_SIZE ||
+      batch_bytes + reading_bytes > config.max_bytes) {
+    return FLUSH_FULL;
+  }
+
+  // Due when the next reading would arrive past the bound
+  uint32_t age = now_s >= oldest_s ? now_s - oldest_s : 0;
+  bool due = interval_s == 0 ? age >= config.max_age_s
+                             : age + interval_s > config.max_age_s;
+  if (due) {
+    bool poor = config.signal_aware && has_signal &&
+                signal_dbm <= config.poor_signal_dbm;
+    if (poor &&
+        age + interval_s <= config.max_age_s + config.poor_signal_defer_s) {
+      return FLUSH_WAIT; // Likely a costly session or a failed one
+    }
+    return FLUSH_DEADLINE;
+  }
+
+  if (!config.signal_aware || !has_signal || interval_s == 0 ||
+      reading_bytes == 0 || current_pct >= average_pct) {
+    return FLUSH_WAIT;
+  }
+
+  // Bytes the batch would hold when it next becomes due or full
+  uint32_t until_due = (config.max_age_s - age) / interval_s;
+  uint32_t until_full = MAX_BATCH_SIZE - batch_readings;
+  uint32_t room = (config.max_bytes - batch_bytes) / reading_bytes;
+  until_full = until_full < room ? until_full : room;
+  if (until_full <= until_due) {
+    // Filling up decides the session count; sending early only adds one
+    return FLUSH_WAIT;
+  }
+  uint32_t more = until_due;
+  uint64_t later_bytes = batch_bytes + (uint64_t)more * reading_bytes;
+
+  // Expected multiplier then: the signal is correlated from reading to
+  // reading, so the current deviation from the average decays by the lag-1
+  // autocorrelation (1/1024 units) per reading rather than vanishing
+  uint64_t rho = 0;
+  if (variance > 0 && covariance > 0) {
+    rho = covariance >= variance ? 1024 : (uint64_t)(covariance * 1024 / variance);
+  }
+  uint64_t decay = 1024;
+  for (uint32_t i = 0; i < more && decay > 0; i++) {
+    decay = decay * rho / 1024;
+  }
+  uint64_t later_pct =
+      average_pct - (average_pct - current_pct) * decay / 1024;
+
+  // Compare cost per byte now and at the expected signal later:
+  // cost_now / batch_bytes < cost_later / later_bytes
+  uint64_t cost_now =
+      (config.session_cost + (uint64_t)config.byte_cost * batch_bytes) *
+      current_pct;
+  uint64_t cost_later =
+      (config.session_cost + (uint64_t)config.byte_cost * later_bytes) *
+      later_pct;
+  if (cost_now * later_bytes < cost_later * batch_bytes) {
+    return FLUSH_SIGNAL;
+  }
+  return FLUSH_WAIT;
+}
+
+void FlushScheduler::onFlush(uint32_t now_s) {
+  batch_bytes = 0;
+  batch_readings = 0;
+  oldest_s = now_s;
+}
@@ -0,0 +1,79 @@
+#ifndef FLUSH_SCHEDULER_H
+#define FLUSH_SCHEDULER_H
+
+#include "payload_types.h"
+
+// Decides when to encode and transmit the current batch. A radio session
+// costs a fixed amount plus an amount per byte, both scaled up as the signal
+// weakens (more transmit power, retransmissions), so batches are held as
+// long as the reporting latency bound allows and sent early only when the
+// signal is good enough to beat the saving of a bigger batch. Integer
+// arithmetic only.
+
+typedef struct {
+  uint32_t session_cost;      // Cost of one session, e.g. uJ (attach, tail)
+  uint32_t byte_cost;         // Cost per payload byte
+  uint32_t max_age_s;         // Latency bound for the oldest reading
+  uint32_t max_bytes;         // Flush before a payload would exceed this
+  int8_t good_signal_dbm;     // At or above: nominal cost
+  int8_t poor_signal_dbm;     // At or below: poor_signal_cost_pct
+  uint16_t poor_signal_cost_pct; // Cost multiplier at poor signal (>= 100)
+  uint32_t poor_signal_defer_s;  // Extra age allowed while the signal is poor
+  bool signal_aware;          // false: flush only when full or due
+} FlushPolicyConfig;
+
+typedef enum {
+  FLUSH_WAIT = 0,     // Keep batching
+  FLUSH_FULL = 1,     // The next reading would not fit
+  FLUSH_DEADLINE = 2, // The next reading would push past max_age_s
+  FLUSH_SIGNAL = 3    // Good signal now beats waiting for a bigger batch
+} FlushDecision;
+
+class FlushScheduler {
+public:
+  FlushScheduler();
+
+  // Defaults: 2 J sessions, 50 uJ/byte, 1 h latency, -85/-110 dBm at 1x/4x,
+  // 15 min extra under poor signal
+  static FlushPolicyConfig defaultConfig();
+
+  // Reset all state
+  // Returns: false if the configuration is invalid
+  bool init(const FlushPolicyConfig &config);
+
+  // Call after each addReading() with the batch's calculateTotalSize() and
+  // getReadingCount(). The signal is taken from the reading if FLAG_SIGNAL
+  // is set.
+  void onReading(const SensorReading &reading, uint32_t batch_bytes,
+                 uint8_t batch_readings, uint32_t now_s);
+
+  // Whether to flush now
+  FlushDecision decide(uint32_t now_s) const;
+
+  // Call after the batch was sent (or dropped) and the encoder reset
+  void onFlush(uint32_t now_s);
+
+  // Cost of a session sending bytes at a signal strength
+  uint64_t sessionCost(uint32_t bytes, int8_t signal_dbm) const;
+
+  // Cost multiplier in percent at a signal strength
+  uint32_t signalCostPct(int8_t signal_dbm) const;
+
+private:
+  FlushPolicyConfig config;
+  uint32_t batch_bytes;
+  uint8_t batch_readings;
+  uint32_t oldest_s;       // Time of the batch's first reading
+  uint32_t last_reading_s;
+  uint32_t interval_s;     // Average time between readings, 0 if unknown
+  uint32_t reading_bytes;  // Average bytes per reading, 0 if unknown
+  int8_t signal_dbm;       // Last known signal
+  uint32_t current_pct;    // Cost multiplier at the last known signal
+  uint32_t average_pct;    // Long-run moving average of the multiplier
+  int64_t variance;        // Of the multiplier around average_pct
+  int64_t covariance;      // Between consecutive multipliers
+  bool has_reading;        // last_reading_s is set
+  bool has_signal;
+};
+
+#endif // FLUSH_SCHEDULER_H
@@ -0,0 +1,205 @@
+#include "flush_simulator.h"
+#include "payload_encoder.h"
+#include <stdio.h>
+#include <string.h>
+
+void initFlushTraceConfig(FlushTraceConfig &config) {
+  config.seed = 1;
+  config.hours = 24 * 7;
+  config.interval_s = 60;
+  config.mean_signal_dbm = -95;
+  config.fade_percent = 10;
+  config.fade_readings = 5;
+}
+
+static uint32_t nextRandom(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+void generateFlushTrace(const FlushTraceConfig &config,
+                        std::vector<FlushTraceEntry> *trace) {
+  trace->clear();
+  uint32_t interval = config.interval_s > 0 ? config.interval_s : 1;
+  uint32_t count = (uint32_t)((uint64_t)config.hours * 3600 / interval);
+  uint32_t mask = FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_HUM) |
+                  FLAG_BIT(FLAG_CO2) | FLAG_BIT(FLAG_TVOC) |
+                  FLAG_BIT(FLAG_NOX) | FLAG_BIT(FLAG_PM_01) |
+                  FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_PM_10) |
+                  FLAG_BIT(FLAG_PM_03_PC) | FLAG_BIT(FLAG_SIGNAL);
+
+  // Fades end with probability 1 / fade_readings per reading; entering one
+  // is as likely as needed for fade_percent of the time
+  uint32_t fade_percent = config.fade_percent < 100 ? config.fade_percent : 99;
+  uint32_t exit_per_mille =
+      1000 / (config.fade_readings > 0 ? config.fade_readings : 1);
+  uint32_t enter_per_mille =
+      exit_per_mille * fade_percent / (100 - fade_percent);
+  uint32_t state = config.seed != 0 ? config.seed : 1;
+  int32_t walk = config.mean_signal_dbm;
+  bool fade = false;
+
+  trace->reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t roll = nextRandom(state) % 1000;
+    fade = fade ? roll >= exit_per_mille : roll < enter_per_mille;
+    // Random walk pulled back towards the mean
+    walk += (int32_t)(nextRandom(state) % 5) - 2;
+    walk += (config.mean_signal_dbm - walk) / 8;
+    int32_t signal = fade ? -115 + (int32_t)(nextRandom(state) % 7) - 3 : walk;
+    signal = signal < -127 ? -127 : (signal > -40 ? -40 : signal);
+
+    FlushTraceEntry entry;
+    entry.time_s = i * interval;
+    entry.signal_dbm = (int8_t)signal;
+    entry.presence_mask = mask;
+    trace->push_back(entry);
+  }
+}
+
+bool loadFlushTrace(const char *path, std::vector<FlushTraceEntry> *trace) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  trace->clear();
+  char line[256];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file) != nullptr) {
+    char *comment = strchr(line, '#');
+    if (comment != nullptr) {
+      *comment = '\0';
+    }
+    unsigned time_s, mask;
+    int signal;
+    char extra;
+    int fields = sscanf(line, "%u %d %x %c", &time_s, &signal, &mask, &extra);
+    if (fields <= 0) {
+      continue; // Blank or comment
+    }
+    if (fields != 3 || signal < -128 || signal > 127) {
+      ok = false;
+      break;
+    }
+    FlushTraceEntry entry;
+    entry.time_s = time_s;
+    entry.signal_dbm = (int8_t)signal;
+    entry.presence_mask = mask;
+    trace->push_back(entry);
+  }
+  fclose(file);
+  return ok;
+}
+
+bool saveFlushTrace(const char *path,
+                    const std::vector<FlushTraceEntry> &trace) {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    return false;
+  }
+  fprintf(file, "# time_s signal_dbm presence_mask\n");
+  for (size_t i = 0; i < trace.size(); i++) {
+    fprintf(file, "%u %d %x\n", trace[i].time_s, trace[i].signal_dbm,
+            trace[i].presence_mask);
+  }
+  return fclose(file) == 0;
+}
+
+// Batch in flight during a simulation
+typedef struct {
+  PayloadEncoder encoder;
+  PayloadHeader header;
+  uint64_t time_sum; // Of the batched readings
+  uint32_t oldest_s;
+} SimBatch;
+
+static void flushBatch(SimBatch &batch, FlushScheduler &scheduler,
+                       uint32_t now_s, int8_t signal_dbm,
+                       FlushDecision decision, FlushSimResult *result) {
+  uint32_t count = batch.encoder.getReadingCount();
+  uint32_t bytes = batch.encoder.calculateTotalSize();
+  result->sessions++;
+  result->payload_bytes += bytes;
+  result->cost += scheduler.sessionCost(bytes, signal_dbm);
+  result->latency_sum_s += (uint64_t)now_s * count - batch.time_sum;
+  if (now_s - batch.oldest_s > result->max_latency_s) {
+    result->max_latency_s = now_s - batch.oldest_s;
+  }
+  result->decisions[decision]++;
+  batch.encoder.init(batch.header);
+  batch.time_sum = 0;
+  scheduler.onFlush(now_s);
+}
+
+bool simulateFlushPolicy(const std::vector<FlushTraceEntry> &trace,
+                         const PayloadHeader &header, FlushPolicy policy,
+                         const FlushPolicyConfig &config,
+                         FlushSimResult *result) {
+  FlushPolicyConfig policy_config = config;
+  policy_config.signal_aware = policy == FLUSH_POLICY_ADAPTIVE;
+  FlushScheduler scheduler;
+  if (policy >= FLUSH_POLICY_COUNT || !scheduler.init(policy_config)) {
+    return false;
+  }
+  memset(result, 0, sizeof(FlushSimResult));
+
+  SimBatch batch;
+  batch.header = header;
+  batch.encoder.init(header);
+  batch.time_sum = 0;
+  batch.oldest_s = 0;
+  for (size_t i = 0; i < trace.size(); i++) {
+    const FlushTraceEntry &entry = trace[i];
+    if (i > 0 && entry.time_s < trace[i - 1].time_s) {
+      return false;
+    }
+    SensorReading reading;
+    initSensorReading(&reading);
+    reading.presence_mask = entry.presence_mask;
+    reading.signal = entry.signal_dbm;
+
+    if (!batch.encoder.addReading(reading)) {
+      // The only trigger of FLUSH_POLICY_WHEN_FULL
+      flushBatch(batch, scheduler, entry.time_s, entry.signal_dbm, FLUSH_FULL,
+                 result);
+      batch.encoder.addReading(reading);
+    }
+    if (batch.encoder.getReadingCount() == 1) {
+      batch.oldest_s = entry.time_s;
+    }
+    batch.time_sum += entry.time_s;
+    result->readings++;
+    if (policy == FLUSH_POLICY_WHEN_FULL) {
+      continue;
+    }
+
+    scheduler.onReading(reading, batch.encoder.calculateTotalSize(),
+                        batch.encoder.getReadingCount(), entry.time_s);
+    FlushDecision decision = scheduler.decide(entry.time_s);
+    if (decision != FLUSH_WAIT) {
+      flushBatch(batch, scheduler, entry.time_s, entry.signal_dbm, decision,
+                 result);
+    }
+  }
+  if (batch.encoder.getReadingCount() > 0) {
+    const FlushTraceEntry &last = trace.back();
+    flushBatch(batch, scheduler, last.time_s, last.signal_dbm, FLUSH_WAIT,
+               result);
+  }
+  return true;
+}
+
+const char *flushPolicyName(FlushPolicy policy) {
+  switch (policy) {
+  case FLUSH_POLICY_WHEN_FULL:
+    return "when_full";
+  case FLUSH_POLICY_DEADLINE:
+    return "deadline";
+  case FLUSH_POLICY_ADAPTIVE:
+    return "adaptive";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef FLUSH_SIMULATOR_H
+#define FLUSH_SIMULATOR_H
+
+#include "flush_scheduler.h"
+#include <vector>
+
+// Replays a device's readings through PayloadEncoder under a flush policy
+// and totals the radio sessions, bytes, cost and reporting latency, to
+// compare policies on the same trace.
+
+// One reading of a trace. Field values do not affect payload size, so a
+// trace only records which fields were present.
+typedef struct {
+  uint32_t time_s;
+  int8_t signal_dbm;
+  uint32_t presence_mask; // FLAG_SIGNAL set if the device reported signal
+} FlushTraceEntry;
+
+typedef enum {
+  FLUSH_POLICY_WHEN_FULL = 0, // Flush when addReading() fails (firmware today)
+  FLUSH_POLICY_DEADLINE = 1,  // FlushScheduler without signal awareness
+  FLUSH_POLICY_ADAPTIVE = 2,  // FlushScheduler
+  FLUSH_POLICY_COUNT = 3
+} FlushPolicy;
+
+typedef struct {
+  uint64_t readings;
+  uint64_t sessions;
+  uint64_t payload_bytes;
+  uint64_t cost;             // FlushScheduler::sessionCost() at flush signal
+  uint64_t latency_sum_s;    // Over readings: flush time - reading time
+  uint32_t max_latency_s;    // Worst-case reporting latency
+  uint64_t decisions[4];     // Sessions by FlushDecision (WAIT: end of trace)
+} FlushSimResult;
+
+typedef struct {
+  uint32_t seed;
+  uint32_t hours;
+  uint32_t interval_s;      // Time between readings
+  int8_t mean_signal_dbm;   // The signal walks around this
+  uint32_t fade_percent;    // Share of time in deep fades (about -115 dBm)
+  uint32_t fade_readings;   // Mean length of a fade
+} FlushTraceConfig;
+
+// Defaults: 7 days, one reading a minute, -95 dBm, 10% in fades of about
+// 5 readings
+void initFlushTraceConfig(FlushTraceConfig &config);
+
+// Synthetic trace of an indoor monitor (temp, hum, CO2, TVOC, NOx, PM,
+// signal) whose signal wanders and drops into fades
+void generateFlushTrace(const FlushTraceConfig &config,
+                        std::vector<FlushTraceEntry> *trace);
+
+// Read a trace of "time_s signal_dbm presence_mask_hex" lines ('#' starts a
+// comment)
+// Returns: false if the file cannot be read or a line is malformed
+bool loadFlushTrace(const char *path, std::vector<FlushTraceEntry> *trace);
+
+// Write a trace in the format loadFlushTrace() reads
+bool saveFlushTrace(const char *path, const std::vector<FlushTraceEntry> &trace);
+
+// Replay trace under policy. config bounds latency and prices sessions for
+// every policy. Whatever is batched at the end is flushed at the last time.
+// Returns: false if config is invalid or the trace goes back in time
+bool simulateFlushPolicy(const std::vector<FlushTraceEntry> &trace,
+                         const PayloadHeader &header, FlushPolicy policy,
+                         const FlushPolicyConfig &config,
+                         FlushSimResult *result);
+
+// Policy name ("when_full", "deadline", "adaptive")
+const char *flushPolicyName(FlushPolicy policy);
+
+#endif // FLUSH_SIMULATOR_H
@@ -0,0 +1,183 @@
+#include "ingest_metrics.h"
+#include <atomic>
+#include <stdio.h>
+
+const char *ingestStageName(IngestStage stage) {
+  switch (stage) {
+  case INGEST_STAGE_RECEIVE:
+    return "receive";
+  case INGEST_STAGE_DECODE:
+    return "decode";
+  case INGEST_STAGE_AGGREGATE:
+    return "aggregate";
+  case INGEST_STAGE_PERSIST:
+    return "persist";
+  default:
+    return "unknown";
+  }
+}
+
+IngestTracer::IngestTracer(uint32_t sample_shift)
+    : items(0),
+      sample_mask(sample_shift < 63 ? (1ULL << sample_shift) - 1 : ~0ULL) {}
+
+void IngestTracer::addTo(IngestStage stage, LatencyHistogram *histogram) const {
+  stages[stage].addTo(histogram);
+}
+
+struct IngestMetrics::Metric {
+  std::string name;
+  std::string labels;
+  std::string help;
+  bool gauge;
+  std::atomic<int64_t> value;
+};
+
+IngestMetrics::IngestMetrics()
+    : stages(new LatencyHistogram[INGEST_STAGE_COUNT]) {}
+
+IngestMetrics::~IngestMetrics() {}
+
+IngestTracer *IngestMetrics::addTracer(uint32_t sample_shift) {
+  std::lock_guard<std::mutex> lock(mutex);
+  tracers.push_back(std::unique_ptr<IngestTracer>(new IngestTracer(sample_shift)));
+  return tracers.back().get();
+}
+
+uint32_t IngestMetrics::addMetric(const char *name, const char *labels,
+                                  const char *help, bool gauge) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<Metric> metric(new Metric);
+  metric->name = name;
+  metric->labels = labels != nullptr ? labels : "";
+  metric->help = help != nullptr ? help : "";
+  metric->gauge = gauge;
+  metric->value.store(0, std::memory_order_relaxed);
+  metrics.push_back(std::move(metric));
+  return (uint32_t)(metrics.size() - 1);
+}
+
+uint32_t IngestMetrics::addCounter(const char *name, const char *labels,
+                                   const char *help) {
+  return addMetric(name, labels, help, false);
+}
+
+uint32_t IngestMetrics::addGauge(const char *name, const char *labels,
+                                 const char *help) {
+  return addMetric(name, labels, help, true);
+}
+
+void IngestMetrics::add(uint32_t id, int64_t delta) {
+  metrics[id]->value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+void IngestMetrics::set(uint32_t id, int64_t value) {
+  metrics[id]->value.store(value, std::memory_order_relaxed);
+}
+
+int64_t IngestMetrics::get(uint32_t id) const {
+  return metrics[id]->value.load(std::memory_order_relaxed);
+}
+
+void IngestMetrics::collect() {
+  // Merge outside the lock; only the swap into place is serialized
+  std::unique_ptr<LatencyHistogram[]> merged(
+      new LatencyHistogram[INGEST_STAGE_COUNT]);
+  std::vector<IngestTracer *> current;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < tracers.size(); i++) {
+      current.push_back(tracers[i].get());
+    }
+  }
+  for (size_t i = 0; i < current.size(); i++) {
+    for (uint32_t s = 0; s < INGEST_STAGE_COUNT; s++) {
+      current[i]->addTo((IngestStage)s, &merged[s]);
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  stages.swap(merged);
+}
+
+void IngestMetrics::getStage(IngestStage stage, LatencyHistogram *out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  *out = stages[stage];
+}
+
+// Nanoseconds as seconds, exactly
+static void appendSeconds(std::string *out, uint64_t ns) {
+  char text[32];
+  snprintf(text, sizeof(text), "%llu.%09llu",
+           (unsigned long long)(ns / 1000000000ULL),
+           (unsigned long long)(ns % 1000000000ULL));
+  out->append(text);
+}
+
+void IngestMetrics::formatPrometheus(std::string *out) const {
+  static const char *const kQuantiles[4] = {"0.5", "0.9", "0.99", "0.999"};
+  static const double kQuantileValues[4] = {0.5, 0.9, 0.99, 0.999};
+  std::lock_guard<std::mutex> lock(mutex);
+  char text[64];
+
+  out->append("# HELP ingest_stage_latency_seconds Time spent per pipeline "
+              "stage (sampled items)\n"
+              "# TYPE ingest_stage_latency_seconds summary\n");
+  for (uint32_t s = 0; s < INGEST_STAGE_COUNT; s++) {
+    const LatencyHistogram &histogram = stages[s];
+    const char *stage = ingestStageName((IngestStage)s);
+    for (uint32_t q = 0; q < 4; q++) {
+      snprintf(text, sizeof(text), "{stage=\"%s\",quantile=\"%s\"} ", stage,
+               kQuantiles[q]);
+      out->append("ingest_stage_latency_seconds");
+      out->append(text);
+      appendSeconds(out, histogram.quantile(kQuantileValues[q]));
+      out->append("\n");
+    }
+    snprintf(text, sizeof(text), "{stage=\"%s\"} ", stage);
+    out->append("ingest_stage_latency_seconds_sum");
+    out->append(text);
+    appendSeconds(out, histogram.getSum());
+    out->append("\ningest_stage_latency_seconds_count");
+    out->append(text);
+    snprintf(text, sizeof(text), "%llu\n",
+             (unsigned long long)histogram.getCount());
+    out->append(text);
+  }
+
+  out->append("# HELP ingest_stage_latency_max_seconds Longest sampled time "
+              "per pipeline stage\n"
+              "# TYPE ingest_stage_latency_max_seconds gauge\n");
+  for (uint32_t s = 0; s < INGEST_STAGE_COUNT; s++) {
+    snprintf(text, sizeof(text), "{stage=\"%s\"} ",
+             ingestStageName((IngestStage)s));
+    out->append("ingest_stage_latency_max_seconds");
+    out->append(text);
+    appendSeconds(out, stages[s].getMax());
+    out->append("\n");
+  }
+
+  // Counters and gauges, grouped by name in registration order
+  std::vector<bool> written(metrics.size(), false);
+  for (size_t i = 0; i < metrics.size(); i++) {
+    if (written[i]) {
+      continue;
+    }
+    const Metric &first = *metrics[i];
+    out->append("# HELP " + first.name + " " + first.help + "\n# TYPE " +
+                first.name + (first.gauge ? " gauge\n" : " counter\n"));
+    for (size_t j = i; j < metrics.size(); j++) {
+      const Metric &metric = *metrics[j];
+      if (written[j] || metric.name != first.name) {
+        continue;
+      }
+      written[j] = true;
+      out->append(metric.name);
+      if (!metric.labels.empty()) {
+        out->append("{" + metric.labels + "}");
+      }
+      snprintf(text, sizeof(text), " %lld\n",
+               (long long)metric.value.load(std::memory_order_relaxed));
+      out->append(text);
+    }
+  }
+}
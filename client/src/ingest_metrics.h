@@ -0,0 +1,133 @@
+#ifndef INGEST_METRICS_H
+#define INGEST_METRICS_H
+
+#include "latency_histogram.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Per-stage latency tracing and counters for an ingest pipeline. Each
+// pipeline thread records into its own IngestTracer without locks;
+// IngestMetrics::collect() merges them into the published histograms,
+// and formatPrometheus() renders them with the counters and gauges.
+
+typedef enum {
+  INGEST_STAGE_RECEIVE = 0,   // From receipt to the start of processing
+  INGEST_STAGE_DECODE = 1,
+  INGEST_STAGE_AGGREGATE = 2,
+  INGEST_STAGE_PERSIST = 3,
+  INGEST_STAGE_COUNT = 4
+} IngestStage;
+
+// Tracers time 1 item in 2^shift. Two clock reads cost about as much as
+// decoding a small payload, so tracing every item is for debugging only.
+#define INGEST_DEFAULT_SAMPLE_SHIFT 6
+
+// Name used in metric labels ("receive", "decode", ...)
+const char *ingestStageName(IngestStage stage);
+
+// Monotonic clock in nanoseconds
+static inline uint64_t ingestNowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Stage timings of one pipeline thread
+class IngestTracer {
+public:
+  explicit IngestTracer(uint32_t sample_shift = INGEST_DEFAULT_SAMPLE_SHIFT);
+
+  // Returns: true if the next item is to be traced
+  bool sample() { return (++items & sample_mask) == 0; }
+
+  // Only from the owning thread
+  void record(IngestStage stage, uint64_t ns) { stages[stage].record(ns); }
+
+  // Add the stage's counts to a histogram (any thread)
+  void addTo(IngestStage stage, LatencyHistogram *histogram) const;
+
+private:
+  IngestTracer(const IngestTracer &);
+  IngestTracer &operator=(const IngestTracer &);
+
+  uint64_t items;
+  uint64_t sample_mask;
+  LatencyRecorder stages[INGEST_STAGE_COUNT];
+};
+
+// Timing of one item through the stages: each mark() records the time
+// since the previous mark (or the start) against a stage. Items the tracer
+// does not sample read no clock at all.
+class IngestTrace {
+public:
+  // Start now
+  explicit IngestTrace(IngestTracer *tracer)
+      : tracer(tracer), last(tracer->sample() ? ingestNowNs() : 0) {}
+
+  // Start at start_ns (ingestNowNs() taken when the item arrived)
+  IngestTrace(IngestTracer *tracer, uint64_t start_ns)
+      : tracer(tracer), last(tracer->sample() ? start_ns : 0) {}
+
+  void mark(IngestStage stage) {
+    if (last != 0) {
+      uint64_t now = ingestNowNs();
+      tracer->record(stage, now - last);
+      last = now;
+    }
+  }
+
+private:
+  IngestTracer *tracer;
+  uint64_t last; // 0 when not sampled
+};
+
+// Registry of tracers, counters and gauges
+class IngestMetrics {
+public:
+  IngestMetrics();
+  ~IngestMetrics();
+
+  // A tracer for one pipeline thread, valid until the registry is destroyed
+  IngestTracer *addTracer(uint32_t sample_shift = INGEST_DEFAULT_SAMPLE_SHIFT);
+
+  // Register a counter or gauge before the pipeline starts using it.
+  // Series of one name share help text and must use distinct labels
+  // (e.g. "reason=\"malformed\"", or "" for none).
+  // Returns: id for add() and set()
+  uint32_t addCounter(const char *name, const char *labels, const char *help);
+  uint32_t addGauge(const char *name, const char *labels, const char *help);
+
+  // Any thread; relaxed atomics
+  void add(uint32_t id, int64_t delta);
+  void set(uint32_t id, int64_t value);
+  int64_t get(uint32_t id) const;
+
+  // Merge all tracers into the published stage histograms
+  void collect();
+
+  // Copy of a stage histogram as of the last collect()
+  void getStage(IngestStage stage, LatencyHistogram *out) const;
+
+  // Prometheus text format (0.0.4): stage latency summaries in seconds as
+  // of the last collect(), then counters and gauges
+  void formatPrometheus(std::string *out) const;
+
+private:
+  IngestMetrics(const IngestMetrics &);
+  IngestMetrics &operator=(const IngestMetrics &);
+
+  struct Metric;
+
+  uint32_t addMetric(const char *name, const char *labels, const char *help,
+                     bool gauge);
+
+  mutable std::mutex mutex; // Registration, collect() and readers
+  std::vector<std::unique_ptr<IngestTracer> > tracers;
+  std::vector<std::unique_ptr<Metric> > metrics;
+  std::unique_ptr<LatencyHistogram[]> stages;
+};
+
+#endif // INGEST_METRICS_H
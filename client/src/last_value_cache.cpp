@@ -0,0 +1,302 @@
+#include "last_value_cache.h"
+#include "payload_decoder.h"
+#include <new>
+#include <string.h>
+#include <thread>
+
+#define KEY_EMPTY UINT64_MAX    // Index entry not in use
+#define SLOT_PENDING UINT64_MAX // Key claimed, slot not assigned yet
+#define LINE_WORDS 8            // 64-byte cache line
+
+// Slot words
+#define SLOT_SEQUENCE 0
+#define SLOT_RING 1 // Newest record (low 32 bits), record count (high 32)
+#define SLOT_RECORDS 2
+
+#define RECORD_WORDS ((8 + sizeof(SensorReading) + 7) / 8)
+static_assert(RECORD_WORDS <= LINE_WORDS * 4, "record copy buffer");
+
+// MurmurHash3 finalizer
+static inline uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+LastValueCache::LastValueCache()
+    : index_mask(0), record_words(0), slot_words(0), slots(nullptr),
+      device_count(0), next_slot(0), update_count(0), stale_count(0),
+      rejected_count(0), retry_count(0) {
+  memset(&config, 0, sizeof(config));
+}
+
+LastValueConfig LastValueCache::defaultConfig() {
+  LastValueConfig config;
+  config.max_devices = 65536;
+  config.history_length = 8;
+  return config;
+}
+
+bool LastValueCache::init(const LastValueConfig &config) {
+  if (config.max_devices == 0 || config.max_devices > (1u << 30) ||
+      config.history_length == 0 ||
+      config.history_length > LAST_VALUE_HISTORY_MAX) {
+    return false;
+  }
+
+  // Index at most half full, so probes stay short and always end
+  uint64_t index_size = 1;
+  while (index_size < (uint64_t)config.max_devices * 2) {
+    index_size <<= 1;
+  }
+  uint32_t record = (uint32_t)RECORD_WORDS;
+  uint32_t slot = SLOT_RECORDS + record * config.history_length;
+  slot = (slot + LINE_WORDS - 1) / LINE_WORDS * LINE_WORDS;
+  uint64_t storage_words = (uint64_t)slot * config.max_devices + LINE_WORDS;
+
+  index.reset(new (std::nothrow) std::atomic<uint64_t>[index_size * 2]);
+  storage.reset(new (std::nothrow) std::atomic<uint64_t>[storage_words]);
+  if (!index || !storage) {
+    index.reset();
+    storage.reset();
+    return false;
+  }
+  for (uint64_t i = 0; i < index_size * 2; i++) {
+    index[i].store(KEY_EMPTY, std::memory_order_relaxed);
+  }
+  for (uint64_t i = 0; i < storage_words; i++) {
+    storage[i].store(0, std::memory_order_relaxed);
+  }
+  uintptr_t base = (uintptr_t)storage.get();
+  uintptr_t line = LINE_WORDS * sizeof(uint64_t);
+  uintptr_t aligned = (base + line - 1) & ~(line - 1);
+  slots = storage.get() + (aligned - base) / 8;
+
+  this->config = config;
+  index_mask = index_size - 1;
+  record_words = record;
+  slot_words = slot;
+  device_count.store(0, std::memory_order_relaxed);
+  update_count.store(0, std::memory_order_relaxed);
+  stale_count.store(0, std::memory_order_relaxed);
+  rejected_count.store(0, std::memory_order_relaxed);
+  retry_count.store(0, std::memory_order_relaxed);
+  next_slot.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+const std::atomic<uint64_t> *
+LastValueCache::findSlot(uint64_t device_id) const {
+  if (!index || device_id == KEY_EMPTY) {
+    return nullptr;
+  }
+  for (uint64_t pos = mix64(device_id) & index_mask;;
+       pos = (pos + 1) & index_mask) {
+    uint64_t key = index[pos * 2].load(std::memory_order_acquire);
+    if (key == KEY_EMPTY) {
+      return nullptr;
+    }
+    if (key == device_id) {
+      uint64_t slot = index[pos * 2 + 1].load(std::memory_order_acquire);
+      // A device being inserted has no readings yet
+      return slot == SLOT_PENDING ? nullptr : &slots[slot * slot_words];
+    }
+  }
+}
+
+// Find the device's slot, adding the device if it is new
+// Returns: the slot, or nullptr if the table is full
+std::atomic<uint64_t> *LastValueCache::insertSlot(uint64_t device_id) {
+  if (!index || device_id == KEY_EMPTY) {
+    return nullptr;
+  }
+  bool reserved = false;
+  for (uint64_t pos = mix64(device_id) & index_mask;;) {
+    uint64_t key = index[pos * 2].load(std::memory_order_acquire);
+    if (key == KEY_EMPTY) {
+      if (!reserved) {
+        // Count the device before claiming an entry, so the table never
+        // holds more than max_devices
+        if (device_count.fetch_add(1, std::memory_order_relaxed) >=
+            config.max_devices) {
+          device_count.fetch_sub(1, std::memory_order_relaxed);
+          rejected_count.fetch_add(1, std::memory_order_relaxed);
+          return nullptr;
+        }
+        reserved = true;
+      }
+      if (index[pos * 2].compare_exchange_strong(key, device_id,
+                                                 std::memory_order_acq_rel)) {
+        // Slots are handed out in claim order; the new slot is all zero
+        uint64_t slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+        index[pos * 2 + 1].store(slot, std::memory_order_release);
+        return &slots[slot * slot_words];
+      }
+      // Lost the entry to another writer: look at what it claimed it for
+      continue;
+    }
+    if (key == device_id) {
+      if (reserved) {
+        device_count.fetch_sub(1, std::memory_order_relaxed);
+      }
+      uint64_t slot;
+      while ((slot = index[pos * 2 + 1].load(std::memory_order_acquire)) ==
+             SLOT_PENDING) {
+        std::this_thread::yield();
+      }
+      return &slots[slot * slot_words];
+    }
+    pos = (pos + 1) & index_mask;
+  }
+}
+
+bool LastValueCache::update(uint64_t device_id, uint64_t timestamp_ms,
+                            const SensorReading &reading) {
+  std::atomic<uint64_t> *slot = insertSlot(device_id);
+  if (slot == nullptr) {
+    return false;
+  }
+
+  // Lock: make the sequence odd. Acquire orders this writer after the
+  // previous one; the fence keeps the slot stores after the odd count.
+  std::atomic<uint64_t> &sequence = slot[SLOT_SEQUENCE];
+  uint64_t seq = sequence.load(std::memory_order_relaxed);
+  for (;;) {
+    if ((seq & 1) != 0) {
+      std::this_thread::yield();
+      seq = sequence.load(std::memory_order_relaxed);
+    } else if (sequence.compare_exchange_weak(seq, seq + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint64_t ring = slot[SLOT_RING].load(std::memory_order_relaxed);
+  uint32_t newest = (uint32_t)ring;
+  uint32_t count = (uint32_t)(ring >> 32);
+  std::atomic<uint64_t> *records = &slot[SLOT_RECORDS];
+  if (count > 0 &&
+      timestamp_ms < records[newest * record_words].load(
+                         std::memory_order_relaxed)) {
+    sequence.store(seq, std::memory_order_release); // Nothing changed
+    stale_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  uint32_t next = count == 0 ? 0 : (newest + 1) % config.history_length;
+  if (count < config.history_length) {
+    count++;
+  }
+  uint64_t words[LINE_WORDS * 4];
+  memset(words, 0, record_words * sizeof(uint64_t));
+  words[0] = timestamp_ms;
+  memcpy(&words[1], &reading, sizeof(SensorReading));
+  std::atomic<uint64_t> *record = &records[next * record_words];
+  for (uint32_t i = 0; i < record_words; i++) {
+    record[i].store(words[i], std::memory_order_relaxed);
+  }
+  slot[SLOT_RING].store(((uint64_t)count << 32) | next,
+                        std::memory_order_relaxed);
+
+  sequence.store(seq + 2, std::memory_order_release);
+  update_count.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+int32_t LastValueCache::updatePayload(uint64_t device_id,
+                                      uint64_t received_ms,
+                                      const uint8_t *payload,
+                                      uint32_t length) {
+  PayloadDecoder decoder;
+  decoder.setPlanCache(&plans);
+  int32_t count = decoder.decode(payload, length);
+  if (count < 0) {
+    return -1;
+  }
+
+  uint64_t interval_ms = decoder.getHeader().interval_minutes * 60000ULL;
+  for (int32_t i = 0; i < count; i++) {
+    uint64_t age_ms = (uint64_t)(count - 1 - i) * interval_ms;
+    if (!update(device_id, received_ms > age_ms ? received_ms - age_ms : 0,
+                decoder.getReading((uint8_t)i))) {
+      return -1;
+    }
+  }
+  return count;
+}
+
+// Copy up to max_values records, newest first, retrying until the copy was
+// not overlapped by a write
+uint32_t LastValueCache::readSlot(const std::atomic<uint64_t> *slot,
+                                  LastValue *values,
+                                  uint32_t max_values) const {
+  const std::atomic<uint64_t> &sequence = slot[SLOT_SEQUENCE];
+  const std::atomic<uint64_t> *records = &slot[SLOT_RECORDS];
+  uint64_t words[LINE_WORDS * 4];
+  for (;;) {
+    uint64_t before = sequence.load(std::memory_order_acquire);
+    if ((before & 1) != 0) {
+      retry_count.fetch_add(1, std::memory_order_relaxed);
+      std::this_thread::yield();
+      continue;
+    }
+
+    uint64_t ring = slot[SLOT_RING].load(std::memory_order_relaxed);
+    uint32_t newest = (uint32_t)ring % config.history_length;
+    uint32_t count = (uint32_t)(ring >> 32);
+    if (count > max_values) {
+      count = max_values;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t position =
+          (newest + config.history_length - i) % config.history_length;
+      const std::atomic<uint64_t> *record = &records[position * record_words];
+      for (uint32_t w = 0; w < record_words; w++) {
+        words[w] = record[w].load(std::memory_order_relaxed);
+      }
+      values[i].timestamp_ms = words[0];
+      memcpy(&values[i].reading, &words[1], sizeof(SensorReading));
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) == before) {
+      return count;
+    }
+    retry_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool LastValueCache::getLatest(uint64_t device_id, LastValue *value) const {
+  const std::atomic<uint64_t> *slot = findSlot(device_id);
+  return slot != nullptr && readSlot(slot, value, 1) == 1;
+}
+
+uint32_t LastValueCache::getHistory(uint64_t device_id, LastValue *values,
+                                    uint32_t max_values) const {
+  const std::atomic<uint64_t> *slot = findSlot(device_id);
+  return slot != nullptr ? readSlot(slot, values, max_values) : 0;
+}
+
+uint64_t LastValueCache::getMemoryUsage() const {
+  if (!index) {
+    return 0;
+  }
+  return (index_mask + 1) * 2 * sizeof(uint64_t) +
+         ((uint64_t)slot_words * config.max_devices + LINE_WORDS) *
+             sizeof(uint64_t);
+}
+
+LastValueStats LastValueCache::getStats() const {
+  LastValueStats stats;
+  stats.devices = next_slot.load(std::memory_order_relaxed);
+  stats.updates = update_count.load(std::memory_order_relaxed);
+  stats.stale = stale_count.load(std::memory_order_relaxed);
+  stats.rejected = rejected_count.load(std::memory_order_relaxed);
+  stats.read_retries = retry_count.load(std::memory_order_relaxed);
+  return stats;
+}
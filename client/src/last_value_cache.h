@@ -0,0 +1,107 @@
+#ifndef LAST_VALUE_CACHE_H
+#define LAST_VALUE_CACHE_H
+
+#include "decode_plan.h"
+#include "payload_types.h"
+#include <atomic>
+#include <memory>
+
+// Latest readings per device for live queries. A fixed table holds, for
+// each device, a ring of its last history_length readings (newest first
+// when read back). Device ids are found through a lock-free hash index;
+// id UINT64_MAX is reserved.
+//
+// Every slot has a sequence lock: a writer makes the count odd, updates the
+// slot in place and makes it even again; a reader copies the slot and
+// retries if the count was odd or changed meanwhile. Readers never block
+// writers or each other and write nothing shared. Writers of the same
+// device serialize on the count; writers of different devices do not
+// interact. Slot contents are copied with relaxed atomic word accesses, so
+// a torn copy is well defined and simply discarded.
+
+#define LAST_VALUE_HISTORY_MAX 64
+
+typedef struct {
+  uint32_t max_devices;    // Devices the table can hold
+  uint32_t history_length; // Readings kept per device, 1-64
+} LastValueConfig;
+
+typedef struct {
+  uint64_t timestamp_ms;
+  SensorReading reading;
+} LastValue;
+
+typedef struct {
+  uint64_t devices;
+  uint64_t updates;      // Readings stored
+  uint64_t stale;        // Readings older than the newest stored, dropped
+  uint64_t rejected;     // Updates for new devices with the table full
+  uint64_t read_retries; // Reads that saw a concurrent write and retried
+} LastValueStats;
+
+class LastValueCache {
+public:
+  LastValueCache();
+
+  // Defaults: 65536 devices, 8 readings each
+  static LastValueConfig defaultConfig();
+
+  // Allocate the table; not thread-safe
+  // Returns: false if the config is invalid or memory cannot be allocated
+  bool init(const LastValueConfig &config);
+
+  // Store a reading. A reading older than the device's newest is dropped.
+  // Returns: false if the device is new and the table is full
+  bool update(uint64_t device_id, uint64_t timestamp_ms,
+              const SensorReading &reading);
+
+  // Decode a payload and store its readings. The last reading is taken at
+  // received_ms and earlier ones one measurement interval apart.
+  // Returns: number of readings stored, or -1 if the payload is malformed or
+  // the table is full
+  int32_t updatePayload(uint64_t device_id, uint64_t received_ms,
+                        const uint8_t *payload, uint32_t length);
+
+  // Newest reading of a device
+  // Returns: false if the device has no readings
+  bool getLatest(uint64_t device_id, LastValue *value) const;
+
+  // Up to max_values readings of a device, newest first
+  // Returns: number of readings copied
+  uint32_t getHistory(uint64_t device_id, LastValue *values,
+                      uint32_t max_values) const;
+
+  // Bytes reserved for the table
+  uint64_t getMemoryUsage() const;
+
+  // Counters are relaxed, so approximate while threads are writing
+  LastValueStats getStats() const;
+
+private:
+  LastValueCache(const LastValueCache &);
+  LastValueCache &operator=(const LastValueCache &);
+
+  std::atomic<uint64_t> *insertSlot(uint64_t device_id);
+  const std::atomic<uint64_t> *findSlot(uint64_t device_id) const;
+  uint32_t readSlot(const std::atomic<uint64_t> *slot, LastValue *values,
+                    uint32_t max_values) const;
+
+  LastValueConfig config;
+  uint64_t index_mask;   // Power-of-two index size - 1
+  uint32_t record_words; // Timestamp and reading
+  uint32_t slot_words;   // Sequence, ring state, ring; whole cache lines
+
+  // Index entries are (device id, slot) word pairs
+  std::unique_ptr<std::atomic<uint64_t>[]> index;
+  std::unique_ptr<std::atomic<uint64_t>[]> storage;
+  std::atomic<uint64_t> *slots; // Cache line aligned, in storage
+  std::atomic<uint64_t> device_count; // Reserved, may run ahead of slots
+  std::atomic<uint64_t> next_slot;    // Slots handed out
+  std::atomic<uint64_t> update_count;
+  std::atomic<uint64_t> stale_count;
+  std::atomic<uint64_t> rejected_count;
+  mutable std::atomic<uint64_t> retry_count;
+  DecodePlanCache plans; // Used by updatePayload()
+};
+
+#endif // LAST_VALUE_CACHE_H
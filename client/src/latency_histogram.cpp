@@ -0,0 +1,102 @@
+#include "latency_histogram.h"
+#include <string.h>
+
+#define LATENCY_HALF_BUCKETS (1u << (LATENCY_SUB_BUCKET_BITS - 1))
+
+uint64_t latencyBucketLow(uint32_t bucket) {
+  if (bucket < 2 * LATENCY_HALF_BUCKETS) {
+    return bucket;
+  }
+  uint32_t shift = bucket / LATENCY_HALF_BUCKETS - 1;
+  return (uint64_t)(bucket - shift * LATENCY_HALF_BUCKETS) << shift;
+}
+
+uint64_t latencyBucketHigh(uint32_t bucket) {
+  if (bucket < 2 * LATENCY_HALF_BUCKETS) {
+    return bucket;
+  }
+  uint32_t shift = bucket / LATENCY_HALF_BUCKETS - 1;
+  return latencyBucketLow(bucket) + (1ULL << shift) - 1;
+}
+
+LatencyHistogram::LatencyHistogram() { reset(); }
+
+void LatencyHistogram::record(uint64_t ns) {
+  counts[latencyBucket(ns)]++;
+  count++;
+  sum += ns;
+  if (ns > max) {
+    max = ns;
+  }
+}
+
+void LatencyHistogram::add(const LatencyHistogram &other) {
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+    counts[i] += other.counts[i];
+  }
+  count += other.count;
+  sum += other.sum;
+  if (other.max > max) {
+    max = other.max;
+  }
+}
+
+void LatencyHistogram::reset() {
+  memset(counts, 0, sizeof(counts));
+  count = 0;
+  sum = 0;
+  max = 0;
+}
+
+uint64_t LatencyHistogram::getCount() const { return count; }
+
+uint64_t LatencyHistogram::getSum() const { return sum; }
+
+uint64_t LatencyHistogram::getMax() const { return max; }
+
+uint64_t LatencyHistogram::getBucketCount(uint32_t bucket) const {
+  return bucket < LATENCY_BUCKETS ? counts[bucket] : 0;
+}
+
+uint64_t LatencyHistogram::quantile(double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  // Rank of the value, 1-based
+  double position = q * (double)count;
+  uint64_t rank = (uint64_t)position;
+  if ((double)rank < position) {
+    rank++;
+  }
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      uint64_t high = latencyBucketHigh(i);
+      return high < max ? high : max;
+    }
+  }
+  return max;
+}
+
+LatencyRecorder::LatencyRecorder() : sum(0), max(0) {
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+    counts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void LatencyRecorder::addTo(LatencyHistogram *histogram) const {
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+    uint64_t n = counts[i].load(std::memory_order_relaxed);
+    histogram->counts[i] += n;
+    histogram->count += n;
+  }
+  histogram->sum += sum.load(std::memory_order_relaxed);
+  uint64_t largest = max.load(std::memory_order_relaxed);
+  if (largest > histogram->max) {
+    histogram->max = largest;
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <stdint.h>
+
+// HDR-style latency histograms in nanoseconds. Values below
+// 2^LATENCY_SUB_BUCKET_BITS get a bucket each; above that, every power of
+// two is split into 2^(LATENCY_SUB_BUCKET_BITS - 1) equal buckets, so a
+// bucket is never wider than 1/64 of its values (under 1.6% error). Values
+// above LATENCY_MAX_NS (about 73 minutes) land in the last bucket.
+
+#define LATENCY_SUB_BUCKET_BITS 7
+#define LATENCY_MAX_NS ((1ULL << 42) - 1)
+#define LATENCY_BUCKETS                                                        \
+  ((42 - LATENCY_SUB_BUCKET_BITS + 2) << (LATENCY_SUB_BUCKET_BITS - 1))
+
+// Bucket of a value
+static inline uint32_t latencyBucket(uint64_t ns) {
+  if (ns < (1u << LATENCY_SUB_BUCKET_BITS)) {
+    return (uint32_t)ns;
+  }
+  if (ns > LATENCY_MAX_NS) {
+    ns = LATENCY_MAX_NS;
+  }
+  uint32_t shift =
+      (uint32_t)(63 - __builtin_clzll(ns)) - (LATENCY_SUB_BUCKET_BITS - 1);
+  return (shift << (LATENCY_SUB_BUCKET_BITS - 1)) + (uint32_t)(ns >> shift);
+}
+
+// Smallest and largest value of a bucket
+uint64_t latencyBucketLow(uint32_t bucket);
+uint64_t latencyBucketHigh(uint32_t bucket);
+
+// Plain histogram, for one thread or for merged snapshots
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void record(uint64_t ns);
+
+  // Add the counts of another histogram
+  void add(const LatencyHistogram &other);
+
+  void reset();
+
+  uint64_t getCount() const;
+  uint64_t getSum() const; // Exact sum of recorded values
+  uint64_t getMax() const; // Exact largest value
+  uint64_t getBucketCount(uint32_t bucket) const;
+
+  // Value at quantile q (0-1): the largest value of the bucket holding it,
+  // clamped to the recorded maximum. 0 when empty.
+  uint64_t quantile(double q) const;
+
+private:
+  friend class LatencyRecorder;
+
+  uint64_t counts[LATENCY_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+};
+
+// Histogram with one writer and any number of concurrent readers. Counters
+// are relaxed atomics, so record() is a few plain loads and stores and a
+// snapshot may be a few values behind the writer.
+class LatencyRecorder {
+public:
+  LatencyRecorder();
+
+  // Only from the owning thread
+  void record(uint64_t ns) {
+    uint32_t bucket = latencyBucket(ns);
+    counts[bucket].store(counts[bucket].load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    sum.store(sum.load(std::memory_order_relaxed) + ns,
+              std::memory_order_relaxed);
+    if (ns > max.load(std::memory_order_relaxed)) {
+      max.store(ns, std::memory_order_relaxed);
+    }
+  }
+
+  // Add the current counts to a histogram (any thread)
+  void addTo(LatencyHistogram *histogram) const;
+
+private:
+  LatencyRecorder(const LatencyRecorder &);
+  LatencyRecorder &operator=(const LatencyRecorder &);
+
+  std::atomic<uint64_t> counts[LATENCY_BUCKETS];
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> max;
+};
+
+#endif // LATENCY_HISTOGRAM_H
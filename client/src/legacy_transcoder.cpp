@@ -0,0 +1,513 @@
+#include "legacy_transcoder.h"
+#include "payload_archive.h"
+#include "rollup_writer.h"
+#include <fcntl.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+static const int64_t kPowersOf10[19] = {
+    1LL,          10LL,          100LL,          1000LL,          10000LL,
+    100000LL,     1000000LL,     10000000LL,     100000000LL,     1000000000LL,
+    10000000000LL,      100000000000LL,      1000000000000LL,
+    10000000000000LL,   100000000000000LL,   1000000000000000LL,
+    10000000000000000LL, 100000000000000000LL, 1000000000000000000LL};
+
+// Per-field parsing limits, derived from kSensorFields
+typedef struct {
+  uint32_t scale_digits; // Decimal digits of the scale (1, 10, 100, 1000)
+  int64_t min, max;      // Raw range of the wire type
+} FieldLimits;
+
+static const FieldLimits *fieldLimits() {
+  static struct Table {
+    FieldLimits fields[SENSOR_FIELD_COUNT];
+    Table() {
+      for (int flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+        FieldLimits &limits = fields[flag];
+        limits.scale_digits = 0;
+        for (uint32_t scale = kSensorFields[flag].scale; scale > 1;
+             scale /= 10) {
+          limits.scale_digits++;
+        }
+        switch (kSensorFields[flag].type) {
+        case FIELD_INT8:
+          limits.min = INT8_MIN;
+          limits.max = INT8_MAX;
+          break;
+        case FIELD_INT16:
+          limits.min = INT16_MIN;
+          limits.max = INT16_MAX;
+          break;
+        case FIELD_UINT16:
+          limits.min = 0;
+          limits.max = UINT16_MAX;
+          break;
+        case FIELD_UINT32:
+          limits.min = 0;
+          limits.max = UINT32_MAX;
+          break;
+        }
+      }
+    }
+  } table;
+  return table.fields;
+}
+
+static inline bool isTwoChannel(const PayloadHeader &header, SensorFlag flag) {
+  return header.dual_mode && kSensorFields[flag].expandable &&
+         !(header.dedicated_temphum_sensor &&
+           (flag == FLAG_TEMP || flag == FLAG_HUM));
+}
+
+// Parse a decimal in physical units into a raw value of the field
+// Returns: false if the text is not a number or out of the field's range
+static bool parseValue(const char *&p, const char *end,
+                       const FieldLimits &limits, int64_t *raw) {
+  bool negative = p < end && *p == '-';
+  if (negative) {
+    p++;
+  }
+  int64_t mantissa = 0;
+  uint32_t digits = 0, fraction = 0;
+  bool point = false;
+  for (; p < end; p++) {
+    char c = *p;
+    if (c >= '0' && c <= '9') {
+      if (digits == 18) {
+        return false;
+      }
+      mantissa = mantissa * 10 + (c - '0');
+      digits++;
+      fraction += point ? 1 : 0;
+    } else if (c == '.' && !point) {
+      point = true;
+    } else {
+      break;
+    }
+  }
+  if (digits == 0) {
+    return false;
+  }
+
+  uint32_t scale = limits.scale_digits;
+  int64_t value;
+  if (fraction <= scale) {
+    if (digits + scale - fraction > 18) {
+      return false;
+    }
+    value = mantissa * kPowersOf10[scale - fraction];
+  } else {
+    // Round half away from zero
+    int64_t divisor = kPowersOf10[fraction - scale];
+    value = (mantissa + divisor / 2) / divisor;
+  }
+  if (negative) {
+    value = -value;
+  }
+  if (value < limits.min || value > limits.max) {
+    return false;
+  }
+  *raw = value;
+  return true;
+}
+
+static void appendValue(int64_t raw, SensorFlag flag, std::string *out) {
+  char text[32];
+  uint32_t digits = fieldLimits()[flag].scale_digits;
+  uint64_t magnitude = raw < 0 ? (uint64_t)(-raw) : (uint64_t)raw;
+  int length;
+  if (digits == 0) {
+    length = snprintf(text, sizeof(text), "%s%llu", raw < 0 ? "-" : "",
+                      (unsigned long long)magnitude);
+  } else {
+    uint64_t scale = (uint64_t)kPowersOf10[digits];
+    length = snprintf(text, sizeof(text), "%s%llu.%0*llu", raw < 0 ? "-" : "",
+                      (unsigned long long)(magnitude / scale), (int)digits,
+                      (unsigned long long)(magnitude % scale));
+  }
+  out->append(text, (size_t)length);
+}
+
+void initLegacyLayout(LegacyLayout &layout) {
+  layout.field_count = SENSOR_FIELD_COUNT;
+  for (uint8_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    layout.fields[flag] = flag;
+  }
+}
+
+bool parseLegacyLayout(const char *names, LegacyLayout &layout) {
+  uint32_t used = 0;
+  layout.field_count = 0;
+  const char *p = names;
+  for (;;) {
+    const char *comma = strchr(p, ',');
+    size_t length = comma != nullptr ? (size_t)(comma - p) : strlen(p);
+    char name[32];
+    if (length == 0 || length >= sizeof(name) ||
+        layout.field_count == SENSOR_FIELD_COUNT) {
+      return false;
+    }
+    memcpy(name, p, length);
+    name[length] = '\0';
+    int32_t flag = findSensorField(name);
+    if (flag < 0 || (used & FLAG_BIT(flag)) != 0) {
+      return false;
+    }
+    used |= FLAG_BIT(flag);
+    layout.fields[layout.field_count++] = (uint8_t)flag;
+    if (comma == nullptr) {
+      return true;
+    }
+    p = comma + 1;
+  }
+}
+
+int32_t parseLegacyPayload(const char *text, uint32_t length,
+                           const LegacyLayout &layout, PayloadHeader *header,
+                           SensorReading *readings) {
+  const char *p = text;
+  const char *end = text + length;
+
+  // Header: interval and mode letters up to ':'
+  uint32_t interval = 0;
+  const char *digits = p;
+  while (p < end && *p >= '0' && *p <= '9' && p - digits < 3) {
+    interval = interval * 10 + (uint32_t)(*p++ - '0');
+  }
+  if (p == digits || interval > 255) {
+    return -1;
+  }
+  memset(header, 0, sizeof(*header));
+  header->version = 1; // Schema version of the transcoded payloads
+  header->interval_minutes = (uint8_t)interval;
+  for (; p < end && *p != ':'; p++) {
+    if (*p == 'D' && !header->dual_mode) {
+      header->dual_mode = true;
+    } else if (*p == 'T' && !header->dedicated_temphum_sensor) {
+      header->dedicated_temphum_sensor = true;
+    } else {
+      return -1;
+    }
+  }
+  if (p == end) {
+    return -1;
+  }
+  p++;
+
+  const FieldLimits *limits = fieldLimits();
+  int32_t count = 0;
+  for (;;) {
+    if (count == MAX_BATCH_SIZE) {
+      return -1;
+    }
+    SensorReading &reading = readings[count++];
+    memset(&reading, 0, sizeof(reading));
+    for (uint32_t position = 0;; position++) {
+      if (p < end && *p != ',' && *p != ';') {
+        if (position >= layout.field_count) {
+          return -1;
+        }
+        SensorFlag flag = (SensorFlag)layout.fields[position];
+        int64_t value;
+        if (!parseValue(p, end, limits[flag], &value)) {
+          return -1;
+        }
+        setSensorFieldValue(reading, flag, 0, value);
+        if (isTwoChannel(*header, flag)) {
+          if (p == end || *p != '/' || !parseValue(++p, end, limits[flag], &value)) {
+            return -1;
+          }
+          setSensorFieldValue(reading, flag, 1, value);
+        }
+        reading.presence_mask |= FLAG_BIT(flag);
+        if (p < end && *p != ',' && *p != ';') {
+          return -1;
+        }
+      } else if (position >= layout.field_count) {
+        return -1;
+      }
+      if (p == end || *p == ';') {
+        break;
+      }
+      p++; // ','
+    }
+    if (p == end) {
+      return count;
+    }
+    p++; // ';'
+  }
+}
+
+void formatLegacyPayload(const PayloadHeader &header,
+                         const SensorReading *readings, uint32_t count,
+                         const LegacyLayout &layout, std::string *out) {
+  char text[8];
+  int length = snprintf(text, sizeof(text), "%u", header.interval_minutes);
+  out->append(text, (size_t)length);
+  if (header.dual_mode) {
+    out->push_back('D');
+  }
+  if (header.dedicated_temphum_sensor) {
+    out->push_back('T');
+  }
+  out->push_back(':');
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (i > 0) {
+      out->push_back(';');
+    }
+    // Field n follows n commas; commas after the last present field are
+    // left off
+    uint32_t commas = 0;
+    for (uint32_t position = 0; position < layout.field_count; position++) {
+      SensorFlag flag = (SensorFlag)layout.fields[position];
+      if (!IS_FLAG_SET(readings[i].presence_mask, flag)) {
+        continue;
+      }
+      out->append(position - commas, ',');
+      commas = position;
+      appendValue(getSensorFieldValue(readings[i], flag, 0), flag, out);
+      if (isTwoChannel(header, flag)) {
+        out->push_back('/');
+        appendValue(getSensorFieldValue(readings[i], flag, 1), flag, out);
+      }
+    }
+  }
+}
+
+LegacyTranscoder::LegacyTranscoder() : reading_count(0) {
+  initLegacyLayout(layout);
+  memset(&header, 0, sizeof(header));
+}
+
+void LegacyTranscoder::setLayout(const LegacyLayout &layout) {
+  this->layout = layout;
+}
+
+int32_t LegacyTranscoder::transcode(const char *text, uint32_t length,
+                                    uint8_t *buffer, uint32_t size) {
+  int32_t count = parseLegacyPayload(text, length, layout, &header, readings);
+  if (count < 0) {
+    reading_count = 0;
+    return -1;
+  }
+  reading_count = (uint8_t)count;
+  encoder.init(header);
+  for (int32_t i = 0; i < count; i++) {
+    encoder.addReading(readings[i]);
+  }
+  return encoder.encode(buffer, size);
+}
+
+const PayloadHeader &LegacyTranscoder::getHeader() const { return header; }
+
+uint8_t LegacyTranscoder::getReadingCount() const { return reading_count; }
+
+const SensorReading &LegacyTranscoder::getReading(uint8_t index) const {
+  return readings[index];
+}
+
+LegacyBulkConfig defaultLegacyBulkConfig() {
+  LegacyBulkConfig config;
+  initLegacyLayout(config.layout);
+  config.threads = std::thread::hardware_concurrency();
+  if (config.threads == 0) {
+    config.threads = 1;
+  }
+  config.write_archive = true;
+  config.write_rollup = true;
+  return config;
+}
+
+namespace {
+
+struct BulkWorker {
+  LegacyTranscoder transcoder;
+  ArchiveWriter archive;
+  RollupWriter rollup;
+  bool write_archive;
+  bool write_rollup;
+  uint64_t sequence;
+  LegacyBulkStats stats;
+  bool failed;
+};
+
+} // namespace
+
+// Parse a decimal number followed by spaces or tabs
+static bool parsePrefixNumber(const char *&p, const char *end,
+                              uint64_t *value) {
+  const char *digits = p;
+  uint64_t number = 0;
+  while (p < end && *p >= '0' && *p <= '9' && p - digits < 20) {
+    number = number * 10 + (uint64_t)(*p++ - '0');
+  }
+  if (p == digits || p == end || (*p != ' ' && *p != '\t')) {
+    return false;
+  }
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  *value = number;
+  return true;
+}
+
+// Transcode the lines that start in [begin, end) of a mapped file
+static void transcodeRange(BulkWorker *worker, const char *data, size_t size,
+                           size_t begin, size_t end) {
+  if (begin > 0 && data[begin - 1] != '\n') {
+    const char *newline =
+        (const char *)memchr(data + begin, '\n', size - begin);
+    begin = newline != nullptr ? (size_t)(newline - data) + 1 : size;
+  }
+
+  uint8_t payload[MAX_PAYLOAD_SIZE];
+  LegacyBulkStats &stats = worker->stats;
+  while (begin < end && !worker->failed) {
+    const char *line = data + begin;
+    const char *newline = (const char *)memchr(line, '\n', size - begin);
+    const char *line_end = newline != nullptr ? newline : data + size;
+    begin = (size_t)(line_end - data) + 1;
+    while (line_end > line && (line_end[-1] == '\r' || line_end[-1] == ' ')) {
+      line_end--;
+    }
+    if (line_end == line) {
+      continue;
+    }
+    stats.lines++;
+
+    const char *p = line;
+    uint64_t device_id, timestamp_ms;
+    int32_t length = -1;
+    if (parsePrefixNumber(p, line_end, &device_id) &&
+        parsePrefixNumber(p, line_end, &timestamp_ms)) {
+      length = worker->transcoder.transcode(p, (uint32_t)(line_end - p),
+                                            payload, sizeof(payload));
+    }
+    if (length < 0) {
+      stats.malformed++;
+      continue;
+    }
+
+    LegacyTranscoder &transcoder = worker->transcoder;
+    uint8_t count = transcoder.getReadingCount();
+    stats.payloads++;
+    stats.readings += count;
+    stats.output_bytes += (uint32_t)length;
+    if (worker->write_archive) {
+      PayloadRecordHeader header;
+      header.length = (uint32_t)length;
+      header.sequence = ++worker->sequence;
+      header.device_id = device_id;
+      header.timestamp_ms = timestamp_ms;
+      worker->failed = !worker->archive.write(header, payload);
+    }
+    if (worker->write_rollup) {
+      uint64_t interval_ms = transcoder.getHeader().interval_minutes * 60000ULL;
+      for (uint8_t i = 0; i < count && !worker->failed; i++) {
+        uint64_t age_ms = (uint64_t)(count - 1 - i) * interval_ms;
+        worker->failed = !worker->rollup.addReading(
+            device_id, timestamp_ms > age_ms ? timestamp_ms - age_ms : 0,
+            transcoder.getReading(i));
+      }
+    }
+  }
+}
+
+bool transcodeLegacyFiles(const std::vector<std::string> &inputs,
+                          const char *output_prefix,
+                          const LegacyBulkConfig &config,
+                          LegacyBulkStats *stats,
+                          std::vector<std::string> *outputs) {
+  uint32_t threads = config.threads > 0 ? config.threads : 1;
+  memset(stats, 0, sizeof(*stats));
+
+  std::unique_ptr<BulkWorker[]> workers(new BulkWorker[threads]);
+  bool ok = true;
+  for (uint32_t t = 0; t < threads; t++) {
+    BulkWorker &worker = workers[t];
+    worker.transcoder.setLayout(config.layout);
+    worker.write_archive = config.write_archive;
+    worker.write_rollup = config.write_rollup;
+    worker.sequence = 0;
+    memset(&worker.stats, 0, sizeof(worker.stats));
+    worker.failed = false;
+
+    char suffix[16];
+    if (config.write_archive) {
+      snprintf(suffix, sizeof(suffix), "-%02u.seg", t);
+      std::string path = std::string(output_prefix) + suffix;
+      ok = ok && worker.archive.open(path.c_str());
+      if (outputs != nullptr) {
+        outputs->push_back(path);
+      }
+    }
+    if (config.write_rollup) {
+      snprintf(suffix, sizeof(suffix), "-%02u.agr", t);
+      std::string path = std::string(output_prefix) + suffix;
+      ok = ok && worker.rollup.open(path.c_str());
+      if (outputs != nullptr) {
+        outputs->push_back(path);
+      }
+    }
+  }
+
+  for (size_t f = 0; f < inputs.size() && ok; f++) {
+    int fd = ::open(inputs[f].c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      ok = false;
+      break;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+      ::close(fd);
+      continue;
+    }
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      ok = false;
+      break;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    stats->input_bytes += size;
+
+    const char *data = (const char *)mapping;
+    std::vector<std::thread> running;
+    for (uint32_t t = 0; t < threads; t++) {
+      running.push_back(std::thread(transcodeRange, &workers[t], data, size,
+                                    size * t / threads,
+                                    size * (t + 1) / threads));
+    }
+    for (size_t t = 0; t < running.size(); t++) {
+      running[t].join();
+    }
+    munmap(mapping, size);
+  }
+
+  for (uint32_t t = 0; t < threads; t++) {
+    BulkWorker &worker = workers[t];
+    ok = ok && !worker.failed;
+    if (config.write_archive && !worker.archive.close()) {
+      ok = false;
+    }
+    if (config.write_rollup && !worker.rollup.close()) {
+      ok = false;
+    }
+    stats->lines += worker.stats.lines;
+    stats->payloads += worker.stats.payloads;
+    stats->readings += worker.stats.readings;
+    stats->malformed += worker.stats.malformed;
+    stats->output_bytes += worker.stats.output_bytes;
+  }
+  return ok;
+}
@@ -0,0 +1,116 @@
+#ifndef LEGACY_TRANSCODER_H
+#define LEGACY_TRANSCODER_H
+
+#include "payload_encoder.h"
+#include "sensor_fields.h"
+#include <string>
+#include <vector>
+
+// Transcoding of the legacy text payloads that the binary format replaced
+// (RFC, "Problem on existing format"). The RFC does not spell that format
+// out. The grammar below is an assumed convention: it has not been checked
+// against real legacy archives, so do not treat it as the reference for
+// firmware or server code.
+//
+//   payload = header ":" reading *(";" reading)
+//   header  = interval minutes, then "D" if dual mode and "T" if the device
+//             has a dedicated temp/hum sensor (e.g. "5", "1D", "2T")
+//   reading = fields in layout order, separated by ","
+//   field   = empty (absent), a value, or "a/b" for both channels of an
+//             expandable field in dual mode
+//
+// Values are decimals in physical units (kSensorFields scale: "23.45" is a
+// temperature of 2345 raw). Every position of the layout must be delimited,
+// but trailing empty fields may be left off. The presence mask of each
+// reading is the set of non-empty fields.
+//
+// Archive files are likewise assumed to hold one payload per line, prefixed
+// with the device id and the receive time in ms:
+// "<device_id> <timestamp_ms> <payload>".
+
+// Field order of a legacy payload
+typedef struct {
+  uint8_t field_count;
+  uint8_t fields[SENSOR_FIELD_COUNT]; // SensorFlag at each position
+} LegacyLayout;
+
+// All fields in SensorFlag order
+void initLegacyLayout(LegacyLayout &layout);
+
+// Layout from comma-separated kSensorFields names ("temperature,humidity")
+// Returns: false on an unknown or repeated name
+bool parseLegacyLayout(const char *names, LegacyLayout &layout);
+
+// Parse a legacy payload into header and readings (MAX_BATCH_SIZE entries)
+// Returns: number of readings, or -1 if malformed
+int32_t parseLegacyPayload(const char *text, uint32_t length,
+                           const LegacyLayout &layout, PayloadHeader *header,
+                           SensorReading *readings);
+
+// Format readings as a legacy payload (appended to out); the inverse of
+// parseLegacyPayload for fields in the layout
+void formatLegacyPayload(const PayloadHeader &header,
+                         const SensorReading *readings, uint32_t count,
+                         const LegacyLayout &layout, std::string *out);
+
+// Parses legacy payloads and re-encodes them with PayloadEncoder. The
+// parsed readings stay available, so callers can also feed them to
+// columnar writers without decoding the binary payload again.
+class LegacyTranscoder {
+public:
+  LegacyTranscoder();
+
+  void setLayout(const LegacyLayout &layout);
+
+  // Returns: binary payload length, or -1 if the text is malformed or buffer
+  // is too small (MAX_PAYLOAD_SIZE always suffices)
+  int32_t transcode(const char *text, uint32_t length, uint8_t *buffer,
+                    uint32_t size);
+
+  // Header and readings of the last payload transcoded
+  const PayloadHeader &getHeader() const;
+  uint8_t getReadingCount() const;
+  const SensorReading &getReading(uint8_t index) const;
+
+private:
+  LegacyTranscoder(const LegacyTranscoder &);
+  LegacyTranscoder &operator=(const LegacyTranscoder &);
+
+  LegacyLayout layout;
+  PayloadHeader header;
+  SensorReading readings[MAX_BATCH_SIZE];
+  uint8_t reading_count;
+  PayloadEncoder encoder;
+};
+
+typedef struct {
+  LegacyLayout layout;
+  uint32_t threads;   // Each thread transcodes a range of lines
+  bool write_archive; // PREFIX-NN.seg, framed binary payloads
+  bool write_rollup;  // PREFIX-NN.agr, one row per reading
+} LegacyBulkConfig;
+
+typedef struct {
+  uint64_t input_bytes;
+  uint64_t lines;     // Non-empty lines
+  uint64_t payloads;  // Transcoded
+  uint64_t readings;
+  uint64_t malformed; // Lines skipped
+  uint64_t output_bytes; // Binary payload bytes, without record framing
+} LegacyBulkStats;
+
+// Defaults: all fields in flag order, hardware threads, archive and rollup
+LegacyBulkConfig defaultLegacyBulkConfig();
+
+// Transcode legacy archive files (mapped with mmap, lines split between
+// threads) into one archive segment and/or rollup file per thread. Readings
+// of a payload are timestamped one interval apart, the last at the receive
+// time. outputs, when given, receives the paths written.
+// Returns: false if an input cannot be read or an output cannot be written
+bool transcodeLegacyFiles(const std::vector<std::string> &inputs,
+                          const char *output_prefix,
+                          const LegacyBulkConfig &config,
+                          LegacyBulkStats *stats,
+                          std::vector<std::string> *outputs = nullptr);
+
+#endif // LEGACY_TRANSCODER_H
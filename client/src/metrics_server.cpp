@@ -0,0 +1,165 @@
+#include "metrics_server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+MetricsServer::MetricsServer()
+    : metrics(nullptr), listen_fd(-1), port(0), collect_interval_ms(1000),
+      requests(0) {
+  wake_fds[0] = wake_fds[1] = -1;
+}
+
+MetricsServer::~MetricsServer() { stop(); }
+
+bool MetricsServer::start(IngestMetrics *metrics, const char *address,
+                          uint16_t port, uint32_t collect_interval_ms) {
+  stop();
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    return false;
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    return false;
+  }
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  socklen_t length = sizeof(addr);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, 16) != 0 ||
+      getsockname(listen_fd, (struct sockaddr *)&addr, &length) != 0 ||
+      pipe(wake_fds) != 0) {
+    ::close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  this->metrics = metrics;
+  this->port = ntohs(addr.sin_port);
+  this->collect_interval_ms = collect_interval_ms > 0 ? collect_interval_ms : 1;
+  metrics->collect();
+  server = std::thread(&MetricsServer::serveLoop, this);
+  return true;
+}
+
+void MetricsServer::stop() {
+  if (server.joinable()) {
+    char byte = 0;
+    if (write(wake_fds[1], &byte, 1) < 0) {
+      perror("metrics server wake");
+    }
+    server.join();
+  }
+  for (int i = 0; i < 2; i++) {
+    if (wake_fds[i] >= 0) {
+      ::close(wake_fds[i]);
+      wake_fds[i] = -1;
+    }
+  }
+  if (listen_fd >= 0) {
+    ::close(listen_fd);
+    listen_fd = -1;
+  }
+}
+
+uint16_t MetricsServer::getPort() const { return port; }
+
+uint64_t MetricsServer::getRequestCount() const {
+  return requests.load(std::memory_order_relaxed);
+}
+
+void MetricsServer::serveLoop() {
+  uint64_t next_collect = ingestNowNs() + collect_interval_ms * 1000000ULL;
+  for (;;) {
+    uint64_t now = ingestNowNs();
+    if (now >= next_collect) {
+      metrics->collect();
+      next_collect = now + collect_interval_ms * 1000000ULL;
+    }
+    struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake_fds[0], POLLIN, 0}};
+    int timeout_ms = (int)((next_collect - now + 999999) / 1000000);
+    if (poll(fds, 2, timeout_ms) < 0) {
+      continue; // EINTR
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        serveConnection(fd);
+        ::close(fd);
+      }
+    }
+  }
+}
+
+// Write all of data, giving up on errors
+static void sendAll(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return;
+    }
+    data += sent;
+    length -= (size_t)sent;
+  }
+}
+
+void MetricsServer::serveConnection(int fd) {
+  // A slow or idle client must not hold up collection for long
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  char request[4096];
+  size_t filled = 0;
+  while (filled < sizeof(request) - 1) {
+    ssize_t received = recv(fd, request + filled, sizeof(request) - 1 - filled, 0);
+    if (received <= 0) {
+      return;
+    }
+    filled += (size_t)received;
+    request[filled] = '\0';
+    if (strstr(request, "\r\n\r\n") != nullptr ||
+        strstr(request, "\n\n") != nullptr) {
+      break;
+    }
+  }
+  request[filled] = '\0';
+
+  std::string body;
+  const char *status;
+  const char *type = "text/plain; charset=utf-8";
+  bool get = strncmp(request, "GET ", 4) == 0;
+  if (get && (strncmp(request + 4, "/metrics ", 9) == 0 ||
+              strncmp(request + 4, "/metrics?", 9) == 0)) {
+    status = "200 OK";
+    type = "text/plain; version=0.0.4; charset=utf-8";
+    metrics->formatPrometheus(&body);
+    requests.fetch_add(1, std::memory_order_relaxed);
+  } else if (get) {
+    status = "404 Not Found";
+    body = "not found\n";
+  } else {
+    status = "405 Method Not Allowed";
+    body = "method not allowed\n";
+  }
+
+  char header[256];
+  int length = snprintf(header, sizeof(header),
+                        "HTTP/1.1 %s\r\nContent-Type: %s\r\n"
+                        "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                        status, type, body.size());
+  sendAll(fd, header, (size_t)length);
+  sendAll(fd, body.data(), body.size());
+}
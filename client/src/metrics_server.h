@@ -0,0 +1,48 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include "ingest_metrics.h"
+#include <atomic>
+#include <thread>
+
+// Minimal HTTP endpoint for Prometheus scrapes. One background thread
+// merges the tracers every collect interval and answers GET /metrics with
+// the last merge; other paths get 404. Connections are served one at a
+// time and closed after the response, which is all a scraper needs.
+class MetricsServer {
+public:
+  MetricsServer();
+  ~MetricsServer();
+
+  // Listen on address:port (port 0 picks a free port, see getPort()).
+  // metrics must outlive the server.
+  // Returns: false if the socket cannot be bound
+  bool start(IngestMetrics *metrics, const char *address, uint16_t port,
+             uint32_t collect_interval_ms = 1000);
+
+  // Stop serving and join the thread
+  void stop();
+
+  // Port actually bound
+  uint16_t getPort() const;
+
+  // Scrapes answered so far
+  uint64_t getRequestCount() const;
+
+private:
+  MetricsServer(const MetricsServer &);
+  MetricsServer &operator=(const MetricsServer &);
+
+  void serveLoop();
+  void serveConnection(int fd);
+
+  IngestMetrics *metrics;
+  int listen_fd;
+  int wake_fds[2]; // stop() writes to [1] to wake poll()
+  uint16_t port;
+  uint32_t collect_interval_ms;
+  std::atomic<uint64_t> requests;
+  std::thread server;
+};
+
+#endif // METRICS_SERVER_H
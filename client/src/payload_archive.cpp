@@ -0,0 +1,227 @@
+#include "payload_archive.h"
+#include "payload_types.h"
+#include <string.h>
+
+// ---------------------------------------------------------------------------
+// ArchiveWriter
+
+ArchiveWriter::ArchiveWriter() : file(nullptr), offset(0), failed(false) {}
+
+ArchiveWriter::~ArchiveWriter() { close(); }
+
+bool ArchiveWriter::open(const char *path) {
+  close();
+
+  file = fopen(path, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  setvbuf(file, nullptr, _IOFBF, 1 << 20);
+  offset = 0;
+  failed = false;
+  return true;
+}
+
+bool ArchiveWriter::write(const PayloadRecordHeader &header,
+                          const uint8_t *payload) {
+  scratch.resize(PAYLOAD_RECORD_HEADER_SIZE + header.length);
+  uint32_t size = writePayloadRecord(scratch.data(), header, payload);
+  return writeRaw(scratch.data(), size);
+}
+
+bool ArchiveWriter::writeRaw(const uint8_t *record, uint32_t length) {
+  if (file == nullptr || failed) {
+    return false;
+  }
+  if (fwrite(record, 1, length, file) != length) {
+    failed = true;
+    return false;
+  }
+  offset += length;
+  return true;
+}
+
+bool ArchiveWriter::close() {
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = !failed;
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  file = nullptr;
+  return ok;
+}
+
+uint64_t ArchiveWriter::getOffset() const { return offset; }
+
+// ---------------------------------------------------------------------------
+// ArchiveReader
+
+ArchiveReader::ArchiveReader()
+    : file(nullptr), start(0), filled(0), buffer_offset(0), range_end(0),
+      record_offset(0), skipped(0), synced(false), eof(true) {}
+
+ArchiveReader::~ArchiveReader() { close(); }
+
+bool ArchiveReader::open(const char *path, uint32_t buffer_size) {
+  return openRange(path, 0, UINT64_MAX, buffer_size);
+}
+
+bool ArchiveReader::openRange(const char *path, uint64_t begin, uint64_t end,
+                              uint32_t buffer_size) {
+  close();
+
+  file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  if (fseeko(file, (off_t)begin, SEEK_SET) != 0) {
+    close();
+    return false;
+  }
+
+  // A buffer must always be able to hold the largest record
+  uint32_t minimum = 2 * (PAYLOAD_RECORD_HEADER_SIZE + MAX_PAYLOAD_SIZE);
+  buffer.resize(buffer_size > minimum ? buffer_size : minimum);
+  start = 0;
+  filled = 0;
+  buffer_offset = begin;
+  range_end = end;
+  record_offset = begin;
+  skipped = 0;
+  synced = begin == 0; // Bytes before the first record of a later range
+                       // belong to the previous range
+  eof = false;
+  return true;
+}
+
+void ArchiveReader::close() {
+  if (file != nullptr) {
+    fclose(file);
+  }
+  file = nullptr;
+  eof = true;
+}
+
+bool ArchiveReader::fill() {
+  if (eof || file == nullptr) {
+    return false;
+  }
+
+  // Keep unread bytes, then top up the buffer
+  memmove(buffer.data(), buffer.data() + start, filled - start);
+  buffer_offset += start;
+  filled -= start;
+  start = 0;
+
+  size_t got = fread(buffer.data() + filled, 1, buffer.size() - filled, file);
+  if (got == 0) {
+    eof = true;
+    return false;
+  }
+  filled += (uint32_t)got;
+  return true;
+}
+
+int32_t ArchiveReader::next(PayloadRecordHeader *header,
+                            const uint8_t **payload, const uint8_t **record,
+                            uint32_t *record_size) {
+  while (buffer_offset + start < range_end) {
+    int32_t size = readPayloadRecord(buffer.data() + start, filled - start,
+                                     header, payload);
+    if (size > 0) {
+      record_offset = buffer_offset + start;
+      if (record != nullptr)
+        *record = buffer.data() + start;
+      if (record_size != nullptr)
+        *record_size = (uint32_t)size;
+      start += (uint32_t)size;
+      synced = true;
+      return 1;
+    }
+
+    if (size == 0) {
+      if (fill()) {
+        continue; // Record continues past the buffer
+      }
+      // Torn record at end of file
+      if (synced)
+        skipped += filled - start;
+      start = filled;
+      return 0;
+    }
+
+    // Not a record boundary: slide forward one byte and look again
+    start++;
+    if (synced)
+      skipped++;
+  }
+
+  return 0;
+}
+
+uint64_t ArchiveReader::getRecordOffset() const { return record_offset; }
+
+uint64_t ArchiveReader::getSkippedBytes() const { return skipped; }
+
+// ---------------------------------------------------------------------------
+// Index
+
+bool writeArchiveIndex(const char *path,
+                       const std::vector<ArchiveIndexEntry> &entries) {
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  uint32_t header[4] = {ARCHIVE_INDEX_MAGIC, ARCHIVE_INDEX_VERSION,
+                        (uint32_t)entries.size(), 0};
+  bool ok = fwrite(header, sizeof(header), 1, file) == 1 &&
+            (entries.empty() ||
+             fwrite(entries.data(), sizeof(ArchiveIndexEntry), entries.size(),
+                    file) == entries.size());
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  return ok;
+}
+
+bool readArchiveIndex(const char *path,
+                      std::vector<ArchiveIndexEntry> *entries) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  uint32_t header[4];
+  bool ok = fread(header, sizeof(header), 1, file) == 1 &&
+            header[0] == ARCHIVE_INDEX_MAGIC &&
+            header[1] == ARCHIVE_INDEX_VERSION;
+  if (ok) {
+    entries->resize(header[2]);
+    ok = entries->empty() ||
+         fread(entries->data(), sizeof(ArchiveIndexEntry), entries->size(),
+               file) == entries->size();
+  }
+  fclose(file);
+  return ok;
+}
+
+const ArchiveIndexEntry *
+findArchiveIndexEntry(const std::vector<ArchiveIndexEntry> &entries,
+                      uint64_t device_id) {
+  size_t lo = 0;
+  size_t hi = entries.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (entries[mid].device_id < device_id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < entries.size() && entries[lo].device_id == device_id
+             ? &entries[lo]
+             : nullptr;
+}
@@ -0,0 +1,117 @@
+#ifndef PAYLOAD_ARCHIVE_H
+#define PAYLOAD_ARCHIVE_H
+
+#include "payload_record.h"
+#include <stdio.h>
+#include <vector>
+
+// Payload archive segments are plain sequences of payload records (see
+// payload_record.h), the same framing the write-ahead log uses, so a sealed
+// log is already a valid arrival-ordered segment.
+
+// Buffered, append-only segment writer
+class ArchiveWriter {
+public:
+  ArchiveWriter();
+  ~ArchiveWriter();
+
+  // Create (truncate) a segment
+  bool open(const char *path);
+
+  // Append a record built from header + payload
+  bool write(const PayloadRecordHeader &header, const uint8_t *payload);
+
+  // Append an already framed record verbatim
+  bool writeRaw(const uint8_t *record, uint32_t length);
+
+  // Flush and close; returns false if any write failed
+  bool close();
+
+  // Bytes written so far (offset of the next record)
+  uint64_t getOffset() const;
+
+private:
+  ArchiveWriter(const ArchiveWriter &);
+  ArchiveWriter &operator=(const ArchiveWriter &);
+
+  FILE *file;
+  uint64_t offset;
+  bool failed;
+  std::vector<uint8_t> scratch;
+};
+
+// Sequential segment reader. A reader can be limited to the records that
+// start inside [begin, end); when begin is not a record boundary it resyncs
+// to the next valid record, so a large segment can be split between threads.
+class ArchiveReader {
+public:
+  ArchiveReader();
+  ~ArchiveReader();
+
+  // Open a whole segment
+  bool open(const char *path, uint32_t buffer_size = 1 << 20);
+
+  // Open the records that start in [begin, end)
+  bool openRange(const char *path, uint64_t begin, uint64_t end,
+                 uint32_t buffer_size = 1 << 20);
+
+  void close();
+
+  // Read the next record. record points at the framed record (header
+  // included) and stays valid until the next call.
+  // Returns: 1 on success, 0 at the end of the range
+  int32_t next(PayloadRecordHeader *header, const uint8_t **payload,
+               const uint8_t **record = nullptr, uint32_t *record_size = nullptr);
+
+  // File offset of the record returned by the last next()
+  uint64_t getRecordOffset() const;
+
+  // Bytes skipped while resyncing past corrupt or torn data
+  uint64_t getSkippedBytes() const;
+
+private:
+  ArchiveReader(const ArchiveReader &);
+  ArchiveReader &operator=(const ArchiveReader &);
+
+  bool fill();
+
+  FILE *file;
+  std::vector<uint8_t> buffer;
+  uint32_t start;           // First unread byte in buffer
+  uint32_t filled;          // Valid bytes in buffer
+  uint64_t buffer_offset;   // File offset of buffer[0]
+  uint64_t range_end;       // Records must start before this offset
+  uint64_t record_offset;
+  uint64_t skipped;
+  bool synced; // A record has been found in this range
+  bool eof;
+};
+
+// Per-device index of a device-sorted segment ("<segment>.idx")
+typedef struct {
+  uint64_t device_id;
+  uint64_t first_timestamp_ms;
+  uint64_t last_timestamp_ms;
+  uint64_t offset;       // File offset of the device's first record
+  uint64_t bytes;        // Bytes of the device's contiguous records
+  uint32_t record_count;
+  uint32_t reserved;
+} ArchiveIndexEntry;
+
+#define ARCHIVE_INDEX_MAGIC 0x58494741u // "AGIX" little-endian
+#define ARCHIVE_INDEX_VERSION 1
+
+// Write entries (sorted by device_id) to an index file
+bool writeArchiveIndex(const char *path,
+                       const std::vector<ArchiveIndexEntry> &entries);
+
+// Load an index file
+bool readArchiveIndex(const char *path, std::vector<ArchiveIndexEntry> *entries);
+
+// Binary search a loaded index
+// Returns: entry for device_id, or nullptr
+const ArchiveIndexEntry *
+findArchiveIndexEntry(const std::vector<ArchiveIndexEntry> &entries,
+                      uint64_t device_id);
+
+#endif // PAYLOAD_ARCHIVE_H
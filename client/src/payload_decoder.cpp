@@ -0,0 +1,256 @@
+#include "payload_decoder.h"
+#include "decode_plan.h"
+#include "payload_index.h"
+#include <string.h>
+
+PayloadDecoder::PayloadDecoder() : plans(nullptr) { reset(); }
+
+void PayloadDecoder::reset() { memset(&ctx, 0, sizeof(DecoderContext)); }
+
+void PayloadDecoder::setPlanCache(DecodePlanCache *cache) { plans = cache; }
+
+const PayloadHeader &PayloadDecoder::getHeader() const { return ctx.header; }
+
+uint8_t PayloadDecoder::getReadingCount() const { return ctx.reading_count; }
+
+const SensorReading &PayloadDecoder::getReading(uint8_t index) const {
+  return ctx.readings[index];
+}
+
+void PayloadDecoder::decodeMetadata(uint8_t metadata) {
+  // Bits 0-2: VERSION
+  ctx.header.version = metadata & 0x07;
+
+  // Bit 3: DUAL_MODE
+  ctx.header.dual_mode = (metadata & (1 << 3)) != 0;
+
+  // Bit 4: DEDICATED_TEMPHUM_SENSOR
+  ctx.header.dedicated_temphum_sensor = (metadata & (1 << 4)) != 0;
+}
+
+bool PayloadDecoder::isExpandable(SensorFlag flag) const {
+  // Must match PayloadEncoder::isExpandable
+  switch (flag) {
+  case FLAG_TEMP:
+  case FLAG_HUM:
+    return !ctx.header.dedicated_temphum_sensor;
+
+  case FLAG_PM_01:
+  case FLAG_PM_25:
+  case FLAG_PM_10:
+  case FLAG_PM_01_SP:
+  case FLAG_PM_25_SP:
+  case FLAG_PM_10_SP:
+  case FLAG_PM_03_PC:
+  case FLAG_PM_05_PC:
+  case FLAG_PM_01_PC:
+  case FLAG_PM_25_PC:
+  case FLAG_PM_5_PC:
+  case FLAG_PM_10_PC:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+uint16_t PayloadDecoder::readUint16(const uint8_t *buffer) const {
+  // Little-endian decoding
+  return (uint16_t)(buffer[0] | (buffer[1] << 8));
+}
+
+int16_t PayloadDecoder::readInt16(const uint8_t *buffer) const {
+  uint16_t unsigned_value = readUint16(buffer);
+  int16_t value;
+  memcpy(&value, &unsigned_value, sizeof(value));
+  return value;
+}
+
+uint32_t PayloadDecoder::readUint32(const uint8_t *buffer) const {
+  // Little-endian decoding
+  return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+         ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+int32_t PayloadDecoder::decodeSensorData(const uint8_t *buffer, uint32_t length,
+                                         SensorReading &reading) const {
+  uint32_t offset = 0;
+
+  // Iterate through flags in order (0-26), mirroring the encoder
+  for (uint8_t flag = 0; flag <= FLAG_SIGNAL; flag++) {
+    if (!IS_FLAG_SET(reading.presence_mask, flag)) {
+      continue; // Field not on the wire
+    }
+
+    SensorFlag sensor_flag = (SensorFlag)flag;
+    bool expandable = isExpandable(sensor_flag);
+    uint8_t value_count = (expandable && ctx.header.dual_mode) ? 2 : 1;
+
+    // Destination for 16-bit unsigned fields, so they share one read loop
+    uint16_t *values16 = nullptr;
+
+    switch (sensor_flag) {
+    case FLAG_TEMP:
+      for (uint8_t i = 0; i < value_count; i++) {
+        if (offset + 2 > length)
+          return -1;
+        reading.temp[i] = readInt16(&buffer[offset]);
+        offset += 2;
+      }
+      break;
+
+    case FLAG_HUM:
+      values16 = reading.hum;
+      break;
+    case FLAG_PM_01:
+      values16 = reading.pm_01;
+      break;
+    case FLAG_PM_25:
+      values16 = reading.pm_25;
+      break;
+    case FLAG_PM_10:
+      values16 = reading.pm_10;
+      break;
+    case FLAG_PM_01_SP:
+      values16 = reading.pm_01_sp;
+      break;
+    case FLAG_PM_25_SP:
+      values16 = reading.pm_25_sp;
+      break;
+    case FLAG_PM_10_SP:
+      values16 = reading.pm_10_sp;
+      break;
+    case FLAG_PM_03_PC:
+      values16 = reading.pm_03_pc;
+      break;
+    case FLAG_PM_05_PC:
+      values16 = reading.pm_05_pc;
+      break;
+    case FLAG_PM_01_PC:
+      values16 = reading.pm_01_pc;
+      break;
+    case FLAG_PM_25_PC:
+      values16 = reading.pm_25_pc;
+      break;
+    case FLAG_PM_5_PC:
+      values16 = reading.pm_5_pc;
+      break;
+    case FLAG_PM_10_PC:
+      values16 = reading.pm_10_pc;
+      break;
+    case FLAG_CO2:
+      values16 = &reading.co2;
+      break;
+    case FLAG_TVOC:
+      values16 = &reading.tvoc;
+      break;
+    case FLAG_TVOC_RAW:
+      values16 = &reading.tvoc_raw;
+      break;
+    case FLAG_NOX:
+      values16 = &reading.nox;
+      break;
+    case FLAG_NOX_RAW:
+      values16 = &reading.nox_raw;
+      break;
+    case FLAG_VBAT:
+      values16 = &reading.vbat;
+      break;
+    case FLAG_VPANEL:
+      values16 = &reading.vpanel;
+      break;
+    case FLAG_AFE_TEMP:
+      values16 = &reading.afe_temp;
+      break;
+
+    case FLAG_O3_WE:
+    case FLAG_O3_AE:
+    case FLAG_NO2_WE:
+    case FLAG_NO2_AE: {
+      if (offset + 4 > length)
+        return -1;
+      uint32_t value = readUint32(&buffer[offset]);
+      offset += 4;
+      if (sensor_flag == FLAG_O3_WE)
+        reading.o3_we = value;
+      else if (sensor_flag == FLAG_O3_AE)
+        reading.o3_ae = value;
+      else if (sensor_flag == FLAG_NO2_WE)
+        reading.no2_we = value;
+      else
+        reading.no2_ae = value;
+      break;
+    }
+
+    case FLAG_SIGNAL:
+      if (offset + 1 > length)
+        return -1;
+      reading.signal = (int8_t)buffer[offset];
+      offset += 1;
+      break;
+    }
+
+    if (values16 != nullptr) {
+      for (uint8_t i = 0; i < value_count; i++) {
+        if (offset + 2 > length)
+          return -1;
+        values16[i] = readUint16(&buffer[offset]);
+        offset += 2;
+      }
+    }
+  }
+
+  return offset;
+}
+
+int32_t PayloadDecoder::decodeReading(const uint8_t *buffer, uint32_t length,
+                                      SensorReading &reading) const {
+  if (length < 4) {
+    return -1; // Truncated presence mask
+  }
+
+  memset(&reading, 0, sizeof(SensorReading));
+  reading.presence_mask = readUint32(buffer);
+
+  const DecodePlan *plan =
+      plans != nullptr ? plans->find(reading.presence_mask, ctx.header)
+                       : nullptr;
+  int32_t data_size =
+      plan != nullptr ? runDecodePlan(*plan, &buffer[4], length - 4, reading)
+                      : decodeSensorData(&buffer[4], length - 4, reading);
+  if (data_size < 0) {
+    return -1;
+  }
+
+  return 4 + data_size;
+}
+
+int32_t PayloadDecoder::decode(const uint8_t *buffer, uint32_t length) {
+  // Each decoded reading is cleared by decodeReading(), so only the header
+  // and count need resetting here
+  memset(&ctx.header, 0, sizeof(ctx.header));
+  ctx.reading_count = 0;
+
+  if (buffer == nullptr || length < 2) {
+    return -1; // Need at least the header
+  }
+
+  decodeMetadata(buffer[0]);
+  ctx.header.interval_minutes = buffer[1];
+
+  // Structure first: a malformed payload is rejected before any field is
+  // decoded, and every reading below is known to be complete
+  PayloadIndex index;
+  if (indexPayload(buffer, length, index) < 0) {
+    return -1;
+  }
+
+  for (uint8_t k = 0; k < index.reading_count; k++) {
+    decodeReading(&buffer[index.offsets[k]],
+                  (uint32_t)(index.offsets[k + 1] - index.offsets[k]),
+                  ctx.readings[k]);
+  }
+  ctx.reading_count = index.reading_count;
+
+  return ctx.reading_count;
+}
@@ -0,0 +1,53 @@
+#ifndef PAYLOAD_DECODER_H
+#define PAYLOAD_DECODER_H
+
+#include "payload_types.h"
+
+class DecodePlanCache;
+
+class PayloadDecoder {
+public:
+  PayloadDecoder();
+
+  // Decode a complete payload (header + readings)
+  // Returns: number of readings decoded, or -1 on malformed payload
+  int32_t decode(const uint8_t *buffer, uint32_t length);
+
+  // Reset decoder (clear header and readings)
+  void reset();
+
+  // Decode readings with compiled plans from a shared cache (nullptr to
+  // decode field by field). The cache must outlive the decoder.
+  void setPlanCache(DecodePlanCache *cache);
+
+  // Decoded header of the last payload
+  const PayloadHeader &getHeader() const;
+
+  // Get decoded reading count
+  uint8_t getReadingCount() const;
+
+  // Get a decoded reading (index < getReadingCount())
+  const SensorReading &getReading(uint8_t index) const;
+
+  // Helper functions made public for testing
+  void decodeMetadata(uint8_t metadata);
+  bool isExpandable(SensorFlag flag) const;
+
+  // Decode one reading (presence mask + sensor data)
+  // Returns: number of bytes consumed, or -1 if the buffer is truncated
+  int32_t decodeReading(const uint8_t *buffer, uint32_t length,
+                        SensorReading &reading) const;
+
+private:
+  DecoderContext ctx;
+  DecodePlanCache *plans;
+
+  // Internal decoding helpers
+  int32_t decodeSensorData(const uint8_t *buffer, uint32_t length,
+                           SensorReading &reading) const;
+  uint16_t readUint16(const uint8_t *buffer) const;
+  int16_t readInt16(const uint8_t *buffer) const;
+  uint32_t readUint32(const uint8_t *buffer) const;
+};
+
+#endif // PAYLOAD_DECODER_H
@@ -0,0 +1,290 @@
+#include "payload_dedup.h"
+#include <math.h>
+#include <new>
+#include <string.h>
+
+#define HASH_COUNT_MAX 16
+#define BITS_PER_KEY_MAX 64
+#define EPOCH_EMPTY UINT64_MAX        // Bucket never used
+#define EPOCH_CLEARING (UINT64_MAX - 1) // Bucket being cleared
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// MurmurHash3 finalizer
+static inline uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t hashWord(uint64_t h, uint64_t word) {
+  h ^= word * 0x87C37B91114253D5ull;
+  return rotl64(h, 29) * 0x4CF5AD432745937Full;
+}
+
+uint64_t duplicateKey(uint64_t device_id, const uint8_t *payload,
+                      uint32_t length) {
+  // The filter lives in one process, so words are read in host byte order
+  uint64_t h = device_id * 0x9E3779B97F4A7C15ull ^ length;
+  uint32_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, &payload[i], sizeof(word));
+    h = hashWord(h, word);
+  }
+  if (i < length) {
+    uint64_t word = 0;
+    for (uint32_t shift = 0; i < length; i++, shift += 8) {
+      word |= (uint64_t)payload[i] << shift;
+    }
+    h = hashWord(h, word);
+  }
+  return mix64(h);
+}
+
+// False positive rate of one bucket with keys_per_word keys per 64-bit word
+// on average (Poisson) and hash_count distinct bits per key
+static double bucketFalsePositiveRate(double keys_per_word,
+                                      uint32_t hash_count) {
+  if (keys_per_word <= 0) {
+    return 0;
+  }
+  double rate = 0;
+  double probability = exp(-keys_per_word); // P(n keys in the word)
+  double total = 0;
+  for (uint32_t n = 0; n < 1000 && total < 1 - 1e-12; n++) {
+    double unset = pow(1 - hash_count / 64.0, (double)n);
+    rate += probability * pow(1 - unset, (double)hash_count);
+    total += probability;
+    probability *= keys_per_word / (n + 1);
+  }
+  return rate;
+}
+
+static double bestFalsePositiveRate(double keys_per_word,
+                                    uint32_t *hash_count) {
+  double best = 1;
+  for (uint32_t k = 1; k <= HASH_COUNT_MAX; k++) {
+    double rate = bucketFalsePositiveRate(keys_per_word, k);
+    if (rate < best) {
+      best = rate;
+      *hash_count = k;
+    }
+  }
+  return best;
+}
+
+DuplicateFilter::DuplicateFilter()
+    : hash_count(0), bits_per_key(0), words_per_bucket(0), current(0),
+      lookup_count(0), duplicate_count(0) {
+  memset(&config, 0, sizeof(config));
+}
+
+DuplicateFilterConfig DuplicateFilter::defaultConfig() {
+  DuplicateFilterConfig config;
+  config.keys_per_bucket = 1000000;
+  config.false_positive_rate = 0.001;
+  config.bucket_ms = 60000;
+  config.buckets = 5;
+  return config;
+}
+
+bool DuplicateFilter::init(const DuplicateFilterConfig &config) {
+  if (config.keys_per_bucket == 0 || config.bucket_ms == 0 ||
+      config.buckets < 2 || config.buckets > 64 ||
+      !(config.false_positive_rate > 0 && config.false_positive_rate < 1)) {
+    return false;
+  }
+
+  // Smallest size whose buckets, all at capacity, meet the target together
+  double target = 1 - pow(1 - config.false_positive_rate, 1.0 / config.buckets);
+  uint32_t k = 1;
+  uint32_t bpk = 1;
+  for (; bpk < BITS_PER_KEY_MAX; bpk++) {
+    if (bestFalsePositiveRate(64.0 / bpk, &k) <= target) {
+      break;
+    }
+  }
+  bestFalsePositiveRate(64.0 / bpk, &k);
+  uint64_t count = (config.keys_per_bucket * bpk + 63) / 64;
+  if (count > UINT32_MAX) {
+    return false;
+  }
+
+  uint64_t total = count * config.buckets;
+  words.reset(new (std::nothrow) std::atomic<uint64_t>[total]);
+  epochs.reset(new (std::nothrow) std::atomic<uint64_t>[config.buckets]);
+  keys.reset(new (std::nothrow) std::atomic<uint64_t>[config.buckets]);
+  if (!words || !epochs || !keys) {
+    return false;
+  }
+  for (uint64_t i = 0; i < total; i++) {
+    words[i].store(0, std::memory_order_relaxed);
+  }
+  for (uint32_t b = 0; b < config.buckets; b++) {
+    epochs[b].store(b == 0 ? 0 : EPOCH_EMPTY, std::memory_order_relaxed);
+    keys[b].store(0, std::memory_order_relaxed);
+  }
+
+  this->config = config;
+  hash_count = k;
+  bits_per_key = bpk;
+  words_per_bucket = count;
+  current.store(0, std::memory_order_release);
+  lookup_count.store(0, std::memory_order_relaxed);
+  duplicate_count.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+// Word that holds the key in each bucket and the bits it sets there
+static inline uint64_t keyBits(uint64_t key, uint64_t words_per_bucket,
+                               uint32_t hash_count, uint64_t *index) {
+  uint64_t h = mix64(key);
+  *index = ((h >> 32) * words_per_bucket) >> 32;
+  uint64_t bits = mix64(h ^ 0x9E3779B97F4A7C15ull);
+  uint64_t pattern = 0;
+  uint32_t set = 0;
+  for (uint32_t used = 0; set < hash_count; used++) {
+    if (used == 10) {
+      // Out of 6-bit positions: rehash for more
+      bits = mix64(bits + 0x9E3779B97F4A7C15ull);
+      used = 0;
+    }
+    uint64_t bit = 1ull << ((bits >> (6 * used)) & 63);
+    if ((pattern & bit) == 0) {
+      pattern |= bit;
+      set++;
+    }
+  }
+  return pattern;
+}
+
+// Returns: true if any live bucket has every bit of pattern in its word
+bool DuplicateFilter::findKey(uint64_t newest, uint64_t index,
+                              uint64_t pattern) const {
+  for (uint32_t b = 0; b < config.buckets; b++) {
+    uint64_t held = epochs[b].load(std::memory_order_acquire);
+    // Skips empty, clearing and expired buckets
+    if (held > newest || held + config.buckets <= newest) {
+      continue;
+    }
+    uint64_t word =
+        words[index * config.buckets + b].load(std::memory_order_relaxed);
+    if ((word & pattern) == pattern) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Move the newest epoch forward, clearing the buckets it takes over. One
+// thread wins the move; the others carry on with the new epoch and skip
+// inserts into a bucket that is still being cleared.
+void DuplicateFilter::advance(uint64_t epoch) {
+  uint64_t previous = current.load(std::memory_order_acquire);
+  while (epoch > previous) {
+    if (!current.compare_exchange_weak(previous, epoch,
+                                       std::memory_order_acq_rel)) {
+      continue;
+    }
+    uint64_t first = previous + 1;
+    if (epoch >= config.buckets && epoch - config.buckets + 1 > first) {
+      first = epoch - config.buckets + 1;
+    }
+    for (uint64_t e = first; e <= epoch; e++) {
+      uint32_t b = (uint32_t)(e % config.buckets);
+      epochs[b].store(EPOCH_CLEARING, std::memory_order_release);
+      for (uint64_t i = 0; i < words_per_bucket; i++) {
+        words[i * config.buckets + b].store(0, std::memory_order_relaxed);
+      }
+      keys[b].store(0, std::memory_order_relaxed);
+      epochs[b].store(e, std::memory_order_release);
+    }
+    return;
+  }
+}
+
+bool DuplicateFilter::checkAndInsert(uint64_t key, uint64_t timestamp_ms) {
+  lookup_count.fetch_add(1, std::memory_order_relaxed);
+  uint64_t epoch = timestamp_ms / config.bucket_ms;
+  uint64_t newest = current.load(std::memory_order_acquire);
+  if (epoch > newest) {
+    advance(epoch);
+    newest = current.load(std::memory_order_acquire);
+  }
+
+  uint64_t index;
+  uint64_t pattern = keyBits(key, words_per_bucket, hash_count, &index);
+
+  if (findKey(newest, index, pattern)) {
+    duplicate_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Late timestamps go into the newest bucket too
+  uint32_t target = (uint32_t)(newest % config.buckets);
+  if (epochs[target].load(std::memory_order_acquire) != newest) {
+    return false;
+  }
+  uint64_t old = words[index * config.buckets + target].fetch_or(
+      pattern, std::memory_order_relaxed);
+  if ((old & pattern) == pattern) {
+    // Another thread inserted the same key since the check
+    duplicate_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  keys[target].fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+bool DuplicateFilter::checkAndInsert(uint64_t device_id,
+                                     const uint8_t *payload, uint32_t length,
+                                     uint64_t timestamp_ms) {
+  return checkAndInsert(duplicateKey(device_id, payload, length),
+                        timestamp_ms);
+}
+
+bool DuplicateFilter::contains(uint64_t key) const {
+  if (words_per_bucket == 0) {
+    return false;
+  }
+  uint64_t index;
+  uint64_t pattern = keyBits(key, words_per_bucket, hash_count, &index);
+  return findKey(current.load(std::memory_order_acquire), index, pattern);
+}
+
+DuplicateFilterStats DuplicateFilter::getStats() const {
+  DuplicateFilterStats stats;
+  memset(&stats, 0, sizeof(stats));
+  stats.lookups = lookup_count.load(std::memory_order_relaxed);
+  stats.duplicates = duplicate_count.load(std::memory_order_relaxed);
+  stats.memory_bytes = words_per_bucket * config.buckets * sizeof(uint64_t);
+  stats.bits_per_key = bits_per_key;
+  stats.hash_count = hash_count;
+  if (words_per_bucket == 0) {
+    return stats;
+  }
+
+  double full = bucketFalsePositiveRate(
+      (double)config.keys_per_bucket / words_per_bucket, hash_count);
+  stats.expected_fp_rate = 1 - pow(1 - full, (double)config.buckets);
+
+  uint64_t newest = current.load(std::memory_order_acquire);
+  double pass = 1;
+  for (uint32_t b = 0; b < config.buckets; b++) {
+    uint64_t held = epochs[b].load(std::memory_order_acquire);
+    if (held > newest || held + config.buckets <= newest) {
+      continue;
+    }
+    double fill = (double)keys[b].load(std::memory_order_relaxed) /
+                  words_per_bucket;
+    pass *= 1 - bucketFalsePositiveRate(fill, hash_count);
+  }
+  stats.estimated_fp_rate = 1 - pass;
+  return stats;
+}
@@ -0,0 +1,92 @@
+#ifndef PAYLOAD_DEDUP_H
+#define PAYLOAD_DEDUP_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+// Duplicate filter for retransmitted payloads. Keys are (device, 64-bit hash
+// of the payload bytes). Keys go into a Bloom filter per time bucket of
+// receive time; the filter remembers the last `buckets` buckets and clears
+// the oldest one when a new bucket starts, so memory is fixed.
+//
+// Each key sets its bits in a single 64-bit word, and the words of all
+// buckets for a key sit next to each other, so a lookup over every bucket
+// costs one cache miss and the insert is one atomic fetch-or. Of several
+// threads inserting the same key at once, exactly one sees it as new.
+//
+// A false positive drops a payload that was never seen; size the filter for
+// the rate that is acceptable. A false negative cannot happen for keys
+// inserted within the window, except for keys that arrive while their
+// bucket is being cleared (they pass as new).
+
+typedef struct {
+  uint64_t keys_per_bucket;   // Expected payloads per bucket
+  double false_positive_rate; // Target rate for a lookup over all buckets
+  uint32_t bucket_ms;         // Width of a bucket of receive time
+  uint32_t buckets;           // Buckets remembered, 2-64; a key is found
+                              // for at least (buckets - 1) x bucket_ms
+} DuplicateFilterConfig;
+
+typedef struct {
+  uint64_t lookups;
+  uint64_t duplicates;           // Lookups that found the key
+  uint64_t memory_bytes;         // Filter memory, all buckets
+  uint32_t bits_per_key;         // Chosen from the target rate
+  uint32_t hash_count;           // Bits set per key
+  double expected_fp_rate;       // Rate with every bucket at capacity
+  double estimated_fp_rate;      // Rate at the current fill
+} DuplicateFilterStats;
+
+// 64-bit hash of payload bytes, seeded with the device id
+uint64_t duplicateKey(uint64_t device_id, const uint8_t *payload,
+                      uint32_t length);
+
+class DuplicateFilter {
+public:
+  DuplicateFilter();
+
+  // Defaults: 1M keys per bucket, 0.1% false positives, 1 minute buckets,
+  // 5 buckets
+  static DuplicateFilterConfig defaultConfig();
+
+  // Size and allocate the filter; not thread-safe
+  // Returns: false if the config is invalid or memory cannot be allocated
+  bool init(const DuplicateFilterConfig &config);
+
+  // Look up the key and record it if it was not there. May be called from
+  // many threads at once.
+  // Returns: true if the key was seen within the window (a duplicate)
+  bool checkAndInsert(uint64_t key, uint64_t timestamp_ms);
+
+  bool checkAndInsert(uint64_t device_id, const uint8_t *payload,
+                      uint32_t length, uint64_t timestamp_ms);
+
+  // Look up the key without recording it
+  // Returns: true if the key was seen within the window
+  bool contains(uint64_t key) const;
+
+  // Counters are relaxed, so approximate while threads are inserting
+  DuplicateFilterStats getStats() const;
+
+private:
+  DuplicateFilter(const DuplicateFilter &);
+  DuplicateFilter &operator=(const DuplicateFilter &);
+
+  void advance(uint64_t epoch);
+  bool findKey(uint64_t newest, uint64_t index, uint64_t pattern) const;
+
+  DuplicateFilterConfig config;
+  uint32_t hash_count;
+  uint32_t bits_per_key;
+  uint64_t words_per_bucket;
+
+  std::unique_ptr<std::atomic<uint64_t>[]> words;  // Interleaved by bucket
+  std::unique_ptr<std::atomic<uint64_t>[]> epochs; // Epoch held by each bucket
+  std::unique_ptr<std::atomic<uint64_t>[]> keys;   // Keys inserted per bucket
+  std::atomic<uint64_t> current;                   // Newest epoch
+  std::atomic<uint64_t> lookup_count;
+  std::atomic<uint64_t> duplicate_count;
+};
+
+#endif // PAYLOAD_DEDUP_H
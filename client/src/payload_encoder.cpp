@@ -1,23 +1,50 @@
 #include "payload_encoder.h"
 #include <string.h>
 
-PayloadEncoder::PayloadEncoder() { reset(); }
+PayloadEncoder::PayloadEncoder() {
+  reset();
+  memset(&urgent_thresholds, 0, sizeof(UrgentThresholds));
+  urgent_active = 0;
+  urgent_header[0] = urgent_header[1] = 0;
+#ifdef PAYLOAD_ENCODER_STATS
+  resetStats();
+#endif
+}
 
 void PayloadEncoder::init(const PayloadHeader &header) {
   reset();
   ctx.header = header;
+  urgent_header[0] = encodeMetadata();
+  urgent_header[1] = header.interval_minutes;
 }
 
 bool PayloadEncoder::addReading(const SensorReading &reading) {
   if (ctx.reading_count >= MAX_BATCH_SIZE) {
+#ifdef PAYLOAD_ENCODER_STATS
+    stats.readings_rejected++;
+#endif
     return false;
   }
 
   ctx.readings[ctx.reading_count++] = reading;
+  if ((urgent_thresholds.co2_alarm | urgent_thresholds.pm_25_alarm) != 0) {
+    checkUrgent(ctx.reading_count - 1);
+  }
+#ifdef PAYLOAD_ENCODER_STATS
+  stats.readings_added++;
+  for (uint32_t mask = reading.presence_mask & ((1u << ENCODER_FIELD_COUNT) - 1);
+       mask != 0; mask &= mask - 1) {
+    stats.field_presence[__builtin_ctz(mask)]++;
+  }
+#endif
   return true;
 }
 
-void PayloadEncoder::reset() { memset(&ctx, 0, sizeof(EncoderContext)); }
+void PayloadEncoder::reset() {
+  memset(&ctx, 0, sizeof(EncoderContext));
+  urgent_index = -1;
+  urgent_encoded = -1;
+}
 
 uint8_t PayloadEncoder::getReadingCount() const { return ctx.reading_count; }
 
@@ -378,6 +405,9 @@ uint32_t PayloadEncoder::calculateTotalSize() const {
 
 int32_t PayloadEncoder::encode(uint8_t *buffer, uint32_t buffer_size) {
   if (buffer == nullptr) {
+#ifdef PAYLOAD_ENCODER_STATS
+    stats.encode_failures++;
+#endif
     return -1;
   }
 
@@ -387,6 +417,9 @@ int32_t PayloadEncoder::encode(uint8_t *buffer, uint32_t buffer_size) {
 
   uint32_t total_size = calculateTotalSize();
   if (total_size > buffer_size) {
+#ifdef PAYLOAD_ENCODER_STATS
+    stats.encode_failures++;
+#endif
     return -1; // Buffer too small
   }
 
@@ -405,10 +438,116 @@ int32_t PayloadEncoder::encode(uint8_t *buffer, uint32_t buffer_size) {
     // Encode sensor data
     int32_t data_size = encodeSensorData(&buffer[offset], buffer_size - offset, ctx.readings[i]);
     if (data_size < 0) {
+#ifdef PAYLOAD_ENCODER_STATS
+      stats.encode_failures++;
+#endif
       return -1; // Error encoding sensor data
     }
     offset += data_size;
   }
 
+#ifdef PAYLOAD_ENCODER_STATS
+  stats.encodes++;
+  stats.bytes_encoded += offset;
+  uint32_t bucket = 31 - __builtin_clz(offset);
+  stats.size_histogram[bucket < ENCODER_SIZE_BUCKETS ? bucket
+                                                     : ENCODER_SIZE_BUCKETS - 1]++;
+#endif
   return offset;
 }
+
+bool PayloadEncoder::setUrgentThresholds(const UrgentThresholds &thresholds) {
+  if (thresholds.co2_clear > thresholds.co2_alarm ||
+      thresholds.pm_25_clear > thresholds.pm_25_alarm) {
+    return false;
+  }
+  urgent_thresholds = thresholds;
+  urgent_active = 0;
+  return true;
+}
+
+void PayloadEncoder::checkUrgent(uint8_t index) {
+  const SensorReading &reading = ctx.readings[index];
+  uint32_t raised = 0;
+
+  if (urgent_thresholds.co2_alarm != 0 &&
+      IS_FLAG_SET(reading.presence_mask, FLAG_CO2)) {
+    if (reading.co2 >= urgent_thresholds.co2_alarm) {
+      raised |= FLAG_BIT(FLAG_CO2);
+    } else if (reading.co2 < urgent_thresholds.co2_clear) {
+      urgent_active &= ~FLAG_BIT(FLAG_CO2);
+    }
+  }
+
+  if (urgent_thresholds.pm_25_alarm != 0 &&
+      IS_FLAG_SET(reading.presence_mask, FLAG_PM_25)) {
+    uint16_t pm_25 = reading.pm_25[0];
+    if (ctx.header.dual_mode && reading.pm_25[1] > pm_25) {
+      pm_25 = reading.pm_25[1];
+    }
+    if (pm_25 >= urgent_thresholds.pm_25_alarm) {
+      raised |= FLAG_BIT(FLAG_PM_25);
+    } else if (pm_25 < urgent_thresholds.pm_25_clear) {
+      urgent_active &= ~FLAG_BIT(FLAG_PM_25);
+    }
+  }
+
+  // Only a crossing is urgent; a field stays in alarm until it clears
+  if ((raised & ~urgent_active) != 0) {
+    urgent_index = (int8_t)index;
+  }
+  urgent_active |= raised;
+}
+
+bool PayloadEncoder::hasUrgent() const { return urgent_index >= 0; }
+
+int32_t PayloadEncoder::encodeUrgent(uint8_t *buffer,
+                                     uint32_t buffer_size) {
+  if (buffer == nullptr || urgent_index < 0 ||
+      buffer_size < URGENT_PAYLOAD_SIZE) {
+    return -1;
+  }
+
+  const SensorReading &reading = ctx.readings[urgent_index];
+  urgent_encoded = urgent_index;
+  uint32_t mask = reading.presence_mask & URGENT_FIELD_MASK;
+  buffer[0] = urgent_header[0];
+  buffer[1] = urgent_header[1];
+  encodePresenceMask(&buffer[2], mask);
+  uint32_t offset = 6;
+
+  // Flag order: CO2 before PM2.5
+  if (IS_FLAG_SET(mask, FLAG_CO2)) {
+    writeUint16(&buffer[offset], reading.co2);
+    offset += 2;
+  }
+  if (IS_FLAG_SET(mask, FLAG_PM_25)) {
+    writeUint16(&buffer[offset], reading.pm_25[0]);
+    offset += 2;
+    if (ctx.header.dual_mode) {
+      writeUint16(&buffer[offset], reading.pm_25[1]);
+      offset += 2;
+    }
+  }
+  return offset;
+}
+
+void PayloadEncoder::markUrgentSent() {
+  if (urgent_encoded < 0) {
+    return;
+  }
+  // A crossing since encodeUrgent() moved urgent_index on; it is still unsent
+  ctx.readings[urgent_encoded].presence_mask &= ~URGENT_FIELD_MASK;
+  if (urgent_index == urgent_encoded) {
+    urgent_index = -1;
+  }
+  urgent_encoded = -1;
+}
+
+#ifdef PAYLOAD_ENCODER_STATS
+void PayloadEncoder::getStats(EncoderStats *stats) const {
+  memcpy(stats, &this->stats, sizeof(EncoderStats));
+}
+
+void PayloadEncoder::resetStats() { memset(&stats, 0, sizeof(EncoderStats)); }
+#endif
@@ -3,6 +3,24 @@
 
 #include "payload_types.h"
 
+#ifdef PAYLOAD_ENCODER_STATS
+// Payload size buckets: bucket b counts sizes in [2^b, 2^(b+1))
+#define ENCODER_SIZE_BUCKETS 11
+#define ENCODER_FIELD_COUNT (FLAG_SIGNAL + 1)
+
+// Encoder counters, only in builds with PAYLOAD_ENCODER_STATS defined.
+// Plain integers: an encoder is used from one task at a time.
+typedef struct {
+  uint32_t readings_added;
+  uint32_t readings_rejected; // addReading() with the batch full
+  uint32_t encodes;           // encode() calls that wrote a payload
+  uint32_t encode_failures;   // encode() returned -1 (buffer missing/small)
+  uint32_t bytes_encoded;
+  uint32_t size_histogram[ENCODER_SIZE_BUCKETS];
+  uint32_t field_presence[ENCODER_FIELD_COUNT]; // Readings added per field
+} EncoderStats;
+#endif
+
 class PayloadEncoder {
 public:
   PayloadEncoder();
@@ -27,6 +45,35 @@ public:
   // Calculate total size needed for current batch
   uint32_t calculateTotalSize() const;
 
+  // Set the alarm levels checked by every addReading() and clear the alarm
+  // state. Thresholds and alarm state are kept across init() and reset().
+  // Returns: false if a clear level is above its alarm level
+  bool setUrgentThresholds(const UrgentThresholds &thresholds);
+
+  // Whether a reading in the batch raised an alarm and has not been sent
+  bool hasUrgent() const;
+
+  // Encode the CO2 and PM2.5 of the latest reading that raised an alarm as
+  // a one-reading payload, and remember which reading it was. The batch is
+  // left as it is.
+  // Returns: bytes written, or -1 if there is no urgent reading or
+  // buffer_size is below URGENT_PAYLOAD_SIZE
+  int32_t encodeUrgent(uint8_t *buffer, uint32_t buffer_size);
+
+  // Call once the payload from the last encodeUrgent() was delivered: the
+  // batch drops CO2 and PM2.5 from the reading it held but keeps its place,
+  // so the batch's reading times still hold. An alarm raised by a later
+  // reading in the meantime stays pending.
+  void markUrgentSent();
+
+#ifdef PAYLOAD_ENCODER_STATS
+  // Copy the counters (kept across init() and reset())
+  void getStats(EncoderStats *stats) const;
+
+  // Zero the counters
+  void resetStats();
+#endif
+
   // Helper functions made public for testing
   uint8_t encodeMetadata() const;
   bool isExpandable(SensorFlag flag) const;
@@ -34,6 +81,16 @@ public:
 
 private:
   EncoderContext ctx;
+  UrgentThresholds urgent_thresholds;
+  uint32_t urgent_active;   // Fields in alarm that have not cleared
+  int8_t urgent_index;      // Reading to send urgently, -1 if none
+  int8_t urgent_encoded;    // Reading of the last encodeUrgent(), -1 if none
+  uint8_t urgent_header[2]; // Payload header bytes, set by init()
+#ifdef PAYLOAD_ENCODER_STATS
+  EncoderStats stats;
+#endif
+
+  void checkUrgent(uint8_t index);
 
   // Internal encoding helpers
   void encodePresenceMask(uint8_t *buffer, uint32_t mask) const;
@@ -0,0 +1,153 @@
+#include "payload_index.h"
+#include "decode_plan.h"
+#include <string.h>
+
+// Field groups by wire layout. Everything not 1 or 4 bytes wide is 2 bytes.
+#define FIELD_BITS ((1u << SENSOR_FIELD_COUNT) - 1)
+#define WIDTH1_FIELDS FLAG_BIT(FLAG_SIGNAL)
+#define WIDTH4_FIELDS                                                          \
+  (FLAG_BIT(FLAG_O3_WE) | FLAG_BIT(FLAG_O3_AE) | FLAG_BIT(FLAG_NO2_WE) |       \
+   FLAG_BIT(FLAG_NO2_AE))
+#define TEMPHUM_FIELDS (FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_HUM))
+// temp, hum and pm01 .. pm10_pc (must match kSensorFields[].expandable)
+#define EXPANDABLE_FIELDS                                                      \
+  (TEMPHUM_FIELDS |                                                            \
+   ((FLAG_BIT(FLAG_PM_10_PC + 1) - 1) & ~(FLAG_BIT(FLAG_PM_01) - 1)))
+
+// Without -mpopcnt the builtin is a library call; the bit-parallel count is
+// a dozen inline instructions
+static inline uint32_t popcount(uint32_t bits) {
+#ifdef __POPCNT__
+  return (uint32_t)__builtin_popcount(bits);
+#else
+  bits = bits - ((bits >> 1) & 0x55555555u);
+  bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+  bits = (bits + (bits >> 4)) & 0x0F0F0F0Fu;
+  return (bits * 0x01010101u) >> 24;
+#endif
+}
+
+static inline uint32_t readUint32(const uint8_t *buffer) {
+  return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+         ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+uint32_t readingDataSize(uint32_t presence_mask, const PayloadHeader &header) {
+  uint32_t fields = presence_mask & FIELD_BITS;
+  uint32_t size = 2 * popcount(fields) - popcount(fields & WIDTH1_FIELDS) +
+                  2 * popcount(fields & WIDTH4_FIELDS);
+  if (header.dual_mode) {
+    uint32_t second = header.dedicated_temphum_sensor
+                          ? EXPANDABLE_FIELDS & ~TEMPHUM_FIELDS
+                          : EXPANDABLE_FIELDS;
+    size += 2 * popcount(fields & second);
+  }
+  return size;
+}
+
+int32_t fieldDataOffset(uint32_t presence_mask, const PayloadHeader &header,
+                        SensorFlag flag) {
+  if (!IS_FLAG_SET(presence_mask, flag)) {
+    return -1;
+  }
+  return (int32_t)readingDataSize(presence_mask & (FLAG_BIT(flag) - 1),
+                                  header);
+}
+
+int32_t indexPayload(const uint8_t *payload, uint32_t length,
+                     PayloadIndex &index) {
+  index.reading_count = 0;
+  if (payload == nullptr || length < 2) {
+    return -1;
+  }
+
+  // Same bits as PayloadDecoder::decodeMetadata
+  index.header.version = payload[0] & 0x07;
+  index.header.dual_mode = (payload[0] & (1 << 3)) != 0;
+  index.header.dedicated_temphum_sensor = (payload[0] & (1 << 4)) != 0;
+  index.header.interval_minutes = payload[1];
+
+  uint32_t offset = 2;
+  uint32_t count = 0;
+  while (offset < length) {
+    if (count >= MAX_BATCH_SIZE || length - offset < 4) {
+      return -1;
+    }
+    uint32_t size = 4 + readingDataSize(readUint32(payload + offset),
+                                        index.header);
+    if (size > length - offset) {
+      return -1; // Truncated reading
+    }
+    index.offsets[count++] = (uint16_t)offset;
+    offset += size;
+  }
+  index.offsets[count] = (uint16_t)offset;
+  index.reading_count = (uint8_t)count;
+  return (int32_t)count;
+}
+
+uint32_t indexedReadingMask(const uint8_t *payload, const PayloadIndex &index,
+                            uint8_t k) {
+  return readUint32(payload + index.offsets[k]);
+}
+
+bool decodeIndexedReading(const uint8_t *payload, const PayloadIndex &index,
+                          uint8_t k, SensorReading &reading,
+                          DecodePlanCache *plans) {
+  if (k >= index.reading_count) {
+    return false;
+  }
+  memset(&reading, 0, sizeof(SensorReading));
+  reading.presence_mask = indexedReadingMask(payload, index, k);
+
+  const DecodePlan *plan =
+      plans != nullptr ? plans->find(reading.presence_mask, index.header)
+                       : nullptr;
+  DecodePlan compiled;
+  if (plan == nullptr) {
+    compileDecodePlan(reading.presence_mask, index.header, compiled);
+    plan = &compiled;
+  }
+  uint32_t start = index.offsets[k] + 4u;
+  return runDecodePlan(*plan, payload + start, index.offsets[k + 1] - start,
+                       reading) >= 0;
+}
+
+bool readIndexedField(const uint8_t *payload, const PayloadIndex &index,
+                      uint8_t k, SensorFlag flag, uint8_t channel,
+                      int64_t *value) {
+  if (k >= index.reading_count || channel > 1) {
+    return false;
+  }
+  uint32_t mask = indexedReadingMask(payload, index, k);
+  int32_t offset = fieldDataOffset(mask, index.header, flag);
+  if (offset < 0) {
+    return false;
+  }
+  if (channel == 1) {
+    bool expandable = (EXPANDABLE_FIELDS & FLAG_BIT(flag)) != 0 &&
+                      !((TEMPHUM_FIELDS & FLAG_BIT(flag)) != 0 &&
+                        index.header.dedicated_temphum_sensor);
+    if (!index.header.dual_mode || !expandable) {
+      return false;
+    }
+    offset += 2;
+  }
+
+  const uint8_t *in = payload + index.offsets[k] + 4 + offset;
+  switch (kSensorFields[flag].type) {
+  case FIELD_INT8:
+    *value = (int8_t)in[0];
+    break;
+  case FIELD_INT16:
+    *value = (int16_t)(uint16_t)(in[0] | (in[1] << 8));
+    break;
+  case FIELD_UINT16:
+    *value = (uint16_t)(in[0] | (in[1] << 8));
+    break;
+  case FIELD_UINT32:
+    *value = readUint32(in);
+    break;
+  }
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef PAYLOAD_INDEX_H
+#define PAYLOAD_INDEX_H
+
+#include "sensor_fields.h"
+
+class DecodePlanCache;
+
+// Structural index of a payload: where each reading starts, found by a pass
+// over the presence masks alone. A reading's size follows from its mask
+// with a few popcounts, so indexing never touches field data, and a
+// malformed payload is rejected before anything is decoded.
+//
+// With the index, readings (or single fields) can be decoded in any order
+// and from several threads at once.
+
+typedef struct {
+  PayloadHeader header;
+  uint8_t reading_count;
+  // offsets[k]: payload offset of reading k's presence mask;
+  // offsets[reading_count] is the payload length
+  uint16_t offsets[MAX_BATCH_SIZE + 1];
+} PayloadIndex;
+
+// Sensor data bytes of a reading (after its 4-byte presence mask)
+uint32_t readingDataSize(uint32_t presence_mask, const PayloadHeader &header);
+
+// Offset of a field's first value within a reading's sensor data
+// Returns: byte offset, or -1 if the field is not present
+int32_t fieldDataOffset(uint32_t presence_mask, const PayloadHeader &header,
+                        SensorFlag flag);
+
+// Index a payload. Fails on a truncated reading, more than MAX_BATCH_SIZE
+// readings or length < 2.
+// Returns: number of readings, or -1 if the payload is malformed
+int32_t indexPayload(const uint8_t *payload, uint32_t length,
+                     PayloadIndex &index);
+
+// Presence mask of reading k (k < index.reading_count)
+uint32_t indexedReadingMask(const uint8_t *payload, const PayloadIndex &index,
+                            uint8_t k);
+
+// Decode reading k of an indexed payload, with a plan from the cache if
+// one is given. The payload is not re-validated.
+// Returns: false if k is out of range
+bool decodeIndexedReading(const uint8_t *payload, const PayloadIndex &index,
+                          uint8_t k, SensorReading &reading,
+                          DecodePlanCache *plans = nullptr);
+
+// Read one raw field value of reading k without decoding the rest
+// Returns: false if k is out of range, the field is absent or the channel
+// is not on the wire
+bool readIndexedField(const uint8_t *payload, const PayloadIndex &index,
+                      uint8_t k, SensorFlag flag, uint8_t channel,
+                      int64_t *value);
+
+#endif // PAYLOAD_INDEX_H
@@ -0,0 +1,577 @@
+#include "payload_queue.h"
+#include "payload_stream.h"
+#include <string.h>
+
+#define SECTOR_HEADER_SIZE 12
+
+// CRC-32C, 4 bits at a time: a 64-byte table instead of the host's 8 KiB
+static const uint32_t kCrcNibbles[16] = {
+    0x00000000, 0x105EC76F, 0x20BD8EDE, 0x30E349B1, 0x417B1DBC, 0x5125DAD3,
+    0x61C69362, 0x7198540D, 0x82F63B78, 0x92A8FC17, 0xA24BB5A6, 0xB21572C9,
+    0xC38D26C4, 0xD3D3E1AB, 0xE330A81A, 0xF36E6F75};
+
+// Continue a running CRC (start with crc = 0), as crc32cExtend()
+static uint32_t crcExtend(uint32_t crc, const uint8_t *data,
+                          uint32_t length) {
+  crc = ~crc;
+  while (length-- > 0) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ kCrcNibbles[crc & 0x0F];
+    crc = (crc >> 4) ^ kCrcNibbles[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+static inline void writeLe32(uint8_t *buffer, uint32_t value) {
+  buffer[0] = (uint8_t)(value >> 0);
+  buffer[1] = (uint8_t)(value >> 8);
+  buffer[2] = (uint8_t)(value >> 16);
+  buffer[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t readLe32(const uint8_t *buffer) {
+  return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+         ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+static inline uint32_t readLe16(const uint8_t *buffer) {
+  return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8);
+}
+
+PayloadQueue::PayloadQueue() {
+  memset(&flash, 0, sizeof(FlashRegion));
+  memset(&stats, 0, sizeof(PayloadQueueStats));
+  data_offset = 0;
+  head_sector = head_sequence = head_offset = 0;
+  head_open = false;
+  sectors_used = 0;
+  tail_sector = tail_offset = 0;
+  next_payload = 1;
+  acked = 0;
+  drain_sector = drain_offset = drain_last = 0;
+  drops = drain_drops = 0;
+  write_address = staged = 0;
+}
+
+uint32_t PayloadQueue::align(uint32_t size) const {
+  return (size + flash.program_size - 1) & ~(flash.program_size - 1);
+}
+
+uint32_t PayloadQueue::nextSector(uint32_t sector) const {
+  return sector + 1 < flash.sector_count ? sector + 1 : 0;
+}
+
+uint32_t PayloadQueue::maxPayloadSize() const {
+  if (flash.sector_size < data_offset + PAYLOAD_QUEUE_RECORD_OVERHEAD +
+                              STREAM_FRAME_OVERHEAD) {
+    return 0;
+  }
+  uint32_t size = flash.sector_size - data_offset -
+                  PAYLOAD_QUEUE_RECORD_OVERHEAD - STREAM_FRAME_OVERHEAD;
+  return size < MAX_PAYLOAD_SIZE ? size : MAX_PAYLOAD_SIZE;
+}
+
+uint32_t PayloadQueue::pendingCount() const {
+  return next_payload - 1 - acked;
+}
+
+const PayloadQueueStats &PayloadQueue::getStats() const { return stats; }
+
+PayloadQueue::RecordStatus
+PayloadQueue::readSectorHeader(uint32_t sector, uint32_t *sequence) {
+  uint8_t header[SECTOR_HEADER_SIZE];
+  if (!flash.read(flash.context, sector * flash.sector_size, header,
+                  sizeof(header))) {
+    return RECORD_IO;
+  }
+  if (readLe32(header) != PAYLOAD_QUEUE_MAGIC ||
+      readLe32(&header[8]) != crcExtend(0, header, 8)) {
+    return RECORD_BAD;
+  }
+  *sequence = readLe32(&header[4]);
+  return RECORD_OK;
+}
+
+PayloadQueue::RecordStatus PayloadQueue::erasedFrom(uint32_t sector,
+                                                    uint32_t offset) {
+  uint32_t length = flash.sector_size - offset;
+  if (length > PAYLOAD_QUEUE_STAGING_SIZE) {
+    length = PAYLOAD_QUEUE_STAGING_SIZE;
+  }
+  if (!flash.read(flash.context, sector * flash.sector_size + offset, staging,
+                  length)) {
+    return RECORD_IO;
+  }
+  for (uint32_t i = 0; i < length; i++) {
+    if (staging[i] != 0xFF) {
+      return RECORD_BAD;
+    }
+  }
+  return RECORD_OK;
+}
+
+PayloadQueue::RecordStatus PayloadQueue::readRecord(uint32_t sector,
+                                                    uint32_t offset,
+                                                    uint8_t *frame,
+                                                    uint32_t capacity,
+                                                    RecordInfo *info) {
+  if (offset + PAYLOAD_QUEUE_RECORD_OVERHEAD > flash.sector_size) {
+    return RECORD_END;
+  }
+  uint32_t address = sector * flash.sector_size + offset;
+  uint8_t header[8];
+  if (!flash.read(flash.context, address, header, sizeof(header))) {
+    return RECORD_IO;
+  }
+  static const uint8_t kErased[8] = {0xFF, 0xFF, 0xFF, 0xFF,
+                                     0xFF, 0xFF, 0xFF, 0xFF};
+  if (memcmp(header, kErased, sizeof(header)) == 0) {
+    return RECORD_END;
+  }
+
+  info->sequence = readLe32(header);
+  info->type = header[4];
+  info->frame_size = readLe16(&header[6]);
+  uint32_t frame_size = info->frame_size;
+  if (info->type == PAYLOAD_QUEUE_ACK) {
+    if (frame_size != 0) {
+      return RECORD_BAD;
+    }
+  } else if (info->type != PAYLOAD_QUEUE_PAYLOAD ||
+             frame_size < STREAM_FRAME_OVERHEAD + 2 ||
+             frame_size > STREAM_FRAME_OVERHEAD + MAX_PAYLOAD_SIZE) {
+    return RECORD_BAD;
+  }
+  if (header[5] != 0) {
+    return RECORD_BAD;
+  }
+  info->size = align(PAYLOAD_QUEUE_RECORD_OVERHEAD + frame_size);
+  if (offset + info->size > flash.sector_size) {
+    return RECORD_BAD;
+  }
+  if (frame != nullptr && frame_size > capacity) {
+    return RECORD_NO_ROOM;
+  }
+
+  // The frame up to its CRC, into the caller's buffer or in chunks
+  uint32_t crc = 0;
+  uint32_t body = frame_size > 0 ? frame_size - 4 : 0;
+  uint32_t done = 0;
+  while (done < body) {
+    uint32_t length = body - done;
+    uint8_t *bytes = frame != nullptr ? frame + done : staging;
+    if (frame == nullptr && length > PAYLOAD_QUEUE_STAGING_SIZE) {
+      length = PAYLOAD_QUEUE_STAGING_SIZE;
+    }
+    if (!flash.read(flash.context, address + 8 + done, bytes, length)) {
+      return RECORD_IO;
+    }
+    uint32_t skip = 0;
+    if (done == 0) {
+      // Sync bytes are not covered by the CRC
+      if (bytes[0] != STREAM_FRAME_SYNC0 || bytes[1] != STREAM_FRAME_SYNC1 ||
+          readLe16(&bytes[2]) != frame_size - STREAM_FRAME_OVERHEAD ||
+          bytes[4] != (uint8_t)~(bytes[2] ^ bytes[3])) {
+        return RECORD_BAD;
+      }
+      skip = 2;
+    }
+    crc = crcExtend(crc, bytes + skip, length - skip);
+    done += length;
+  }
+
+  // Frame CRC (if any) and record CRC
+  uint8_t trailer[8];
+  uint32_t trailer_size = frame_size > 0 ? 8 : 4;
+  if (!flash.read(flash.context, address + 8 + body,
+                  &trailer[8 - trailer_size], trailer_size)) {
+    return RECORD_IO;
+  }
+  if (frame_size > 0) {
+    if (readLe32(trailer) != crc) {
+      return RECORD_BAD;
+    }
+    if (frame != nullptr) {
+      memcpy(frame + body, trailer, 4);
+    }
+  }
+  if (readLe32(&trailer[4]) != crcExtend(crc, header, sizeof(header))) {
+    return RECORD_BAD;
+  }
+  return RECORD_OK;
+}
+
+bool PayloadQueue::mount(const FlashRegion &flash) {
+  if (flash.read == nullptr || flash.program == nullptr ||
+      flash.erase == nullptr || flash.sector_count < 2 ||
+      flash.program_size == 0 ||
+      flash.program_size > PAYLOAD_QUEUE_STAGING_SIZE ||
+      (flash.program_size & (flash.program_size - 1)) != 0 ||
+      flash.sector_size % flash.program_size != 0 ||
+      (uint64_t)flash.sector_size * flash.sector_count > UINT32_MAX) {
+    return false;
+  }
+  this->flash = flash;
+  data_offset = align(SECTOR_HEADER_SIZE);
+  if (maxPayloadSize() < 2) {
+    return false;
+  }
+  memset(&stats, 0, sizeof(PayloadQueueStats));
+  drain_last = 0;
+  drops = drain_drops = 0;
+  next_payload = 1;
+  acked = 0;
+
+  // Newest sector
+  bool found = false;
+  for (uint32_t sector = 0; sector < flash.sector_count; sector++) {
+    uint32_t sequence;
+    RecordStatus status = readSectorHeader(sector, &sequence);
+    if (status == RECORD_IO) {
+      return false;
+    }
+    if (status == RECORD_OK &&
+        (!found || (int32_t)(sequence - head_sequence) > 0)) {
+      head_sector = sector;
+      head_sequence = sequence;
+      found = true;
+    }
+  }
+  if (!found) {
+    // Empty: the first record opens sector 0
+    head_sector = flash.sector_count - 1;
+    head_sequence = 0;
+    head_offset = data_offset;
+    head_open = false;
+    sectors_used = 0;
+    tail_sector = 0;
+    tail_offset = data_offset;
+    return true;
+  }
+
+  // Older sectors follow back from the head while their sequence steps down
+  sectors_used = 1;
+  while (sectors_used < flash.sector_count) {
+    uint32_t sector =
+        (head_sector + flash.sector_count - sectors_used) % flash.sector_count;
+    uint32_t sequence;
+    RecordStatus status = readSectorHeader(sector, &sequence);
+    if (status == RECORD_IO) {
+      return false;
+    }
+    if (status != RECORD_OK || sequence != head_sequence - sectors_used) {
+      break;
+    }
+    sectors_used++;
+  }
+  uint32_t oldest = (head_sector + flash.sector_count - sectors_used + 1) %
+                    flash.sector_count;
+
+  // Sequences, the last ack and the end of the head sector
+  uint32_t max_payload = 0, min_payload = 0, max_ack = 0;
+  head_open = true;
+  uint32_t sector = oldest;
+  for (uint32_t i = 0; i < sectors_used; i++, sector = nextSector(sector)) {
+    uint32_t offset = data_offset;
+    for (;;) {
+      RecordInfo info;
+      RecordStatus status = readRecord(sector, offset, nullptr, 0, &info);
+      if (status == RECORD_IO) {
+        return false;
+      }
+      if (status == RECORD_BAD) {
+        stats.torn_records++;
+        if (sector == head_sector) {
+          head_open = false; // Never program over the damaged bytes
+        }
+        break;
+      }
+      if (status != RECORD_OK) {
+        break;
+      }
+      if (info.type == PAYLOAD_QUEUE_ACK) {
+        max_ack = info.sequence > max_ack ? info.sequence : max_ack;
+      } else {
+        if (min_payload == 0 || info.sequence < min_payload) {
+          min_payload = info.sequence;
+        }
+        max_payload = info.sequence > max_payload ? info.sequence : max_payload;
+      }
+      offset += info.size;
+    }
+    if (sector == head_sector) {
+      head_offset = offset;
+      // A record torn before its header was programmed leaves stray bytes
+      if (head_open && offset < flash.sector_size) {
+        RecordStatus status = erasedFrom(sector, offset);
+        if (status == RECORD_IO) {
+          return false;
+        }
+        if (status != RECORD_OK) {
+          stats.torn_records++;
+          head_open = false;
+        }
+      }
+    }
+  }
+  next_payload = (max_payload > max_ack ? max_payload : max_ack) + 1;
+  acked = max_ack;
+  // Payloads below the oldest one left were drained or dropped
+  if (min_payload > 0 && min_payload - 1 > acked) {
+    acked = min_payload - 1;
+  }
+
+  // Tail: the first payload not yet drained
+  tail_sector = head_sector;
+  tail_offset = head_offset;
+  sector = oldest;
+  bool tail_found = false;
+  for (uint32_t i = 0; i < sectors_used && !tail_found;
+       i++, sector = nextSector(sector)) {
+    uint32_t offset = data_offset;
+    for (;;) {
+      RecordInfo info;
+      RecordStatus status = readRecord(sector, offset, nullptr, 0, &info);
+      if (status == RECORD_IO) {
+        return false;
+      }
+      if (status != RECORD_OK) {
+        break;
+      }
+      if (info.type == PAYLOAD_QUEUE_PAYLOAD && info.sequence > acked) {
+        tail_sector = sector;
+        tail_offset = offset;
+        tail_found = true;
+        break;
+      }
+      offset += info.size;
+    }
+  }
+  return true;
+}
+
+bool PayloadQueue::programStaged(uint32_t length) {
+  if (!flash.program(flash.context, write_address, staging, length)) {
+    return false;
+  }
+  stats.bytes_programmed += length;
+  write_address += length;
+  staged = 0;
+  return true;
+}
+
+bool PayloadQueue::stage(const uint8_t *data, uint32_t length) {
+  while (length > 0) {
+    uint32_t count = PAYLOAD_QUEUE_STAGING_SIZE - staged;
+    count = count < length ? count : length;
+    memcpy(&staging[staged], data, count);
+    staged += count;
+    data += count;
+    length -= count;
+    if (staged == PAYLOAD_QUEUE_STAGING_SIZE &&
+        !programStaged(PAYLOAD_QUEUE_STAGING_SIZE)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PayloadQueue::openSector() {
+  uint32_t sector = nextSector(head_sector);
+
+  if (sectors_used == flash.sector_count) {
+    // Ring full: the oldest sector goes, with any payloads not yet drained
+    uint32_t last = 0;
+    uint32_t offset = data_offset;
+    for (;;) {
+      RecordInfo info;
+      RecordStatus status = readRecord(sector, offset, nullptr, 0, &info);
+      if (status == RECORD_IO) {
+        return false;
+      }
+      if (status != RECORD_OK) {
+        break;
+      }
+      if (info.type == PAYLOAD_QUEUE_PAYLOAD && info.sequence > last) {
+        last = info.sequence;
+      }
+      offset += info.size;
+    }
+    if (last > acked) {
+      stats.dropped += last - acked;
+      acked = last;
+    }
+    drops++;
+    sectors_used--;
+    if (tail_sector == sector) {
+      tail_sector = nextSector(sector);
+      tail_offset = data_offset;
+    }
+  }
+
+  head_open = false;
+  if (!flash.erase(flash.context, sector)) {
+    return false;
+  }
+  stats.erases++;
+  if (sectors_used == 0) {
+    tail_sector = sector;
+    tail_offset = data_offset;
+  }
+  head_sector = sector;
+  head_sequence++;
+  head_offset = data_offset;
+  sectors_used++;
+
+  memset(staging, 0xFF, data_offset);
+  writeLe32(&staging[0], PAYLOAD_QUEUE_MAGIC);
+  writeLe32(&staging[4], head_sequence);
+  writeLe32(&staging[8], crcExtend(0, staging, 8));
+  write_address = sector * flash.sector_size;
+  if (!programStaged(data_offset)) {
+    return false;
+  }
+  head_open = true;
+  return true;
+}
+
+bool PayloadQueue::appendRecord(uint8_t type, uint32_t sequence,
+                                const uint8_t *payload, uint32_t length) {
+  uint32_t frame_size =
+      type == PAYLOAD_QUEUE_PAYLOAD ? length + STREAM_FRAME_OVERHEAD : 0;
+  uint32_t size = align(PAYLOAD_QUEUE_RECORD_OVERHEAD + frame_size);
+  if ((!head_open || head_offset + size > flash.sector_size) &&
+      !openSector()) {
+    return false;
+  }
+
+  uint8_t header[8];
+  writeLe32(header, sequence);
+  header[4] = type;
+  header[5] = 0;
+  header[6] = (uint8_t)(frame_size & 0xFF);
+  header[7] = (uint8_t)(frame_size >> 8);
+  uint8_t frame_header[STREAM_FRAME_HEADER_SIZE];
+  uint8_t crc_bytes[4];
+  uint32_t crc = 0;
+  if (frame_size > 0) {
+    frame_header[0] = STREAM_FRAME_SYNC0;
+    frame_header[1] = STREAM_FRAME_SYNC1;
+    frame_header[2] = (uint8_t)(length & 0xFF);
+    frame_header[3] = (uint8_t)(length >> 8);
+    frame_header[4] = (uint8_t)~(frame_header[2] ^ frame_header[3]);
+    crc = crcExtend(0, &frame_header[2], 3);
+    crc = crcExtend(crc, payload, length);
+  }
+
+  // Header first: a record cut short fails its CRC rather than looking
+  // erased
+  write_address = head_sector * flash.sector_size + head_offset;
+  staged = 0;
+  bool ok = stage(header, sizeof(header));
+  if (ok && frame_size > 0) {
+    writeLe32(crc_bytes, crc);
+    ok = stage(frame_header, sizeof(frame_header)) &&
+         stage(payload, length) && stage(crc_bytes, 4);
+  }
+  if (ok) {
+    writeLe32(crc_bytes, crcExtend(crc, header, sizeof(header)));
+    ok = stage(crc_bytes, 4);
+  }
+  if (ok && staged > 0) {
+    uint32_t padded = align(staged);
+    memset(&staging[staged], 0xFF, padded - staged);
+    ok = programStaged(padded);
+  }
+  if (!ok) {
+    head_open = false;
+    return false;
+  }
+  head_offset += size;
+  return true;
+}
+
+bool PayloadQueue::enqueue(const uint8_t *payload, uint32_t length) {
+  if (payload == nullptr || length < 2 || length > maxPayloadSize() ||
+      !appendRecord(PAYLOAD_QUEUE_PAYLOAD, next_payload, payload, length)) {
+    return false;
+  }
+  next_payload++;
+  stats.enqueued++;
+  return true;
+}
+
+int32_t PayloadQueue::drain(uint8_t *buffer, uint32_t buffer_size,
+                            uint32_t *payload_count) {
+  *payload_count = 0;
+  drain_last = 0;
+  if (pendingCount() == 0) {
+    return 0;
+  }
+
+  uint32_t sector = tail_sector;
+  uint32_t offset = tail_offset;
+  uint32_t used = 0;
+  uint32_t count = 0;
+  for (uint32_t visited = 0; visited <= flash.sector_count;) {
+    if (sector == head_sector && offset >= head_offset) {
+      break;
+    }
+    RecordInfo info;
+    RecordStatus status =
+        readRecord(sector, offset, buffer + used, buffer_size - used, &info);
+    if (status == RECORD_IO) {
+      return -1;
+    }
+    if (status == RECORD_END || status == RECORD_BAD) {
+      if (sector == head_sector) {
+        offset = head_offset; // Damaged since mount: skip to the write point
+        continue;
+      }
+      sector = nextSector(sector);
+      offset = data_offset;
+      visited++;
+      continue;
+    }
+    bool wanted = info.type == PAYLOAD_QUEUE_PAYLOAD && info.sequence > acked;
+    if (status == RECORD_NO_ROOM && wanted) {
+      if (count == 0) {
+        return -1;
+      }
+      break;
+    }
+    if (status == RECORD_OK && wanted) {
+      used += info.frame_size;
+      count++;
+      drain_last = info.sequence;
+    }
+    offset += info.size;
+  }
+
+  drain_sector = sector;
+  drain_offset = offset;
+  drain_drops = drops;
+  *payload_count = count;
+  return (int32_t)used;
+}
+
+bool PayloadQueue::commitDrain() {
+  if (drain_last == 0) {
+    return true;
+  }
+  if (drain_last > acked) {
+    if (!appendRecord(PAYLOAD_QUEUE_ACK, drain_last, nullptr, 0)) {
+      return false;
+    }
+    stats.drained += drain_last - acked;
+    acked = drain_last;
+  }
+  // A sector dropped since drain() may have held the drain position; the
+  // tail was moved past it then
+  if (drops == drain_drops) {
+    tail_sector = drain_sector;
+    tail_offset = drain_offset;
+  }
+  drain_last = 0;
+  return true;
+}
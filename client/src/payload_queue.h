@@ -0,0 +1,156 @@
+#ifndef PAYLOAD_QUEUE_H
+#define PAYLOAD_QUEUE_H
+
+#include "payload_types.h"
+
+// Flash region given to a PayloadQueue. Programming can only clear bits of
+// erased bytes, erasing sets a whole sector to 0xFF. Each function returns
+// false on failure.
+typedef struct {
+  uint32_t sector_size;  // Erase unit in bytes, a multiple of program_size
+  uint32_t sector_count; // At least 2
+  uint32_t program_size; // Write unit: a power of two up to 64
+  bool (*read)(void *context, uint32_t address, uint8_t *data,
+               uint32_t length);
+  bool (*program)(void *context, uint32_t address, const uint8_t *data,
+                  uint32_t length); // address and length are whole units
+  bool (*erase)(void *context, uint32_t sector);
+  void *context;
+} FlashRegion;
+
+// Persistent queue of encoded payloads in a ring of flash sectors, for
+// holding batches while the link is down. Nothing is updated in place:
+// each sector starts with a header carrying its position in the ring, and
+// payloads and acknowledgements are appended as records with a CRC. A
+// drained burst is acknowledged by appending an ack record, so head and
+// tail are rebuilt by mount() from whatever records are intact after a
+// power loss. Sectors are erased in ring order, one lap at a time, whether
+// the queue is full or empty, so wear is spread evenly.
+//
+// Sector header (padded to program_size), little-endian:
+//
+//   [ 4 ] magic        "AGQS"
+//   [ 4 ] sequence     ring position, +1 for every sector opened
+//   [ 4 ] crc          CRC-32C over bytes 0-7
+//
+// Record (starting on a program_size boundary and padded to the next one):
+//
+//   [ 4 ] sequence     payload number, or for an ack the last one drained
+//   [ 1 ] type         PAYLOAD_QUEUE_PAYLOAD or PAYLOAD_QUEUE_ACK
+//   [ 1 ] reserved     0
+//   [ 2 ] frame_size   bytes of the stream frame that follows (0 for acks)
+//   [ frame_size ]     the payload as a stream frame (payload_stream.h)
+//   [ 4 ] crc          CRC-32C continuing the frame's CRC over bytes 0-7
+//
+// When the ring is full the oldest sector is erased to make room and its
+// undrained payloads are counted as dropped. A payload acknowledged but
+// then resent after a power loss reaches the server twice, where the
+// duplicate filter removes it.
+//
+// Not thread-safe.
+
+#define PAYLOAD_QUEUE_MAGIC 0x53514741u // "AGQS" little-endian
+#define PAYLOAD_QUEUE_PAYLOAD 0x01
+#define PAYLOAD_QUEUE_ACK 0x02
+#define PAYLOAD_QUEUE_RECORD_OVERHEAD 12
+#define PAYLOAD_QUEUE_STAGING_SIZE 64
+
+typedef struct {
+  uint64_t enqueued;
+  uint64_t dropped;          // Overwritten before they were drained
+  uint64_t drained;          // Acknowledged with commitDrain()
+  uint64_t erases;
+  uint64_t bytes_programmed; // Padding and headers included
+  uint32_t torn_records;     // Incomplete or corrupt records seen by mount()
+} PayloadQueueStats;
+
+class PayloadQueue {
+public:
+  PayloadQueue();
+
+  // Scan the region and recover the queue (an erased or unrecognized region
+  // is an empty queue)
+  // Returns: false if the geometry is invalid or the flash cannot be read
+  bool mount(const FlashRegion &flash);
+
+  // Append a payload (as produced by PayloadEncoder::encode())
+  // Returns: false if length is outside 2 .. maxPayloadSize() or the
+  // flash failed
+  bool enqueue(const uint8_t *payload, uint32_t length);
+
+  // Copy queued payloads, oldest first, into buffer as stream frames until
+  // the next would not fit. Nothing is removed until commitDrain(); calling
+  // drain() again starts from the same payload.
+  // Returns: bytes written (0 if the queue is empty), or -1 if the oldest
+  // frame does not fit in buffer_size or the flash failed
+  int32_t drain(uint8_t *buffer, uint32_t buffer_size,
+                uint32_t *payload_count);
+
+  // The burst from the last drain() was delivered: remove its payloads
+  // Returns: false if the acknowledgement could not be written
+  bool commitDrain();
+
+  // Payloads queued and not yet committed
+  uint32_t pendingCount() const;
+
+  // Largest payload a record can hold in one sector
+  uint32_t maxPayloadSize() const;
+
+  const PayloadQueueStats &getStats() const;
+
+private:
+  PayloadQueue(const PayloadQueue &);
+  PayloadQueue &operator=(const PayloadQueue &);
+
+  typedef struct {
+    uint32_t sequence;
+    uint8_t type;
+    uint32_t frame_size;
+    uint32_t size; // Whole record, padded
+  } RecordInfo;
+
+  typedef enum {
+    RECORD_OK,
+    RECORD_END,     // Erased, or no room left for a record
+    RECORD_BAD,     // Torn or corrupt
+    RECORD_NO_ROOM, // The frame is larger than the caller's space
+    RECORD_IO       // The flash read failed
+  } RecordStatus;
+
+  // Read and check the record at offset; with frame set, the frame is
+  // copied there (at most capacity bytes) rather than read in chunks
+  RecordStatus readRecord(uint32_t sector, uint32_t offset, uint8_t *frame,
+                          uint32_t capacity, RecordInfo *info);
+  RecordStatus readSectorHeader(uint32_t sector, uint32_t *sequence);
+  RecordStatus erasedFrom(uint32_t sector, uint32_t offset);
+  bool openSector();
+  bool appendRecord(uint8_t type, uint32_t sequence, const uint8_t *payload,
+                    uint32_t length);
+  bool stage(const uint8_t *data, uint32_t length);
+  bool programStaged(uint32_t length);
+  uint32_t nextSector(uint32_t sector) const;
+  uint32_t align(uint32_t size) const;
+
+  FlashRegion flash;
+  uint32_t data_offset;    // First record offset in a sector
+  uint32_t head_sector;
+  uint32_t head_sequence;  // Sector sequence of head_sector
+  uint32_t head_offset;    // Next record offset in head_sector
+  bool head_open;          // Records may be appended to head_sector
+  uint32_t sectors_used;   // Sectors in the ring, oldest to head
+  uint32_t tail_sector;    // At or before the first undrained payload
+  uint32_t tail_offset;
+  uint32_t next_payload;   // Sequence of the next payload
+  uint32_t acked;          // Last payload drained or dropped
+  uint32_t drain_sector;   // Position after the last drain()
+  uint32_t drain_offset;
+  uint32_t drain_last;     // Last payload of the last drain(), 0 if none
+  uint32_t drops;          // Drop count, to tell a stale drain position
+  uint32_t drain_drops;
+  uint32_t write_address;  // Of the staged bytes
+  uint32_t staged;
+  uint8_t staging[PAYLOAD_QUEUE_STAGING_SIZE];
+  PayloadQueueStats stats;
+};
+
+#endif // PAYLOAD_QUEUE_H
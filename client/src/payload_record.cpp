@@ -0,0 +1,103 @@
+#include "payload_record.h"
+#include "crc32c.h"
+#include "payload_types.h"
+#include <string.h>
+
+namespace {
+
+void writeLE32(uint8_t *buffer, uint32_t value) {
+  buffer[0] = (value >> 0) & 0xFF;
+  buffer[1] = (value >> 8) & 0xFF;
+  buffer[2] = (value >> 16) & 0xFF;
+  buffer[3] = (value >> 24) & 0xFF;
+}
+
+void writeLE64(uint8_t *buffer, uint64_t value) {
+  writeLE32(buffer, (uint32_t)value);
+  writeLE32(buffer + 4, (uint32_t)(value >> 32));
+}
+
+uint32_t readLE32(const uint8_t *buffer) {
+  return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+         ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+uint64_t readLE64(const uint8_t *buffer) {
+  return (uint64_t)readLE32(buffer) | ((uint64_t)readLE32(buffer + 4) << 32);
+}
+
+} // namespace
+
+uint32_t writePayloadRecord(uint8_t *buffer, const PayloadRecordHeader &header,
+                            const uint8_t *payload) {
+  writeLE32(&buffer[0], PAYLOAD_RECORD_MAGIC);
+  writeLE32(&buffer[4], header.length);
+  writeLE64(&buffer[8], header.sequence);
+  writeLE64(&buffer[16], header.device_id);
+  writeLE64(&buffer[24], header.timestamp_ms);
+  memcpy(&buffer[PAYLOAD_RECORD_HEADER_SIZE], payload, header.length);
+
+  uint32_t crc = crc32c(buffer, 32);
+  crc = crc32cExtend(crc, payload, header.length);
+  writeLE32(&buffer[32], crc);
+  writeLE32(&buffer[36], 0);
+
+  return PAYLOAD_RECORD_HEADER_SIZE + header.length;
+}
+
+int32_t readPayloadRecord(const uint8_t *buffer, uint32_t available,
+                          PayloadRecordHeader *header,
+                          const uint8_t **payload) {
+  if (available < 4) {
+    return 0;
+  }
+  if (readLE32(&buffer[0]) != PAYLOAD_RECORD_MAGIC) {
+    return -1;
+  }
+  if (available < PAYLOAD_RECORD_HEADER_SIZE) {
+    return 0;
+  }
+
+  uint32_t length = readLE32(&buffer[4]);
+  if (length > MAX_PAYLOAD_SIZE) {
+    return -1; // Larger than any valid payload
+  }
+  if (available < PAYLOAD_RECORD_HEADER_SIZE + length) {
+    return 0;
+  }
+
+  const uint8_t *data = &buffer[PAYLOAD_RECORD_HEADER_SIZE];
+  uint32_t crc = crc32c(buffer, 32);
+  crc = crc32cExtend(crc, data, length);
+  if (crc != readLE32(&buffer[32])) {
+    return -1;
+  }
+
+  if (header != nullptr) {
+    header->length = length;
+    header->sequence = readLE64(&buffer[8]);
+    header->device_id = readLE64(&buffer[16]);
+    header->timestamp_ms = readLE64(&buffer[24]);
+  }
+  if (payload != nullptr) {
+    *payload = data;
+  }
+
+  return (int32_t)(PAYLOAD_RECORD_HEADER_SIZE + length);
+}
+
+uint32_t findPayloadRecord(const uint8_t *buffer, uint32_t available,
+                           uint32_t start) {
+  for (uint32_t offset = start; offset + PAYLOAD_RECORD_HEADER_SIZE <= available;
+       offset++) {
+    if (buffer[offset] != (PAYLOAD_RECORD_MAGIC & 0xFF)) {
+      continue;
+    }
+    if (readPayloadRecord(&buffer[offset], available - offset, nullptr,
+                          nullptr) > 0) {
+      return offset;
+    }
+  }
+
+  return available;
+}
@@ -0,0 +1,46 @@
+#ifndef PAYLOAD_RECORD_H
+#define PAYLOAD_RECORD_H
+
+#include <stdint.h>
+
+// On-disk framing for a received payload, shared by the write-ahead log and
+// payload archive segments. All fields are little-endian.
+//
+//   [ 4 ] magic        "AGPR"
+//   [ 4 ] length       payload bytes that follow the header
+//   [ 8 ] sequence     monotonically increasing per log
+//   [ 8 ] device_id    sender identity assigned by the ingest front end
+//   [ 8 ] timestamp_ms receive time (Unix epoch, milliseconds)
+//   [ 4 ] crc          CRC-32C over header bytes 0-31 and the payload
+//   [ 4 ] reserved     0
+//   [ length ] payload
+
+#define PAYLOAD_RECORD_MAGIC 0x52504741u // "AGPR" little-endian
+#define PAYLOAD_RECORD_HEADER_SIZE 40
+
+typedef struct {
+  uint32_t length;
+  uint64_t sequence;
+  uint64_t device_id;
+  uint64_t timestamp_ms;
+} PayloadRecordHeader;
+
+// Write header + payload to buffer (must hold
+// PAYLOAD_RECORD_HEADER_SIZE + header.length bytes)
+// Returns: number of bytes written
+uint32_t writePayloadRecord(uint8_t *buffer, const PayloadRecordHeader &header,
+                            const uint8_t *payload);
+
+// Parse one record from buffer
+// Returns: total record size, 0 if more bytes are needed, or -1 if the bytes
+// at buffer are not a valid record (bad magic, bad length or bad CRC)
+int32_t readPayloadRecord(const uint8_t *buffer, uint32_t available,
+                          PayloadRecordHeader *header,
+                          const uint8_t **payload);
+
+// Find the next offset >= start at which a valid record begins
+// Returns: offset, or available if none is found
+uint32_t findPayloadRecord(const uint8_t *buffer, uint32_t available,
+                           uint32_t start);
+
+#endif // PAYLOAD_RECORD_H
@@ -0,0 +1,237 @@
+#include "payload_stream.h"
+#include "crc32c.h"
+#include "decode_plan.h"
+#include "payload_index.h"
+#include <string.h>
+
+static inline uint32_t readLE32(const uint8_t *buffer) {
+  return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+         ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+static inline uint8_t lengthCheck(uint8_t low, uint8_t high) {
+  return (uint8_t)~(low ^ high);
+}
+
+uint32_t writeStreamFrame(uint8_t *buffer, const uint8_t *payload,
+                          uint32_t length) {
+  if (length < 2 || length > MAX_PAYLOAD_SIZE) {
+    return 0;
+  }
+  buffer[0] = STREAM_FRAME_SYNC0;
+  buffer[1] = STREAM_FRAME_SYNC1;
+  buffer[2] = (uint8_t)(length & 0xFF);
+  buffer[3] = (uint8_t)(length >> 8);
+  buffer[4] = lengthCheck(buffer[2], buffer[3]);
+  memcpy(&buffer[STREAM_FRAME_HEADER_SIZE], payload, length);
+
+  uint32_t crc = crc32c(&buffer[2], 3);
+  crc = crc32cExtend(crc, payload, length);
+  uint8_t *trailer = &buffer[STREAM_FRAME_HEADER_SIZE + length];
+  trailer[0] = (uint8_t)(crc >> 0);
+  trailer[1] = (uint8_t)(crc >> 8);
+  trailer[2] = (uint8_t)(crc >> 16);
+  trailer[3] = (uint8_t)(crc >> 24);
+  return length + STREAM_FRAME_OVERHEAD;
+}
+
+StreamDecoder::StreamDecoder()
+    : on_reading(nullptr), on_frame(nullptr), user(nullptr), plans(nullptr) {
+  memset(&stats, 0, sizeof(stats));
+  reset();
+}
+
+void StreamDecoder::setCallbacks(StreamReadingCallback on_reading,
+                                 StreamFrameCallback on_frame, void *user) {
+  this->on_reading = on_reading;
+  this->on_frame = on_frame;
+  this->user = user;
+}
+
+void StreamDecoder::setPlanCache(DecodePlanCache *cache) { plans = cache; }
+
+void StreamDecoder::reset() {
+  state = WAIT_SYNC0;
+  have = 0;
+  remaining = 0;
+  data_size = 0;
+  mask = 0;
+  crc = 0;
+  memset(&header, 0, sizeof(header));
+  reading_count = 0;
+}
+
+bool StreamDecoder::inFrame() const { return state >= READ_HEADER; }
+
+const StreamDecoderStats &StreamDecoder::getStats() const { return stats; }
+
+// Move up to need - have bytes into scratch
+// Returns: true once scratch holds need bytes
+bool StreamDecoder::collect(const uint8_t *&data, uint32_t &length,
+                            uint32_t need) {
+  uint32_t count = need - have;
+  if (count > length) {
+    count = length;
+  }
+  memcpy(&scratch[have], data, count);
+  have += count;
+  data += count;
+  length -= count;
+  return have == need;
+}
+
+void StreamDecoder::beginReading() {
+  data_size = readingDataSize(mask, header);
+  if (reading_count >= MAX_BATCH_SIZE || 4 + data_size > remaining) {
+    // The frame length does not match its readings: give up on the frame
+    // and look for the next one from here
+    endFrame(STREAM_FRAME_MALFORMED);
+    return;
+  }
+  remaining -= 4 + data_size;
+  state = READ_DATA;
+}
+
+void StreamDecoder::emitReading(const uint8_t *data) {
+  SensorReading reading;
+  memset(&reading, 0, sizeof(reading));
+  reading.presence_mask = mask;
+
+  const DecodePlan *plan =
+      plans != nullptr ? plans->find(mask, header) : nullptr;
+  DecodePlan compiled;
+  if (plan == nullptr) {
+    compileDecodePlan(mask, header, compiled);
+    plan = &compiled;
+  }
+  runDecodePlan(*plan, data, data_size, reading);
+
+  stats.readings++;
+  if (on_reading != nullptr) {
+    on_reading(header, reading_count, reading, user);
+  }
+  reading_count++;
+  state = remaining > 0 ? READ_MASK : READ_CRC;
+}
+
+void StreamDecoder::endFrame(StreamFrameStatus status) {
+  if (status == STREAM_FRAME_OK) {
+    stats.frames++;
+  } else if (status == STREAM_FRAME_BAD_CRC) {
+    stats.crc_errors++;
+  } else {
+    stats.malformed++;
+  }
+  if (on_frame != nullptr) {
+    on_frame(header, reading_count, status, user);
+  }
+  state = WAIT_SYNC0;
+}
+
+void StreamDecoder::feed(const uint8_t *data, uint32_t length) {
+  while (length > 0) {
+    switch (state) {
+    case WAIT_SYNC0: {
+      const uint8_t *sync =
+          (const uint8_t *)memchr(data, STREAM_FRAME_SYNC0, length);
+      if (sync == nullptr) {
+        stats.skipped_bytes += length;
+        return;
+      }
+      uint32_t skipped = (uint32_t)(sync - data);
+      stats.skipped_bytes += skipped;
+      data += skipped + 1;
+      length -= skipped + 1;
+      state = WAIT_SYNC1;
+      break;
+    }
+
+    case WAIT_SYNC1:
+      if (*data == STREAM_FRAME_SYNC1) {
+        data++;
+        length--;
+        have = 0;
+        state = READ_LENGTH;
+      } else {
+        // Not consumed: it may be the start of the real sync
+        stats.skipped_bytes++;
+        state = WAIT_SYNC0;
+      }
+      break;
+
+    case READ_LENGTH: {
+      if (!collect(data, length, 3)) {
+        return;
+      }
+      have = 0;
+      uint32_t frame_length = scratch[0] | ((uint32_t)scratch[1] << 8);
+      if (scratch[2] != lengthCheck(scratch[0], scratch[1]) ||
+          frame_length < 2 || frame_length > MAX_PAYLOAD_SIZE) {
+        // False sync: rescan the three bytes after it, which cannot hold a
+        // complete header themselves
+        uint8_t pending[3];
+        memcpy(pending, scratch, sizeof(pending));
+        stats.skipped_bytes += 2;
+        state = WAIT_SYNC0;
+        feed(pending, sizeof(pending));
+        break;
+      }
+      crc = crc32c(scratch, 3);
+      remaining = frame_length;
+      state = READ_HEADER;
+      break;
+    }
+
+    case READ_HEADER:
+      if (!collect(data, length, 2)) {
+        return;
+      }
+      have = 0;
+      crc = crc32cExtend(crc, scratch, 2);
+      header.version = scratch[0] & 0x07;
+      header.dual_mode = (scratch[0] & (1 << 3)) != 0;
+      header.dedicated_temphum_sensor = (scratch[0] & (1 << 4)) != 0;
+      header.interval_minutes = scratch[1];
+      reading_count = 0;
+      remaining -= 2;
+      state = remaining > 0 ? READ_MASK : READ_CRC;
+      break;
+
+    case READ_MASK:
+      if (!collect(data, length, 4)) {
+        return;
+      }
+      have = 0;
+      crc = crc32cExtend(crc, scratch, 4);
+      mask = readLE32(scratch);
+      beginReading();
+      if (state == READ_DATA && data_size == 0) {
+        emitReading(scratch);
+      }
+      break;
+
+    case READ_DATA:
+      if (have == 0 && length >= data_size) {
+        // Whole reading in this chunk: decode in place
+        crc = crc32cExtend(crc, data, data_size);
+        emitReading(data);
+        data += data_size;
+        length -= data_size;
+      } else if (collect(data, length, data_size)) {
+        have = 0;
+        crc = crc32cExtend(crc, scratch, data_size);
+        emitReading(scratch);
+      }
+      break;
+
+    case READ_CRC:
+      if (!collect(data, length, 4)) {
+        return;
+      }
+      have = 0;
+      endFrame(readLE32(scratch) == crc ? STREAM_FRAME_OK
+                                        : STREAM_FRAME_BAD_CRC);
+      break;
+    }
+  }
+}
@@ -0,0 +1,117 @@
+#ifndef PAYLOAD_STREAM_H
+#define PAYLOAD_STREAM_H
+
+#include "payload_types.h"
+
+class DecodePlanCache;
+
+// Framing for payloads sent back to back over a byte stream (TCP, serial
+// modem link). All fields are little-endian.
+//
+//   [ 1 ] sync         0xA6
+//   [ 1 ] sync         0x47 ('G')
+//   [ 2 ] length       payload bytes (2 .. MAX_PAYLOAD_SIZE)
+//   [ 1 ] check        ~(length low byte ^ length high byte)
+//   [ length ] payload
+//   [ 4 ] crc          CRC-32C over length, check and payload
+//
+// The check byte and the length range reject most corrupted headers before
+// any payload byte is consumed, so a damaged frame costs little more than
+// its own bytes when resynchronizing.
+
+#define STREAM_FRAME_SYNC0 0xA6
+#define STREAM_FRAME_SYNC1 0x47
+#define STREAM_FRAME_HEADER_SIZE 5
+#define STREAM_FRAME_OVERHEAD (STREAM_FRAME_HEADER_SIZE + 4)
+
+// Write one frame (buffer must hold length + STREAM_FRAME_OVERHEAD bytes)
+// Returns: number of bytes written, or 0 if length is out of range
+uint32_t writeStreamFrame(uint8_t *buffer, const uint8_t *payload,
+                          uint32_t length);
+
+typedef enum {
+  STREAM_FRAME_OK = 0,        // CRC matched
+  STREAM_FRAME_BAD_CRC = 1,   // Complete frame, CRC mismatch
+  STREAM_FRAME_MALFORMED = 2  // Readings do not fit the frame length
+} StreamFrameStatus;
+
+typedef struct {
+  uint64_t frames;        // Frames with a valid CRC
+  uint64_t crc_errors;    // Frames dropped for a CRC mismatch
+  uint64_t malformed;     // Frames abandoned for a bad reading layout
+  uint64_t readings;      // Readings delivered
+  uint64_t skipped_bytes; // Bytes discarded while looking for a frame
+} StreamDecoderStats;
+
+// Called for each reading as soon as its last byte arrives. The frame CRC
+// is only known at the end, so consumers that need verified data hold the
+// readings (at most MAX_BATCH_SIZE) until the frame callback.
+typedef void (*StreamReadingCallback)(const PayloadHeader &header,
+                                      uint8_t index,
+                                      const SensorReading &reading,
+                                      void *user);
+
+// Called once per frame that got past its header
+typedef void (*StreamFrameCallback)(const PayloadHeader &header,
+                                    uint8_t reading_count,
+                                    StreamFrameStatus status, void *user);
+
+// Incremental decoder: feed() takes chunks of any size, and the state kept
+// between chunks is bounded by one reading, whatever the payload size.
+// Readings that arrive whole within a chunk are decoded in place.
+class StreamDecoder {
+public:
+  StreamDecoder();
+
+  void setCallbacks(StreamReadingCallback on_reading,
+                    StreamFrameCallback on_frame, void *user);
+
+  // Decode readings with plans from a shared cache (nullptr: none)
+  void setPlanCache(DecodePlanCache *cache);
+
+  // Consume the next bytes of the stream
+  void feed(const uint8_t *data, uint32_t length);
+
+  // Drop any partial frame (e.g. after reconnecting)
+  void reset();
+
+  // True while a frame has started but not ended
+  bool inFrame() const;
+
+  const StreamDecoderStats &getStats() const;
+
+private:
+  typedef enum {
+    WAIT_SYNC0,
+    WAIT_SYNC1,
+    READ_LENGTH,
+    READ_HEADER,
+    READ_MASK,
+    READ_DATA,
+    READ_CRC
+  } State;
+
+  bool collect(const uint8_t *&data, uint32_t &length, uint32_t need);
+  void consumePayload(const uint8_t *bytes, uint32_t count);
+  void beginReading();
+  void emitReading(const uint8_t *data);
+  void endFrame(StreamFrameStatus status);
+
+  State state;
+  uint8_t scratch[MAX_READING_SIZE]; // Partial field bytes of one unit
+  uint32_t have;                     // Bytes in scratch
+  uint32_t remaining;                // Payload bytes left in the frame
+  uint32_t data_size;                // Sensor data bytes of this reading
+  uint32_t mask;                     // Presence mask of this reading
+  uint32_t crc;                      // Running CRC-32C
+  PayloadHeader header;
+  uint8_t reading_count;
+
+  StreamReadingCallback on_reading;
+  StreamFrameCallback on_frame;
+  void *user;
+  DecodePlanCache *plans;
+  StreamDecoderStats stats;
+};
+
+#endif // PAYLOAD_STREAM_H
@@ -7,6 +7,13 @@
 // Maximum number of readings in a batch
 #define MAX_BATCH_SIZE 20
 
+// Largest possible encoded reading: mask (4) + all flags set in dual mode
+// (14 expandable * 4 + 8 scalar 16-bit * 2 + 4 scalar 32-bit * 4 + signal 1)
+#define MAX_READING_SIZE 93
+
+// Largest possible encoded payload: header (2) + a full batch
+#define MAX_PAYLOAD_SIZE (2 + MAX_BATCH_SIZE * MAX_READING_SIZE)
+
 // Sensor flags enum (matches presence mask bits 0-26)
 typedef enum {
     FLAG_TEMP = 0,
@@ -42,6 +49,13 @@ typedef enum {
 #define FLAG_BIT(flag) (1U << (flag))
 #define IS_FLAG_SET(mask, flag) (((mask) & FLAG_BIT(flag)) != 0)
 
+// Fields sent in an urgent payload
+#define URGENT_FIELD_MASK (FLAG_BIT(FLAG_CO2) | FLAG_BIT(FLAG_PM_25))
+
+// Largest urgent payload: header (2) + mask (4) + CO2 (2) + PM2.5 (2, or 4
+// in dual mode)
+#define URGENT_PAYLOAD_SIZE 12
+
 // Sensor reading structure
 typedef struct {
     uint32_t presence_mask;     // Which fields are present
@@ -87,6 +101,16 @@ typedef struct {
     uint8_t interval_minutes;       // Measurement interval in minutes
 } PayloadHeader;
 
+// Alarm levels for urgent sends. A field raises an alarm when it reaches
+// its alarm level and can raise another once it has dropped below its clear
+// level. An alarm level of 0 disables the field.
+typedef struct {
+    uint16_t co2_alarm;         // CO2 ppm
+    uint16_t co2_clear;
+    uint16_t pm_25_alarm;       // PM2.5 * 10, either channel in dual mode
+    uint16_t pm_25_clear;
+} UrgentThresholds;
+
 // Encoder context
 typedef struct {
     PayloadHeader header;
@@ -94,6 +118,9 @@ typedef struct {
     uint8_t reading_count;
 } EncoderContext;
 
+// Decoder context (same layout, filled from a received payload)
+typedef EncoderContext DecoderContext;
+
 // Helper to initialize a sensor reading
 static inline void initSensorReading(SensorReading* reading) {
     reading->presence_mask = 0;
@@ -0,0 +1,300 @@
+#include "payload_wal.h"
+#include "payload_types.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t kScanChunkSize = 1 << 20;
+
+bool writeAll(int fd, const uint8_t *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = ::write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    length -= (size_t)written;
+  }
+  return true;
+}
+
+int syncData(int fd) {
+#ifdef __APPLE__
+  return ::fsync(fd);
+#else
+  return ::fdatasync(fd);
+#endif
+}
+
+// Walk the records of an open log from the start of the file.
+// valid_end receives the offset just past the last valid record and
+// last_sequence its sequence number (0 if the log is empty).
+// Returns: number of records delivered to callback, or -1 on read error
+int64_t scanLog(int fd, uint64_t from_sequence, WalReplayCallback callback,
+                void *user, uint64_t *valid_end, uint64_t *last_sequence) {
+  std::vector<uint8_t> chunk(kScanChunkSize);
+  uint32_t filled = 0;
+  uint64_t file_offset = 0; // File offset of chunk[0]
+  uint64_t delivered = 0;
+  bool eof = false;
+
+  *valid_end = 0;
+  *last_sequence = 0;
+
+  if (::lseek(fd, 0, SEEK_SET) < 0) {
+    return -1;
+  }
+
+  while (true) {
+    // Top up the chunk
+    while (!eof && filled < chunk.size()) {
+      ssize_t got = ::read(fd, &chunk[filled], chunk.size() - filled);
+      if (got < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      if (got == 0) {
+        eof = true;
+        break;
+      }
+      filled += (uint32_t)got;
+    }
+
+    uint32_t offset = 0;
+    while (offset < filled) {
+      PayloadRecordHeader header;
+      const uint8_t *payload;
+      int32_t size = readPayloadRecord(&chunk[offset], filled - offset, &header,
+                                       &payload);
+      if (size == 0 && !eof) {
+        break; // Need more bytes
+      }
+      if (size <= 0) {
+        return (int64_t)delivered; // Torn or corrupt tail
+      }
+
+      if (header.sequence >= from_sequence && callback != nullptr) {
+        callback(header, payload, user);
+        delivered++;
+      }
+      *last_sequence = header.sequence;
+      offset += (uint32_t)size;
+      *valid_end = file_offset + offset;
+    }
+
+    if (eof && offset >= filled) {
+      return (int64_t)delivered;
+    }
+
+    // Keep the partial record at the front of the chunk
+    memmove(&chunk[0], &chunk[offset], filled - offset);
+    filled -= offset;
+    file_offset += offset;
+  }
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog()
+    : fd(-1), pending_records(0), next_sequence(1), durable_sequence(0),
+      stopping(false), failed(false) {
+  config = defaultConfig();
+  memset(&stats, 0, sizeof(stats));
+}
+
+WriteAheadLog::~WriteAheadLog() { close(); }
+
+WalConfig WriteAheadLog::defaultConfig() {
+  WalConfig defaults;
+  defaults.group_max_records = 256;
+  defaults.group_max_bytes = 256 * 1024;
+  defaults.group_window_us = 1000;
+  defaults.sync = true;
+  return defaults;
+}
+
+bool WriteAheadLog::open(const char *path, const WalConfig &wal_config) {
+  close();
+
+  int log_fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (log_fd < 0) {
+    return false;
+  }
+
+  // Recover: find the end of the last complete record
+  uint64_t valid_end;
+  uint64_t last_sequence;
+  if (scanLog(log_fd, UINT64_MAX, nullptr, nullptr, &valid_end,
+              &last_sequence) < 0) {
+    ::close(log_fd);
+    return false;
+  }
+
+  struct stat st;
+  if (::fstat(log_fd, &st) != 0) {
+    ::close(log_fd);
+    return false;
+  }
+  if ((uint64_t)st.st_size > valid_end) {
+    // Drop the torn tail so new records follow the last valid one
+    if (::ftruncate(log_fd, (off_t)valid_end) != 0 || syncData(log_fd) != 0) {
+      ::close(log_fd);
+      return false;
+    }
+  }
+  if (::lseek(log_fd, (off_t)valid_end, SEEK_SET) < 0) {
+    ::close(log_fd);
+    return false;
+  }
+
+  fd = log_fd;
+  config = wal_config;
+  pending.clear();
+  writing.clear();
+  pending.reserve(config.group_max_bytes + PAYLOAD_RECORD_HEADER_SIZE +
+                  MAX_PAYLOAD_SIZE);
+  pending_records = 0;
+  next_sequence = last_sequence + 1;
+  durable_sequence = last_sequence;
+  memset(&stats, 0, sizeof(stats));
+  stopping = false;
+  failed = false;
+  flusher = std::thread(&WriteAheadLog::flusherLoop, this);
+
+  return true;
+}
+
+void WriteAheadLog::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0) {
+      return;
+    }
+    stopping = true;
+  }
+  flush_cv.notify_one();
+  flusher.join();
+
+  ::close(fd);
+  fd = -1;
+}
+
+uint64_t WriteAheadLog::append(uint64_t device_id, uint64_t timestamp_ms,
+                               const uint8_t *payload, uint32_t length) {
+  if (payload == nullptr || length > MAX_PAYLOAD_SIZE) {
+    return 0;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (fd < 0 || stopping || failed) {
+    return 0;
+  }
+
+  PayloadRecordHeader header;
+  header.length = length;
+  header.sequence = next_sequence++;
+  header.device_id = device_id;
+  header.timestamp_ms = timestamp_ms;
+
+  if (pending_records == 0) {
+    first_pending = std::chrono::steady_clock::now();
+  }
+  size_t offset = pending.size();
+  pending.resize(offset + PAYLOAD_RECORD_HEADER_SIZE + length);
+  writePayloadRecord(&pending[offset], header, payload);
+  pending_records++;
+
+  // Wake the flusher to start the group window, or because the group is full
+  if (pending_records == 1 || pending_records >= config.group_max_records ||
+      pending.size() >= config.group_max_bytes) {
+    flush_cv.notify_one();
+  }
+
+  uint64_t sequence = header.sequence;
+  durable_cv.wait(lock,
+                  [&] { return durable_sequence >= sequence || failed; });
+
+  return durable_sequence >= sequence ? sequence : 0;
+}
+
+uint64_t WriteAheadLog::getDurableSequence() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return durable_sequence;
+}
+
+WalStats WriteAheadLog::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+void WriteAheadLog::flusherLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  while (true) {
+    flush_cv.wait(lock, [&] { return stopping || pending_records > 0; });
+    if (pending_records == 0) {
+      return; // Stopping with nothing left to flush
+    }
+    if (failed) {
+      // Never write behind a failed group; its appenders already saw 0
+      pending.clear();
+      pending_records = 0;
+      continue;
+    }
+
+    // Let the group fill until a limit or the window deadline is reached
+    std::chrono::steady_clock::time_point deadline =
+        first_pending + std::chrono::microseconds(config.group_window_us);
+    while (!stopping && pending_records < config.group_max_records &&
+           pending.size() < config.group_max_bytes) {
+      if (flush_cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+        break;
+      }
+    }
+
+    // Take the group; appenders keep filling the other buffer meanwhile
+    pending.swap(writing);
+    pending.clear();
+    uint32_t group_records = pending_records;
+    uint64_t group_last_sequence = next_sequence - 1;
+    pending_records = 0;
+
+    lock.unlock();
+    bool ok = writeAll(fd, writing.data(), writing.size()) &&
+              (!config.sync || syncData(fd) == 0);
+    lock.lock();
+
+    if (ok) {
+      durable_sequence = group_last_sequence;
+      stats.groups++;
+      stats.records += group_records;
+      stats.bytes += writing.size();
+    } else {
+      failed = true; // Log state unknown; refuse further appends
+    }
+    durable_cv.notify_all();
+  }
+}
+
+int64_t WriteAheadLog::replay(const char *path, uint64_t from_sequence,
+                              WalReplayCallback callback, void *user) {
+  int log_fd = ::open(path, O_RDONLY);
+  if (log_fd < 0) {
+    return -1;
+  }
+
+  uint64_t valid_end;
+  uint64_t last_sequence;
+  int64_t delivered = scanLog(log_fd, from_sequence, callback, user, &valid_end,
+                              &last_sequence);
+  ::close(log_fd);
+
+  return delivered;
+}
@@ -0,0 +1,92 @@
+#ifndef PAYLOAD_WAL_H
+#define PAYLOAD_WAL_H
+
+#include "payload_record.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Group commit configuration. A group is flushed with one write + fdatasync
+// as soon as any limit is reached.
+typedef struct {
+  uint32_t group_max_records; // Flush when this many records are pending
+  uint32_t group_max_bytes;   // Flush when this many bytes are pending
+  uint32_t group_window_us;   // Max time the oldest pending record waits
+                              // (0 = flush immediately, no grouping)
+  bool sync;                  // fdatasync after each group write
+} WalConfig;
+
+// Counters since open()
+typedef struct {
+  uint64_t groups;  // Number of group writes
+  uint64_t records; // Records made durable
+  uint64_t bytes;   // Bytes written (headers included)
+} WalStats;
+
+// Called once per record during replay
+typedef void (*WalReplayCallback)(const PayloadRecordHeader &header,
+                                  const uint8_t *payload, void *user);
+
+// Write-ahead log for raw payloads with group commit. append() may be called
+// from many ingest threads; a background thread batches their records into a
+// single write + fdatasync and wakes every appender of that group together.
+class WriteAheadLog {
+public:
+  WriteAheadLog();
+  ~WriteAheadLog();
+
+  // Defaults: 256 records, 256 KiB, 1 ms window, sync on
+  static WalConfig defaultConfig();
+
+  // Open (or create) the log and start the flusher thread. An existing log
+  // is scanned and a torn tail left by a crash is truncated away.
+  // Returns: true on success
+  bool open(const char *path, const WalConfig &config);
+
+  // Flush anything pending, stop the flusher and close the file
+  void close();
+
+  // Append one payload and block until its group is durable
+  // Returns: sequence number of the record, or 0 on error
+  uint64_t append(uint64_t device_id, uint64_t timestamp_ms,
+                  const uint8_t *payload, uint32_t length);
+
+  // Highest sequence number known to be on disk
+  uint64_t getDurableSequence() const;
+
+  // Snapshot of group commit counters
+  WalStats getStats() const;
+
+  // Replay every valid record with sequence >= from_sequence, stopping at
+  // the first torn or corrupt record
+  // Returns: number of records delivered, or -1 if the log cannot be read
+  static int64_t replay(const char *path, uint64_t from_sequence,
+                        WalReplayCallback callback, void *user);
+
+private:
+  WriteAheadLog(const WriteAheadLog &);
+  WriteAheadLog &operator=(const WriteAheadLog &);
+
+  void flusherLoop();
+
+  int fd;
+  WalConfig config;
+
+  mutable std::mutex mutex;
+  std::condition_variable flush_cv;   // Wakes the flusher
+  std::condition_variable durable_cv; // Wakes appenders
+  std::vector<uint8_t> pending;       // Records of the group being filled
+  std::vector<uint8_t> writing;       // Records of the group being written
+  uint32_t pending_records;
+  std::chrono::steady_clock::time_point first_pending;
+  uint64_t next_sequence;
+  uint64_t durable_sequence;
+  WalStats stats;
+  bool stopping;
+  bool failed;
+  std::thread flusher;
+};
+
+#endif // PAYLOAD_WAL_H
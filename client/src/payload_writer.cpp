@@ -0,0 +1,484 @@
+#include "payload_writer.h"
+#include "payload_index.h"
+#include <string.h>
+
+#define FIELD_MASK ((1u << SENSOR_FIELD_COUNT) - 1)
+
+// Upper bound on output bytes per payload byte. The densest case is a
+// one-byte value (a field name and up to 5 characters of text) or a CSV row
+// of about 90 characters for a 4-byte empty reading.
+#define OUTPUT_BYTES_PER_INPUT_BYTE 64
+#define OUTPUT_SLACK 512
+
+// Tokens are padded so they are copied with one fixed-size store; the
+// writers may store up to 64 bytes past the end of the text, which the
+// output reservation covers. The longest token is ,name_2= (a field name
+// plus 4 bytes); buildTables() checks every name fits.
+#define TOKEN_SIZE 16
+
+namespace {
+
+typedef struct {
+  char text[TOKEN_SIZE];
+  uint32_t length;
+} Token;
+
+// Everything the writers need about one field, for one combination of the
+// dual-mode and dedicated temp/hum header bits
+typedef struct {
+  SensorFieldType type;
+  uint8_t decimals;   // log10(scale)
+  uint8_t channels;   // Values on the wire (1 or 2)
+  uint8_t width;      // Bytes per value
+  uint8_t bytes;      // channels * width
+  uint8_t csv_column; // CSV column of channel 1, counted after the fields
+  Token json_key;     // ,"name":
+  Token line_keys[2]; // ,name= and ,name_2=
+} FieldFormat;
+
+typedef struct {
+  FieldFormat modes[4][SENSOR_FIELD_COUNT]; // Indexed by metadata bits 3-4
+  uint32_t csv_columns;                     // Second-channel CSV columns
+  bool valid;                               // Every token fit TOKEN_SIZE
+} WriterTables;
+
+// Returns: false if the token does not fit TOKEN_SIZE
+bool makeToken(Token &token, const char *prefix, const char *name,
+               const char *suffix) {
+  memset(token.text, 0, sizeof(token.text));
+  token.length = 0;
+  const char *parts[3] = {prefix, name, suffix};
+  for (int p = 0; p < 3; p++) {
+    for (const char *c = parts[p]; *c != '\0'; c++) {
+      if (token.length == TOKEN_SIZE) {
+        return false;
+      }
+      token.text[token.length++] = *c;
+    }
+  }
+  return true;
+}
+
+WriterTables buildTables() {
+  WriterTables result;
+  result.csv_columns = 0;
+  result.valid = true;
+  for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    const SensorFieldInfo &info = kSensorFields[flag];
+    FieldFormat format;
+    format.type = info.type;
+    format.decimals = 0;
+    for (uint16_t scale = info.scale; scale >= 10; scale /= 10)
+      format.decimals++;
+    format.width = sensorFieldWidth((SensorFlag)flag);
+    format.csv_column = (uint8_t)result.csv_columns;
+    if (info.expandable)
+      result.csv_columns++;
+    // A longer field name would be cut short and corrupt every key
+    result.valid = makeToken(format.json_key, ",\"", info.name, "\":") &&
+                   makeToken(format.line_keys[0], ",", info.name, "=") &&
+                   makeToken(format.line_keys[1], ",", info.name, "_2=") &&
+                   result.valid;
+
+    for (uint32_t mode = 0; mode < 4; mode++) {
+      bool dual = (mode & 1) != 0;
+      bool dedicated = (mode & 2) != 0;
+      bool expandable = info.expandable &&
+                        !((flag == FLAG_TEMP || flag == FLAG_HUM) && dedicated);
+      format.channels = dual && expandable ? 2 : 1;
+      format.bytes = format.channels * format.width;
+      result.modes[mode][flag] = format;
+    }
+  }
+  return result;
+}
+
+const WriterTables &tables() {
+  static const WriterTables result = buildTables();
+  return result;
+}
+
+inline const FieldFormat *formatsFor(uint8_t metadata) {
+  return tables().modes[(metadata >> 3) & 3];
+}
+
+inline uint32_t readMask(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+         ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Raw value of one channel at bytes (little-endian wire format)
+inline int64_t readValue(const uint8_t *bytes, SensorFieldType type) {
+  switch (type) {
+  case FIELD_INT8:
+    return (int8_t)bytes[0];
+  case FIELD_INT16:
+    return (int16_t)(bytes[0] | (bytes[1] << 8));
+  case FIELD_UINT16:
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+  case FIELD_UINT32:
+    return readMask(bytes);
+  }
+  return 0;
+}
+
+// Validate the payload and count its readings
+// Returns: reading count, or -1 if a reading is truncated
+int32_t scanPayload(const uint8_t *payload, uint32_t length) {
+  PayloadHeader header = {(uint8_t)(payload[0] & 0x07),
+                          (payload[0] & (1 << 3)) != 0,
+                          (payload[0] & (1 << 4)) != 0, payload[1]};
+  uint32_t offset = 2;
+  int32_t count = 0;
+  while (offset < length) {
+    if (length - offset < 4) {
+      return -1;
+    }
+    uint32_t size = 4 + readingDataSize(readMask(payload + offset), header);
+    if (size > length - offset) {
+      return -1;
+    }
+    offset += size;
+    count++;
+  }
+  return count;
+}
+
+const char kDigitPairs[201] = "00010203040506070809"
+                              "10111213141516171819"
+                              "20212223242526272829"
+                              "30313233343536373839"
+                              "40414243444546474849"
+                              "50515253545556575859"
+                              "60616263646566676869"
+                              "70717273747576777879"
+                              "80818283848586878889"
+                              "90919293949596979899";
+
+const char kCommas[] = ",,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,"
+                       ",,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,";
+
+inline char *writeToken(char *out, const Token &token) {
+  memcpy(out, token.text, TOKEN_SIZE);
+  return out + token.length;
+}
+
+inline char *writeText(char *out, const char *text, size_t length) {
+  memcpy(out, text, length);
+  return out + length;
+}
+
+#define WRITE_LITERAL(out, text) writeText(out, text, sizeof(text) - 1)
+
+// count commas (at most 64) with one fixed-size store
+inline char *writeCommas(char *out, uint32_t count) {
+  memcpy(out, kCommas, sizeof(kCommas) - 1);
+  return out + count;
+}
+
+inline void putPair(char *out, uint32_t pair) {
+  memcpy(out, kDigitPairs + pair * 2, 2);
+}
+
+inline uint32_t digitCount(uint32_t value) {
+  if (value < 100000) {
+    if (value < 100)
+      return value < 10 ? 1 : 2;
+    return value < 1000 ? 3 : value < 10000 ? 4 : 5;
+  }
+  if (value < 10000000)
+    return value < 1000000 ? 6 : 7;
+  return value < 100000000 ? 8 : value < 1000000000 ? 9 : 10;
+}
+
+// Two digits at a time from the end, with constant divisors
+inline char *writeUint32(char *out, uint32_t value) {
+  uint32_t digits = digitCount(value);
+  char *end = out + digits;
+  while (value >= 100) {
+    end -= 2;
+    putPair(end, value % 100);
+    value /= 100;
+  }
+  if (value >= 10) {
+    putPair(end - 2, value);
+  } else {
+    end[-1] = (char)('0' + value);
+  }
+  return out + digits;
+}
+
+// Device ids and millisecond timestamps, in groups of 9 digits so the digit
+// loop runs on 32-bit values
+inline char *writeUint64(char *out, uint64_t value) {
+  if (value <= UINT32_MAX) {
+    return writeUint32(out, (uint32_t)value);
+  }
+  out = writeUint64(out, value / 1000000000);
+  uint32_t low = (uint32_t)(value % 1000000000);
+  char *end = out + 9;
+  for (int i = 0; i < 4; i++) {
+    end -= 2;
+    putPair(end, low % 100);
+    low /= 100;
+  }
+  end[-1] = (char)('0' + low);
+  return out + 9;
+}
+
+// raw / 10^decimals in fixed point, trailing zeros dropped. Raw values are
+// at most 32 bits wide, so the magnitude fits in uint32_t.
+inline char *writeScaled(char *out, int64_t raw, uint32_t decimals) {
+  if (raw < 0) {
+    *out++ = '-';
+    raw = -raw;
+  }
+  uint32_t magnitude = (uint32_t)raw;
+  uint32_t fraction;
+  switch (decimals) {
+  case 0:
+    return writeUint32(out, magnitude);
+  case 1:
+    out = writeUint32(out, magnitude / 10);
+    fraction = magnitude % 10;
+    if (fraction != 0) {
+      out[0] = '.';
+      out[1] = (char)('0' + fraction);
+      out += 2;
+    }
+    return out;
+  case 2:
+    out = writeUint32(out, magnitude / 100);
+    fraction = magnitude % 100;
+    if (fraction != 0) {
+      out[0] = '.';
+      putPair(out + 1, fraction);
+      out += fraction % 10 == 0 ? 2 : 3;
+    }
+    return out;
+  default:
+    out = writeUint32(out, magnitude / 1000);
+    fraction = magnitude % 1000;
+    if (fraction != 0) {
+      out[0] = '.';
+      out[1] = (char)('0' + fraction / 100);
+      putPair(out + 2, fraction % 100);
+      out += fraction % 100 == 0 ? 2 : fraction % 10 == 0 ? 3 : 4;
+    }
+    return out;
+  }
+}
+
+} // namespace
+
+PayloadWriter::PayloadWriter(OutputFormat format)
+    : format(format), measurement("airgradient"), used(0) {}
+
+void PayloadWriter::setMeasurement(const char *measurement) {
+  this->measurement = measurement;
+}
+
+const char *PayloadWriter::data() const { return buffer.data(); }
+
+size_t PayloadWriter::size() const { return used; }
+
+void PayloadWriter::clear() { used = 0; }
+
+char *PayloadWriter::reserve(size_t bytes) {
+  if (used + bytes > buffer.size()) {
+    size_t capacity = buffer.size() * 2;
+    if (capacity < used + bytes)
+      capacity = used + bytes;
+    buffer.resize(capacity);
+  }
+  return &buffer[used];
+}
+
+void PayloadWriter::writeCsvHeader() {
+  if (!tables().valid) {
+    return;
+  }
+  const FieldFormat *formats = formatsFor(0);
+  char *start = reserve(OUTPUT_SLACK + 2 * TOKEN_SIZE * SENSOR_FIELD_COUNT);
+  char *out = WRITE_LITERAL(start, "device_id,timestamp_ms");
+  for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    const Token &key = formats[flag].line_keys[0];
+    out = writeText(out, key.text, key.length - 1); // Without the '='
+  }
+  for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    if (kSensorFields[flag].expandable) {
+      const Token &key = formats[flag].line_keys[1];
+      out = writeText(out, key.text, key.length - 1);
+    }
+  }
+  *out++ = '\n';
+  used += (size_t)(out - start);
+}
+
+int32_t PayloadWriter::write(uint64_t device_id, uint64_t received_ms,
+                             const uint8_t *payload, uint32_t length) {
+  if (payload == nullptr || length < 2 || !tables().valid) {
+    return -1;
+  }
+  int32_t count = scanPayload(payload, length);
+  if (count < 0) {
+    return -1;
+  }
+
+  // One reservation covers the whole payload, so the writers below never
+  // check bounds
+  size_t bound = (size_t)length * OUTPUT_BYTES_PER_INPUT_BYTE + OUTPUT_SLACK;
+  if (format == OUTPUT_LINE_PROTOCOL)
+    bound += (size_t)count * measurement.size();
+  char *start = reserve(bound);
+  char *out;
+  if (format == OUTPUT_JSON)
+    out = writeJson(start, payload, length);
+  else if (format == OUTPUT_CSV)
+    out = writeCsv(start, device_id, received_ms, payload, (uint32_t)count);
+  else
+    out = writeLines(start, device_id, received_ms, payload, (uint32_t)count);
+  used += (size_t)(out - start);
+  return count;
+}
+
+char *PayloadWriter::writeJson(char *out, const uint8_t *payload,
+                               uint32_t length) {
+  const FieldFormat *formats = formatsFor(payload[0]);
+  uint8_t metadata = payload[0];
+
+  out = WRITE_LITERAL(out, "{\"header\":{\"version\":");
+  *out++ = (char)('0' + (metadata & 0x07));
+  out = (metadata & 0x08) ? WRITE_LITERAL(out, ",\"dualMode\":true")
+                          : WRITE_LITERAL(out, ",\"dualMode\":false");
+  out = (metadata & 0x10)
+            ? WRITE_LITERAL(out, ",\"dedicatedTempHumSensor\":true")
+            : WRITE_LITERAL(out, ",\"dedicatedTempHumSensor\":false");
+  out = WRITE_LITERAL(out, ",\"intervalMinutes\":");
+  out = writeUint32(out, payload[1]);
+  out = WRITE_LITERAL(out, "},\"readings\":[");
+
+  const uint8_t *in = payload + 2;
+  const uint8_t *end = payload + length;
+  uint32_t count = 0;
+  while (in < end) {
+    uint32_t mask = readMask(in);
+    in += 4;
+    if (count++ > 0)
+      *out++ = ',';
+    out = WRITE_LITERAL(out, "{\"presenceMask\":");
+    out = writeUint32(out, mask);
+
+    for (uint32_t bits = mask & FIELD_MASK; bits != 0; bits &= bits - 1) {
+      const FieldFormat &field = formats[__builtin_ctz(bits)];
+      out = writeToken(out, field.json_key);
+      if (field.channels == 2) {
+        *out++ = '[';
+        out = writeScaled(out, readValue(in, field.type), field.decimals);
+        *out++ = ',';
+        out = writeScaled(out, readValue(in + field.width, field.type),
+                          field.decimals);
+        *out++ = ']';
+      } else {
+        out = writeScaled(out, readValue(in, field.type), field.decimals);
+      }
+      in += field.bytes;
+    }
+    *out++ = '}';
+  }
+
+  out = WRITE_LITERAL(out, "],\"readingCount\":");
+  out = writeUint32(out, count);
+  out = WRITE_LITERAL(out, "}\n");
+  return out;
+}
+
+char *PayloadWriter::writeCsv(char *out, uint64_t device_id,
+                              uint64_t received_ms, const uint8_t *payload,
+                              uint32_t reading_count) {
+  const FieldFormat *formats = formatsFor(payload[0]);
+  uint32_t second_columns = tables().csv_columns;
+  uint64_t interval_ms = payload[1] * 60000ULL;
+
+  const uint8_t *in = payload + 2;
+  for (uint32_t i = 0; i < reading_count; i++) {
+    uint64_t age_ms = (uint64_t)(reading_count - 1 - i) * interval_ms;
+    uint64_t timestamp_ms = received_ms > age_ms ? received_ms - age_ms : 0;
+    uint32_t mask = readMask(in) & FIELD_MASK;
+    in += 4;
+
+    out = writeUint64(out, device_id);
+    *out++ = ',';
+    out = writeUint64(out, timestamp_ms);
+
+    // Channel 0 columns fill in flag order; channel 1 columns come after
+    // all of them, so hold those values until the end of the row
+    int64_t second[SENSOR_FIELD_COUNT];
+    uint32_t second_mask = 0;
+    uint32_t column = 0;
+    for (uint32_t bits = mask; bits != 0; bits &= bits - 1) {
+      uint32_t flag = (uint32_t)__builtin_ctz(bits);
+      const FieldFormat &field = formats[flag];
+      out = writeCommas(out, flag + 1 - column);
+      column = flag + 1;
+      out = writeScaled(out, readValue(in, field.type), field.decimals);
+      if (field.channels == 2) {
+        second[flag] = readValue(in + field.width, field.type);
+        second_mask |= 1u << flag;
+      }
+      in += field.bytes;
+    }
+    out = writeCommas(out, SENSOR_FIELD_COUNT - column);
+
+    column = 0;
+    for (uint32_t bits = second_mask; bits != 0; bits &= bits - 1) {
+      uint32_t flag = (uint32_t)__builtin_ctz(bits);
+      const FieldFormat &field = formats[flag];
+      out = writeCommas(out, field.csv_column + 1u - column);
+      column = field.csv_column + 1u;
+      out = writeScaled(out, second[flag], field.decimals);
+    }
+    out = writeCommas(out, second_columns - column);
+    *out++ = '\n';
+  }
+  return out;
+}
+
+char *PayloadWriter::writeLines(char *out, uint64_t device_id,
+                                uint64_t received_ms, const uint8_t *payload,
+                                uint32_t reading_count) {
+  const FieldFormat *formats = formatsFor(payload[0]);
+  uint64_t interval_ms = payload[1] * 60000ULL;
+
+  const uint8_t *in = payload + 2;
+  for (uint32_t i = 0; i < reading_count; i++) {
+    uint64_t age_ms = (uint64_t)(reading_count - 1 - i) * interval_ms;
+    uint64_t timestamp_ms = received_ms > age_ms ? received_ms - age_ms : 0;
+    uint32_t mask = readMask(in) & FIELD_MASK;
+    in += 4;
+
+    // Line protocol needs at least one field per line
+    if (mask == 0)
+      continue;
+    out = writeText(out, measurement.data(), measurement.size());
+    out = WRITE_LITERAL(out, ",device=");
+    out = writeUint64(out, device_id);
+    char *first = out; // The first key's ',' becomes the space before fields
+    for (uint32_t bits = mask; bits != 0; bits &= bits - 1) {
+      const FieldFormat &field = formats[__builtin_ctz(bits)];
+      for (uint32_t channel = 0; channel < field.channels; channel++) {
+        out = writeToken(out, field.line_keys[channel]);
+        out = writeScaled(out, readValue(in + channel * field.width, field.type),
+                          field.decimals);
+        if (field.decimals == 0)
+          *out++ = 'i';
+      }
+      in += field.bytes;
+    }
+    *first = ' ';
+    *out++ = ' ';
+    out = writeUint64(out, timestamp_ms);
+    *out++ = '\n';
+  }
+  return out;
+}
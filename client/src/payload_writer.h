@@ -0,0 +1,77 @@
+#ifndef PAYLOAD_WRITER_H
+#define PAYLOAD_WRITER_H
+
+#include "sensor_fields.h"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Text output straight from payload bytes, without decoding into
+// SensorReading first. Field names are those of kSensorFields (the same as
+// SensorFieldNames in server/src/payload_types.js).
+//
+//   JSON           Same text as decodePayloadToJSON(buffer) on the server:
+//                  {"header":{...},"readings":[{...}],"readingCount":N}
+//   CSV            One row per reading: device_id,timestamp_ms, then every
+//                  field in flag order, then "<name>_2" for the second
+//                  channel of expandable fields. Absent values are empty.
+//   Line protocol  One line per reading:
+//                  <measurement>,device=<id> <field>=<value>,... <time>
+//                  with the time in milliseconds (write with precision=ms).
+//                  Unscaled fields are integers ("400i"), the second channel
+//                  is "<name>_2". Readings without fields are skipped.
+//
+// Scaled values are printed in fixed point (raw / scale with trailing zeros
+// dropped), which is the shortest form JavaScript prints for raw / scale.
+// Reading timestamps for CSV and line protocol follow
+// DeviceAggregator::updatePayload(): the last reading at received_ms,
+// earlier ones one measurement interval apart.
+
+typedef enum {
+  OUTPUT_JSON = 0,
+  OUTPUT_CSV = 1,
+  OUTPUT_LINE_PROTOCOL = 2
+} OutputFormat;
+
+// Appends payloads to an output buffer that is reused across calls: clear()
+// keeps the memory, so steady-state writing does not allocate.
+class PayloadWriter {
+public:
+  explicit PayloadWriter(OutputFormat format = OUTPUT_JSON);
+
+  // Measurement name for line protocol (default "airgradient"). Written
+  // as given: it must not contain spaces or commas.
+  void setMeasurement(const char *measurement);
+
+  // Append the CSV header line (CSV only)
+  void writeCsvHeader();
+
+  // Append one payload. JSON output ends with a newline so payloads form
+  // JSON Lines.
+  // Returns: number of readings in the payload, or -1 if it is malformed
+  // or a kSensorFields name is too long for the writer's keys (the output
+  // is left unchanged)
+  int32_t write(uint64_t device_id, uint64_t received_ms,
+                const uint8_t *payload, uint32_t length);
+
+  const char *data() const;
+  size_t size() const;
+
+  // Drop the output, keeping the buffer
+  void clear();
+
+private:
+  char *reserve(size_t bytes);
+  char *writeJson(char *out, const uint8_t *payload, uint32_t length);
+  char *writeCsv(char *out, uint64_t device_id, uint64_t received_ms,
+                 const uint8_t *payload, uint32_t reading_count);
+  char *writeLines(char *out, uint64_t device_id, uint64_t received_ms,
+                   const uint8_t *payload, uint32_t reading_count);
+
+  OutputFormat format;
+  std::string measurement;
+  std::vector<char> buffer; // Capacity; size() of the output is used
+  size_t used;
+};
+
+#endif // PAYLOAD_WRITER_H
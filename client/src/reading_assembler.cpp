@@ -0,0 +1,85 @@
+#include "reading_assembler.h"
+#include <stddef.h>
+#include <string.h>
+
+#define FIELD(member)                                                          \
+  { (uint8_t)offsetof(SensorReading, member),                                  \
+    (uint8_t)sizeof(((SensorReading *)0)->member) }
+
+// Location of each field in SensorReading (both channels), by SensorFlag
+static const struct {
+  uint8_t offset;
+  uint8_t size;
+} kFieldBytes[FLAG_SIGNAL + 1] = {
+    FIELD(temp),     FIELD(hum),      FIELD(co2),      FIELD(tvoc),
+    FIELD(tvoc_raw), FIELD(nox),      FIELD(nox_raw),  FIELD(pm_01),
+    FIELD(pm_25),    FIELD(pm_10),    FIELD(pm_01_sp), FIELD(pm_25_sp),
+    FIELD(pm_10_sp), FIELD(pm_03_pc), FIELD(pm_05_pc), FIELD(pm_01_pc),
+    FIELD(pm_25_pc), FIELD(pm_5_pc),  FIELD(pm_10_pc), FIELD(vbat),
+    FIELD(vpanel),   FIELD(o3_we),    FIELD(o3_ae),    FIELD(no2_we),
+    FIELD(no2_ae),   FIELD(afe_temp), FIELD(signal),
+};
+
+#undef FIELD
+
+ReadingAssembler::ReadingAssembler() : open(0), closing(false) {
+  for (int i = 0; i < 2; i++) {
+    memset(&slots[i].reading, 0, sizeof(SensorReading));
+    slots[i].mask.store(0);
+    slots[i].writers.store(0);
+  }
+}
+
+void ReadingAssembler::contribute(const SensorReading &part) {
+  uint32_t fields = part.presence_mask & ((1u << (FLAG_SIGNAL + 1)) - 1);
+  if (fields == 0) {
+    return;
+  }
+
+  // Register on the open slot, then check it is still open. commit() stores
+  // open before it reads writers, so either it sees this writer or this
+  // sees the new open value (both sequentially consistent).
+  Slot *slot;
+  for (;;) {
+    uint32_t ticket = open.load();
+    slot = &slots[ticket & 1];
+    slot->writers.fetch_add(1);
+    if (open.load() == ticket) {
+      break;
+    }
+    slot->writers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Plain stores: each task writes only its own fields
+  uint8_t *target = (uint8_t *)&slot->reading;
+  const uint8_t *source = (const uint8_t *)&part;
+  for (uint32_t mask = fields; mask != 0; mask &= mask - 1) {
+    uint32_t flag = (uint32_t)__builtin_ctz(mask);
+    memcpy(target + kFieldBytes[flag].offset,
+           source + kFieldBytes[flag].offset, kFieldBytes[flag].size);
+  }
+  slot->mask.fetch_or(fields, std::memory_order_relaxed);
+  slot->writers.fetch_sub(1, std::memory_order_release);
+}
+
+int32_t ReadingAssembler::commit(SensorReading *reading) {
+  if (!closing) {
+    open.store(open.load(std::memory_order_relaxed) + 1);
+    closing = true;
+  }
+  Slot *slot = &slots[(open.load(std::memory_order_relaxed) - 1) & 1];
+  if (slot->writers.load() != 0) {
+    return -1;
+  }
+
+  uint32_t fields = slot->mask.load(std::memory_order_relaxed);
+  if (fields != 0) {
+    *reading = slot->reading;
+    reading->presence_mask = fields;
+  }
+  // Reset before the slot opens again, published by the store to open
+  memset(&slot->reading, 0, sizeof(SensorReading));
+  slot->mask.store(0, std::memory_order_relaxed);
+  closing = false;
+  return fields != 0 ? 1 : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef READING_ASSEMBLER_H
+#define READING_ASSEMBLER_H
+
+#include "payload_types.h"
+#include <atomic>
+
+// Builds one SensorReading from parts contributed by several sensor tasks
+// without a lock. contribute() registers as a writer of the open reading,
+// copies the part's fields into it and ORs its presence bits in. commit()
+// closes the open reading (later parts go to the next one) and hands it out
+// once no contribution is still being copied.
+//
+// Any number of sensor tasks, each owning a disjoint set of fields; one task
+// calls commit(). Parts contributed twice to the same reading overwrite the
+// earlier values.
+class ReadingAssembler {
+public:
+  ReadingAssembler();
+
+  // Sensor task: merge the fields set in part.presence_mask into the open
+  // reading
+  void contribute(const SensorReading &part);
+
+  // Commit task: close the open reading and copy it to reading.
+  // Returns: 1 if reading was filled, 0 if the reading had no fields, or -1
+  // if a contribution is still being copied (call again; the reading stays
+  // closed and new parts go to the next one)
+  int32_t commit(SensorReading *reading);
+
+private:
+  ReadingAssembler(const ReadingAssembler &);
+  ReadingAssembler &operator=(const ReadingAssembler &);
+
+  typedef struct {
+    SensorReading reading;          // presence_mask unused, see mask
+    std::atomic<uint32_t> mask;     // Fields contributed so far
+    std::atomic<uint32_t> writers;  // Contributions registered on the slot
+  } Slot;
+
+  // The open reading is slots[open % 2]; the other one is being committed
+  // or empty
+  Slot slots[2];
+  std::atomic<uint32_t> open;
+  bool closing; // Commit task only: slots[(open - 1) % 2] awaits its writers
+};
+
+#endif // READING_ASSEMBLER_H
@@ -0,0 +1,82 @@
+#ifndef ROLLUP_FORMAT_H
+#define ROLLUP_FORMAT_H
+
+#include "sensor_fields.h"
+#include <stdint.h>
+
+// Columnar rollup file ("AGRC") written from decoded readings.
+//
+//   [ file header ]  magic + version (8 bytes)
+//   [ row group 0 ]  one chunk per column, each 64-byte aligned
+//   [ row group 1 ]
+//   ...
+//   [ group directory ]  RollupGroup[group_count]
+//   [ footer ]           RollupFooter (last 40 bytes of the file)
+//
+// Columns: device id, receive timestamp, then one column per SensorFlag
+// holding channel 0 of the field. A chunk stores every row of its group as
+// an unsigned delta from the chunk minimum (frame-of-reference) in the
+// narrowest width that fits, so a range predicate becomes an unsigned range
+// test on packed 8/16/32-bit lanes. Rows without the field are marked in the
+// chunk presence bitmap and hold delta 0.
+//
+// Structures are stored in host byte order and are read in place through
+// mmap; files are only portable between little-endian hosts.
+
+#define ROLLUP_MAGIC 0x43524741u // "AGRC" little-endian
+#define ROLLUP_VERSION 1
+
+#define ROLLUP_COLUMN_DEVICE 0
+#define ROLLUP_COLUMN_TIMESTAMP 1
+#define ROLLUP_COLUMN_FIELD(flag) (2 + (flag))
+#define ROLLUP_COLUMN_COUNT (2 + SENSOR_FIELD_COUNT)
+
+// Rows per group (multiple of 64 so bitmaps are whole words)
+#define ROLLUP_DEFAULT_GROUP_ROWS 16384
+
+// Alignment of chunk data inside the file
+#define ROLLUP_ALIGNMENT 64
+
+// Chunk codecs (frame-of-reference delta width)
+typedef enum {
+  ROLLUP_CODEC_CONSTANT = 0, // Every present value equals min; no data
+  ROLLUP_CODEC_FOR8 = 1,
+  ROLLUP_CODEC_FOR16 = 2,
+  ROLLUP_CODEC_FOR32 = 3,
+  ROLLUP_CODEC_FOR64 = 4
+} RollupCodec;
+
+typedef struct {
+  uint64_t data_offset;   // File offset of packed deltas (0 for CONSTANT)
+  uint64_t bitmap_offset; // File offset of presence bitmap (0 = all present)
+  int64_t min;            // Zone map over present rows
+  int64_t max;
+  uint32_t present_count; // Rows holding a value
+  uint8_t codec;          // RollupCodec
+  uint8_t reserved[3];
+} RollupChunk;
+
+typedef struct {
+  uint64_t first_row;
+  uint32_t row_count;
+  uint32_t reserved;
+  RollupChunk chunks[ROLLUP_COLUMN_COUNT];
+} RollupGroup;
+
+typedef struct {
+  uint64_t directory_offset; // File offset of RollupGroup[group_count]
+  uint64_t row_count;
+  uint32_t group_count;
+  uint32_t group_rows;
+  uint32_t column_count;
+  uint32_t version;
+  uint32_t magic;
+  uint32_t reserved;
+} RollupFooter;
+
+// Bytes per delta for a codec
+static inline uint8_t rollupCodecWidth(uint8_t codec) {
+  return codec == ROLLUP_CODEC_CONSTANT ? 0 : (uint8_t)(1u << (codec - 1));
+}
+
+#endif // ROLLUP_FORMAT_H
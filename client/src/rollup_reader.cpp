@@ -0,0 +1,134 @@
+#include "rollup_reader.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+RollupReader::RollupReader()
+    : base(nullptr), size(0), footer(nullptr), groups(nullptr) {}
+
+RollupReader::~RollupReader() { close(); }
+
+bool RollupReader::open(const char *path) {
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RollupFooter)) {
+    ::close(fd);
+    return false;
+  }
+
+  void *mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  base = (const uint8_t *)mapping;
+  size = (size_t)st.st_size;
+
+  footer = (const RollupFooter *)(base + size - sizeof(RollupFooter));
+  bool valid = footer->magic == ROLLUP_MAGIC &&
+               footer->version == ROLLUP_VERSION &&
+               footer->column_count == ROLLUP_COLUMN_COUNT &&
+               footer->directory_offset <= size - sizeof(RollupFooter) &&
+               (uint64_t)footer->group_count * sizeof(RollupGroup) <=
+                   size - sizeof(RollupFooter) - footer->directory_offset;
+  if (valid) {
+    groups = (const RollupGroup *)(base + footer->directory_offset);
+    for (uint32_t g = 0; g < footer->group_count && valid; g++) {
+      if (groups[g].row_count > footer->group_rows) {
+        valid = false;
+      }
+      for (uint32_t c = 0; c < ROLLUP_COLUMN_COUNT && valid; c++) {
+        valid = chunkInBounds(groups[g].chunks[c], groups[g].row_count);
+      }
+    }
+  }
+  if (!valid) {
+    close();
+    return false;
+  }
+
+  // Chunks are read front to back during scans
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  return true;
+}
+
+bool RollupReader::chunkInBounds(const RollupChunk &chunk, uint32_t rows) const {
+  if (chunk.codec > ROLLUP_CODEC_FOR64) {
+    return false;
+  }
+  uint64_t data_size = (uint64_t)rows * rollupCodecWidth(chunk.codec);
+  if (data_size > 0 && (chunk.data_offset > size ||
+                        data_size > size - chunk.data_offset)) {
+    return false;
+  }
+  uint64_t bitmap_size = (uint64_t)(rows + 63) / 64 * sizeof(uint64_t);
+  if (chunk.bitmap_offset != 0 && (chunk.bitmap_offset > size ||
+                                   bitmap_size > size - chunk.bitmap_offset)) {
+    return false;
+  }
+  return true;
+}
+
+void RollupReader::close() {
+  if (base != nullptr) {
+    munmap((void *)base, size);
+  }
+  base = nullptr;
+  size = 0;
+  footer = nullptr;
+  groups = nullptr;
+}
+
+uint64_t RollupReader::getRowCount() const {
+  return footer != nullptr ? footer->row_count : 0;
+}
+
+uint32_t RollupReader::getGroupCount() const {
+  return footer != nullptr ? footer->group_count : 0;
+}
+
+const RollupGroup &RollupReader::getGroup(uint32_t index) const {
+  return groups[index];
+}
+
+const uint8_t *RollupReader::getChunkData(const RollupChunk &chunk) const {
+  return chunk.codec == ROLLUP_CODEC_CONSTANT ? nullptr
+                                              : base + chunk.data_offset;
+}
+
+const uint64_t *RollupReader::getChunkBitmap(const RollupChunk &chunk) const {
+  return chunk.bitmap_offset == 0
+             ? nullptr
+             : (const uint64_t *)(base + chunk.bitmap_offset);
+}
+
+bool RollupReader::getValue(const RollupGroup &group, uint32_t column,
+                            uint32_t row, int64_t *value) const {
+  const RollupChunk &chunk = group.chunks[column];
+  if (chunk.present_count == 0) {
+    return false;
+  }
+
+  const uint64_t *bitmap = getChunkBitmap(chunk);
+  if (bitmap != nullptr && ((bitmap[row / 64] >> (row & 63)) & 1) == 0) {
+    return false;
+  }
+
+  uint64_t delta = 0;
+  uint8_t width = rollupCodecWidth(chunk.codec);
+  if (width > 0) {
+    memcpy(&delta, getChunkData(chunk) + (size_t)row * width, width);
+  }
+  *value = (int64_t)((uint64_t)chunk.min + delta);
+  return true;
+}
+
+size_t RollupReader::getMappedSize() const { return size; }
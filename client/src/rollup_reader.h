@@ -0,0 +1,49 @@
+#ifndef ROLLUP_READER_H
+#define ROLLUP_READER_H
+
+#include "rollup_format.h"
+#include <stddef.h>
+
+// Read-only view of a rollup file mapped with mmap
+class RollupReader {
+public:
+  RollupReader();
+  ~RollupReader();
+
+  // Map the file and validate footer and directory
+  // Returns: true on success
+  bool open(const char *path);
+
+  // Unmap the file
+  void close();
+
+  uint64_t getRowCount() const;
+  uint32_t getGroupCount() const;
+  const RollupGroup &getGroup(uint32_t index) const;
+
+  // Packed deltas of a chunk (nullptr for CONSTANT chunks)
+  const uint8_t *getChunkData(const RollupChunk &chunk) const;
+
+  // Presence bitmap of a chunk (nullptr when every row is present)
+  const uint64_t *getChunkBitmap(const RollupChunk &chunk) const;
+
+  // Decode one value; returns false if the row has no value in this column
+  bool getValue(const RollupGroup &group, uint32_t column, uint32_t row,
+                int64_t *value) const;
+
+  // Size of the mapping in bytes
+  size_t getMappedSize() const;
+
+private:
+  RollupReader(const RollupReader &);
+  RollupReader &operator=(const RollupReader &);
+
+  bool chunkInBounds(const RollupChunk &chunk, uint32_t rows) const;
+
+  const uint8_t *base;
+  size_t size;
+  const RollupFooter *footer;
+  const RollupGroup *groups;
+};
+
+#endif // ROLLUP_READER_H
@@ -0,0 +1,423 @@
+#include "rollup_scan.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define ROLLUP_HAVE_AVX2_KERNELS 1
+#endif
+
+namespace {
+
+bool force_scalar = false;
+
+uint32_t bitmapWords(uint32_t rows) { return (rows + 63) / 64; }
+
+void setAllRows(uint64_t *bits, uint32_t rows) {
+  uint32_t words = bitmapWords(rows);
+  memset(bits, 0xFF, words * sizeof(uint64_t));
+  if (rows & 63) {
+    bits[words - 1] = (1ULL << (rows & 63)) - 1;
+  }
+}
+
+template <typename T>
+void rangeScalar(const uint8_t *data, uint32_t first, uint32_t rows,
+                 uint64_t lo, uint64_t hi, uint64_t *bits) {
+  // Unsigned trick: lo <= x <= hi  <=>  (x - lo) <= (hi - lo)
+  T base = (T)lo;
+  T span = (T)(hi - lo);
+  for (uint32_t row = first; row < rows; row++) {
+    T value;
+    memcpy(&value, data + (size_t)row * sizeof(T), sizeof(T));
+    uint64_t match = (T)(value - base) <= span;
+    bits[row / 64] |= match << (row & 63);
+  }
+}
+
+// Parse a decimal ("-20.15") as value * 10^scale_digits without rounding:
+// *floor_value is the largest integer not above it, *fraction is set when
+// digits were left over
+bool parseDecimal(const char *text, uint32_t scale_digits,
+                  int64_t *floor_value, bool *fraction) {
+  const char *p = text;
+  bool negative = *p == '-';
+  if (negative) {
+    p++;
+  }
+  int64_t mantissa = 0;
+  uint32_t digits = 0, fraction_digits = 0;
+  bool point = false, leftover = false;
+  for (; *p != '\0'; p++) {
+    if (*p >= '0' && *p <= '9') {
+      digits++;
+      if (!point) {
+        if (digits + scale_digits > 18) {
+          return false;
+        }
+        mantissa = mantissa * 10 + (*p - '0');
+      } else if (fraction_digits < scale_digits) {
+        mantissa = mantissa * 10 + (*p - '0');
+        fraction_digits++;
+      } else if (*p != '0') {
+        leftover = true;
+      }
+    } else if (*p == '.' && !point) {
+      point = true;
+    } else {
+      return false;
+    }
+  }
+  if (digits == 0) {
+    return false;
+  }
+  for (; fraction_digits < scale_digits; fraction_digits++) {
+    mantissa *= 10;
+  }
+  *floor_value = negative ? -mantissa - (leftover ? 1 : 0) : mantissa;
+  *fraction = leftover;
+  return true;
+}
+
+// "now", "now-7d" (at most 3 decimals) or a number of milliseconds
+bool parseTimestamp(const char *text, int64_t now_ms, int64_t *floor_value,
+                    bool *fraction) {
+  if (strncmp(text, "now", 3) != 0) {
+    return parseDecimal(text, 0, floor_value, fraction);
+  }
+  *floor_value = now_ms;
+  *fraction = false;
+  if (text[3] == '\0') {
+    return true;
+  }
+  if (text[3] != '-' || text[4] == '\0') {
+    return false;
+  }
+
+  std::string amount(text + 4, strlen(text + 4) - 1);
+  char unit = text[strlen(text) - 1];
+  int64_t unit_s = unit == 's'   ? 1
+                   : unit == 'm' ? 60
+                   : unit == 'h' ? 3600
+                   : unit == 'd' ? 86400
+                                 : 0;
+  int64_t amount_ms; // In thousandths of the unit
+  bool leftover;
+  if (unit_s == 0 || amount.empty() || amount[0] == '-' ||
+      !parseDecimal(amount.c_str(), 3, &amount_ms, &leftover) || leftover) {
+    return false;
+  }
+  *floor_value -= amount_ms * unit_s;
+  return true;
+}
+
+} // namespace
+
+bool rollupParsePredicate(const char *text, bool raw, int64_t now_ms,
+                          RollupPredicate *predicate) {
+  const char *op = strpbrk(text, "<>=");
+  if (op == nullptr || op == text) {
+    return false;
+  }
+
+  std::string name(text, op - text);
+  uint32_t column;
+  if (name == "device") {
+    column = ROLLUP_COLUMN_DEVICE;
+  } else if (name == "timestamp") {
+    column = ROLLUP_COLUMN_TIMESTAMP;
+  } else {
+    int32_t flag = findSensorField(name.c_str());
+    if (flag < 0) {
+      return false;
+    }
+    column = ROLLUP_COLUMN_FIELD(flag);
+  }
+
+  bool or_equal = op[0] != '=' && op[1] == '=';
+  const char *value_text = op + (or_equal ? 2 : 1);
+  int64_t value; // floor of the exact value in raw units
+  bool fraction;
+  if (column == ROLLUP_COLUMN_TIMESTAMP) {
+    if (!parseTimestamp(value_text, now_ms, &value, &fraction)) {
+      return false;
+    }
+  } else {
+    uint32_t scale_digits = 0;
+    if (!raw && column != ROLLUP_COLUMN_DEVICE) {
+      for (uint32_t scale = kSensorFields[column - ROLLUP_COLUMN_FIELD(0)].scale;
+           scale >= 10; scale /= 10) {
+        scale_digits++;
+      }
+    }
+    if (!parseDecimal(value_text, scale_digits, &value, &fraction)) {
+      return false;
+    }
+  }
+
+  // Raw values are integers: x > v is x >= floor(v) + 1, x >= v is
+  // x >= ceil(v), and x = v has no match when v has a fraction
+  int64_t ceil_value = value + (fraction ? 1 : 0);
+  predicate->column = column;
+  predicate->lo = INT64_MIN;
+  predicate->hi = INT64_MAX;
+  switch (op[0]) {
+  case '>':
+    predicate->lo = or_equal ? ceil_value : value + 1;
+    break;
+  case '<':
+    predicate->hi = or_equal ? value : ceil_value - 1;
+    break;
+  default:
+    predicate->lo = ceil_value;
+    predicate->hi = value;
+    break;
+  }
+  return true;
+}
+
+bool rollupHaveAvx2() {
+#ifdef ROLLUP_HAVE_AVX2_KERNELS
+  static const bool available = __builtin_cpu_supports("avx2");
+  return available;
+#else
+  return false;
+#endif
+}
+
+void rollupForceScalar(bool force) { force_scalar = force; }
+
+void rollupRangeScalar(const uint8_t *data, uint8_t codec, uint32_t rows,
+                       uint64_t lo, uint64_t hi, uint64_t *bits) {
+  memset(bits, 0, bitmapWords(rows) * sizeof(uint64_t));
+
+  switch (codec) {
+  case ROLLUP_CODEC_FOR8:
+    rangeScalar<uint8_t>(data, 0, rows, lo, hi, bits);
+    break;
+  case ROLLUP_CODEC_FOR16:
+    rangeScalar<uint16_t>(data, 0, rows, lo, hi, bits);
+    break;
+  case ROLLUP_CODEC_FOR32:
+    rangeScalar<uint32_t>(data, 0, rows, lo, hi, bits);
+    break;
+  case ROLLUP_CODEC_FOR64:
+    rangeScalar<uint64_t>(data, 0, rows, lo, hi, bits);
+    break;
+  default:
+    setAllRows(bits, rows);
+    break;
+  }
+}
+
+#ifdef ROLLUP_HAVE_AVX2_KERNELS
+
+namespace {
+
+// Each kernel produces a 32-bit match mask for 32 consecutive rows
+
+__attribute__((target("avx2"))) inline uint32_t
+match32x8(const uint8_t *data, __m256i base, __m256i span) {
+  __m256i x = _mm256_loadu_si256((const __m256i *)data);
+  __m256i shifted = _mm256_sub_epi8(x, base);
+  __m256i in_range = _mm256_cmpeq_epi8(_mm256_max_epu8(shifted, span), span);
+  return (uint32_t)_mm256_movemask_epi8(in_range);
+}
+
+__attribute__((target("avx2"))) inline uint32_t
+match32x16(const uint8_t *data, __m256i base, __m256i span) {
+  __m256i a = _mm256_loadu_si256((const __m256i *)data);
+  __m256i b = _mm256_loadu_si256((const __m256i *)(data + 32));
+  __m256i in_a = _mm256_cmpeq_epi16(
+      _mm256_max_epu16(_mm256_sub_epi16(a, base), span), span);
+  __m256i in_b = _mm256_cmpeq_epi16(
+      _mm256_max_epu16(_mm256_sub_epi16(b, base), span), span);
+  // Narrow to bytes; packs interleaves 128-bit lanes, permute restores order
+  __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(in_a, in_b),
+                                            0xD8);
+  return (uint32_t)_mm256_movemask_epi8(packed);
+}
+
+__attribute__((target("avx2"))) inline uint32_t
+match32x32(const uint8_t *data, __m256i base, __m256i span) {
+  uint32_t mask = 0;
+  for (int i = 0; i < 4; i++) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(data + i * 32));
+    __m256i in_range = _mm256_cmpeq_epi32(
+        _mm256_max_epu32(_mm256_sub_epi32(x, base), span), span);
+    mask |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(in_range))
+            << (i * 8);
+  }
+  return mask;
+}
+
+} // namespace
+
+__attribute__((target("avx2"))) void
+rollupRangeAvx2(const uint8_t *data, uint8_t codec, uint32_t rows, uint64_t lo,
+                uint64_t hi, uint64_t *bits) {
+  memset(bits, 0, bitmapWords(rows) * sizeof(uint64_t));
+
+  uint32_t blocks = rows / 32;
+  uint32_t row = blocks * 32;
+
+  switch (codec) {
+  case ROLLUP_CODEC_FOR8: {
+    __m256i base = _mm256_set1_epi8((char)lo);
+    __m256i span = _mm256_set1_epi8((char)(hi - lo));
+    for (uint32_t b = 0; b < blocks; b++) {
+      bits[b / 2] |= (uint64_t)match32x8(data + b * 32, base, span)
+                     << ((b & 1) * 32);
+    }
+    rangeScalar<uint8_t>(data, row, rows, lo, hi, bits);
+    break;
+  }
+  case ROLLUP_CODEC_FOR16: {
+    __m256i base = _mm256_set1_epi16((short)lo);
+    __m256i span = _mm256_set1_epi16((short)(hi - lo));
+    for (uint32_t b = 0; b < blocks; b++) {
+      bits[b / 2] |= (uint64_t)match32x16(data + b * 64, base, span)
+                     << ((b & 1) * 32);
+    }
+    rangeScalar<uint16_t>(data, row, rows, lo, hi, bits);
+    break;
+  }
+  case ROLLUP_CODEC_FOR32: {
+    __m256i base = _mm256_set1_epi32((int)lo);
+    __m256i span = _mm256_set1_epi32((int)(hi - lo));
+    for (uint32_t b = 0; b < blocks; b++) {
+      bits[b / 2] |= (uint64_t)match32x32(data + b * 128, base, span)
+                     << ((b & 1) * 32);
+    }
+    rangeScalar<uint32_t>(data, row, rows, lo, hi, bits);
+    break;
+  }
+  case ROLLUP_CODEC_FOR64:
+    // Only device ids and wide timestamps; no unsigned 64-bit compare in AVX2
+    rangeScalar<uint64_t>(data, 0, rows, lo, hi, bits);
+    break;
+  default:
+    setAllRows(bits, rows);
+    break;
+  }
+}
+
+#else
+
+void rollupRangeAvx2(const uint8_t *data, uint8_t codec, uint32_t rows,
+                     uint64_t lo, uint64_t hi, uint64_t *bits) {
+  rollupRangeScalar(data, codec, rows, lo, hi, bits);
+}
+
+#endif
+
+bool rollupEvaluatePredicate(const RollupReader &reader,
+                             const RollupGroup &group,
+                             const RollupPredicate &predicate, uint64_t *bits,
+                             RollupScanStats *stats) {
+  uint32_t rows = group.row_count;
+  uint32_t words = bitmapWords(rows);
+  if (predicate.column >= ROLLUP_COLUMN_COUNT) {
+    memset(bits, 0, words * sizeof(uint64_t));
+    return false;
+  }
+  const RollupChunk &chunk = group.chunks[predicate.column];
+
+  // Zone map: can any present value fall inside the range?
+  if (chunk.present_count == 0 || predicate.lo > predicate.hi ||
+      predicate.hi < chunk.min || predicate.lo > chunk.max) {
+    memset(bits, 0, words * sizeof(uint64_t));
+    return false;
+  }
+
+  int64_t lo = predicate.lo > chunk.min ? predicate.lo : chunk.min;
+  int64_t hi = predicate.hi < chunk.max ? predicate.hi : chunk.max;
+  uint64_t delta_lo = (uint64_t)lo - (uint64_t)chunk.min;
+  uint64_t delta_hi = (uint64_t)hi - (uint64_t)chunk.min;
+  uint64_t range = (uint64_t)chunk.max - (uint64_t)chunk.min;
+
+  if (chunk.codec == ROLLUP_CODEC_CONSTANT ||
+      (delta_lo == 0 && delta_hi == range)) {
+    setAllRows(bits, rows); // Whole chunk inside the range
+  } else {
+    const uint8_t *data = reader.getChunkData(chunk);
+    if (rollupHaveAvx2() && !force_scalar) {
+      rollupRangeAvx2(data, chunk.codec, rows, delta_lo, delta_hi, bits);
+    } else {
+      rollupRangeScalar(data, chunk.codec, rows, delta_lo, delta_hi, bits);
+    }
+    if (stats != nullptr) {
+      stats->bytes_scanned += (uint64_t)rows * rollupCodecWidth(chunk.codec);
+    }
+  }
+
+  const uint64_t *present = reader.getChunkBitmap(chunk);
+  if (present != nullptr) {
+    for (uint32_t w = 0; w < words; w++) {
+      bits[w] &= present[w];
+    }
+  }
+  return true;
+}
+
+uint64_t rollupScan(const RollupReader &reader,
+                    const RollupPredicate *predicates, uint32_t count,
+                    RollupMatchCallback callback, void *user,
+                    RollupScanStats *stats) {
+  RollupScanStats local;
+  if (stats == nullptr) {
+    stats = &local;
+  }
+  memset(stats, 0, sizeof(*stats));
+  for (uint32_t p = 0; p < count; p++) {
+    if (predicates[p].column >= ROLLUP_COLUMN_COUNT) {
+      return 0;
+    }
+  }
+
+  std::vector<uint64_t> bits;
+  std::vector<uint64_t> scratch;
+
+  for (uint32_t g = 0; g < reader.getGroupCount(); g++) {
+    const RollupGroup &group = reader.getGroup(g);
+    uint32_t words = bitmapWords(group.row_count);
+    bits.resize(words);
+    scratch.resize(words);
+    stats->groups++;
+
+    bool possible = true;
+    if (count == 0) {
+      setAllRows(bits.data(), group.row_count);
+    }
+    for (uint32_t p = 0; p < count && possible; p++) {
+      uint64_t *target = p == 0 ? bits.data() : scratch.data();
+      possible = rollupEvaluatePredicate(reader, group, predicates[p], target,
+                                         stats);
+      if (possible && p > 0) {
+        uint64_t any = 0;
+        for (uint32_t w = 0; w < words; w++) {
+          bits[w] &= scratch[w];
+          any |= bits[w];
+        }
+        possible = any != 0;
+      }
+    }
+    if (!possible) {
+      stats->groups_skipped++;
+      continue;
+    }
+
+    uint64_t matched = 0;
+    for (uint32_t w = 0; w < words; w++) {
+      matched += (uint64_t)__builtin_popcountll(bits[w]);
+    }
+    stats->rows_matched += matched;
+
+    if (matched > 0 && callback != nullptr) {
+      callback(group, bits.data(), user);
+    }
+  }
+
+  return stats->rows_matched;
+}
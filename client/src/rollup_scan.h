@@ -0,0 +1,63 @@
+#ifndef ROLLUP_SCAN_H
+#define ROLLUP_SCAN_H
+
+#include "rollup_reader.h"
+
+// Inclusive range predicate on raw column values: lo <= value <= hi
+typedef struct {
+  uint32_t column; // ROLLUP_COLUMN_*
+  int64_t lo;
+  int64_t hi;
+} RollupPredicate;
+
+typedef struct {
+  uint64_t groups;         // Row groups visited
+  uint64_t groups_skipped; // Row groups with no possible match
+  uint64_t bytes_scanned;  // Packed chunk bytes run through a kernel
+  uint64_t rows_matched;
+} RollupScanStats;
+
+// Called for every group with at least one match; bit i of bits (word i / 64)
+// is set when row i of the group matches every predicate
+typedef void (*RollupMatchCallback)(const RollupGroup &group,
+                                    const uint64_t *bits, void *user);
+
+// True if the CPU supports AVX2 (and scans use the AVX2 kernels)
+bool rollupHaveAvx2();
+
+// Force the scalar kernels even when AVX2 is available (for comparisons)
+void rollupForceScalar(bool force);
+
+// Range kernels over packed deltas: set bit i when lo <= delta[i] <= hi.
+// bits must hold (rows + 63) / 64 words and is overwritten.
+void rollupRangeScalar(const uint8_t *data, uint8_t codec, uint32_t rows,
+                       uint64_t lo, uint64_t hi, uint64_t *bits);
+void rollupRangeAvx2(const uint8_t *data, uint8_t codec, uint32_t rows,
+                     uint64_t lo, uint64_t hi, uint64_t *bits);
+
+// Evaluate one predicate on a group (zone map, kernel, presence bitmap)
+// Returns: false if no row of the group can match (bits are zeroed)
+bool rollupEvaluatePredicate(const RollupReader &reader,
+                             const RollupGroup &group,
+                             const RollupPredicate &predicate, uint64_t *bits,
+                             RollupScanStats *stats);
+
+// Parse "<column><op><value>" with op one of > >= < <= =, e.g. "pm25>35" or
+// "timestamp>=now-7d". Columns are "device", "timestamp" or a field name.
+// Field values are exact decimals in physical units unless raw is set, and
+// bounds are derived without rounding ("temperature>=20.1" is raw >= 2010,
+// "temperature=20.15" matches nothing). Timestamps are Unix milliseconds or
+// now[-N{s,m,h,d}] relative to now_ms.
+// Returns: false on an unknown column, operator or malformed value
+bool rollupParsePredicate(const char *text, bool raw, int64_t now_ms,
+                          RollupPredicate *predicate);
+
+// Scan every group with the AND of predicates
+// Returns: number of matching rows (0, without scanning, if a predicate's
+// column is not a ROLLUP_COLUMN_*)
+uint64_t rollupScan(const RollupReader &reader,
+                    const RollupPredicate *predicates, uint32_t count,
+                    RollupMatchCallback callback, void *user,
+                    RollupScanStats *stats);
+
+#endif // ROLLUP_SCAN_H
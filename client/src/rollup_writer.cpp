@@ -0,0 +1,202 @@
+#include "rollup_writer.h"
+#include <string.h>
+
+RollupWriter::RollupWriter()
+    : file(nullptr), file_offset(0), group_rows(0), buffered_rows(0),
+      row_count(0), failed(false) {}
+
+RollupWriter::~RollupWriter() {
+  if (file != nullptr) {
+    fclose(file);
+  }
+}
+
+bool RollupWriter::open(const char *path, uint32_t rows_per_group) {
+  if (file != nullptr) {
+    fclose(file);
+  }
+
+  file = fopen(path, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  group_rows = (rows_per_group + 63) & ~63u;
+  if (group_rows == 0) {
+    group_rows = ROLLUP_DEFAULT_GROUP_ROWS;
+  }
+  buffered_rows = 0;
+  row_count = 0;
+  failed = false;
+  file_offset = 0;
+  groups.clear();
+
+  for (uint32_t column = 0; column < ROLLUP_COLUMN_COUNT; column++) {
+    values[column].assign(group_rows, 0);
+    present[column].assign(group_rows / 64, 0);
+  }
+
+  uint32_t file_header[2] = {ROLLUP_MAGIC, ROLLUP_VERSION};
+  uint64_t ignored;
+  return writeAligned(file_header, sizeof(file_header), &ignored);
+}
+
+bool RollupWriter::addReading(uint64_t device_id, uint64_t timestamp_ms,
+                              const SensorReading &reading) {
+  if (file == nullptr || failed) {
+    return false;
+  }
+
+  uint32_t row = buffered_rows;
+  uint64_t row_bit = 1ULL << (row & 63);
+
+  values[ROLLUP_COLUMN_DEVICE][row] = (int64_t)device_id;
+  present[ROLLUP_COLUMN_DEVICE][row / 64] |= row_bit;
+  values[ROLLUP_COLUMN_TIMESTAMP][row] = (int64_t)timestamp_ms;
+  present[ROLLUP_COLUMN_TIMESTAMP][row / 64] |= row_bit;
+
+  // Only walk the fields that are present
+  uint32_t mask = reading.presence_mask & ((1u << SENSOR_FIELD_COUNT) - 1);
+  while (mask != 0) {
+    uint32_t flag = (uint32_t)__builtin_ctz(mask);
+    mask &= mask - 1;
+
+    uint32_t column = ROLLUP_COLUMN_FIELD(flag);
+    values[column][row] = getSensorFieldValue(reading, (SensorFlag)flag, 0);
+    present[column][row / 64] |= row_bit;
+  }
+
+  buffered_rows++;
+  row_count++;
+
+  if (buffered_rows == group_rows) {
+    return flushGroup();
+  }
+  return true;
+}
+
+bool RollupWriter::writeAligned(const void *data, size_t length,
+                                uint64_t *offset) {
+  static const uint8_t zeros[ROLLUP_ALIGNMENT] = {0};
+
+  uint32_t padding = (uint32_t)(-file_offset & (ROLLUP_ALIGNMENT - 1));
+  if (padding > 0 && fwrite(zeros, 1, padding, file) != padding) {
+    return false;
+  }
+  file_offset += padding;
+
+  *offset = file_offset;
+  if (length > 0 && fwrite(data, 1, length, file) != length) {
+    return false;
+  }
+  file_offset += length;
+  return true;
+}
+
+bool RollupWriter::writeChunk(uint32_t column, RollupChunk &chunk) {
+  const std::vector<int64_t> &column_values = values[column];
+  const std::vector<uint64_t> &column_present = present[column];
+  uint32_t words = (buffered_rows + 63) / 64;
+
+  memset(&chunk, 0, sizeof(chunk));
+
+  // Zone map over present rows
+  bool have_value = false;
+  for (uint32_t row = 0; row < buffered_rows; row++) {
+    if ((column_present[row / 64] >> (row & 63)) & 1) {
+      int64_t value = column_values[row];
+      if (!have_value || value < chunk.min)
+        chunk.min = value;
+      if (!have_value || value > chunk.max)
+        chunk.max = value;
+      have_value = true;
+      chunk.present_count++;
+    }
+  }
+
+  if (chunk.present_count != buffered_rows && chunk.present_count > 0) {
+    if (!writeAligned(column_present.data(), words * sizeof(uint64_t),
+                      &chunk.bitmap_offset)) {
+      return false;
+    }
+  }
+
+  uint64_t range = (uint64_t)chunk.max - (uint64_t)chunk.min;
+  if (chunk.present_count == 0 || range == 0) {
+    chunk.codec = ROLLUP_CODEC_CONSTANT;
+    return true;
+  }
+  chunk.codec = range <= 0xFF         ? ROLLUP_CODEC_FOR8
+                : range <= 0xFFFF     ? ROLLUP_CODEC_FOR16
+                : range <= 0xFFFFFFFF ? ROLLUP_CODEC_FOR32
+                                      : ROLLUP_CODEC_FOR64;
+
+  uint8_t width = rollupCodecWidth(chunk.codec);
+  packed.resize((size_t)buffered_rows * width);
+  for (uint32_t row = 0; row < buffered_rows; row++) {
+    bool is_present = (column_present[row / 64] >> (row & 63)) & 1;
+    uint64_t delta =
+        is_present ? (uint64_t)column_values[row] - (uint64_t)chunk.min : 0;
+    memcpy(&packed[(size_t)row * width], &delta, width); // Little-endian
+  }
+
+  return writeAligned(packed.data(), packed.size(), &chunk.data_offset);
+}
+
+bool RollupWriter::flushGroup() {
+  if (buffered_rows == 0) {
+    return true;
+  }
+
+  RollupGroup group;
+  memset(&group, 0, sizeof(group));
+  group.first_row = row_count - buffered_rows;
+  group.row_count = buffered_rows;
+
+  for (uint32_t column = 0; column < ROLLUP_COLUMN_COUNT; column++) {
+    if (!writeChunk(column, group.chunks[column])) {
+      failed = true;
+      return false;
+    }
+    memset(present[column].data(), 0, present[column].size() * sizeof(uint64_t));
+  }
+
+  groups.push_back(group);
+  buffered_rows = 0;
+  return true;
+}
+
+bool RollupWriter::close() {
+  if (file == nullptr) {
+    return false;
+  }
+
+  bool ok = !failed && flushGroup();
+
+  RollupFooter footer;
+  memset(&footer, 0, sizeof(footer));
+  if (ok) {
+    ok = writeAligned(groups.data(), groups.size() * sizeof(RollupGroup),
+                      &footer.directory_offset);
+  }
+
+  footer.row_count = row_count;
+  footer.group_count = (uint32_t)groups.size();
+  footer.group_rows = group_rows;
+  footer.column_count = ROLLUP_COLUMN_COUNT;
+  footer.version = ROLLUP_VERSION;
+  footer.magic = ROLLUP_MAGIC;
+
+  // Footer goes right after the directory, unpadded, ending the file
+  if (ok && fwrite(&footer, 1, sizeof(footer), file) != sizeof(footer)) {
+    ok = false;
+  }
+  if (fclose(file) != 0) {
+    ok = false;
+  }
+  file = nullptr;
+
+  return ok;
+}
+
+uint64_t RollupWriter::getRowCount() const { return row_count; }
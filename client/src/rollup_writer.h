@@ -0,0 +1,53 @@
+#ifndef ROLLUP_WRITER_H
+#define ROLLUP_WRITER_H
+
+#include "rollup_format.h"
+#include <stdio.h>
+#include <vector>
+
+// Writes decoded readings into a columnar rollup file (see rollup_format.h).
+// Rows are buffered one group at a time; close() writes the directory and
+// footer, so a file is only readable after close() succeeds.
+class RollupWriter {
+public:
+  RollupWriter();
+  ~RollupWriter();
+
+  // Create the file (group_rows is rounded up to a multiple of 64)
+  // Returns: true on success
+  bool open(const char *path, uint32_t group_rows = ROLLUP_DEFAULT_GROUP_ROWS);
+
+  // Append one reading (channel 0 of each present field)
+  // Returns: false on write error
+  bool addReading(uint64_t device_id, uint64_t timestamp_ms,
+                  const SensorReading &reading);
+
+  // Flush the last group, write directory + footer and close the file
+  // Returns: true on success
+  bool close();
+
+  // Rows appended since open()
+  uint64_t getRowCount() const;
+
+private:
+  RollupWriter(const RollupWriter &);
+  RollupWriter &operator=(const RollupWriter &);
+
+  bool flushGroup();
+  bool writeChunk(uint32_t column, RollupChunk &chunk);
+  bool writeAligned(const void *data, size_t length, uint64_t *offset);
+
+  FILE *file;
+  uint64_t file_offset;
+  uint32_t group_rows;
+  uint32_t buffered_rows;
+  uint64_t row_count;
+  bool failed;
+
+  std::vector<int64_t> values[ROLLUP_COLUMN_COUNT];   // group_rows each
+  std::vector<uint64_t> present[ROLLUP_COLUMN_COUNT]; // group_rows / 64 each
+  std::vector<uint8_t> packed;                        // Chunk encode scratch
+  std::vector<RollupGroup> groups;
+};
+
+#endif // ROLLUP_WRITER_H
@@ -0,0 +1,117 @@
+#include "sensor_fields.h"
+#include <stddef.h>
+#include <string.h>
+
+#define SENSOR_FIELD(name, type, scale, expandable, member)                    \
+  { name, type, scale, expandable, (uint16_t)offsetof(SensorReading, member) }
+
+const SensorFieldInfo kSensorFields[SENSOR_FIELD_COUNT] = {
+    SENSOR_FIELD("temperature", FIELD_INT16, 100, true, temp),
+    SENSOR_FIELD("humidity", FIELD_UINT16, 100, true, hum),
+    SENSOR_FIELD("co2", FIELD_UINT16, 1, false, co2),
+    SENSOR_FIELD("tvoc", FIELD_UINT16, 1, false, tvoc),
+    SENSOR_FIELD("tvoc_raw", FIELD_UINT16, 1, false, tvoc_raw),
+    SENSOR_FIELD("nox", FIELD_UINT16, 1, false, nox),
+    SENSOR_FIELD("nox_raw", FIELD_UINT16, 1, false, nox_raw),
+    SENSOR_FIELD("pm01", FIELD_UINT16, 10, true, pm_01),
+    SENSOR_FIELD("pm25", FIELD_UINT16, 10, true, pm_25),
+    SENSOR_FIELD("pm10", FIELD_UINT16, 10, true, pm_10),
+    SENSOR_FIELD("pm01_sp", FIELD_UINT16, 10, true, pm_01_sp),
+    SENSOR_FIELD("pm25_sp", FIELD_UINT16, 10, true, pm_25_sp),
+    SENSOR_FIELD("pm10_sp", FIELD_UINT16, 10, true, pm_10_sp),
+    SENSOR_FIELD("pm03_pc", FIELD_UINT16, 1, true, pm_03_pc),
+    SENSOR_FIELD("pm05_pc", FIELD_UINT16, 1, true, pm_05_pc),
+    SENSOR_FIELD("pm01_pc", FIELD_UINT16, 1, true, pm_01_pc),
+    SENSOR_FIELD("pm25_pc", FIELD_UINT16, 1, true, pm_25_pc),
+    SENSOR_FIELD("pm5_pc", FIELD_UINT16, 1, true, pm_5_pc),
+    SENSOR_FIELD("pm10_pc", FIELD_UINT16, 1, true, pm_10_pc),
+    SENSOR_FIELD("vbat", FIELD_UINT16, 100, false, vbat),
+    SENSOR_FIELD("vpanel", FIELD_UINT16, 100, false, vpanel),
+    SENSOR_FIELD("o3_we", FIELD_UINT32, 1000, false, o3_we),
+    SENSOR_FIELD("o3_ae", FIELD_UINT32, 1000, false, o3_ae),
+    SENSOR_FIELD("no2_we", FIELD_UINT32, 1000, false, no2_we),
+    SENSOR_FIELD("no2_ae", FIELD_UINT32, 1000, false, no2_ae),
+    SENSOR_FIELD("afe_temp", FIELD_UINT16, 10, false, afe_temp),
+    SENSOR_FIELD("signal", FIELD_INT8, 1, false, signal),
+};
+
+#undef SENSOR_FIELD
+
+int32_t findSensorField(const char *name) {
+  for (int32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    if (strcmp(kSensorFields[flag].name, name) == 0) {
+      return flag;
+    }
+  }
+  return -1;
+}
+
+uint8_t sensorFieldWidth(SensorFlag flag) {
+  switch (kSensorFields[flag].type) {
+  case FIELD_INT8:
+    return 1;
+  case FIELD_UINT32:
+    return 4;
+  default:
+    return 2;
+  }
+}
+
+int64_t getSensorFieldValue(const SensorReading &reading, SensorFlag flag,
+                            uint8_t channel) {
+  const SensorFieldInfo &info = kSensorFields[flag];
+  const uint8_t *base = (const uint8_t *)&reading + info.offset;
+
+  switch (info.type) {
+  case FIELD_INT8: {
+    int8_t value;
+    memcpy(&value, base, sizeof(value));
+    return value;
+  }
+  case FIELD_INT16: {
+    int16_t value;
+    memcpy(&value, base + channel * sizeof(value), sizeof(value));
+    return value;
+  }
+  case FIELD_UINT16: {
+    uint16_t value;
+    memcpy(&value, base + channel * sizeof(value), sizeof(value));
+    return value;
+  }
+  case FIELD_UINT32: {
+    uint32_t value;
+    memcpy(&value, base, sizeof(value));
+    return value;
+  }
+  }
+  return 0;
+}
+
+void setSensorFieldValue(SensorReading &reading, SensorFlag flag,
+                         uint8_t channel, int64_t value) {
+  const SensorFieldInfo &info = kSensorFields[flag];
+  uint8_t *base = (uint8_t *)&reading + info.offset;
+
+  switch (info.type) {
+  case FIELD_INT8: {
+    int8_t narrow = (int8_t)value;
+    memcpy(base, &narrow, sizeof(narrow));
+    break;
+  }
+  case FIELD_INT16: {
+    int16_t narrow = (int16_t)value;
+    memcpy(base + channel * sizeof(narrow), &narrow, sizeof(narrow));
+    break;
+  }
+  case FIELD_UINT16: {
+    uint16_t narrow = (uint16_t)value;
+    memcpy(base + channel * sizeof(narrow), &narrow, sizeof(narrow));
+    break;
+  }
+  case FIELD_UINT32: {
+    uint32_t narrow = (uint32_t)value;
+    memcpy(base, &narrow, sizeof(narrow));
+    break;
+  }
+  }
+}
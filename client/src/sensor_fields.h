@@ -0,0 +1,44 @@
+#ifndef SENSOR_FIELDS_H
+#define SENSOR_FIELDS_H
+
+#include "payload_types.h"
+
+// Number of sensor fields (presence mask bits 0-26)
+#define SENSOR_FIELD_COUNT (FLAG_SIGNAL + 1)
+
+// Wire type of a sensor field
+typedef enum {
+  FIELD_INT8 = 0,
+  FIELD_INT16 = 1,
+  FIELD_UINT16 = 2,
+  FIELD_UINT32 = 3
+} SensorFieldType;
+
+// Static description of one sensor field
+typedef struct {
+  const char *name;     // Matches SensorFieldNames in server/src/payload_types.js
+  SensorFieldType type; // Wire type
+  uint16_t scale;       // Divide raw value by scale for physical units
+  bool expandable;      // Two values in dual mode (unless dedicated temp/hum)
+  uint16_t offset;      // Byte offset of the field in SensorReading
+} SensorFieldInfo;
+
+// Field table indexed by SensorFlag
+extern const SensorFieldInfo kSensorFields[SENSOR_FIELD_COUNT];
+
+// Look up a field by name (as in kSensorFields)
+// Returns: SensorFlag value, or -1 if unknown
+int32_t findSensorField(const char *name);
+
+// Wire size of one value of a field in bytes
+uint8_t sensorFieldWidth(SensorFlag flag);
+
+// Read a raw field value (channel 1 only exists for expandable fields)
+int64_t getSensorFieldValue(const SensorReading &reading, SensorFlag flag,
+                            uint8_t channel);
+
+// Write a raw field value (value is truncated to the field type)
+void setSensorFieldValue(SensorReading &reading, SensorFlag flag,
+                         uint8_t channel, int64_t value);
+
+#endif // SENSOR_FIELDS_H
@@ -0,0 +1,319 @@
+#include "unity.h"
+#include "aggregator_snapshot.h"
+#include "payload_encoder.h"
+#include "payload_wal.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static const char *kSnapshotPath = "test_aggregator.snap";
+static const char *kWalPath = "test_aggregator.wal";
+
+static const uint64_t kMinute = 60000;
+static const uint64_t kBase = 1700000100000ULL - 1700000100000ULL % (60 * kMinute);
+
+typedef struct {
+    uint64_t device_id;
+    uint32_t window;
+    AggregateWindow aggregate;
+} Closed;
+
+static std::vector<Closed> closed;
+static DeviceAggregator aggregator;
+
+static void collect(uint64_t device_id, uint32_t window, const AggregateWindow &aggregate,
+                    void *user) {
+    (void)user;
+    Closed entry = {device_id, window, aggregate};
+    closed.push_back(entry);
+}
+
+static SensorReading makeReading(int16_t temp, uint16_t pm25, uint32_t o3_we) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_TEMP);
+    setFlag(&reading, FLAG_PM_25);
+    setFlag(&reading, FLAG_O3_WE);
+    reading.temp[0] = temp;
+    reading.pm_25[0] = pm25;
+    reading.o3_we = o3_we;
+    return reading;
+}
+
+void setUp(void) {
+    closed.clear();
+    TEST_ASSERT_TRUE(aggregator.init(DeviceAggregator::defaultConfig(), collect, nullptr));
+}
+
+void tearDown(void) {
+    unlink(kSnapshotPath);
+    unlink(kWalPath);
+}
+
+static bool sameWindow(const AggregateWindow *a, const AggregateWindow *b) {
+    if (a == nullptr || b == nullptr || a->start_ms != b->start_ms ||
+        a->field_mask != b->field_mask) {
+        return false;
+    }
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+        if (a->count[flag] != b->count[flag]) {
+            return false;
+        }
+        if (a->count[flag] > 0 && (a->sum[flag] != b->sum[flag] || a->min[flag] != b->min[flag] ||
+                                   a->max[flag] != b->max[flag])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t makePayload(uint32_t i, uint8_t *buffer) {
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, false, false, 1};
+    encoder.init(header);
+    for (uint32_t r = 0; r < 3; r++) {
+        encoder.addReading(makeReading((int16_t)(i * 3 + r), (uint16_t)(i + r), i * 1000 + r));
+    }
+    return (uint32_t)encoder.encode(buffer, MAX_PAYLOAD_SIZE);
+}
+
+typedef struct {
+    DeviceAggregator *target;
+    uint32_t applied;
+} ReplayState;
+
+static void replayRecord(const PayloadRecordHeader &header, const uint8_t *payload, void *user) {
+    ReplayState *state = (ReplayState *)user;
+    state->target->updatePayload(header.device_id, header.timestamp_ms, payload, header.length);
+    state->applied++;
+}
+
+// Test: Mean, min and max per field, including negative and uint32 values
+void test_aggregator_mean_min_max(void) {
+    aggregator.update(7, kBase, makeReading(-500, 100, 4000000000u));
+    aggregator.update(7, kBase + kMinute, makeReading(2500, 300, 10));
+    aggregator.update(7, kBase + 2 * kMinute, makeReading(1000, 200, 3000000000u));
+
+    const AggregateWindow *window = aggregator.find(7, 0);
+    TEST_ASSERT_NOT_NULL(window);
+    TEST_ASSERT_EQUAL_UINT64(kBase, window->start_ms);
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_O3_WE),
+                            window->field_mask);
+    TEST_ASSERT_EQUAL_UINT16(3, window->count[FLAG_TEMP]);
+    TEST_ASSERT_EQUAL_UINT16(0, window->count[FLAG_CO2]);
+
+    TEST_ASSERT_EQUAL_FLOAT(1000.0, aggregateMean(*window, FLAG_TEMP));
+    TEST_ASSERT_EQUAL_INT64(-500, aggregateMin(*window, FLAG_TEMP));
+    TEST_ASSERT_EQUAL_INT64(2500, aggregateMax(*window, FLAG_TEMP));
+    TEST_ASSERT_EQUAL_FLOAT(200.0, aggregateMean(*window, FLAG_PM_25));
+    TEST_ASSERT_EQUAL_INT64(10, aggregateMin(*window, FLAG_O3_WE));
+    TEST_ASSERT_EQUAL_INT64(4000000000LL, aggregateMax(*window, FLAG_O3_WE));
+    TEST_ASSERT_EQUAL_INT64(7000000010LL, window->sum[FLAG_O3_WE]);
+
+    TEST_ASSERT_NULL(aggregator.find(8, 0));
+    TEST_ASSERT_EQUAL(0, closed.size());
+}
+
+// Test: A reading in the next window closes the open one
+void test_aggregator_rollover_on_update(void) {
+    aggregator.update(1, kBase + kMinute, makeReading(100, 10, 1));
+    aggregator.update(1, kBase + 4 * kMinute, makeReading(300, 30, 3));
+    aggregator.update(1, kBase + 6 * kMinute, makeReading(500, 50, 5));
+
+    TEST_ASSERT_EQUAL(1, closed.size());
+    TEST_ASSERT_EQUAL_UINT64(1, closed[0].device_id);
+    TEST_ASSERT_EQUAL_UINT32(0, closed[0].window);
+    TEST_ASSERT_EQUAL_UINT64(kBase, closed[0].aggregate.start_ms);
+    TEST_ASSERT_EQUAL_FLOAT(200.0, aggregateMean(closed[0].aggregate, FLAG_TEMP));
+
+    // The 5 min window restarted, the hour window kept everything
+    TEST_ASSERT_EQUAL_UINT64(kBase + 5 * kMinute, aggregator.find(1, 0)->start_ms);
+    TEST_ASSERT_EQUAL_UINT16(1, aggregator.find(1, 0)->count[FLAG_TEMP]);
+    TEST_ASSERT_EQUAL_UINT16(3, aggregator.find(1, 1)->count[FLAG_TEMP]);
+}
+
+// Test: Readings older than the open window are dropped
+void test_aggregator_late_readings(void) {
+    aggregator.update(1, kBase + 6 * kMinute, makeReading(100, 10, 1));
+    aggregator.update(1, kBase + 2 * kMinute, makeReading(900, 90, 9));
+
+    TEST_ASSERT_EQUAL_UINT16(1, aggregator.find(1, 0)->count[FLAG_TEMP]);
+    TEST_ASSERT_EQUAL_UINT16(2, aggregator.find(1, 1)->count[FLAG_TEMP]);
+    TEST_ASSERT_EQUAL_UINT64(1, aggregator.getStats().late);
+}
+
+// Test: advance() closes expired windows a few devices at a time
+void test_aggregator_incremental_advance(void) {
+    for (uint64_t device = 0; device < 10; device++) {
+        aggregator.update(device, kBase + kMinute, makeReading(100, 10, 1));
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, aggregator.advance(kBase + 4 * kMinute, 10));
+    TEST_ASSERT_EQUAL_UINT32(4, aggregator.advance(kBase + 5 * kMinute, 4));
+    TEST_ASSERT_EQUAL_UINT32(4, aggregator.advance(kBase + 5 * kMinute, 4));
+    TEST_ASSERT_EQUAL_UINT32(2, aggregator.advance(kBase + 5 * kMinute, 4));
+    TEST_ASSERT_EQUAL_UINT32(0, aggregator.advance(kBase + 5 * kMinute, 100));
+    TEST_ASSERT_EQUAL(10, closed.size());
+
+    // A straggler for the closed window is late, not a second window
+    aggregator.update(3, kBase + 2 * kMinute, makeReading(100, 10, 1));
+    TEST_ASSERT_EQUAL_UINT64(1, aggregator.getStats().late);
+
+    aggregator.flush();
+    TEST_ASSERT_EQUAL(20, closed.size());
+    TEST_ASSERT_EQUAL_UINT32(1, closed[19].window);
+}
+
+// Test: The table grows past its presized capacity without losing devices
+void test_aggregator_table_growth(void) {
+    AggregatorConfig config = DeviceAggregator::defaultConfig();
+    config.expected_devices = 4;
+    TEST_ASSERT_TRUE(aggregator.init(config, nullptr, nullptr));
+
+    for (uint32_t i = 0; i < 20000; i++) {
+        uint64_t device = (uint64_t)i * 0x100000001ULL;
+        aggregator.update(device, kBase, makeReading((int16_t)i, (uint16_t)i, i));
+    }
+    TEST_ASSERT_EQUAL_UINT32(20000, aggregator.getDeviceCount());
+    for (uint32_t i = 0; i < 20000; i++) {
+        const AggregateWindow *window = aggregator.find((uint64_t)i * 0x100000001ULL, 1);
+        TEST_ASSERT_NOT_NULL(window);
+        TEST_ASSERT_EQUAL_INT64(i, aggregateMax(*window, FLAG_O3_WE));
+    }
+}
+
+// Test: Invalid configurations are rejected
+void test_aggregator_rejects_bad_config(void) {
+    AggregatorConfig config = DeviceAggregator::defaultConfig();
+    config.window_count = 0;
+    TEST_ASSERT_FALSE(aggregator.init(config, nullptr, nullptr));
+    config.window_count = AGGREGATE_MAX_WINDOWS + 1;
+    TEST_ASSERT_FALSE(aggregator.init(config, nullptr, nullptr));
+    config.window_count = 1;
+    config.window_ms[0] = 0;
+    TEST_ASSERT_FALSE(aggregator.init(config, nullptr, nullptr));
+}
+
+// Test: A restored snapshot matches the saved state and keeps working
+void test_aggregator_snapshot_round_trip(void) {
+    for (uint32_t i = 0; i < 500; i++) {
+        aggregator.update(i % 100, kBase + i * 1000, makeReading((int16_t)i, (uint16_t)i, i * 7));
+    }
+    TEST_ASSERT_TRUE(aggregator.saveSnapshot(kSnapshotPath, 1234));
+
+    // The state array can be mapped with 4, 16 or 64 KB pages
+    AggregatorSnapshotHeader header;
+    FILE *file = fopen(kSnapshotPath, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL_UINT32(1, (uint32_t)fread(&header, sizeof(header), 1, file));
+    fclose(file);
+    TEST_ASSERT_EQUAL_UINT32(AGGREGATOR_SNAPSHOT_VERSION, header.version);
+    TEST_ASSERT_EQUAL_UINT64(0, header.states_offset % 65536);
+
+    DeviceAggregator restored;
+    uint64_t sequence = 0;
+    TEST_ASSERT_TRUE(restored.restoreSnapshot(kSnapshotPath, &sequence));
+    TEST_ASSERT_EQUAL_UINT64(1234, sequence);
+    TEST_ASSERT_EQUAL_UINT32(100, restored.getDeviceCount());
+    for (uint64_t device = 0; device < 100; device++) {
+        TEST_ASSERT_TRUE(sameWindow(aggregator.find(device, 0), restored.find(device, 0)));
+        TEST_ASSERT_TRUE(sameWindow(aggregator.find(device, 1), restored.find(device, 1)));
+    }
+
+    // Writes go to private pages; new devices grow past the mapped region
+    for (uint64_t device = 0; device < 1000; device++) {
+        restored.update(device, kBase + 600000, makeReading(1, 2, 3));
+        aggregator.update(device, kBase + 600000, makeReading(1, 2, 3));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1000, restored.getDeviceCount());
+    for (uint64_t device = 0; device < 1000; device++) {
+        TEST_ASSERT_TRUE(sameWindow(aggregator.find(device, 0), restored.find(device, 0)));
+        TEST_ASSERT_TRUE(sameWindow(aggregator.find(device, 1), restored.find(device, 1)));
+    }
+
+    // The snapshot file itself is untouched
+    DeviceAggregator again;
+    TEST_ASSERT_TRUE(again.restoreSnapshot(kSnapshotPath, &sequence));
+    TEST_ASSERT_EQUAL_UINT32(100, again.getDeviceCount());
+}
+
+// Test: Corrupt or truncated snapshots are rejected and leave state alone
+void test_aggregator_snapshot_rejects_corruption(void) {
+    aggregator.update(42, kBase, makeReading(1, 2, 3));
+    TEST_ASSERT_TRUE(aggregator.saveSnapshot(kSnapshotPath, 1));
+
+    FILE *file = fopen(kSnapshotPath, "r+b");
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, -100, SEEK_END);
+    int byte = fgetc(file);
+    fseek(file, -100, SEEK_END);
+    fputc(byte ^ 0x01, file);
+    fclose(file);
+
+    DeviceAggregator restored;
+    TEST_ASSERT_TRUE(restored.init(DeviceAggregator::defaultConfig(), nullptr, nullptr));
+    restored.update(7, kBase, makeReading(1, 2, 3));
+    uint64_t sequence = 99;
+    TEST_ASSERT_FALSE(restored.restoreSnapshot(kSnapshotPath, &sequence));
+    TEST_ASSERT_EQUAL_UINT64(99, sequence);
+    TEST_ASSERT_NOT_NULL(restored.find(7, 0));
+    TEST_ASSERT_NULL(restored.find(42, 0));
+
+    TEST_ASSERT_TRUE(aggregator.saveSnapshot(kSnapshotPath, 1));
+    TEST_ASSERT_EQUAL_INT(0, truncate(kSnapshotPath, 4000));
+    TEST_ASSERT_FALSE(restored.restoreSnapshot(kSnapshotPath, &sequence));
+    TEST_ASSERT_FALSE(restored.restoreSnapshot("missing.snap", &sequence));
+}
+
+// Test: Snapshot + WAL tail replay gives the same state as a full replay
+void test_aggregator_snapshot_plus_wal_tail(void) {
+    WalConfig config = WriteAheadLog::defaultConfig();
+    config.sync = false;
+    config.group_window_us = 0; // Single appender: nothing to group
+    WriteAheadLog wal;
+    unlink(kWalPath);
+    TEST_ASSERT_TRUE(wal.open(kWalPath, config));
+
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    uint64_t snapshot_sequence = 0;
+    for (uint32_t i = 0; i < 300; i++) {
+        uint32_t length = makePayload(i, payload);
+        uint64_t sequence = wal.append(i % 37, kBase + i * 20000, payload, length);
+        TEST_ASSERT_TRUE(sequence > 0);
+        aggregator.updatePayload(i % 37, kBase + i * 20000, payload, length);
+        if (i == 199) {
+            snapshot_sequence = sequence;
+            TEST_ASSERT_TRUE(aggregator.saveSnapshot(kSnapshotPath, sequence));
+        }
+    }
+    wal.close();
+
+    DeviceAggregator restarted;
+    uint64_t sequence;
+    TEST_ASSERT_TRUE(restarted.restoreSnapshot(kSnapshotPath, &sequence));
+    TEST_ASSERT_EQUAL_UINT64(snapshot_sequence, sequence);
+    ReplayState state = {&restarted, 0};
+    TEST_ASSERT_EQUAL_INT64(100, WriteAheadLog::replay(kWalPath, sequence + 1, replayRecord, &state));
+
+    for (uint64_t device = 0; device < 37; device++) {
+        TEST_ASSERT_TRUE(sameWindow(aggregator.find(device, 0), restarted.find(device, 0)));
+        TEST_ASSERT_TRUE(sameWindow(aggregator.find(device, 1), restarted.find(device, 1)));
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_aggregator_mean_min_max);
+    RUN_TEST(test_aggregator_rollover_on_update);
+    RUN_TEST(test_aggregator_late_readings);
+    RUN_TEST(test_aggregator_incremental_advance);
+    RUN_TEST(test_aggregator_table_growth);
+    RUN_TEST(test_aggregator_rejects_bad_config);
+    RUN_TEST(test_aggregator_snapshot_round_trip);
+    RUN_TEST(test_aggregator_snapshot_rejects_corruption);
+    RUN_TEST(test_aggregator_snapshot_plus_wal_tail);
+
+    return UNITY_END();
+}
@@ -0,0 +1,243 @@
+#include "unity.h"
+#include "archive_compactor.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *kInputA = "test_archive_a.seg";
+static const char *kInputB = "test_archive_b.seg";
+static const char *kOutputPrefix = "test_archive_out";
+static const uint32_t kDevices = 50;
+static const uint32_t kRecordsPerInput = 2000;
+
+static std::vector<std::string> outputs;
+
+// Payload bytes derived from the key so records can be checked after sorting
+static uint32_t makePayload(uint64_t device_id, uint64_t timestamp_ms, uint8_t *payload) {
+    uint32_t length = 8 + (uint32_t)(device_id % 40);
+    for (uint32_t i = 0; i < length; i++) {
+        payload[i] = (uint8_t)(device_id * 31 + timestamp_ms + i);
+    }
+    return length;
+}
+
+// Arrival order: devices interleaved, time increasing
+static void writeInput(const char *path, uint64_t first_sequence) {
+    ArchiveWriter writer;
+    TEST_ASSERT_TRUE(writer.open(path));
+    uint8_t payload[64];
+    for (uint32_t i = 0; i < kRecordsPerInput; i++) {
+        uint64_t sequence = first_sequence + i;
+        PayloadRecordHeader header;
+        header.sequence = sequence;
+        header.device_id = (sequence * 7919) % kDevices;
+        header.timestamp_ms = 1700000000000ULL + sequence * 1000;
+        header.length = makePayload(header.device_id, header.timestamp_ms, payload);
+        TEST_ASSERT_TRUE(writer.write(header, payload));
+    }
+    TEST_ASSERT_TRUE(writer.close());
+}
+
+void setUp(void) {
+    writeInput(kInputA, 0);
+    writeInput(kInputB, kRecordsPerInput);
+    outputs.clear();
+}
+
+void tearDown(void) {
+    unlink(kInputA);
+    unlink(kInputB);
+    for (size_t i = 0; i < outputs.size(); i++) {
+        unlink(outputs[i].c_str());
+        unlink((outputs[i] + ".idx").c_str());
+    }
+}
+
+// Test: Records read back in order with their offsets
+void test_archive_round_trip(void) {
+    ArchiveReader reader;
+    TEST_ASSERT_TRUE(reader.open(kInputA));
+
+    PayloadRecordHeader header;
+    const uint8_t *payload;
+    uint32_t size;
+    uint64_t offset = 0;
+    uint32_t count = 0;
+    while (reader.next(&header, &payload, nullptr, &size) == 1) {
+        TEST_ASSERT_EQUAL_UINT64(count, header.sequence);
+        TEST_ASSERT_EQUAL_UINT64(offset, reader.getRecordOffset());
+        uint8_t expected[64];
+        TEST_ASSERT_EQUAL_UINT32(makePayload(header.device_id, header.timestamp_ms, expected),
+                                 header.length);
+        TEST_ASSERT_EQUAL_MEMORY(expected, payload, header.length);
+        offset += size;
+        count++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(kRecordsPerInput, count);
+    TEST_ASSERT_EQUAL_UINT64(0, reader.getSkippedBytes());
+}
+
+// Test: Ranges split at arbitrary offsets deliver each record exactly once
+void test_archive_ranges_partition_records(void) {
+    struct stat st;
+    TEST_ASSERT_EQUAL_INT(0, stat(kInputA, &st));
+    uint64_t size = (uint64_t)st.st_size;
+    const uint64_t cuts[] = {0, 1, 777, size / 3, size / 2 + 13, size};
+
+    uint64_t expected_sequence = 0;
+    for (size_t c = 0; c + 1 < sizeof(cuts) / sizeof(cuts[0]); c++) {
+        ArchiveReader reader;
+        TEST_ASSERT_TRUE(reader.openRange(kInputA, cuts[c], cuts[c + 1], 4096));
+        PayloadRecordHeader header;
+        const uint8_t *payload;
+        while (reader.next(&header, &payload) == 1) {
+            TEST_ASSERT_EQUAL_UINT64(expected_sequence, header.sequence);
+            TEST_ASSERT_TRUE(reader.getRecordOffset() >= cuts[c]);
+            TEST_ASSERT_TRUE(reader.getRecordOffset() < cuts[c + 1]);
+            expected_sequence++;
+        }
+        TEST_ASSERT_EQUAL_UINT64(0, reader.getSkippedBytes());
+    }
+    TEST_ASSERT_EQUAL_UINT64(kRecordsPerInput, expected_sequence);
+}
+
+// Test: A corrupt record is skipped and reading resumes at the next one
+void test_archive_skips_corruption(void) {
+    ArchiveReader reader;
+    TEST_ASSERT_TRUE(reader.open(kInputA));
+    PayloadRecordHeader header;
+    const uint8_t *payload;
+    uint32_t size;
+    TEST_ASSERT_EQUAL_INT32(1, reader.next(&header, &payload, nullptr, &size));
+    reader.close();
+
+    // Flip a payload byte of the second record
+    FILE *file = fopen(kInputA, "r+b");
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, size + PAYLOAD_RECORD_HEADER_SIZE + 2, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, size + PAYLOAD_RECORD_HEADER_SIZE + 2, SEEK_SET);
+    fputc(byte ^ 0xFF, file);
+    fclose(file);
+
+    TEST_ASSERT_TRUE(reader.open(kInputA));
+    uint32_t count = 0;
+    while (reader.next(&header, &payload) == 1) {
+        TEST_ASSERT_TRUE(header.sequence != 1);
+        count++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(kRecordsPerInput - 1, count);
+    TEST_ASSERT_TRUE(reader.getSkippedBytes() > 0);
+}
+
+// Test: Compaction with a tiny budget (many runs, several merge passes)
+// sorts every record by device and time and indexes each device
+void test_archive_compaction(void) {
+    std::vector<std::string> inputs;
+    inputs.push_back(kInputA);
+    inputs.push_back(kInputB);
+
+    CompactionConfig config = defaultCompactionConfig();
+    config.memory_budget = 32 << 10;
+    config.threads = 2;
+    config.merge_fan_in = 3;
+    config.output_segment_bytes = 64 << 10;
+    config.temp_dir = ".";
+
+    CompactionStats stats;
+    TEST_ASSERT_TRUE(compactArchive(inputs, kOutputPrefix, config, &stats, &outputs));
+    TEST_ASSERT_EQUAL_UINT64(2 * kRecordsPerInput, stats.input_records);
+    TEST_ASSERT_EQUAL_UINT64(kDevices, stats.devices);
+    TEST_ASSERT_TRUE(stats.runs > 3);
+    TEST_ASSERT_TRUE(stats.merge_passes > 1);
+    TEST_ASSERT_TRUE(outputs.size() > 1);
+    TEST_ASSERT_EQUAL_UINT64(outputs.size(), stats.output_segments);
+
+    uint64_t total = 0;
+    uint64_t last_device = 0;
+    uint64_t last_timestamp = 0;
+    std::vector<bool> seen(2 * kRecordsPerInput, false);
+    for (size_t s = 0; s < outputs.size(); s++) {
+        std::vector<ArchiveIndexEntry> index;
+        TEST_ASSERT_TRUE(readArchiveIndex((outputs[s] + ".idx").c_str(), &index));
+
+        ArchiveReader reader;
+        TEST_ASSERT_TRUE(reader.open(outputs[s].c_str()));
+        PayloadRecordHeader header;
+        const uint8_t *payload;
+        bool first_in_segment = true;
+        while (reader.next(&header, &payload) == 1) {
+            TEST_ASSERT_TRUE(total == 0 || header.device_id > last_device ||
+                             (header.device_id == last_device &&
+                              header.timestamp_ms > last_timestamp));
+            // Devices never straddle segments
+            if (first_in_segment && s > 0) {
+                TEST_ASSERT_TRUE(header.device_id > last_device);
+            }
+            first_in_segment = false;
+
+            const ArchiveIndexEntry *entry = findArchiveIndexEntry(index, header.device_id);
+            TEST_ASSERT_NOT_NULL(entry);
+            TEST_ASSERT_TRUE(reader.getRecordOffset() >= entry->offset);
+            TEST_ASSERT_TRUE(reader.getRecordOffset() < entry->offset + entry->bytes);
+            TEST_ASSERT_TRUE(header.timestamp_ms >= entry->first_timestamp_ms);
+            TEST_ASSERT_TRUE(header.timestamp_ms <= entry->last_timestamp_ms);
+
+            uint8_t expected[64];
+            makePayload(header.device_id, header.timestamp_ms, expected);
+            TEST_ASSERT_EQUAL_MEMORY(expected, payload, header.length);
+
+            TEST_ASSERT_FALSE(seen[header.sequence]);
+            seen[header.sequence] = true;
+            last_device = header.device_id;
+            last_timestamp = header.timestamp_ms;
+            total++;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT64(2 * kRecordsPerInput, total);
+}
+
+// Test: An index range reads exactly one device's history
+void test_archive_index_range_scan(void) {
+    std::vector<std::string> inputs;
+    inputs.push_back(kInputA);
+
+    CompactionConfig config = defaultCompactionConfig();
+    config.memory_budget = 1 << 20;
+    config.threads = 1;
+    TEST_ASSERT_TRUE(compactArchive(inputs, kOutputPrefix, config, nullptr, &outputs));
+    TEST_ASSERT_EQUAL_UINT32(1, outputs.size());
+
+    std::vector<ArchiveIndexEntry> index;
+    TEST_ASSERT_TRUE(readArchiveIndex((outputs[0] + ".idx").c_str(), &index));
+    TEST_ASSERT_EQUAL_UINT32(kDevices, index.size());
+    TEST_ASSERT_NULL(findArchiveIndexEntry(index, kDevices));
+
+    const ArchiveIndexEntry *entry = findArchiveIndexEntry(index, 17);
+    TEST_ASSERT_NOT_NULL(entry);
+    ArchiveReader reader;
+    TEST_ASSERT_TRUE(reader.openRange(outputs[0].c_str(), entry->offset,
+                                      entry->offset + entry->bytes));
+    PayloadRecordHeader header;
+    const uint8_t *payload;
+    uint32_t count = 0;
+    while (reader.next(&header, &payload) == 1) {
+        TEST_ASSERT_EQUAL_UINT64(17, header.device_id);
+        count++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(entry->record_count, count);
+    TEST_ASSERT_EQUAL_UINT32(kRecordsPerInput / kDevices, count);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_archive_round_trip);
+    RUN_TEST(test_archive_ranges_partition_records);
+    RUN_TEST(test_archive_skips_corruption);
+    RUN_TEST(test_archive_compaction);
+    RUN_TEST(test_archive_index_range_scan);
+
+    return UNITY_END();
+}
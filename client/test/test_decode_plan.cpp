@@ -0,0 +1,176 @@
+#include "unity.h"
+#include "decode_plan.h"
+#include "payload_decoder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#define ALL_FIELDS 0x07FFFFFFu
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+static PayloadHeader makeHeader(bool dual, bool dedicated) {
+    PayloadHeader header = {1, dual, dedicated, 5};
+    return header;
+}
+
+// Test: Evenly spaced fields are merged into runs
+void test_plan_merges_runs(void) {
+    DecodePlan plan;
+
+    // Dual mode: both channels of all PM fields are one contiguous run
+    compileDecodePlan(ALL_FIELDS, makeHeader(true, false), plan);
+    TEST_ASSERT_EQUAL_UINT32(MAX_READING_SIZE - 4, plan.data_size);
+    TEST_ASSERT_EQUAL_UINT32(7, plan.op_count);
+    TEST_ASSERT_EQUAL_UINT8(FLAG_TEMP, plan.ops[0].flag);
+    TEST_ASSERT_EQUAL_UINT8(4, plan.ops[0].count);  // temp[0..1], hum[0..1]
+    TEST_ASSERT_EQUAL_UINT8(FLAG_CO2, plan.ops[1].flag);
+    TEST_ASSERT_EQUAL_UINT8(5, plan.ops[1].count);  // co2 .. nox_raw
+    TEST_ASSERT_EQUAL_UINT8(FLAG_PM_01, plan.ops[2].flag);
+    TEST_ASSERT_EQUAL_UINT8(24, plan.ops[2].count);
+    TEST_ASSERT_EQUAL_UINT8(2, plan.ops[2].stride);
+    TEST_ASSERT_EQUAL_UINT8(FLAG_O3_WE, plan.ops[4].flag);
+    TEST_ASSERT_EQUAL_UINT8(4, plan.ops[4].width);
+    TEST_ASSERT_EQUAL_UINT8(4, plan.ops[4].count);
+
+    // Single mode: channel 0 of each PM field, one array apart
+    compileDecodePlan(ALL_FIELDS, makeHeader(false, false), plan);
+    TEST_ASSERT_EQUAL_UINT32(7, plan.op_count);
+    TEST_ASSERT_EQUAL_UINT8(12, plan.ops[2].count);
+    TEST_ASSERT_EQUAL_UINT8(4, plan.ops[2].stride);
+
+    // Gaps in the mask split runs
+    uint32_t mask = FLAG_BIT(FLAG_PM_01) | FLAG_BIT(FLAG_PM_10) | FLAG_BIT(FLAG_SIGNAL);
+    compileDecodePlan(mask, makeHeader(false, false), plan);
+    TEST_ASSERT_EQUAL_UINT32(5, plan.data_size);
+    TEST_ASSERT_EQUAL_UINT32(2, plan.op_count);  // pm01 + pm10 evenly spaced, signal
+    TEST_ASSERT_EQUAL_UINT8(8, plan.ops[0].stride);
+}
+
+// Test: Plans decode exactly like the field-by-field decoder
+void test_plan_matches_field_decoder(void) {
+    DecodePlanCache cache;
+    PayloadDecoder by_field;
+    PayloadDecoder by_plan;
+    by_plan.setPlanCache(&cache);
+
+    srand(33);
+    uint8_t buffer[4 + MAX_READING_SIZE];
+    for (int iteration = 0; iteration < 3000; iteration++) {
+        uint8_t metadata = (uint8_t)(1 | ((iteration % 3) == 1 ? 0x08 : 0) |
+                                     ((iteration % 3) == 2 ? 0x18 : 0));
+        by_field.decodeMetadata(metadata);
+        by_plan.decodeMetadata(metadata);
+
+        // Undefined bits 27-31 are kept in the mask but carry no data
+        uint32_t mask = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        if (iteration % 4 == 0)
+            mask |= ALL_FIELDS;
+        memcpy(buffer, &mask, 4);
+        for (size_t i = 4; i < sizeof(buffer); i++)
+            buffer[i] = (uint8_t)rand();
+
+        SensorReading expected;
+        SensorReading actual;
+        int32_t size = by_field.decodeReading(buffer, sizeof(buffer), expected);
+        TEST_ASSERT_TRUE(size >= 4);
+        TEST_ASSERT_EQUAL_INT32(size, by_plan.decodeReading(buffer, sizeof(buffer), actual));
+        TEST_ASSERT_EQUAL_MEMORY(&expected, &actual, sizeof(SensorReading));
+
+        // Truncated anywhere: both fail
+        uint32_t cut = (uint32_t)(rand() % size);
+        TEST_ASSERT_EQUAL_INT32(-1, by_field.decodeReading(buffer, cut, expected));
+        TEST_ASSERT_EQUAL_INT32(-1, by_plan.decodeReading(buffer, cut, actual));
+    }
+    TEST_ASSERT_TRUE(cache.hits() > 0);
+}
+
+// Test: Hit/miss counters, shared keys and a full cache
+void test_cache_counts_and_capacity(void) {
+    DecodePlanCache cache(2);
+    PayloadHeader single = makeHeader(false, false);
+    uint32_t mask = FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_CO2);
+
+    const DecodePlan *plan = cache.find(mask, single);
+    TEST_ASSERT_NOT_NULL(plan);
+    TEST_ASSERT_EQUAL_UINT64(0, cache.hits());
+    TEST_ASSERT_EQUAL_UINT64(1, cache.misses());
+
+    // Undefined mask bits and the dedicated flag outside dual mode do not
+    // change the layout
+    TEST_ASSERT_TRUE(plan == cache.find(mask | 0x80000000u, single));
+    TEST_ASSERT_TRUE(plan == cache.find(mask, makeHeader(false, true)));
+    TEST_ASSERT_EQUAL_UINT64(2, cache.hits());
+
+    // Dual mode is a different plan
+    const DecodePlan *dual = cache.find(mask, makeHeader(true, false));
+    TEST_ASSERT_NOT_NULL(dual);
+    TEST_ASSERT_TRUE(plan != dual);
+    TEST_ASSERT_EQUAL_UINT32(2, cache.size());
+
+    // Full: no plan, the decoder falls back to the field walk
+    TEST_ASSERT_NULL(cache.find(mask, makeHeader(true, true)));
+    TEST_ASSERT_EQUAL_UINT32(2, cache.size());
+    TEST_ASSERT_EQUAL_UINT64(3, cache.misses());
+
+    PayloadDecoder decoder;
+    decoder.setPlanCache(&cache);
+    uint8_t payload[] = {0x19, 0x05, 0x05, 0x00, 0x00, 0x00,
+                         0xF6, 0x09,   // temp 2550
+                         0x9C, 0x01};  // co2 412
+    TEST_ASSERT_EQUAL_INT32(1, decoder.decode(payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_INT16(2550, decoder.getReading(0).temp[0]);
+    TEST_ASSERT_EQUAL_UINT16(412, decoder.getReading(0).co2);
+}
+
+// Test: Threads looking up the same masks share one plan per mask
+void test_cache_concurrent_readers(void) {
+    const int kThreads = 4;
+    const int kMasks = 64;
+    const int kRounds = 500;
+    DecodePlanCache cache;
+    PayloadHeader header = makeHeader(true, false);
+    const DecodePlan *seen[kThreads][kMasks];
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.push_back(std::thread([&cache, &seen, &header, t, kMasks, kRounds]() {
+            for (int round = 0; round < kRounds; round++) {
+                for (int m = 0; m < kMasks; m++) {
+                    int index = (m + t * 7) % kMasks;
+                    seen[t][index] = cache.find(0x100u * (index + 1) + 5, header);
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    TEST_ASSERT_EQUAL_UINT32(kMasks, cache.size());
+    TEST_ASSERT_EQUAL_UINT64((uint64_t)kThreads * kMasks * kRounds,
+                             cache.hits() + cache.misses());
+    for (int m = 0; m < kMasks; m++) {
+        TEST_ASSERT_NOT_NULL(seen[0][m]);
+        TEST_ASSERT_EQUAL_UINT32(0x100u * (m + 1) + 5, seen[0][m]->key & ALL_FIELDS);
+        for (int t = 1; t < kThreads; t++)
+            TEST_ASSERT_TRUE(seen[t][m] == seen[0][m]);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_plan_merges_runs);
+    RUN_TEST(test_plan_matches_field_decoder);
+    RUN_TEST(test_cache_counts_and_capacity);
+    RUN_TEST(test_cache_concurrent_readers);
+
+    return UNITY_END();
+}
@@ -0,0 +1,219 @@
+#include "unity.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+#include <string.h>
+
+PayloadEncoder encoder;
+PayloadDecoder decoder;
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+static SensorReading makeFullReading(void) {
+    SensorReading reading;
+    memset(&reading, 0, sizeof(reading));
+    reading.presence_mask = 0x07FFFFFF;  // All 27 flags
+
+    reading.temp[0] = -1250;
+    reading.temp[1] = 2600;
+    reading.hum[0] = 5000;
+    reading.hum[1] = 5100;
+    reading.co2 = 412;
+    reading.tvoc = 100;
+    reading.tvoc_raw = 30000;
+    reading.nox = 1;
+    reading.nox_raw = 17000;
+    reading.pm_01[0] = 10;
+    reading.pm_01[1] = 11;
+    reading.pm_25[0] = 25;
+    reading.pm_25[1] = 26;
+    reading.pm_10[0] = 50;
+    reading.pm_10[1] = 51;
+    reading.pm_01_sp[0] = 12;
+    reading.pm_01_sp[1] = 13;
+    reading.pm_25_sp[0] = 27;
+    reading.pm_25_sp[1] = 28;
+    reading.pm_10_sp[0] = 52;
+    reading.pm_10_sp[1] = 53;
+    reading.pm_03_pc[0] = 1000;
+    reading.pm_03_pc[1] = 1001;
+    reading.pm_05_pc[0] = 2000;
+    reading.pm_05_pc[1] = 2001;
+    reading.pm_01_pc[0] = 3000;
+    reading.pm_01_pc[1] = 3001;
+    reading.pm_25_pc[0] = 4000;
+    reading.pm_25_pc[1] = 4001;
+    reading.pm_5_pc[0] = 5000;
+    reading.pm_5_pc[1] = 5001;
+    reading.pm_10_pc[0] = 6000;
+    reading.pm_10_pc[1] = 6001;
+    reading.vbat = 3700;
+    reading.vpanel = 5000;
+    reading.o3_we = 0xFFFFFFF0;
+    reading.o3_ae = 2000;
+    reading.no2_we = 3000;
+    reading.no2_ae = 4000;
+    reading.afe_temp = 250;
+    reading.signal = -85;
+    return reading;
+}
+
+// Test: Decode simple single channel payload
+void test_decode_single_channel(void) {
+    PayloadHeader header = {1, false, false, 5};
+    encoder.init(header);
+
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_TEMP);
+    setFlag(&reading, FLAG_CO2);
+    reading.temp[0] = 2550;
+    reading.co2 = 412;
+    encoder.addReading(reading);
+
+    uint8_t buffer[256];
+    int32_t size = encoder.encode(buffer, sizeof(buffer));
+
+    TEST_ASSERT_EQUAL_INT32(1, decoder.decode(buffer, size));
+    TEST_ASSERT_EQUAL_UINT8(1, decoder.getHeader().version);
+    TEST_ASSERT_FALSE(decoder.getHeader().dual_mode);
+    TEST_ASSERT_EQUAL_UINT8(5, decoder.getHeader().interval_minutes);
+
+    const SensorReading &decoded = decoder.getReading(0);
+    TEST_ASSERT_EQUAL_UINT32(0x00000005, decoded.presence_mask);
+    TEST_ASSERT_EQUAL_INT32(2550, decoded.temp[0]);
+    TEST_ASSERT_EQUAL_INT32(412, decoded.co2);
+}
+
+// Test: All fields round trip in single and dual mode
+void test_decode_all_fields_round_trip(void) {
+    SensorReading reading = makeFullReading();
+
+    for (int dual = 0; dual <= 1; dual++) {
+        PayloadHeader header = {1, dual == 1, false, 5};
+        encoder.init(header);
+        encoder.addReading(reading);
+
+        uint8_t buffer[MAX_PAYLOAD_SIZE];
+        int32_t size = encoder.encode(buffer, sizeof(buffer));
+        TEST_ASSERT_EQUAL_INT32(dual ? 2 + MAX_READING_SIZE : 67, size);
+        TEST_ASSERT_EQUAL_INT32(1, decoder.decode(buffer, size));
+
+        SensorReading expected = reading;
+        if (!dual) {
+            // Second channel is not on the wire in single mode
+            expected.temp[1] = 0;
+            expected.hum[1] = 0;
+            expected.pm_01[1] = 0;
+            expected.pm_25[1] = 0;
+            expected.pm_10[1] = 0;
+            expected.pm_01_sp[1] = 0;
+            expected.pm_25_sp[1] = 0;
+            expected.pm_10_sp[1] = 0;
+            expected.pm_03_pc[1] = 0;
+            expected.pm_05_pc[1] = 0;
+            expected.pm_01_pc[1] = 0;
+            expected.pm_25_pc[1] = 0;
+            expected.pm_5_pc[1] = 0;
+            expected.pm_10_pc[1] = 0;
+        }
+        TEST_ASSERT_EQUAL_MEMORY(&expected, &decoder.getReading(0),
+                                 sizeof(SensorReading));
+    }
+}
+
+// Test: Dedicated temp/hum sensor reads a single temp/hum value in dual mode
+void test_decode_dual_dedicated_temphum(void) {
+    // RFC example: metadata 0x19, mask 0x107
+    uint8_t buffer[] = {0x19, 0x05, 0x07, 0x01, 0x00, 0x00,
+                        0xF6, 0x09,              // temp 2550
+                        0x88, 0x13,              // hum 5000
+                        0x9C, 0x01,              // co2 412
+                        0x19, 0x00, 0x1A, 0x00}; // pm25 25, 26
+
+    TEST_ASSERT_EQUAL_INT32(1, decoder.decode(buffer, sizeof(buffer)));
+    TEST_ASSERT_TRUE(decoder.getHeader().dual_mode);
+    TEST_ASSERT_TRUE(decoder.getHeader().dedicated_temphum_sensor);
+
+    const SensorReading &decoded = decoder.getReading(0);
+    TEST_ASSERT_EQUAL_INT32(2550, decoded.temp[0]);
+    TEST_ASSERT_EQUAL_INT32(0, decoded.temp[1]);
+    TEST_ASSERT_EQUAL_INT32(5000, decoded.hum[0]);
+    TEST_ASSERT_EQUAL_INT32(412, decoded.co2);
+    TEST_ASSERT_EQUAL_INT32(25, decoded.pm_25[0]);
+    TEST_ASSERT_EQUAL_INT32(26, decoded.pm_25[1]);
+}
+
+// Test: Full batch decodes every reading
+void test_decode_full_batch(void) {
+    PayloadHeader header = {1, true, false, 1};
+    encoder.init(header);
+
+    for (int i = 0; i < MAX_BATCH_SIZE; i++) {
+        SensorReading reading = makeFullReading();
+        reading.co2 = 400 + i;
+        reading.presence_mask &= ~(uint32_t)(i & 0x3);  // Vary the masks
+        encoder.addReading(reading);
+    }
+
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    int32_t size = encoder.encode(buffer, sizeof(buffer));
+    TEST_ASSERT_GREATER_THAN(0, size);
+
+    TEST_ASSERT_EQUAL_INT32(MAX_BATCH_SIZE, decoder.decode(buffer, size));
+    for (int i = 0; i < MAX_BATCH_SIZE; i++) {
+        TEST_ASSERT_EQUAL_UINT32(0x07FFFFFF & ~(uint32_t)(i & 0x3),
+                                 decoder.getReading(i).presence_mask);
+        TEST_ASSERT_EQUAL_INT32(400 + i, decoder.getReading(i).co2);
+    }
+}
+
+// Test: Malformed payloads are rejected
+void test_decode_malformed(void) {
+    uint8_t header_only[] = {0x01};
+    TEST_ASSERT_EQUAL_INT32(-1, decoder.decode(header_only, sizeof(header_only)));
+    TEST_ASSERT_EQUAL_INT32(-1, decoder.decode(nullptr, 10));
+
+    // Truncated presence mask
+    uint8_t short_mask[] = {0x01, 0x05, 0x04, 0x00};
+    TEST_ASSERT_EQUAL_INT32(-1, decoder.decode(short_mask, sizeof(short_mask)));
+
+    // CO2 bit set but only one data byte
+    uint8_t short_data[] = {0x01, 0x05, 0x04, 0x00, 0x00, 0x00, 0x90};
+    TEST_ASSERT_EQUAL_INT32(-1, decoder.decode(short_data, sizeof(short_data)));
+
+    // Header with no readings is valid and empty
+    uint8_t empty[] = {0x01, 0x05};
+    TEST_ASSERT_EQUAL_INT32(0, decoder.decode(empty, sizeof(empty)));
+}
+
+// Test: More readings than MAX_BATCH_SIZE are rejected
+void test_decode_too_many_readings(void) {
+    uint8_t buffer[2 + (MAX_BATCH_SIZE + 1) * 4];
+    memset(buffer, 0, sizeof(buffer));
+    buffer[0] = 0x01;
+    buffer[1] = 0x05;
+
+    // Empty-mask readings are 4 bytes each
+    TEST_ASSERT_EQUAL_INT32(-1, decoder.decode(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_INT32(MAX_BATCH_SIZE,
+                            decoder.decode(buffer, sizeof(buffer) - 4));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_decode_single_channel);
+    RUN_TEST(test_decode_all_fields_round_trip);
+    RUN_TEST(test_decode_dual_dedicated_temphum);
+    RUN_TEST(test_decode_full_batch);
+    RUN_TEST(test_decode_malformed);
+    RUN_TEST(test_decode_too_many_readings);
+
+    return UNITY_END();
+}
@@ -0,0 +1,146 @@
+#include "unity.h"
+#include "payload_dedup.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+static DuplicateFilterConfig smallConfig(double rate) {
+    DuplicateFilterConfig config = DuplicateFilter::defaultConfig();
+    config.keys_per_bucket = 100000;
+    config.false_positive_rate = rate;
+    config.bucket_ms = 1000;
+    config.buckets = 4;
+    return config;
+}
+
+// Test: A repeated payload is a duplicate; other bytes or devices are not
+void test_duplicate_payloads(void) {
+    DuplicateFilter filter;
+    TEST_ASSERT_TRUE(filter.init(smallConfig(1e-6)));
+
+    uint8_t payload[40];
+    for (uint32_t i = 0; i < sizeof(payload); i++)
+        payload[i] = (uint8_t)(i * 7);
+    TEST_ASSERT_FALSE(filter.checkAndInsert(1, payload, sizeof(payload), 5000));
+    TEST_ASSERT_TRUE(filter.checkAndInsert(1, payload, sizeof(payload), 5100));
+    TEST_ASSERT_TRUE(filter.checkAndInsert(1, payload, sizeof(payload), 5200));
+    TEST_ASSERT_FALSE(filter.checkAndInsert(2, payload, sizeof(payload), 5200));
+    TEST_ASSERT_FALSE(filter.checkAndInsert(1, payload, sizeof(payload) - 1, 5200));
+    payload[39] ^= 1;
+    TEST_ASSERT_FALSE(filter.checkAndInsert(1, payload, sizeof(payload), 5200));
+
+    DuplicateFilterStats stats = filter.getStats();
+    TEST_ASSERT_EQUAL_UINT64(6, stats.lookups);
+    TEST_ASSERT_EQUAL_UINT64(2, stats.duplicates);
+}
+
+// Test: Keys are remembered for buckets - 1 bucket widths, then forgotten
+void test_rotation(void) {
+    DuplicateFilter filter;
+    TEST_ASSERT_TRUE(filter.init(smallConfig(1e-6)));
+
+    TEST_ASSERT_FALSE(filter.checkAndInsert(42, 10500));  // Bucket 10
+    TEST_ASSERT_FALSE(filter.checkAndInsert(43, 11000));  // Bucket 11
+    TEST_ASSERT_TRUE(filter.checkAndInsert(42, 13999));   // Bucket 13: 10 still live
+    TEST_ASSERT_FALSE(filter.checkAndInsert(42, 14000));  // Bucket 14: 10 cleared
+    TEST_ASSERT_TRUE(filter.checkAndInsert(43, 14000));
+    // Late timestamps still see the newest buckets
+    TEST_ASSERT_TRUE(filter.checkAndInsert(42, 9000));
+
+    // A jump past the whole window forgets everything
+    TEST_ASSERT_FALSE(filter.checkAndInsert(42, 100000));
+    TEST_ASSERT_FALSE(filter.checkAndInsert(43, 100000));
+}
+
+// Test: Measured false positive rate is near the configured and estimated one
+void test_false_positive_rate(void) {
+    DuplicateFilter filter;
+    DuplicateFilterConfig config = smallConfig(0.01);
+    TEST_ASSERT_TRUE(filter.init(config));
+
+    // Every bucket at capacity
+    for (uint32_t b = 0; b < config.buckets; b++) {
+        for (uint64_t i = 0; i < config.keys_per_bucket; i++)
+            filter.checkAndInsert(((uint64_t)b << 40) | i, b * 1000ull);
+    }
+    DuplicateFilterStats stats = filter.getStats();
+    uint64_t inserted_duplicates = stats.duplicates;
+    TEST_ASSERT_TRUE(stats.expected_fp_rate <= config.false_positive_rate);
+    TEST_ASSERT_TRUE(stats.estimated_fp_rate > 0.5 * stats.expected_fp_rate);
+    TEST_ASSERT_TRUE(stats.estimated_fp_rate < 1.5 * stats.expected_fp_rate);
+
+    uint32_t probes = 200000;
+    uint64_t false_positives = 0;
+    for (uint32_t i = 0; i < probes; i++)
+        false_positives += filter.contains((1ull << 50) | i) ? 1 : 0;
+    double measured = (double)false_positives / probes;
+    TEST_ASSERT_TRUE(measured < 1.5 * config.false_positive_rate);
+    TEST_ASSERT_TRUE(measured > 0.3 * stats.expected_fp_rate);
+    // Inserts themselves see false positives at most at the same rate
+    TEST_ASSERT_TRUE(inserted_duplicates < config.false_positive_rate *
+                                               config.keys_per_bucket * config.buckets);
+    TEST_ASSERT_EQUAL_UINT64(
+        (config.keys_per_bucket * stats.bits_per_key + 63) / 64 * 8 * config.buckets,
+        stats.memory_bytes);
+}
+
+// Test: Of threads inserting the same keys at once, exactly one sees each as new
+void test_concurrent_inserts(void) {
+    DuplicateFilter filter;
+    TEST_ASSERT_TRUE(filter.init(smallConfig(1e-7)));
+    const uint32_t key_count = 20000;
+    const uint32_t thread_count = 4;
+    std::atomic<uint32_t> fresh(0);
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&filter, &fresh, t]() {
+            for (uint32_t i = 0; i < key_count; i++) {
+                uint64_t key = (i + t * 5000) % key_count;
+                if (!filter.checkAndInsert(key, 500))
+                    fresh.fetch_add(1);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    TEST_ASSERT_EQUAL_UINT32(key_count, fresh.load());
+    TEST_ASSERT_EQUAL_UINT64(key_count * (thread_count - 1), filter.getStats().duplicates);
+}
+
+// Test: Invalid configurations are rejected
+void test_invalid_config(void) {
+    DuplicateFilter filter;
+    DuplicateFilterConfig config = smallConfig(0.01);
+    config.buckets = 1;
+    TEST_ASSERT_FALSE(filter.init(config));
+    config = smallConfig(0.0);
+    TEST_ASSERT_FALSE(filter.init(config));
+    config = smallConfig(0.01);
+    config.bucket_ms = 0;
+    TEST_ASSERT_FALSE(filter.init(config));
+    config = smallConfig(0.01);
+    config.keys_per_bucket = 0;
+    TEST_ASSERT_FALSE(filter.init(config));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_duplicate_payloads);
+    RUN_TEST(test_rotation);
+    RUN_TEST(test_false_positive_rate);
+    RUN_TEST(test_concurrent_inserts);
+    RUN_TEST(test_invalid_config);
+
+    return UNITY_END();
+}
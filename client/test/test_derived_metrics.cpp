@@ -0,0 +1,239 @@
+#include "unity.h"
+#include "derived_metrics.h"
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Branchy double-precision reference of the same formulas
+
+static double referenceCorrected(double pa, double rh) {
+    double low = 0.524 * pa - 0.0862 * rh + 5.75;
+    double mid = 0.786 * pa - 0.0862 * rh + 5.75;
+    double high = 0.69 * pa + 8.84e-4 * pa * pa + 2.966;
+    double value;
+    if (pa < 30) {
+        value = low;
+    } else if (pa < 50) {
+        double w = pa / 20 - 1.5;
+        value = (0.786 * w + 0.524 * (1 - w)) * pa - 0.0862 * rh + 5.75;
+    } else if (pa < 210) {
+        value = mid;
+    } else if (pa < 260) {
+        double w = pa / 50 - 4.2;
+        value = mid * (1 - w) + high * w;
+    } else {
+        value = high;
+    }
+    return value < 0 ? 0 : value;
+}
+
+static double referenceAqi(double concentration) {
+    static const double c_low[6] = {0.0, 9.1, 35.5, 55.5, 125.5, 225.5};
+    static const double c_high[6] = {9.0, 35.4, 55.4, 125.4, 225.4, 325.4};
+    static const double i_low[6] = {0, 51, 101, 151, 201, 301};
+    static const double i_high[6] = {50, 100, 150, 200, 300, 500};
+    double c = floor(concentration * 10 + 1e-9) / 10;
+    if (c > 325.4)
+        return 500;
+    for (int k = 5; k >= 0; k--) {
+        if (c >= c_low[k])
+            return floor((i_high[k] - i_low[k]) / (c_high[k] - c_low[k]) * (c - c_low[k]) +
+                         i_low[k] + 0.5);
+    }
+    return 0;
+}
+
+static double referenceSignal(const ElectrochemCalibration &cal, double temperature,
+                              uint32_t we, uint32_t ae) {
+    double x = (temperature + 30) / 10;
+    double n;
+    if (x <= 0) {
+        n = cal.n_temp[0];
+    } else if (x >= METRIC_TEMP_POINTS - 1) {
+        n = cal.n_temp[METRIC_TEMP_POINTS - 1];
+    } else {
+        int k = (int)x;
+        n = cal.n_temp[k] + (x - k) * (cal.n_temp[k + 1] - cal.n_temp[k]);
+    }
+    return (we / 1000.0 - cal.we_zero_mv) - n * (ae / 1000.0 - cal.ae_zero_mv);
+}
+
+static void assertClose(double expected, float actual, double tolerance) {
+    TEST_ASSERT_FALSE(isnan(actual));
+    TEST_ASSERT_TRUE(fabs(expected - actual) <= tolerance + fabs(expected) * 1e-4);
+}
+
+// Readings with realistic values; some rows miss fields
+static MetricColumns makeColumns(uint32_t rows, uint32_t seed) {
+    MetricColumns columns;
+    srand(seed);
+    for (uint32_t i = 0; i < rows; i++) {
+        SensorReading reading;
+        initSensorReading(&reading);
+        reading.presence_mask = FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_HUM) |
+                                FLAG_BIT(FLAG_AFE_TEMP) | FLAG_BIT(FLAG_O3_WE) |
+                                FLAG_BIT(FLAG_O3_AE) | FLAG_BIT(FLAG_NO2_WE) |
+                                FLAG_BIT(FLAG_NO2_AE);
+        if (i % 7 == 3)
+            reading.presence_mask &= ~FLAG_BIT(FLAG_HUM);
+        if (i % 11 == 5)
+            reading.presence_mask &= ~FLAG_BIT(FLAG_NO2_AE);
+        reading.pm_25[0] = (uint16_t)(rand() % 5000);
+        reading.hum[0] = (uint16_t)(rand() % 10000);
+        reading.afe_temp = (uint16_t)(rand() % 700);  // 0-70 C
+        reading.o3_we = 180000 + (uint32_t)(rand() % 200000);
+        reading.o3_ae = 200000 + (uint32_t)(rand() % 100000);
+        reading.no2_we = 180000 + (uint32_t)(rand() % 200000);
+        reading.no2_ae = 200000 + (uint32_t)(rand() % 100000);
+        columns.append(reading);
+    }
+    return columns;
+}
+
+typedef struct {
+    std::vector<float> corrected, aqi, o3, no2;
+} Outputs;
+
+static Outputs compute(const MetricInputs &inputs, const DerivedMetricsConfig &config) {
+    Outputs results;
+    results.corrected.resize(inputs.rows);
+    results.aqi.resize(inputs.rows);
+    results.o3.resize(inputs.rows);
+    results.no2.resize(inputs.rows);
+    MetricOutputs outputs = {results.corrected.data(), results.aqi.data(), results.o3.data(),
+                             results.no2.data()};
+    computeDerivedMetrics(inputs, config, outputs);
+    return results;
+}
+
+// Test: Results match the double-precision reference, NaN where fields are missing
+void test_matches_reference(void) {
+    DerivedMetricsConfig config;
+    initDerivedMetricsConfig(config);
+    config.aqi_from_corrected = false;
+    MetricColumns columns = makeColumns(203, 36);
+    MetricInputs in = columns.inputs();
+    Outputs out = compute(in, config);
+
+    for (uint32_t i = 0; i < in.rows; i++) {
+        bool has_hum = i % 7 != 3;
+        bool has_no2 = i % 11 != 5;
+        double pa = in.pm25[i] / 10.0;
+        double rh = in.hum[i] / 100.0;
+        double temperature = in.afe_temp[i] / 10.0;
+
+        if (has_hum)
+            assertClose(referenceCorrected(pa, rh), out.corrected[i], 0.01);
+        else
+            TEST_ASSERT_TRUE(isnan(out.corrected[i]));
+        TEST_ASSERT_EQUAL_FLOAT(referenceAqi(pa), out.aqi[i]);
+
+        double no2 = referenceSignal(config.no2, temperature, in.no2_we[i], in.no2_ae[i]) /
+                     config.no2.sensitivity;
+        double o3 = (referenceSignal(config.o3, temperature, in.o3_we[i], in.o3_ae[i]) -
+                     no2 * config.o3.no2_sensitivity) /
+                    config.o3.sensitivity;
+        if (has_no2) {
+            assertClose(no2, out.no2[i], 0.05);
+            assertClose(o3, out.o3[i], 0.05);
+        } else {
+            // O3 needs NO2 for its cross-sensitivity term
+            TEST_ASSERT_TRUE(isnan(out.no2[i]));
+            TEST_ASSERT_TRUE(isnan(out.o3[i]));
+        }
+    }
+}
+
+// Test: AVX2 and scalar kernels give bit-identical results at every length
+void test_simd_matches_scalar(void) {
+    if (!metricsHaveAvx2())
+        return;  // Nothing to compare on this CPU
+    DerivedMetricsConfig config;
+    initDerivedMetricsConfig(config);
+    for (uint32_t rows = 0; rows <= 35; rows++) {
+        MetricColumns columns = makeColumns(rows, 100 + rows);
+        MetricInputs in = columns.inputs();
+        Outputs simd = compute(in, config);
+        metricsForceScalar(true);
+        Outputs scalar = compute(in, config);
+        metricsForceScalar(false);
+        if (rows > 0) {
+            TEST_ASSERT_EQUAL_MEMORY(scalar.corrected.data(), simd.corrected.data(), rows * 4);
+            TEST_ASSERT_EQUAL_MEMORY(scalar.aqi.data(), simd.aqi.data(), rows * 4);
+            TEST_ASSERT_EQUAL_MEMORY(scalar.o3.data(), simd.o3.data(), rows * 4);
+            TEST_ASSERT_EQUAL_MEMORY(scalar.no2.data(), simd.no2.data(), rows * 4);
+        }
+    }
+}
+
+// Test: AQI at the breakpoint edges, in both kernels
+void test_aqi_breakpoints(void) {
+    const uint16_t tenths[] = {0, 90, 91, 354, 355, 554, 555, 1254, 1255, 2254,
+                               2255, 3254, 3255, 65535, 50, 120};
+    const float expected[] = {0, 50, 51, 100, 101, 150, 151, 200, 201, 300,
+                              301, 500, 500, 500, 28, 56};
+    const uint32_t rows = sizeof(tenths) / sizeof(tenths[0]);
+    std::vector<uint32_t> mask(rows, FLAG_BIT(FLAG_PM_25));
+    std::vector<uint16_t> hum(rows, 0);
+    MetricInputs in = {rows, mask.data(), tenths, hum.data(), nullptr,
+                       nullptr, nullptr, nullptr, nullptr};
+    DerivedMetricsConfig config;
+    initDerivedMetricsConfig(config);
+    config.aqi_from_corrected = false;
+
+    for (int pass = 0; pass < 2; pass++) {
+        metricsForceScalar(pass == 1);
+        float aqi[rows];
+        MetricOutputs outputs = {nullptr, aqi, nullptr, nullptr};
+        computeDerivedMetrics(in, config, outputs);
+        for (uint32_t i = 0; i < rows; i++)
+            TEST_ASSERT_EQUAL_FLOAT(expected[i], aqi[i]);
+    }
+    metricsForceScalar(false);
+}
+
+// Test: Columns gathered from another PM field, AQI from the corrected value
+void test_columns_pm_flag(void) {
+    MetricColumns columns(FLAG_PM_25_SP);
+    SensorReading reading;
+    initSensorReading(&reading);
+    setSensorFieldValue(reading, FLAG_PM_25_SP, 0, 400);  // 40 ug/m3
+    setSensorFieldValue(reading, FLAG_HUM, 0, 5000);      // 50 %
+    setSensorFieldValue(reading, FLAG_PM_25, 0, 9999);
+    reading.presence_mask = FLAG_BIT(FLAG_PM_25_SP) | FLAG_BIT(FLAG_HUM);
+    columns.append(reading);
+    reading.presence_mask = FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_HUM);
+    columns.append(reading);
+    TEST_ASSERT_EQUAL_UINT32(2, columns.size());
+
+    DerivedMetricsConfig config;
+    initDerivedMetricsConfig(config);
+    Outputs out = compute(columns.inputs(), config);
+    double corrected = referenceCorrected(40, 50);
+    assertClose(corrected, out.corrected[0], 0.01);
+    TEST_ASSERT_EQUAL_FLOAT(referenceAqi(corrected), out.aqi[0]);
+    TEST_ASSERT_TRUE(isnan(out.corrected[1]));
+    TEST_ASSERT_TRUE(isnan(out.aqi[1]));
+
+    columns.clear();
+    TEST_ASSERT_EQUAL_UINT32(0, columns.size());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_matches_reference);
+    RUN_TEST(test_simd_matches_scalar);
+    RUN_TEST(test_aqi_breakpoints);
+    RUN_TEST(test_columns_pm_flag);
+
+    return UNITY_END();
+}
@@ -0,0 +1,134 @@
+#include "unity.h"
+#include "double_buffered_encoder.h"
+#include "payload_decoder.h"
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+static const PayloadHeader kHeader = {1, false, false, 5};
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Reading carrying a sequence number in o3_we
+static SensorReading sequenceReading(uint32_t sequence) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_O3_WE);
+    reading.o3_we = sequence;
+    return reading;
+}
+
+// Test: Swap, release and the cases where acquireBatch() returns nothing
+void test_swap_and_release(void) {
+    DoubleBufferedEncoder encoder;
+    encoder.init(kHeader);
+    TEST_ASSERT_NULL(encoder.acquireBatch()); // Empty
+
+    TEST_ASSERT_TRUE(encoder.addReading(sequenceReading(1)));
+    TEST_ASSERT_TRUE(encoder.addReading(sequenceReading(2)));
+    PayloadEncoder *batch = encoder.acquireBatch();
+    TEST_ASSERT_NOT_NULL(batch);
+    TEST_ASSERT_EQUAL_UINT8(2, batch->getReadingCount());
+
+    // Sampling continues in the other batch while this one is sent
+    for (uint32_t i = 0; i < MAX_BATCH_SIZE; i++) {
+        TEST_ASSERT_TRUE(encoder.addReading(sequenceReading(10 + i)));
+    }
+    TEST_ASSERT_FALSE(encoder.addReading(sequenceReading(99)));
+    TEST_ASSERT_NULL(encoder.acquireBatch()); // Not released yet
+    TEST_ASSERT_EQUAL_UINT8(2, batch->getReadingCount());
+
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    int32_t size = batch->encode(buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_INT32(2 + 2 * (4 + 4), size);
+    TEST_ASSERT_EQUAL_UINT8(0x01, buffer[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x05, buffer[1]);
+    encoder.releaseBatch();
+    TEST_ASSERT_EQUAL_UINT8(0, batch->getReadingCount());
+
+    PayloadEncoder *next = encoder.acquireBatch();
+    TEST_ASSERT_TRUE(next != nullptr && next != batch);
+    TEST_ASSERT_EQUAL_UINT8(MAX_BATCH_SIZE, next->getReadingCount());
+    encoder.releaseBatch();
+
+    // The released batch kept the header
+    TEST_ASSERT_TRUE(encoder.addReading(sequenceReading(3)));
+    batch = encoder.acquireBatch();
+    TEST_ASSERT_EQUAL_INT32(2 + 4 + 4, batch->encode(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_UINT8(0x05, buffer[1]);
+    encoder.releaseBatch();
+    TEST_ASSERT_NULL(encoder.acquireBatch());
+}
+
+// Test: Sampling and transmit threads under stress: every reading arrives
+// once, in order
+void test_concurrent_sampling(void) {
+    const uint32_t kReadings = 300000;
+    DoubleBufferedEncoder encoder;
+    encoder.init(kHeader);
+    std::atomic<bool> done(false);
+
+    std::thread sampler([&]() {
+        for (uint32_t i = 0; i < kReadings; i++) {
+            while (!encoder.addReading(sequenceReading(i)))
+                std::this_thread::yield(); // Both batches full
+        }
+        done.store(true);
+    });
+
+    std::vector<uint32_t> received;
+    received.reserve(kReadings);
+    uint32_t payloads = 0;
+    bool ordered = true, decoded = true;
+    PayloadDecoder decoder;
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    std::thread transmitter([&]() {
+        for (;;) {
+            bool finished = done.load();
+            PayloadEncoder *batch = encoder.acquireBatch();
+            if (batch == nullptr) {
+                if (finished)
+                    break; // Nothing left once the sampler is done
+                std::this_thread::yield();
+                continue;
+            }
+            int32_t size = batch->encode(buffer, sizeof(buffer));
+            encoder.releaseBatch();
+            int32_t count = decoder.decode(buffer, (uint32_t)size);
+            if (count <= 0) {
+                decoded = false;
+                break;
+            }
+            for (int32_t r = 0; r < count; r++) {
+                uint32_t sequence = decoder.getReading((uint8_t)r).o3_we;
+                if (sequence != received.size())
+                    ordered = false;
+                received.push_back(sequence);
+            }
+            payloads++;
+        }
+    });
+
+    sampler.join();
+    transmitter.join();
+    TEST_ASSERT_TRUE(decoded);
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_EQUAL_UINT32(kReadings, (uint32_t)received.size());
+    TEST_ASSERT_TRUE(payloads >= kReadings / MAX_BATCH_SIZE);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_swap_and_release);
+    RUN_TEST(test_concurrent_sampling);
+
+    return UNITY_END();
+}
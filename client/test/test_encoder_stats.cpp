@@ -0,0 +1,112 @@
+#include "unity.h"
+#include "payload_encoder.h"
+#include <string.h>
+
+PayloadEncoder encoder;
+
+void setUp(void) {
+    encoder.resetStats();
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+static SensorReading co2Reading(uint16_t co2) {
+    SensorReading reading;
+    memset(&reading, 0, sizeof(reading));
+    setFlag(&reading, FLAG_CO2);
+    reading.co2 = co2;
+    return reading;
+}
+
+// Test: Readings added and rejected, per-field presence
+void test_reading_counters(void) {
+    PayloadHeader header = {1, false, false, 5};
+    encoder.init(header);
+
+    SensorReading reading = co2Reading(400);
+    setFlag(&reading, FLAG_TEMP);
+    setFlag(&reading, FLAG_SIGNAL);
+    for (int i = 0; i < MAX_BATCH_SIZE + 3; i++)
+        encoder.addReading(reading);
+
+    EncoderStats stats;
+    encoder.getStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(MAX_BATCH_SIZE, stats.readings_added);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.readings_rejected);
+    TEST_ASSERT_EQUAL_UINT32(MAX_BATCH_SIZE, stats.field_presence[FLAG_CO2]);
+    TEST_ASSERT_EQUAL_UINT32(MAX_BATCH_SIZE, stats.field_presence[FLAG_TEMP]);
+    TEST_ASSERT_EQUAL_UINT32(MAX_BATCH_SIZE, stats.field_presence[FLAG_SIGNAL]);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.field_presence[FLAG_HUM]);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.encodes);
+}
+
+// Test: Encodes, failures, bytes and the size histogram; counters survive
+// init() and reset()
+void test_encode_counters(void) {
+    PayloadHeader header = {1, false, false, 5};
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+
+    // 2 + 6 = 8 bytes: bucket 3
+    encoder.init(header);
+    encoder.addReading(co2Reading(400));
+    TEST_ASSERT_EQUAL_INT32(8, encoder.encode(buffer, sizeof(buffer)));
+
+    // 2 + 20 * 6 = 122 bytes: bucket 6
+    encoder.init(header);
+    for (int i = 0; i < MAX_BATCH_SIZE; i++)
+        encoder.addReading(co2Reading((uint16_t)(400 + i)));
+    TEST_ASSERT_EQUAL_INT32(122, encoder.encode(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_INT32(-1, encoder.encode(buffer, 100));
+    TEST_ASSERT_EQUAL_INT32(-1, encoder.encode(nullptr, sizeof(buffer)));
+
+    // Empty batch: neither an encode nor a failure
+    encoder.reset();
+    TEST_ASSERT_EQUAL_INT32(0, encoder.encode(buffer, sizeof(buffer)));
+
+    EncoderStats stats;
+    encoder.getStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.encodes);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.encode_failures);
+    TEST_ASSERT_EQUAL_UINT32(130, stats.bytes_encoded);
+    TEST_ASSERT_EQUAL_UINT32(21, stats.readings_added);
+    for (int b = 0; b < ENCODER_SIZE_BUCKETS; b++)
+        TEST_ASSERT_EQUAL_UINT32(b == 3 || b == 6 ? 1 : 0, stats.size_histogram[b]);
+}
+
+// Test: Largest possible payload lands in the last bucket; resetStats()
+// zeroes everything
+void test_histogram_range_and_reset(void) {
+    PayloadHeader header = {1, true, false, 5};
+    encoder.init(header);
+    SensorReading reading;
+    memset(&reading, 0, sizeof(reading));
+    reading.presence_mask = (1u << ENCODER_FIELD_COUNT) - 1;
+    for (int i = 0; i < MAX_BATCH_SIZE; i++)
+        encoder.addReading(reading);
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    TEST_ASSERT_EQUAL_INT32(MAX_PAYLOAD_SIZE, encoder.encode(buffer, sizeof(buffer)));
+
+    EncoderStats stats;
+    encoder.getStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.size_histogram[ENCODER_SIZE_BUCKETS - 1]);
+    for (int f = 0; f < ENCODER_FIELD_COUNT; f++)
+        TEST_ASSERT_EQUAL_UINT32(MAX_BATCH_SIZE, stats.field_presence[f]);
+
+    encoder.resetStats();
+    encoder.getStats(&stats);
+    EncoderStats zero;
+    memset(&zero, 0, sizeof(zero));
+    TEST_ASSERT_EQUAL_MEMORY(&zero, &stats, sizeof(stats));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reading_counters);
+    RUN_TEST(test_encode_counters);
+    RUN_TEST(test_histogram_range_and_reset);
+
+    return UNITY_END();
+}
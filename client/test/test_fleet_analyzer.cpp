@@ -0,0 +1,236 @@
+#include "unity.h"
+#include "fleet_analyzer.h"
+#include "fleet_generator.h"
+#include "payload_archive.h"
+#include "payload_encoder.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *kSegment = "test_fleet_analyzer.seg";
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    unlink(kSegment);
+}
+
+// Single mode, three CO2-only readings: 400, 401, 403 (20 bytes)
+static int32_t encodeCo2Payload(uint8_t *buffer) {
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, false, false, 5};
+    encoder.init(header);
+    const uint16_t values[3] = {400, 401, 403};
+    for (int i = 0; i < 3; i++) {
+        SensorReading reading;
+        initSensorReading(&reading);
+        setFlag(&reading, FLAG_CO2);
+        reading.co2 = values[i];
+        encoder.addReading(reading);
+    }
+    return encoder.encode(buffer, MAX_PAYLOAD_SIZE);
+}
+
+// Dual mode: {temperature, PM2.5} then {PM2.5} (22 bytes)
+static int32_t encodeDualPayload(uint8_t *buffer) {
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, true, false, 5};
+    encoder.init(header);
+    SensorReading reading;
+    memset(&reading, 0, sizeof(reading));
+    setFlag(&reading, FLAG_TEMP);
+    setFlag(&reading, FLAG_PM_25);
+    reading.temp[0] = 2150;
+    reading.temp[1] = 2160;
+    reading.pm_25[0] = 100;
+    reading.pm_25[1] = 100;
+    encoder.addReading(reading);
+    clearFlag(&reading, FLAG_TEMP);
+    reading.pm_25[0] = 90;
+    encoder.addReading(reading);
+    return encoder.encode(buffer, MAX_PAYLOAD_SIZE);
+}
+
+// Test: Header, mask and field bytes; combinations
+void test_attribution(void) {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    FleetAnalyzer analyzer;
+    TEST_ASSERT_EQUAL_INT32(20, encodeCo2Payload(buffer));
+    TEST_ASSERT_TRUE(analyzer.addPayload(buffer, 20));
+    TEST_ASSERT_EQUAL_INT32(22, encodeDualPayload(buffer));
+    TEST_ASSERT_TRUE(analyzer.addPayload(buffer, 22));
+    TEST_ASSERT_FALSE(analyzer.addPayload(buffer, 1));
+
+    const FleetTotals &totals = analyzer.getTotals();
+    TEST_ASSERT_EQUAL_UINT64(2, totals.payloads);
+    TEST_ASSERT_EQUAL_UINT64(5, totals.readings);
+    TEST_ASSERT_EQUAL_UINT64(1, totals.malformed);
+    TEST_ASSERT_EQUAL_UINT64(42, totals.payload_bytes);
+    TEST_ASSERT_EQUAL_UINT64(4, totals.header_bytes);
+    TEST_ASSERT_EQUAL_UINT64(20, totals.mask_bytes);
+    TEST_ASSERT_EQUAL_UINT64(3, totals.field_readings[FLAG_CO2]);
+    TEST_ASSERT_EQUAL_UINT64(6, totals.field_bytes[FLAG_CO2]);
+    TEST_ASSERT_EQUAL_UINT64(1, totals.field_readings[FLAG_TEMP]);
+    TEST_ASSERT_EQUAL_UINT64(4, totals.field_bytes[FLAG_TEMP]);
+    TEST_ASSERT_EQUAL_UINT64(2, totals.field_readings[FLAG_PM_25]);
+    TEST_ASSERT_EQUAL_UINT64(8, totals.field_bytes[FLAG_PM_25]);
+
+    std::vector<FleetMaskProfile> masks;
+    analyzer.getMasks(&masks);
+    TEST_ASSERT_EQUAL(3, masks.size());
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_CO2), masks[0].presence_mask);
+    TEST_ASSERT_FALSE(masks[0].dual_mode);
+    TEST_ASSERT_EQUAL_UINT64(3, masks[0].readings);
+    TEST_ASSERT_EQUAL_UINT64(18, masks[0].bytes);
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_PM_25),
+                            masks[1].presence_mask);
+    TEST_ASSERT_TRUE(masks[1].dual_mode);
+    TEST_ASSERT_EQUAL_UINT64(12, masks[1].bytes);
+    TEST_ASSERT_EQUAL_UINT64(8, masks[2].bytes);
+}
+
+// Test: Variant estimates against hand-computed sizes
+void test_variants(void) {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    FleetAnalyzer co2;
+    co2.addPayload(buffer, (uint32_t)encodeCo2Payload(buffer));
+    const FleetTotals &a = co2.getTotals();
+    // One mask instead of three
+    TEST_ASSERT_EQUAL_UINT64(12, a.variant_bytes[FLEET_VARIANT_MASK_ELISION]);
+    // 400, +1, +2: 2 + 1 + 1 bytes
+    TEST_ASSERT_EQUAL_UINT64(18, a.variant_bytes[FLEET_VARIANT_DELTA]);
+    TEST_ASSERT_EQUAL_UINT64(4, a.field_delta_bytes[FLAG_CO2]);
+    // Base 400, width 2 bits, 3 x 2 bits: 2 + 1 + 1 bytes
+    TEST_ASSERT_EQUAL_UINT64(18, a.variant_bytes[FLEET_VARIANT_BITPACK]);
+    TEST_ASSERT_EQUAL_UINT64(4, a.field_bitpack_bytes[FLAG_CO2]);
+    // Header, one mask, 4 data bytes and a selector byte
+    TEST_ASSERT_EQUAL_UINT64(11, a.variant_bytes[FLEET_VARIANT_COMBINED]);
+
+    FleetAnalyzer dual;
+    dual.addPayload(buffer, (uint32_t)encodeDualPayload(buffer));
+    const FleetTotals &b = dual.getTotals();
+    // Masks differ: nothing elided
+    TEST_ASSERT_EQUAL_UINT64(22, b.variant_bytes[FLEET_VARIANT_MASK_ELISION]);
+    // Temperature 2 + 2; PM2.5 channel 0 100, -10: 3; channel 1 100, +0: 3
+    TEST_ASSERT_EQUAL_UINT64(20, b.variant_bytes[FLEET_VARIANT_DELTA]);
+    TEST_ASSERT_EQUAL_UINT64(6, b.field_delta_bytes[FLAG_PM_25]);
+    // PM2.5 channel 0 range 10: 2 + 1 + 1; channel 1 range 0: 2 + 1
+    TEST_ASSERT_EQUAL_UINT64(21, b.variant_bytes[FLEET_VARIANT_BITPACK]);
+    TEST_ASSERT_EQUAL_UINT64(7, b.field_bitpack_bytes[FLAG_PM_25]);
+    TEST_ASSERT_EQUAL_UINT64(21, b.variant_bytes[FLEET_VARIANT_COMBINED]);
+}
+
+// Fleet payloads, then 100 bytes of garbage, more payloads and a torn
+// record at the end. reference gets every payload directly.
+static uint32_t writeSegment(FleetAnalyzer *reference) {
+    FleetConfig config;
+    initFleetConfig(config);
+    config.devices = 200;
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+
+    ArchiveWriter writer;
+    TEST_ASSERT_TRUE(writer.open(kSegment));
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    uint64_t sequence = 0;
+    for (uint32_t round = 0; round < 6; round++) {
+        for (uint32_t d = 0; d < config.devices; d++) {
+            FleetPayloadInfo info;
+            PayloadRecordHeader header;
+            int32_t length = generator.generate(d, payload, sizeof(payload), &info);
+            TEST_ASSERT_TRUE(length > 0);
+            header.length = (uint32_t)length;
+            header.sequence = ++sequence;
+            header.device_id = info.device_id;
+            header.timestamp_ms = info.timestamp_ms;
+            TEST_ASSERT_TRUE(writer.write(header, payload));
+            reference->addPayload(payload, (uint32_t)length);
+        }
+        if (round == 2) {
+            uint8_t garbage[100];
+            memset(garbage, 0x41, sizeof(garbage));
+            TEST_ASSERT_TRUE(writer.writeRaw(garbage, sizeof(garbage)));
+        }
+    }
+    uint8_t torn[PAYLOAD_RECORD_HEADER_SIZE + 8];
+    PayloadRecordHeader header = {8, ++sequence, 1, 1};
+    writePayloadRecord(torn, header, payload);
+    TEST_ASSERT_TRUE(writer.writeRaw(torn, 30));
+    TEST_ASSERT_TRUE(writer.close());
+    return (uint32_t)sequence - 1;
+}
+
+// Test: Scans with any thread count and chunk size match a direct pass;
+// garbage and torn bytes are counted once
+void test_archive_scan(void) {
+    FleetAnalyzer reference;
+    uint32_t records = writeSegment(&reference);
+    std::vector<FleetMaskProfile> expected;
+    reference.getMasks(&expected);
+
+    const uint32_t threads[3] = {1, 3, 4};
+    const uint64_t chunks[3] = {64ULL << 20, 1000, 37};
+    for (int i = 0; i < 3; i++) {
+        FleetScanConfig config = defaultFleetScanConfig();
+        config.threads = threads[i];
+        config.chunk_bytes = chunks[i];
+        FleetAnalyzer result;
+        FleetScanStats stats;
+        TEST_ASSERT_TRUE(analyzeArchiveFiles(std::vector<std::string>(1, kSegment),
+                                             config, &result, &stats));
+        TEST_ASSERT_EQUAL_UINT64(records, stats.records);
+        TEST_ASSERT_EQUAL_UINT64(130, stats.skipped_bytes);
+        TEST_ASSERT_EQUAL_MEMORY(&reference.getTotals(), &result.getTotals(),
+                                 sizeof(FleetTotals));
+        std::vector<FleetMaskProfile> masks;
+        result.getMasks(&masks);
+        TEST_ASSERT_EQUAL(expected.size(), masks.size());
+        for (size_t m = 0; m < masks.size(); m++) {
+            TEST_ASSERT_EQUAL_HEX32(expected[m].presence_mask, masks[m].presence_mask);
+            TEST_ASSERT_EQUAL_UINT64(expected[m].bytes, masks[m].bytes);
+        }
+    }
+
+    FleetAnalyzer result;
+    FleetScanStats stats;
+    TEST_ASSERT_FALSE(analyzeArchiveFiles(
+        std::vector<std::string>(1, "missing.seg"), defaultFleetScanConfig(),
+        &result, &stats));
+}
+
+// Test: JSON report
+void test_report_json(void) {
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    FleetAnalyzer analyzer;
+    analyzer.addPayload(buffer, (uint32_t)encodeCo2Payload(buffer));
+    std::string json;
+    formatFleetReportJson(analyzer, nullptr, 10, &json);
+
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(), "\"payloads\": 1,"));
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(), "\"mask_share\": 0.600000,"));
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(),
+        "{\"name\": \"co2\", \"readings\": 3, \"bytes\": 6, \"share\": 0.300000, "
+        "\"delta_bytes\": 4, \"bitpack_bytes\": 4}"));
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(),
+        "{\"name\": \"combined\", \"bytes\": 11, \"saved\": 9, "
+        "\"saved_share\": 0.450000}"));
+    TEST_ASSERT_NOT_NULL(strstr(json.c_str(),
+        "{\"mask\": \"0x0000004\", \"dual\": false, \"dedicated\": false, "
+        "\"readings\": 3, \"bytes\": 18, \"share\": 0.900000}"));
+    TEST_ASSERT_NULL(strstr(json.c_str(), "temperature"));
+    TEST_ASSERT_EQUAL('\n', json[json.size() - 1]);
+    TEST_ASSERT_EQUAL('}', json[json.size() - 2]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_attribution);
+    RUN_TEST(test_variants);
+    RUN_TEST(test_archive_scan);
+    RUN_TEST(test_report_json);
+
+    return UNITY_END();
+}
@@ -0,0 +1,213 @@
+#include "unity.h"
+#include "fleet_generator.h"
+#include "payload_decoder.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Concatenated payloads of every device in order, count payloads each
+static std::vector<uint8_t> generateAll(const FleetConfig &config, uint32_t count) {
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+    std::vector<uint8_t> out;
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    for (uint32_t d = 0; d < generator.getDeviceCount(); d++) {
+        for (uint32_t i = 0; i < count; i++) {
+            FleetPayloadInfo info;
+            int32_t length = generator.generate(d, buffer, sizeof(buffer), &info);
+            TEST_ASSERT_TRUE(length > 0);
+            out.insert(out.end(), buffer, buffer + length);
+        }
+    }
+    return out;
+}
+
+// Test: Same seed gives the same payloads, in any device visiting order;
+// another seed does not
+void test_deterministic(void) {
+    FleetConfig config;
+    initFleetConfig(config);
+    config.devices = 50;
+    std::vector<uint8_t> a = generateAll(config, 20);
+    std::vector<uint8_t> b = generateAll(config, 20);
+    TEST_ASSERT_EQUAL(a.size(), b.size());
+    TEST_ASSERT_EQUAL_MEMORY(a.data(), b.data(), a.size());
+
+    // Interleave devices instead of finishing one before the next
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+    std::vector<std::vector<uint8_t> > perDevice(config.devices);
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    for (uint32_t i = 0; i < 20; i++) {
+        for (uint32_t d = config.devices; d-- > 0;) {
+            FleetPayloadInfo info;
+            int32_t length = generator.generate(d, buffer, sizeof(buffer), &info);
+            perDevice[d].insert(perDevice[d].end(), buffer, buffer + length);
+        }
+    }
+    std::vector<uint8_t> c;
+    for (uint32_t d = 0; d < config.devices; d++)
+        c.insert(c.end(), perDevice[d].begin(), perDevice[d].end());
+    TEST_ASSERT_EQUAL(a.size(), c.size());
+    TEST_ASSERT_EQUAL_MEMORY(a.data(), c.data(), a.size());
+
+    config.seed = 2;
+    std::vector<uint8_t> d = generateAll(config, 20);
+    TEST_ASSERT_FALSE(a.size() == d.size() && memcmp(a.data(), d.data(), a.size()) == 0);
+}
+
+// Test: Payloads decode with the profile's header, fields and batch sizes,
+// and send times advance by whole batches of the interval
+void test_profiles_decode(void) {
+    static const uint8_t intervals[FLEET_PROFILE_COUNT] = {1, 1, 5, 2};
+    static const uint8_t max_batch[FLEET_PROFILE_COUNT] = {3, 5, 20, 10};
+    FleetConfig config;
+    initFleetConfig(config);
+    config.devices = 200;
+    config.dropout = 0;
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+
+    uint32_t seen[FLEET_PROFILE_COUNT] = {0};
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    PayloadDecoder decoder;
+    for (uint32_t d = 0; d < config.devices; d++) {
+        uint64_t last_ms = 0;
+        for (uint32_t i = 0; i < 10; i++) {
+            uint64_t send_ms = generator.nextSendTime(d);
+            FleetPayloadInfo info;
+            int32_t length = generator.generate(d, buffer, sizeof(buffer), &info);
+            TEST_ASSERT_EQUAL(length, (int32_t)info.length);
+            TEST_ASSERT_EQUAL_UINT64(config.first_device_id + d, info.device_id);
+            TEST_ASSERT_EQUAL_UINT64(send_ms, info.timestamp_ms);
+            TEST_ASSERT_EQUAL(info.reading_count, decoder.decode(buffer, (uint32_t)length));
+            TEST_ASSERT_TRUE(info.reading_count >= 1 && info.reading_count <= max_batch[info.profile]);
+
+            const PayloadHeader &header = decoder.getHeader();
+            TEST_ASSERT_EQUAL(intervals[info.profile], header.interval_minutes);
+            TEST_ASSERT_EQUAL(info.profile == FLEET_OUTDOOR, header.dual_mode);
+            TEST_ASSERT_EQUAL(info.profile == FLEET_GAS, header.dedicated_temphum_sensor);
+            if (i > 0) {
+                // The previous payload's batch ended one interval before this
+                // payload's first reading
+                TEST_ASSERT_EQUAL_UINT64(last_ms + info.reading_count * header.interval_minutes * 60000ULL,
+                                         info.timestamp_ms);
+            }
+            last_ms = info.timestamp_ms;
+
+            // Without dropout every reading has the same fields
+            uint32_t mask = decoder.getReading(0).presence_mask;
+            TEST_ASSERT_TRUE(IS_FLAG_SET(mask, FLAG_TEMP));
+            TEST_ASSERT_TRUE(IS_FLAG_SET(mask, FLAG_SIGNAL));
+            TEST_ASSERT_EQUAL(info.profile == FLEET_INDOOR, IS_FLAG_SET(mask, FLAG_CO2) != 0);
+            TEST_ASSERT_EQUAL(info.profile == FLEET_SOLAR, IS_FLAG_SET(mask, FLAG_VBAT) != 0);
+            TEST_ASSERT_EQUAL(info.profile == FLEET_GAS, IS_FLAG_SET(mask, FLAG_O3_WE) != 0);
+            for (uint8_t r = 1; r < info.reading_count; r++)
+                TEST_ASSERT_EQUAL_HEX32(mask, decoder.getReading(r).presence_mask);
+            seen[info.profile]++;
+        }
+    }
+    for (int p = 0; p < FLEET_PROFILE_COUNT; p++)
+        TEST_ASSERT_TRUE(seen[p] > 0);
+    // 50/30/10/10 mix
+    TEST_ASSERT_TRUE(seen[FLEET_INDOOR] > seen[FLEET_OUTDOOR]);
+    TEST_ASSERT_TRUE(seen[FLEET_OUTDOOR] > seen[FLEET_SOLAR]);
+}
+
+// Test: Mix with a single profile, dropout removes optional fields only
+void test_mix_and_dropout(void) {
+    FleetConfig config;
+    initFleetConfig(config);
+    config.devices = 20;
+    config.dropout = 0.5;
+    for (int p = 0; p < FLEET_PROFILE_COUNT; p++)
+        config.mix[p] = p == FLEET_INDOOR ? 1 : 0;
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    PayloadDecoder decoder;
+    uint32_t without_co2 = 0, readings = 0;
+    for (uint32_t d = 0; d < config.devices; d++) {
+        for (uint32_t i = 0; i < 20; i++) {
+            FleetPayloadInfo info;
+            int32_t length = generator.generate(d, buffer, sizeof(buffer), &info);
+            TEST_ASSERT_EQUAL(FLEET_INDOOR, info.profile);
+            TEST_ASSERT_EQUAL(info.reading_count, decoder.decode(buffer, (uint32_t)length));
+            for (uint8_t r = 0; r < info.reading_count; r++) {
+                uint32_t mask = decoder.getReading(r).presence_mask;
+                TEST_ASSERT_TRUE(IS_FLAG_SET(mask, FLAG_TEMP));
+                TEST_ASSERT_TRUE(IS_FLAG_SET(mask, FLAG_PM_25));
+                without_co2 += !IS_FLAG_SET(mask, FLAG_CO2);
+                readings++;
+            }
+        }
+    }
+    TEST_ASSERT_TRUE(without_co2 > readings / 4 && without_co2 < readings * 3 / 4);
+
+    config.mix[FLEET_INDOOR] = 0;
+    TEST_ASSERT_FALSE(generator.init(config));
+    config.mix[FLEET_INDOOR] = 1;
+    config.devices = 0;
+    TEST_ASSERT_FALSE(generator.init(config));
+}
+
+// Test: Series are correlated: humidity falls as temperature rises over the
+// daily cycle, and the two channels of an outdoor device agree closely
+void test_correlated_series(void) {
+    FleetConfig config;
+    initFleetConfig(config);
+    config.devices = 10;
+    for (int p = 0; p < FLEET_PROFILE_COUNT; p++)
+        config.mix[p] = p == FLEET_OUTDOOR ? 1 : 0;
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+
+    uint8_t buffer[MAX_PAYLOAD_SIZE];
+    PayloadDecoder decoder;
+    for (uint32_t d = 0; d < config.devices; d++) {
+        double st = 0, sh = 0, stt = 0, shh = 0, sth = 0, pm_gap = 0, pm_sum = 0;
+        uint32_t n = 0;
+        // Two simulated days
+        while (generator.nextSendTime(d) < config.start_ms + 2 * 86400000ULL) {
+            FleetPayloadInfo info;
+            int32_t length = generator.generate(d, buffer, sizeof(buffer), &info);
+            TEST_ASSERT_EQUAL(info.reading_count, decoder.decode(buffer, (uint32_t)length));
+            for (uint8_t r = 0; r < info.reading_count; r++) {
+                const SensorReading &reading = decoder.getReading(r);
+                double t = reading.temp[0], h = reading.hum[0];
+                st += t; sh += h; stt += t * t; shh += h * h; sth += t * h;
+                pm_gap += reading.pm_25[0] > reading.pm_25[1] ? reading.pm_25[0] - reading.pm_25[1]
+                                                               : reading.pm_25[1] - reading.pm_25[0];
+                pm_sum += reading.pm_25[0];
+                n++;
+            }
+        }
+        double cov = sth / n - (st / n) * (sh / n);
+        double var_t = stt / n - (st / n) * (st / n);
+        double var_h = shh / n - (sh / n) * (sh / n);
+        double correlation = cov / sqrt(var_t * var_h);
+        TEST_ASSERT_TRUE(correlation < -0.5);
+        // Channels within about a fifth of each other on average
+        TEST_ASSERT_TRUE(pm_gap < pm_sum * 0.2);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_deterministic);
+    RUN_TEST(test_profiles_decode);
+    RUN_TEST(test_mix_and_dropout);
+    RUN_TEST(test_correlated_series);
+
+    return UNITY_END();
+}
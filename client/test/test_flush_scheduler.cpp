@@ -0,0 +1,232 @@
+#include "unity.h"
+#include "flush_simulator.h"
+#include "payload_encoder.h"
+#include <stdio.h>
+#include <unistd.h>
+
+static const PayloadHeader kHeader = {1, false, false, 5};
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Typical reading with signal
+static SensorReading signalReading(int8_t signal_dbm) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_CO2);
+    setFlag(&reading, FLAG_PM_25);
+    setFlag(&reading, FLAG_SIGNAL);
+    reading.co2 = 450;
+    reading.pm_25[0] = 80;
+    reading.signal = signal_dbm;
+    return reading;
+}
+
+// Add a reading at now_s and ask the scheduler; on a flush, reset the batch
+static FlushDecision step(PayloadEncoder &encoder, FlushScheduler &scheduler,
+                          int8_t signal_dbm, uint32_t now_s) {
+    SensorReading reading = signalReading(signal_dbm);
+    TEST_ASSERT_TRUE(encoder.addReading(reading));
+    scheduler.onReading(reading, encoder.calculateTotalSize(),
+                        encoder.getReadingCount(), now_s);
+    FlushDecision decision = scheduler.decide(now_s);
+    if (decision != FLUSH_WAIT) {
+        encoder.init(kHeader);
+        scheduler.onFlush(now_s);
+    }
+    return decision;
+}
+
+// Test: Cost multiplier interpolates between the signal points
+void test_cost_model(void) {
+    FlushScheduler scheduler;
+    FlushPolicyConfig config = FlushScheduler::defaultConfig();
+    TEST_ASSERT_TRUE(scheduler.init(config));
+    TEST_ASSERT_EQUAL_UINT32(100, scheduler.signalCostPct(-60));
+    TEST_ASSERT_EQUAL_UINT32(100, scheduler.signalCostPct(-85));
+    TEST_ASSERT_EQUAL_UINT32(220, scheduler.signalCostPct(-95));
+    TEST_ASSERT_EQUAL_UINT32(400, scheduler.signalCostPct(-110));
+    TEST_ASSERT_EQUAL_UINT32(400, scheduler.signalCostPct(-128));
+    TEST_ASSERT_EQUAL_UINT64(2000000 + 50 * 100, scheduler.sessionCost(100, -80));
+    TEST_ASSERT_EQUAL_UINT64((2000000 + 50 * 100) * 4, scheduler.sessionCost(100, -120));
+
+    FlushPolicyConfig bad = config;
+    bad.max_age_s = 0;
+    TEST_ASSERT_FALSE(scheduler.init(bad));
+    bad = config;
+    bad.poor_signal_dbm = bad.good_signal_dbm;
+    TEST_ASSERT_FALSE(scheduler.init(bad));
+    bad = config;
+    bad.poor_signal_cost_pct = 50;
+    TEST_ASSERT_FALSE(scheduler.init(bad));
+}
+
+// Test: Full batches, byte limit and the latency bound
+void test_full_and_deadline(void) {
+    PayloadEncoder encoder;
+    FlushScheduler scheduler;
+    FlushPolicyConfig config = FlushScheduler::defaultConfig();
+    config.signal_aware = false;
+    TEST_ASSERT_TRUE(scheduler.init(config));
+    TEST_ASSERT_EQUAL(FLUSH_WAIT, scheduler.decide(0)); // Nothing batched
+
+    // A reading every 10 s: the batch fills long before the hour
+    encoder.init(kHeader);
+    for (uint32_t i = 0; i < MAX_BATCH_SIZE - 1; i++)
+        TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -90, i * 10));
+    TEST_ASSERT_EQUAL(FLUSH_FULL, step(encoder, scheduler, -90, 190));
+
+    // Every 300 s: the 13th reading is an hour old at the next one
+    for (uint32_t i = 0; i < 12; i++)
+        TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -90, 1000 + i * 300));
+    TEST_ASSERT_EQUAL(FLUSH_DEADLINE, step(encoder, scheduler, -90, 1000 + 12 * 300));
+
+    // Byte limit: 2 header bytes + 11 bytes per reading
+    config.max_bytes = 2 + 3 * 11;
+    TEST_ASSERT_TRUE(scheduler.init(config));
+    encoder.init(kHeader);
+    TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -90, 0));
+    TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -90, 10));
+    TEST_ASSERT_EQUAL(FLUSH_FULL, step(encoder, scheduler, -90, 20));
+}
+
+// Test: A due batch waits out poor signal, up to the extra delay
+void test_poor_signal_deferral(void) {
+    PayloadEncoder encoder;
+    FlushScheduler scheduler;
+    TEST_ASSERT_TRUE(scheduler.init(FlushScheduler::defaultConfig()));
+    encoder.init(kHeader);
+    // Due from the 13th reading, deferred while age + 300 <= 3600 + 900
+    for (uint32_t i = 0; i < 15; i++)
+        TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -115, i * 300));
+    TEST_ASSERT_EQUAL(FLUSH_DEADLINE, step(encoder, scheduler, -115, 15 * 300));
+
+    // The signal recovers while deferred: sent at once
+    for (uint32_t i = 0; i < 13; i++)
+        TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -115, 10000 + i * 300));
+    TEST_ASSERT_EQUAL(FLUSH_DEADLINE, step(encoder, scheduler, -90, 10000 + 13 * 300));
+}
+
+// Test: Good signal sends a deadline-bound batch early, when the signal has
+// been changing from reading to reading
+void test_signal_early_flush(void) {
+    PayloadEncoder encoder;
+    FlushScheduler scheduler;
+    FlushPolicyConfig config = FlushScheduler::defaultConfig();
+    TEST_ASSERT_TRUE(scheduler.init(config));
+    encoder.init(kHeader);
+
+    // History: signal alternating between fair and poor
+    uint32_t now = 0;
+    for (uint32_t i = 0; i < 200; i++, now += 300)
+        step(encoder, scheduler, (i & 1) ? -110 : -100, now);
+    encoder.init(kHeader);
+    scheduler.onFlush(now);
+
+    // Half way to the deadline, a good reading
+    for (uint32_t i = 0; i < 6; i++, now += 300)
+        TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -110, now));
+    TEST_ASSERT_EQUAL(FLUSH_SIGNAL, step(encoder, scheduler, -80, now));
+
+    // Without signal awareness the same reading waits
+    config.signal_aware = false;
+    TEST_ASSERT_TRUE(scheduler.init(config));
+    encoder.init(kHeader);
+    now = 0;
+    for (uint32_t i = 0; i < 6; i++, now += 300)
+        TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -110, now));
+    TEST_ASSERT_EQUAL(FLUSH_WAIT, step(encoder, scheduler, -80, now));
+}
+
+// Test: Policies on a synthetic trace: readings conserved, latency bounds
+// held, adaptive no costlier than deadline
+void test_simulator(void) {
+    FlushTraceConfig trace_config;
+    initFlushTraceConfig(trace_config);
+    trace_config.hours = 48;
+    trace_config.interval_s = 300;
+    std::vector<FlushTraceEntry> trace;
+    generateFlushTrace(trace_config, &trace);
+    TEST_ASSERT_EQUAL_UINT32(48 * 12, (uint32_t)trace.size());
+    std::vector<FlushTraceEntry> again;
+    generateFlushTrace(trace_config, &again);
+    TEST_ASSERT_EQUAL_INT8(trace[100].signal_dbm, again[100].signal_dbm);
+
+    FlushPolicyConfig config = FlushScheduler::defaultConfig();
+    FlushSimResult results[FLUSH_POLICY_COUNT];
+    for (int p = 0; p < FLUSH_POLICY_COUNT; p++) {
+        TEST_ASSERT_TRUE(simulateFlushPolicy(trace, kHeader, (FlushPolicy)p, config, &results[p]));
+        TEST_ASSERT_EQUAL_UINT64(trace.size(), results[p].readings);
+    }
+    TEST_ASSERT_EQUAL_UINT64((trace.size() + MAX_BATCH_SIZE - 1) / MAX_BATCH_SIZE,
+                             results[FLUSH_POLICY_WHEN_FULL].sessions);
+    TEST_ASSERT_EQUAL_UINT32((MAX_BATCH_SIZE - 1) * 300 + 300,
+                             results[FLUSH_POLICY_WHEN_FULL].max_latency_s);
+    TEST_ASSERT_TRUE(results[FLUSH_POLICY_DEADLINE].max_latency_s <= config.max_age_s);
+    TEST_ASSERT_TRUE(results[FLUSH_POLICY_ADAPTIVE].max_latency_s <=
+                     config.max_age_s + config.poor_signal_defer_s);
+    TEST_ASSERT_TRUE(results[FLUSH_POLICY_ADAPTIVE].cost <= results[FLUSH_POLICY_DEADLINE].cost);
+    TEST_ASSERT_EQUAL_UINT64(0, results[FLUSH_POLICY_DEADLINE].decisions[FLUSH_SIGNAL]);
+
+    // Out of order traces and invalid configurations are refused
+    std::vector<FlushTraceEntry> backwards = trace;
+    backwards[10].time_s = 0;
+    TEST_ASSERT_FALSE(simulateFlushPolicy(backwards, kHeader, FLUSH_POLICY_DEADLINE,
+                                          config, &results[0]));
+    config.max_age_s = 0;
+    TEST_ASSERT_FALSE(simulateFlushPolicy(trace, kHeader, FLUSH_POLICY_ADAPTIVE,
+                                          config, &results[0]));
+}
+
+// Test: Trace files round-trip; malformed lines are refused
+void test_trace_files(void) {
+    char path[] = "/tmp/test_flush_traceXXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+
+    FlushTraceConfig trace_config;
+    initFlushTraceConfig(trace_config);
+    trace_config.hours = 2;
+    std::vector<FlushTraceEntry> trace, loaded;
+    generateFlushTrace(trace_config, &trace);
+    TEST_ASSERT_TRUE(saveFlushTrace(path, trace));
+    TEST_ASSERT_TRUE(loadFlushTrace(path, &loaded));
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)trace.size(), (uint32_t)loaded.size());
+    for (size_t i = 0; i < trace.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(trace[i].time_s, loaded[i].time_s);
+        TEST_ASSERT_EQUAL_INT8(trace[i].signal_dbm, loaded[i].signal_dbm);
+        TEST_ASSERT_EQUAL_HEX32(trace[i].presence_mask, loaded[i].presence_mask);
+    }
+
+    FILE *file = fopen(path, "w");
+    fprintf(file, "# comment\n\n0 -90 4000104\n60 -91\n");
+    fclose(file);
+    TEST_ASSERT_FALSE(loadFlushTrace(path, &loaded));
+    file = fopen(path, "w");
+    fprintf(file, "0 -90 4000104 # first\n60 -91 4000104\n");
+    fclose(file);
+    TEST_ASSERT_TRUE(loadFlushTrace(path, &loaded));
+    TEST_ASSERT_EQUAL_UINT32(2, (uint32_t)loaded.size());
+    TEST_ASSERT_EQUAL_HEX32(0x4000104, loaded[1].presence_mask);
+    TEST_ASSERT_FALSE(loadFlushTrace("/nonexistent/trace", &loaded));
+    unlink(path);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_cost_model);
+    RUN_TEST(test_full_and_deadline);
+    RUN_TEST(test_poor_signal_deferral);
+    RUN_TEST(test_signal_early_flush);
+    RUN_TEST(test_simulator);
+    RUN_TEST(test_trace_files);
+
+    return UNITY_END();
+}
@@ -0,0 +1,218 @@
+#include "unity.h"
+#include "ingest_metrics.h"
+#include "metrics_server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Test: Buckets are contiguous, hold their bounds and stay within 1/64
+void test_bucket_layout(void) {
+    TEST_ASSERT_EQUAL_UINT32(0, latencyBucket(0));
+    TEST_ASSERT_EQUAL_UINT32(127, latencyBucket(127));
+    TEST_ASSERT_EQUAL_UINT32(128, latencyBucket(128));
+    TEST_ASSERT_EQUAL_UINT32(128, latencyBucket(129));
+    for (uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+        uint64_t low = latencyBucketLow(b), high = latencyBucketHigh(b);
+        TEST_ASSERT_EQUAL_UINT32(b, latencyBucket(low));
+        TEST_ASSERT_EQUAL_UINT32(b, latencyBucket(high));
+        TEST_ASSERT_TRUE((high - low) * 64 <= low || high == low);
+        if (b + 1 < LATENCY_BUCKETS) {
+            TEST_ASSERT_EQUAL_UINT64(high + 1, latencyBucketLow(b + 1));
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT64(LATENCY_MAX_NS, latencyBucketHigh(LATENCY_BUCKETS - 1));
+    TEST_ASSERT_EQUAL_UINT32(LATENCY_BUCKETS - 1, latencyBucket(~0ULL));
+}
+
+// Test: Quantiles within bucket error; count, sum and max exact
+void test_quantiles(void) {
+    LatencyHistogram histogram;
+    TEST_ASSERT_EQUAL_UINT64(0, histogram.quantile(0.5));
+    for (uint64_t v = 1; v <= 100000; v++) {
+        histogram.record(v * 100);
+    }
+    TEST_ASSERT_EQUAL_UINT64(100000, histogram.getCount());
+    TEST_ASSERT_EQUAL_UINT64(100ULL * 100000 * 100001 / 2, histogram.getSum());
+    TEST_ASSERT_EQUAL_UINT64(10000000, histogram.getMax());
+    TEST_ASSERT_EQUAL_UINT64(10000000, histogram.quantile(1.0));
+    TEST_ASSERT_EQUAL_UINT64(100, histogram.quantile(0.0));
+
+    const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+    for (int i = 0; i < 4; i++) {
+        double exact = quantiles[i] * 10000000.0;
+        double got = (double)histogram.quantile(quantiles[i]);
+        TEST_ASSERT_TRUE(got >= exact);
+        TEST_ASSERT_TRUE(got <= exact * (1.0 + 1.0 / 64));
+    }
+
+    LatencyHistogram other;
+    other.record(20000000);
+    histogram.add(other);
+    TEST_ASSERT_EQUAL_UINT64(100001, histogram.getCount());
+    TEST_ASSERT_EQUAL_UINT64(20000000, histogram.getMax());
+}
+
+// Test: Sampling, per-thread tracers merged while they record
+void test_tracers(void) {
+    IngestMetrics metrics;
+    IngestTracer *sampled = metrics.addTracer(4);
+    for (int i = 0; i < 1600; i++) {
+        IngestTrace trace(sampled, ingestNowNs());
+        trace.mark(INGEST_STAGE_RECEIVE);
+        trace.mark(INGEST_STAGE_DECODE);
+    }
+    metrics.collect();
+    LatencyHistogram stage;
+    metrics.getStage(INGEST_STAGE_RECEIVE, &stage);
+    TEST_ASSERT_EQUAL_UINT64(100, stage.getCount());
+    metrics.getStage(INGEST_STAGE_DECODE, &stage);
+    TEST_ASSERT_EQUAL_UINT64(100, stage.getCount());
+    metrics.getStage(INGEST_STAGE_PERSIST, &stage);
+    TEST_ASSERT_EQUAL_UINT64(0, stage.getCount());
+
+    const int kThreads = 4;
+    const uint64_t kItems = 200000;
+    std::vector<IngestTracer *> tracers;
+    for (int t = 0; t < kThreads; t++)
+        tracers.push_back(metrics.addTracer(0));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.push_back(std::thread([&tracers, t, kItems]() {
+            for (uint64_t i = 0; i < kItems; i++)
+                tracers[t]->record(INGEST_STAGE_DECODE, 1000 + (i % 1000));
+        }));
+    }
+    for (int r = 0; r < 20; r++) {
+        metrics.collect();
+        metrics.getStage(INGEST_STAGE_DECODE, &stage);
+        TEST_ASSERT_TRUE(stage.getCount() <= kThreads * kItems + 100);
+    }
+    for (int t = 0; t < kThreads; t++)
+        threads[t].join();
+    metrics.collect();
+    metrics.getStage(INGEST_STAGE_DECODE, &stage);
+    TEST_ASSERT_EQUAL_UINT64(kThreads * kItems + 100, stage.getCount());
+    TEST_ASSERT_TRUE(stage.getMax() >= 1999);
+    LatencyHistogram first;
+    sampled->addTo(INGEST_STAGE_DECODE, &first);
+    TEST_ASSERT_EQUAL_UINT64(kThreads * (kItems / 1000) * (1000 * 1000 + 999 * 1000 / 2),
+                             stage.getSum() - first.getSum());
+}
+
+// Test: Prometheus text: summaries, counters grouped by name, gauges
+void test_prometheus_format(void) {
+    IngestMetrics metrics;
+    IngestTracer *tracer = metrics.addTracer(0);
+    tracer->record(INGEST_STAGE_PERSIST, 1500000000ULL);
+    uint32_t malformed = metrics.addCounter("ingest_dropped_total",
+                                            "reason=\"malformed\"", "Items dropped");
+    uint32_t depth = metrics.addGauge("ingest_queue_depth", "", "Batches queued");
+    uint32_t full = metrics.addCounter("ingest_dropped_total",
+                                       "reason=\"queue_full\"", "Items dropped");
+    metrics.add(malformed, 3);
+    metrics.add(full, 2);
+    metrics.add(full, 5);
+    metrics.set(depth, 12);
+    metrics.collect();
+
+    std::string text;
+    metrics.formatPrometheus(&text);
+    const char *expected[] = {
+        "# TYPE ingest_stage_latency_seconds summary\n",
+        "ingest_stage_latency_seconds{stage=\"persist\",quantile=\"0.99\"} 1.500000000\n",
+        "ingest_stage_latency_seconds_sum{stage=\"persist\"} 1.500000000\n",
+        "ingest_stage_latency_seconds_count{stage=\"persist\"} 1\n",
+        "ingest_stage_latency_seconds_count{stage=\"decode\"} 0\n",
+        "ingest_stage_latency_max_seconds{stage=\"persist\"} 1.500000000\n",
+        "# HELP ingest_dropped_total Items dropped\n# TYPE ingest_dropped_total counter\n"
+        "ingest_dropped_total{reason=\"malformed\"} 3\n"
+        "ingest_dropped_total{reason=\"queue_full\"} 7\n"
+        "# HELP ingest_queue_depth Batches queued\n# TYPE ingest_queue_depth gauge\n"
+        "ingest_queue_depth 12\n",
+    };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        TEST_ASSERT_NOT_NULL(strstr(text.c_str(), expected[i]));
+    }
+    TEST_ASSERT_EQUAL_INT64(7, metrics.get(full));
+}
+
+// Send a request to the server and return the whole response
+static std::string httpRequest(uint16_t port, const char *request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TEST_ASSERT_EQUAL_INT(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL_INT((int)strlen(request), (int)send(fd, request, strlen(request), 0));
+    std::string response;
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        response.append(buffer, (size_t)received);
+    close(fd);
+    return response;
+}
+
+// Test: /metrics over HTTP, with periodic collection; other requests refused
+void test_metrics_server(void) {
+    IngestMetrics metrics;
+    IngestTracer *tracer = metrics.addTracer(0);
+    uint32_t payloads = metrics.addCounter("ingest_payloads_total", "", "Payloads");
+    metrics.add(payloads, 42);
+
+    MetricsServer server;
+    TEST_ASSERT_TRUE(server.start(&metrics, "127.0.0.1", 0, 10));
+    TEST_ASSERT_TRUE(server.getPort() != 0);
+
+    std::string response = httpRequest(server.getPort(), "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+    TEST_ASSERT_EQUAL(0, response.find("HTTP/1.1 200 OK\r\n"));
+    TEST_ASSERT_TRUE(response.find("version=0.0.4") != std::string::npos);
+    TEST_ASSERT_TRUE(response.find("\r\n\r\n# HELP ingest_stage_latency_seconds") != std::string::npos);
+    TEST_ASSERT_TRUE(response.find("ingest_payloads_total 42\n") != std::string::npos);
+
+    // Recorded after start: visible once the server has collected again
+    tracer->record(INGEST_STAGE_AGGREGATE, 5000);
+    const char *needle = "ingest_stage_latency_seconds_count{stage=\"aggregate\"} 1\n";
+    bool seen = false;
+    for (int i = 0; i < 200 && !seen; i++) {
+        usleep(5000);
+        seen = httpRequest(server.getPort(), "GET /metrics HTTP/1.0\r\n\r\n").find(needle) !=
+               std::string::npos;
+    }
+    TEST_ASSERT_TRUE(seen);
+
+    response = httpRequest(server.getPort(), "GET / HTTP/1.1\r\n\r\n");
+    TEST_ASSERT_EQUAL(0, response.find("HTTP/1.1 404 Not Found\r\n"));
+    response = httpRequest(server.getPort(), "POST /metrics HTTP/1.1\r\n\r\n");
+    TEST_ASSERT_EQUAL(0, response.find("HTTP/1.1 405"));
+    TEST_ASSERT_TRUE(server.getRequestCount() >= 2);
+
+    server.stop();
+    TEST_ASSERT_FALSE(server.start(&metrics, "not an address", 0, 10));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_bucket_layout);
+    RUN_TEST(test_quantiles);
+    RUN_TEST(test_tracers);
+    RUN_TEST(test_prometheus_format);
+    RUN_TEST(test_metrics_server);
+
+    return UNITY_END();
+}
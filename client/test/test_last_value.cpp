@@ -0,0 +1,198 @@
+#include "unity.h"
+#include "last_value_cache.h"
+#include "payload_encoder.h"
+#include "sensor_fields.h"
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Reading whose every field is derived from value, so a torn copy shows
+static SensorReading makeReading(uint64_t value) {
+    SensorReading reading;
+    memset(&reading, 0, sizeof(reading));
+    reading.presence_mask = (uint32_t)(value * 2654435761u) & 0x07FFFFFF;
+    for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+        for (uint8_t channel = 0; channel < 2; channel++)
+            setSensorFieldValue(reading, (SensorFlag)flag, channel, (int64_t)(value + flag));
+    }
+    return reading;
+}
+
+static LastValueCache *makeCache(uint32_t max_devices, uint32_t history) {
+    LastValueCache *cache = new LastValueCache();
+    LastValueConfig config = LastValueCache::defaultConfig();
+    config.max_devices = max_devices;
+    config.history_length = history;
+    TEST_ASSERT_TRUE(cache->init(config));
+    return cache;
+}
+
+// Test: Latest value and history, newest first, with the ring wrapping
+void test_latest_and_history(void) {
+    LastValueCache *cache = makeCache(16, 4);
+    LastValue values[8];
+    TEST_ASSERT_FALSE(cache->getLatest(7, values));
+    TEST_ASSERT_EQUAL_UINT32(0, cache->getHistory(7, values, 8));
+
+    for (uint64_t t = 1; t <= 6; t++)
+        TEST_ASSERT_TRUE(cache->update(7, t * 1000, makeReading(t)));
+    TEST_ASSERT_TRUE(cache->update(8, 500, makeReading(50)));
+
+    TEST_ASSERT_TRUE(cache->getLatest(7, values));
+    TEST_ASSERT_EQUAL_UINT64(6000, values[0].timestamp_ms);
+    SensorReading expected = makeReading(6);
+    TEST_ASSERT_EQUAL_MEMORY(&expected, &values[0].reading, sizeof(SensorReading));
+
+    TEST_ASSERT_EQUAL_UINT32(4, cache->getHistory(7, values, 8));
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_UINT64((6 - i) * 1000, values[i].timestamp_ms);
+        expected = makeReading(6 - i);
+        TEST_ASSERT_EQUAL_MEMORY(&expected, &values[i].reading, sizeof(SensorReading));
+    }
+    TEST_ASSERT_EQUAL_UINT32(2, cache->getHistory(7, values, 2));
+    TEST_ASSERT_EQUAL_UINT32(1, cache->getHistory(8, values, 8));
+    TEST_ASSERT_EQUAL_UINT64(500, values[0].timestamp_ms);
+
+    // Older than the newest: dropped
+    TEST_ASSERT_TRUE(cache->update(7, 5500, makeReading(99)));
+    TEST_ASSERT_TRUE(cache->getLatest(7, values));
+    TEST_ASSERT_EQUAL_UINT64(6000, values[0].timestamp_ms);
+
+    LastValueStats stats = cache->getStats();
+    TEST_ASSERT_EQUAL_UINT64(2, stats.devices);
+    TEST_ASSERT_EQUAL_UINT64(7, stats.updates);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.stale);
+    delete cache;
+}
+
+// Test: A full table rejects new devices but keeps updating known ones
+void test_table_full(void) {
+    LastValueCache *cache = makeCache(3, 2);
+    for (uint64_t device = 0; device < 3; device++)
+        TEST_ASSERT_TRUE(cache->update(device, 1, makeReading(device)));
+    TEST_ASSERT_FALSE(cache->update(3, 1, makeReading(3)));
+    TEST_ASSERT_FALSE(cache->update(UINT64_MAX, 1, makeReading(3)));
+    TEST_ASSERT_TRUE(cache->update(2, 2, makeReading(4)));
+
+    LastValue value;
+    TEST_ASSERT_FALSE(cache->getLatest(3, &value));
+    TEST_ASSERT_TRUE(cache->getLatest(2, &value));
+    TEST_ASSERT_EQUAL_UINT64(2, value.timestamp_ms);
+    TEST_ASSERT_EQUAL_UINT64(3, cache->getStats().devices);
+    TEST_ASSERT_EQUAL_UINT64(1, cache->getStats().rejected);
+    TEST_ASSERT_TRUE(cache->getMemoryUsage() > 3 * 2 * sizeof(SensorReading));
+
+    LastValueConfig config = LastValueCache::defaultConfig();
+    config.history_length = LAST_VALUE_HISTORY_MAX + 1;
+    TEST_ASSERT_FALSE(cache->init(config));
+    delete cache;
+}
+
+// Test: Payload readings are stored one interval apart, ending at receive time
+void test_update_payload(void) {
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, false, false, 5};
+    encoder.init(header);
+    for (uint64_t i = 0; i < 3; i++) {
+        SensorReading reading;
+        initSensorReading(&reading);
+        setSensorFieldValue(reading, FLAG_CO2, 0, (int64_t)(400 + i));
+        reading.presence_mask = FLAG_BIT(FLAG_CO2);
+        encoder.addReading(reading);
+    }
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    int32_t length = encoder.encode(payload, sizeof(payload));
+    TEST_ASSERT_TRUE(length > 0);
+
+    LastValueCache *cache = makeCache(4, 8);
+    TEST_ASSERT_EQUAL_INT32(3, cache->updatePayload(9, 1000000, payload, (uint32_t)length));
+    TEST_ASSERT_EQUAL_INT32(-1, cache->updatePayload(9, 1000000, payload, 1));
+
+    LastValue values[4];
+    TEST_ASSERT_EQUAL_UINT32(3, cache->getHistory(9, values, 4));
+    for (uint32_t i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_UINT64(1000000 - i * 300000, values[i].timestamp_ms);
+        TEST_ASSERT_EQUAL_INT64(402 - i, getSensorFieldValue(values[i].reading, FLAG_CO2, 0));
+    }
+    delete cache;
+}
+
+// Test: Readers racing writers only ever see whole, ordered readings
+void test_concurrent_readers_and_writers(void) {
+    const uint32_t devices = 8;
+    const uint32_t history = 4;
+    LastValueCache *cache = makeCache(devices, history);
+    std::atomic<uint64_t> clock(1);
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> reads(0);
+    std::atomic<uint32_t> errors(0);
+
+    // Two writers share every device, so they also contend with each other
+    std::vector<std::thread> writers;
+    for (uint32_t w = 0; w < 2; w++) {
+        writers.push_back(std::thread([cache, &clock]() {
+            for (uint32_t i = 0; i < 40000; i++) {
+                uint64_t t = clock.fetch_add(1);
+                cache->update(t % devices, t, makeReading(t));
+            }
+        }));
+    }
+    std::vector<std::thread> readers;
+    for (uint32_t r = 0; r < 2; r++) {
+        readers.push_back(std::thread([cache, &done, &reads, &errors]() {
+            LastValue values[history];
+            while (!done.load()) {
+                for (uint64_t device = 0; device < devices; device++) {
+                    uint32_t count = cache->getHistory(device, values, history);
+                    for (uint32_t i = 0; i < count; i++) {
+                        SensorReading expected = makeReading(values[i].timestamp_ms);
+                        if (values[i].timestamp_ms % devices != device ||
+                            memcmp(&expected, &values[i].reading, sizeof(expected)) != 0 ||
+                            (i > 0 && values[i].timestamp_ms >= values[i - 1].timestamp_ms))
+                            errors.fetch_add(1);
+                    }
+                    reads.fetch_add(1);
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < writers.size(); i++)
+        writers[i].join();
+    done.store(true);
+    for (size_t i = 0; i < readers.size(); i++)
+        readers[i].join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, errors.load());
+    TEST_ASSERT_TRUE(reads.load() > 0);
+    LastValueStats stats = cache->getStats();
+    TEST_ASSERT_EQUAL_UINT64(80000, stats.updates + stats.stale);
+
+    // Every device ends with its newest readings
+    uint64_t last = clock.load() - 1;
+    for (uint64_t device = 0; device < devices; device++) {
+        LastValue value;
+        TEST_ASSERT_TRUE(cache->getLatest(device, &value));
+        TEST_ASSERT_TRUE(value.timestamp_ms + devices * 2 > last);
+    }
+    delete cache;
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_latest_and_history);
+    RUN_TEST(test_table_full);
+    RUN_TEST(test_update_payload);
+    RUN_TEST(test_concurrent_readers_and_writers);
+
+    return UNITY_END();
+}
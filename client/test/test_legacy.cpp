@@ -0,0 +1,253 @@
+#include "unity.h"
+#include "fleet_generator.h"
+#include "legacy_transcoder.h"
+#include "payload_archive.h"
+#include "payload_decoder.h"
+#include "rollup_reader.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static const char *kInput = "test_legacy_input.txt";
+static const char *kPrefix = "test_legacy_out";
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+static int32_t parse(const char *text, PayloadHeader *header, SensorReading *readings) {
+    LegacyLayout layout;
+    initLegacyLayout(layout);
+    return parseLegacyPayload(text, (uint32_t)strlen(text), layout, header, readings);
+}
+
+// Test: Values in physical units become raw values, present fields form the mask
+void test_parse_single(void) {
+    PayloadHeader header;
+    SensorReading readings[MAX_BATCH_SIZE];
+    TEST_ASSERT_EQUAL(1, parse("5:23.45,51.2,412", &header, readings));
+    TEST_ASSERT_EQUAL(5, header.interval_minutes);
+    TEST_ASSERT_FALSE(header.dual_mode);
+    TEST_ASSERT_FALSE(header.dedicated_temphum_sensor);
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_HUM) | FLAG_BIT(FLAG_CO2),
+                            readings[0].presence_mask);
+    TEST_ASSERT_EQUAL(2345, readings[0].temp[0]);
+    TEST_ASSERT_EQUAL(5120, readings[0].hum[0]);
+    TEST_ASSERT_EQUAL(412, readings[0].co2);
+
+    // Negative, rounding beyond the field's precision, empty fields
+    TEST_ASSERT_EQUAL(2, parse("1:-5.006,,,,,,,,12.34;,,400", &header, readings));
+    TEST_ASSERT_EQUAL(-501, readings[0].temp[0]);
+    TEST_ASSERT_EQUAL(123, readings[0].pm_25[0]);
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_PM_25), readings[0].presence_mask);
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_CO2), readings[1].presence_mask);
+}
+
+// Test: Dual mode takes both channels of expandable fields, except temp/hum
+// with a dedicated sensor
+void test_parse_dual(void) {
+    PayloadHeader header;
+    SensorReading readings[MAX_BATCH_SIZE];
+    TEST_ASSERT_EQUAL(1, parse("2DT:21.5,40,,,,,,1.5/2.0,12.3/12.1", &header, readings));
+    TEST_ASSERT_TRUE(header.dual_mode);
+    TEST_ASSERT_TRUE(header.dedicated_temphum_sensor);
+    TEST_ASSERT_EQUAL(2150, readings[0].temp[0]);
+    TEST_ASSERT_EQUAL(15, readings[0].pm_01[0]);
+    TEST_ASSERT_EQUAL(20, readings[0].pm_01[1]);
+    TEST_ASSERT_EQUAL(123, readings[0].pm_25[0]);
+    TEST_ASSERT_EQUAL(121, readings[0].pm_25[1]);
+
+    TEST_ASSERT_EQUAL(1, parse("1D:21.5/22.0,40/41", &header, readings));
+    TEST_ASSERT_EQUAL(2200, readings[0].temp[1]);
+    TEST_ASSERT_EQUAL(4100, readings[0].hum[1]);
+}
+
+// Test: Malformed payloads are rejected
+void test_parse_malformed(void) {
+    PayloadHeader header;
+    SensorReading readings[MAX_BATCH_SIZE];
+    TEST_ASSERT_EQUAL(-1, parse("", &header, readings));
+    TEST_ASSERT_EQUAL(-1, parse("5", &header, readings));            // No ':'
+    TEST_ASSERT_EQUAL(-1, parse("X:1", &header, readings));          // No interval
+    TEST_ASSERT_EQUAL(-1, parse("256:1", &header, readings));        // Interval range
+    TEST_ASSERT_EQUAL(-1, parse("5Q:1", &header, readings));         // Unknown mode
+    TEST_ASSERT_EQUAL(-1, parse("5:abc", &header, readings));        // Not a number
+    TEST_ASSERT_EQUAL(-1, parse("5:1.2.3", &header, readings));
+    TEST_ASSERT_EQUAL(-1, parse("5:,,70000", &header, readings));    // co2 range
+    TEST_ASSERT_EQUAL(-1, parse("5:,-1", &header, readings));        // Unsigned
+    TEST_ASSERT_EQUAL(-1, parse("1D:21.5,40", &header, readings));   // One channel
+    TEST_ASSERT_EQUAL(-1, parse("1:21.5/22", &header, readings));    // Two channels
+
+    // One field too many
+    std::string text = "1:";
+    for (int i = 0; i < SENSOR_FIELD_COUNT; i++)
+        text += ",";
+    TEST_ASSERT_EQUAL(-1, parse(text.c_str(), &header, readings));
+    text.erase(text.size() - 1);
+    TEST_ASSERT_EQUAL(1, parse(text.c_str(), &header, readings));
+
+    // Batch limit
+    text = "1:1";
+    for (int i = 0; i < MAX_BATCH_SIZE; i++)
+        text += ";1";
+    TEST_ASSERT_EQUAL(-1, parse(text.c_str(), &header, readings));
+}
+
+// Test: Custom field order
+void test_layout(void) {
+    LegacyLayout layout;
+    TEST_ASSERT_TRUE(parseLegacyLayout("co2,temperature,signal", layout));
+    TEST_ASSERT_EQUAL(3, layout.field_count);
+    PayloadHeader header;
+    SensorReading readings[MAX_BATCH_SIZE];
+    const char *text = "1:415,-2.5,-71";
+    TEST_ASSERT_EQUAL(1, parseLegacyPayload(text, (uint32_t)strlen(text), layout, &header, readings));
+    TEST_ASSERT_EQUAL(415, readings[0].co2);
+    TEST_ASSERT_EQUAL(-250, readings[0].temp[0]);
+    TEST_ASSERT_EQUAL(-71, readings[0].signal);
+    text = "1:415,-2.5,-71,1";
+    TEST_ASSERT_EQUAL(-1, parseLegacyPayload(text, (uint32_t)strlen(text), layout, &header, readings));
+
+    TEST_ASSERT_FALSE(parseLegacyLayout("co2,bogus", layout));
+    TEST_ASSERT_FALSE(parseLegacyLayout("co2,co2", layout));
+    TEST_ASSERT_FALSE(parseLegacyLayout("co2,", layout));
+}
+
+// Test: Fleet payloads formatted as legacy text transcode back to the same
+// bytes, for every profile
+void test_round_trip(void) {
+    FleetConfig config;
+    initFleetConfig(config);
+    config.devices = 40;
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+    LegacyLayout layout;
+    initLegacyLayout(layout);
+
+    LegacyTranscoder transcoder;
+    PayloadDecoder decoder;
+    uint8_t original[MAX_PAYLOAD_SIZE], transcoded[MAX_PAYLOAD_SIZE];
+    for (uint32_t d = 0; d < config.devices; d++) {
+        for (int i = 0; i < 5; i++) {
+            FleetPayloadInfo info;
+            int32_t length = generator.generate(d, original, sizeof(original), &info);
+            int32_t count = decoder.decode(original, (uint32_t)length);
+            TEST_ASSERT_TRUE(count > 0);
+            std::vector<SensorReading> readings;
+            for (int32_t r = 0; r < count; r++)
+                readings.push_back(decoder.getReading((uint8_t)r));
+
+            std::string text;
+            formatLegacyPayload(decoder.getHeader(), readings.data(), (uint32_t)count, layout, &text);
+            TEST_ASSERT_EQUAL(length, transcoder.transcode(text.data(), (uint32_t)text.size(),
+                                                           transcoded, sizeof(transcoded)));
+            TEST_ASSERT_EQUAL_MEMORY(original, transcoded, length);
+            TEST_ASSERT_EQUAL(count, transcoder.getReadingCount());
+        }
+    }
+    TEST_ASSERT_EQUAL(-1, transcoder.transcode("bad", 3, transcoded, sizeof(transcoded)));
+    TEST_ASSERT_EQUAL(0, transcoder.getReadingCount());
+}
+
+// Test: Bulk transcoding of a file into archive segments and rollups, with
+// malformed lines skipped and counted
+void test_bulk(void) {
+    FleetConfig config;
+    initFleetConfig(config);
+    config.devices = 100;
+    FleetGenerator generator;
+    TEST_ASSERT_TRUE(generator.init(config));
+    LegacyLayout layout;
+    initLegacyLayout(layout);
+
+    FILE *file = fopen(kInput, "w");
+    TEST_ASSERT_NOT_NULL(file);
+    PayloadDecoder decoder;
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    uint64_t payloads = 0, readings = 0, bytes = 0;
+    for (int i = 0; i < 10; i++) {
+        for (uint32_t d = 0; d < config.devices; d++) {
+            FleetPayloadInfo info;
+            int32_t length = generator.generate(d, payload, sizeof(payload), &info);
+            int32_t count = decoder.decode(payload, (uint32_t)length);
+            std::vector<SensorReading> batch;
+            for (int32_t r = 0; r < count; r++)
+                batch.push_back(decoder.getReading((uint8_t)r));
+            std::string text;
+            formatLegacyPayload(decoder.getHeader(), batch.data(), (uint32_t)count, layout, &text);
+            fprintf(file, "%llu %llu %s\r\n", (unsigned long long)info.device_id,
+                    (unsigned long long)info.timestamp_ms, text.c_str());
+            payloads++;
+            readings += (uint64_t)count;
+            bytes += (uint64_t)length;
+        }
+    }
+    fprintf(file, "\n7 1000 5:abc\n");   // Malformed payload
+    fprintf(file, "7 5:1\n");            // Missing timestamp
+    fprintf(file, "8 2000 5:1");         // Last line without newline
+    fclose(file);
+
+    LegacyBulkConfig bulk = defaultLegacyBulkConfig();
+    bulk.threads = 3;
+    LegacyBulkStats stats;
+    std::vector<std::string> outputs;
+    std::vector<std::string> inputs(1, kInput);
+    TEST_ASSERT_TRUE(transcodeLegacyFiles(inputs, kPrefix, bulk, &stats, &outputs));
+    TEST_ASSERT_EQUAL(6, outputs.size());
+    TEST_ASSERT_EQUAL_UINT64(payloads + 3, stats.lines);
+    TEST_ASSERT_EQUAL_UINT64(payloads + 1, stats.payloads);
+    TEST_ASSERT_EQUAL_UINT64(readings + 1, stats.readings);
+    TEST_ASSERT_EQUAL_UINT64(2, stats.malformed);
+
+    uint64_t records = 0, record_bytes = 0, rows = 0;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (outputs[i].find(".seg") != std::string::npos) {
+            ArchiveReader reader;
+            TEST_ASSERT_TRUE(reader.open(outputs[i].c_str()));
+            PayloadRecordHeader header;
+            const uint8_t *data;
+            uint64_t last_sequence = 0;
+            while (reader.next(&header, &data) > 0) {
+                TEST_ASSERT_TRUE(header.sequence > last_sequence);
+                last_sequence = header.sequence;
+                TEST_ASSERT_TRUE(decoder.decode(data, header.length) > 0);
+                records++;
+                record_bytes += header.length;
+            }
+        } else {
+            RollupReader reader;
+            TEST_ASSERT_TRUE(reader.open(outputs[i].c_str()));
+            rows += reader.getRowCount();
+        }
+        remove(outputs[i].c_str());
+    }
+    TEST_ASSERT_EQUAL_UINT64(payloads + 1, records);
+    TEST_ASSERT_EQUAL_UINT64(stats.output_bytes, record_bytes);
+    TEST_ASSERT_TRUE(record_bytes > bytes);
+    TEST_ASSERT_EQUAL_UINT64(readings + 1, rows);
+
+    inputs.push_back("test_legacy_missing.txt");
+    outputs.clear();
+    TEST_ASSERT_FALSE(transcodeLegacyFiles(inputs, kPrefix, bulk, &stats, &outputs));
+    for (size_t i = 0; i < outputs.size(); i++)
+        remove(outputs[i].c_str());
+    remove(kInput);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_parse_single);
+    RUN_TEST(test_parse_dual);
+    RUN_TEST(test_parse_malformed);
+    RUN_TEST(test_layout);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_bulk);
+
+    return UNITY_END();
+}
@@ -0,0 +1,155 @@
+#include "unity.h"
+#include "decode_plan.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+#include "payload_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t payload[MAX_PAYLOAD_SIZE + 8];
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Batch of readings with varying masks and values
+static int32_t makeBatch(bool dual, bool dedicated, uint8_t count, uint32_t seed) {
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, dual, dedicated, 5};
+    encoder.init(header);
+    srand(seed);
+    for (uint8_t i = 0; i < count; i++) {
+        SensorReading reading;
+        initSensorReading(&reading);
+        reading.presence_mask = (((uint32_t)rand() << 16) ^ (uint32_t)rand()) & 0x07FFFFFF;
+        for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+            for (uint8_t channel = 0; channel < 2; channel++)
+                setSensorFieldValue(reading, (SensorFlag)flag, channel, rand());
+        }
+        encoder.addReading(reading);
+    }
+    return encoder.encode(payload, MAX_PAYLOAD_SIZE);
+}
+
+// Test: Popcount sizing matches the field-by-field layout
+void test_reading_size_matches_fields(void) {
+    srand(34);
+    for (int iteration = 0; iteration < 5000; iteration++) {
+        PayloadHeader header = {1, (iteration & 1) != 0, (iteration & 2) != 0, 5};
+        uint32_t mask = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        DecodePlan plan;
+        compileDecodePlan(mask, header, plan);
+        TEST_ASSERT_EQUAL_UINT32(plan.data_size, readingDataSize(mask, header));
+    }
+
+    PayloadHeader dual = {1, true, false, 5};
+    TEST_ASSERT_EQUAL_UINT32(MAX_READING_SIZE - 4, readingDataSize(0xFFFFFFFF, dual));
+
+    // temp[2], hum[2], co2, pm25[2] in dual mode
+    uint32_t mask = FLAG_BIT(FLAG_TEMP) | FLAG_BIT(FLAG_HUM) | FLAG_BIT(FLAG_CO2) |
+                    FLAG_BIT(FLAG_PM_25);
+    TEST_ASSERT_EQUAL_INT32(0, fieldDataOffset(mask, dual, FLAG_TEMP));
+    TEST_ASSERT_EQUAL_INT32(8, fieldDataOffset(mask, dual, FLAG_CO2));
+    TEST_ASSERT_EQUAL_INT32(10, fieldDataOffset(mask, dual, FLAG_PM_25));
+    TEST_ASSERT_EQUAL_INT32(-1, fieldDataOffset(mask, dual, FLAG_PM_01));
+}
+
+// Test: Any reading decodes on its own, in any order, like a full decode
+void test_random_access_matches_decoder(void) {
+    PayloadDecoder decoder;
+    DecodePlanCache plans;
+    for (int mode = 0; mode < 3; mode++) {
+        int32_t size = makeBatch(mode > 0, mode == 2, MAX_BATCH_SIZE, 100 + mode);
+        TEST_ASSERT_EQUAL_INT32(MAX_BATCH_SIZE, decoder.decode(payload, size));
+
+        PayloadIndex index;
+        TEST_ASSERT_EQUAL_INT32(MAX_BATCH_SIZE, indexPayload(payload, size, index));
+        TEST_ASSERT_EQUAL_UINT16(2, index.offsets[0]);
+        TEST_ASSERT_EQUAL_UINT16(size, index.offsets[MAX_BATCH_SIZE]);
+        TEST_ASSERT_TRUE(index.header.dual_mode == (mode > 0));
+
+        for (int i = MAX_BATCH_SIZE - 1; i >= 0; i--) {
+            SensorReading reading;
+            TEST_ASSERT_TRUE(decodeIndexedReading(payload, index, (uint8_t)i, reading,
+                                                  (i & 1) ? &plans : nullptr));
+            TEST_ASSERT_EQUAL_MEMORY(&decoder.getReading((uint8_t)i), &reading,
+                                     sizeof(SensorReading));
+        }
+        SensorReading reading;
+        TEST_ASSERT_FALSE(decodeIndexedReading(payload, index, MAX_BATCH_SIZE, reading));
+    }
+}
+
+// Test: Single fields read in place match the decoded values
+void test_read_single_fields(void) {
+    PayloadDecoder decoder;
+    for (int mode = 0; mode < 3; mode++) {
+        int32_t size = makeBatch(mode > 0, mode == 2, 8, 200 + mode);
+        TEST_ASSERT_EQUAL_INT32(8, decoder.decode(payload, size));
+        PayloadIndex index;
+        TEST_ASSERT_EQUAL_INT32(8, indexPayload(payload, size, index));
+
+        for (uint8_t k = 0; k < 8; k++) {
+            const SensorReading &reading = decoder.getReading(k);
+            for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+                bool present = IS_FLAG_SET(reading.presence_mask, flag);
+                bool second = present && mode == 1 && kSensorFields[flag].expandable;
+                if (mode == 2)
+                    second = present && kSensorFields[flag].expandable &&
+                             flag != FLAG_TEMP && flag != FLAG_HUM;
+
+                int64_t value = 0;
+                TEST_ASSERT_TRUE(present == readIndexedField(payload, index, k, (SensorFlag)flag, 0, &value));
+                if (present)
+                    TEST_ASSERT_TRUE(value == getSensorFieldValue(reading, (SensorFlag)flag, 0));
+                TEST_ASSERT_TRUE(second == readIndexedField(payload, index, k, (SensorFlag)flag, 1, &value));
+                if (second)
+                    TEST_ASSERT_TRUE(value == getSensorFieldValue(reading, (SensorFlag)flag, 1));
+            }
+        }
+    }
+}
+
+// Test: Malformed payloads are rejected by the index pass
+void test_malformed_rejected(void) {
+    PayloadIndex index;
+    PayloadDecoder decoder;
+    int32_t size = makeBatch(true, false, 3, 300);
+
+    TEST_ASSERT_EQUAL_INT32(3, indexPayload(payload, size, index));
+    TEST_ASSERT_EQUAL_INT32(-1, indexPayload(nullptr, size, index));
+    TEST_ASSERT_EQUAL_INT32(-1, indexPayload(payload, 1, index));
+    TEST_ASSERT_EQUAL_INT32(0, indexPayload(payload, 2, index));
+
+    // Cut inside the last reading or its mask, or trailing bytes
+    for (int32_t cut = index.offsets[2] + 1; cut < size; cut++) {
+        TEST_ASSERT_EQUAL_INT32(-1, indexPayload(payload, cut, index));
+        TEST_ASSERT_EQUAL_INT32(-1, decoder.decode(payload, cut));
+        TEST_ASSERT_EQUAL_UINT8(0, decoder.getReadingCount());
+    }
+    payload[size] = 0x00;
+    TEST_ASSERT_EQUAL_INT32(-1, indexPayload(payload, size + 1, index));
+
+    // More readings than MAX_BATCH_SIZE: empty readings are 4 bytes each
+    uint8_t many[2 + 4 * (MAX_BATCH_SIZE + 1)];
+    memset(many, 0, sizeof(many));
+    many[0] = 0x01;
+    TEST_ASSERT_EQUAL_INT32(MAX_BATCH_SIZE, indexPayload(many, sizeof(many) - 4, index));
+    TEST_ASSERT_EQUAL_INT32(-1, indexPayload(many, sizeof(many), index));
+    TEST_ASSERT_EQUAL_INT32(-1, decoder.decode(many, sizeof(many)));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reading_size_matches_fields);
+    RUN_TEST(test_random_access_matches_decoder);
+    RUN_TEST(test_read_single_fields);
+    RUN_TEST(test_malformed_rejected);
+
+    return UNITY_END();
+}
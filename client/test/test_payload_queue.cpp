@@ -0,0 +1,325 @@
+#include "unity.h"
+#include "file_flash.h"
+#include "payload_queue.h"
+#include "payload_stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static char flash_path[64];
+
+void setUp(void) {
+    strcpy(flash_path, "/tmp/test_payload_queueXXXXXX");
+    int fd = mkstemp(flash_path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+}
+
+void tearDown(void) {
+    unlink(flash_path);
+}
+
+// Payload i: header bytes and a size that varies with i
+static std::vector<uint8_t> makePayload(uint32_t i) {
+    std::vector<uint8_t> payload(20 + (i * 37) % 90);
+    for (size_t b = 0; b < payload.size(); b++)
+        payload[b] = (uint8_t)(i * 31 + b * 7);
+    payload[0] = 0x01;
+    payload[1] = 0x05;
+    return payload;
+}
+
+// Stream frames of payloads [first, last)
+static std::vector<uint8_t> expectedFrames(uint32_t first, uint32_t last) {
+    std::vector<uint8_t> frames;
+    for (uint32_t i = first; i < last; i++) {
+        std::vector<uint8_t> payload = makePayload(i);
+        uint8_t frame[MAX_PAYLOAD_SIZE + STREAM_FRAME_OVERHEAD];
+        uint32_t size = writeStreamFrame(frame, payload.data(), (uint32_t)payload.size());
+        frames.insert(frames.end(), frame, frame + size);
+    }
+    return frames;
+}
+
+// Drain and commit everything, in bursts of burst_size
+static std::vector<uint8_t> drainAll(PayloadQueue &queue, uint32_t burst_size,
+                                     uint32_t *payloads) {
+    std::vector<uint8_t> all;
+    std::vector<uint8_t> burst(burst_size);
+    *payloads = 0;
+    for (;;) {
+        uint32_t count;
+        int32_t size = queue.drain(burst.data(), burst_size, &count);
+        TEST_ASSERT_TRUE(size >= 0);
+        if (size == 0)
+            break;
+        all.insert(all.end(), burst.begin(), burst.begin() + size);
+        *payloads += count;
+        TEST_ASSERT_TRUE(queue.commitDrain());
+    }
+    return all;
+}
+
+// Test: Payloads come back as stream frames in order, survive a remount and
+// are removed only on commit
+void test_queue_roundtrip(void) {
+    FileFlash flash;
+    TEST_ASSERT_TRUE(flash.open(flash_path, 512, 8, 8));
+    PayloadQueue queue;
+    TEST_ASSERT_TRUE(queue.mount(flash.region()));
+    TEST_ASSERT_EQUAL_UINT32(0, queue.pendingCount());
+
+    uint8_t burst[4096];
+    uint32_t count;
+    TEST_ASSERT_EQUAL_INT32(0, queue.drain(burst, sizeof(burst), &count));
+    TEST_ASSERT_TRUE(queue.commitDrain()); // Nothing to acknowledge
+
+    for (uint32_t i = 0; i < 10; i++) {
+        std::vector<uint8_t> payload = makePayload(i);
+        TEST_ASSERT_TRUE(queue.enqueue(payload.data(), (uint32_t)payload.size()));
+    }
+    TEST_ASSERT_EQUAL_UINT32(10, queue.pendingCount());
+
+    std::vector<uint8_t> expected = expectedFrames(0, 10);
+    int32_t size = queue.drain(burst, sizeof(burst), &count);
+    TEST_ASSERT_EQUAL_INT32((int32_t)expected.size(), size);
+    TEST_ASSERT_EQUAL_UINT32(10, count);
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), burst, expected.size());
+
+    // Not committed: a remount delivers the same payloads
+    PayloadQueue remounted;
+    TEST_ASSERT_TRUE(remounted.mount(flash.region()));
+    TEST_ASSERT_EQUAL_UINT32(10, remounted.pendingCount());
+    size = remounted.drain(burst, sizeof(burst), &count);
+    TEST_ASSERT_EQUAL_INT32((int32_t)expected.size(), size);
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), burst, expected.size());
+    TEST_ASSERT_TRUE(remounted.commitDrain());
+    TEST_ASSERT_EQUAL_UINT32(0, remounted.pendingCount());
+    TEST_ASSERT_EQUAL_UINT64(10, remounted.getStats().drained);
+    TEST_ASSERT_EQUAL_INT32(0, remounted.drain(burst, sizeof(burst), &count));
+
+    // Committed: gone after a remount, and numbering carries on
+    TEST_ASSERT_TRUE(queue.mount(flash.region()));
+    TEST_ASSERT_EQUAL_UINT32(0, queue.pendingCount());
+    std::vector<uint8_t> payload = makePayload(10);
+    TEST_ASSERT_TRUE(queue.enqueue(payload.data(), (uint32_t)payload.size()));
+    expected = expectedFrames(10, 11);
+    size = queue.drain(burst, sizeof(burst), &count);
+    TEST_ASSERT_EQUAL_INT32((int32_t)expected.size(), size);
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), burst, expected.size());
+    TEST_ASSERT_EQUAL_UINT32(0, queue.getStats().torn_records);
+}
+
+// Test: Bursts stop at the buffer size; a partial commit survives a remount
+void test_queue_bursts(void) {
+    FileFlash flash;
+    TEST_ASSERT_TRUE(flash.open(flash_path, 512, 8, 8));
+    PayloadQueue queue;
+    TEST_ASSERT_TRUE(queue.mount(flash.region()));
+    for (uint32_t i = 0; i < 20; i++) {
+        std::vector<uint8_t> payload = makePayload(i);
+        TEST_ASSERT_TRUE(queue.enqueue(payload.data(), (uint32_t)payload.size()));
+    }
+
+    // Payload 0 takes 29 bytes framed, payload 1 66
+    uint8_t burst[300];
+    uint32_t count;
+    TEST_ASSERT_EQUAL_INT32(-1, queue.drain(burst, 28, &count));
+    TEST_ASSERT_EQUAL_INT32(29, queue.drain(burst, 94, &count));
+    TEST_ASSERT_EQUAL_UINT32(1, count);
+    TEST_ASSERT_EQUAL_INT32(95, queue.drain(burst, 95, &count));
+    TEST_ASSERT_EQUAL_UINT32(2, count);
+    TEST_ASSERT_TRUE(queue.commitDrain());
+    TEST_ASSERT_EQUAL_UINT32(18, queue.pendingCount());
+
+    PayloadQueue remounted;
+    TEST_ASSERT_TRUE(remounted.mount(flash.region()));
+    TEST_ASSERT_EQUAL_UINT32(18, remounted.pendingCount());
+    uint32_t payloads;
+    std::vector<uint8_t> all = drainAll(remounted, sizeof(burst), &payloads);
+    std::vector<uint8_t> expected = expectedFrames(2, 20);
+    TEST_ASSERT_EQUAL_UINT32(18, payloads);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)expected.size(), (uint32_t)all.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), all.data(), expected.size());
+}
+
+// Test: A full ring drops the oldest payloads and keeps the newest in order
+void test_queue_overwrite(void) {
+    FileFlash flash;
+    TEST_ASSERT_TRUE(flash.open(flash_path, 512, 4, 8));
+    PayloadQueue queue;
+    TEST_ASSERT_TRUE(queue.mount(flash.region()));
+    const uint32_t total = 100;
+    for (uint32_t i = 0; i < total; i++) {
+        std::vector<uint8_t> payload = makePayload(i);
+        TEST_ASSERT_TRUE(queue.enqueue(payload.data(), (uint32_t)payload.size()));
+    }
+    const PayloadQueueStats &stats = queue.getStats();
+    TEST_ASSERT_TRUE(stats.dropped > 0);
+    TEST_ASSERT_EQUAL_UINT64(total, stats.dropped + queue.pendingCount());
+
+    uint32_t pending = queue.pendingCount();
+    PayloadQueue remounted;
+    TEST_ASSERT_TRUE(remounted.mount(flash.region()));
+    TEST_ASSERT_EQUAL_UINT32(pending, remounted.pendingCount());
+
+    uint32_t payloads;
+    std::vector<uint8_t> all = drainAll(remounted, 1024, &payloads);
+    std::vector<uint8_t> expected = expectedFrames(total - pending, total);
+    TEST_ASSERT_EQUAL_UINT32(pending, payloads);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)expected.size(), (uint32_t)all.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected.data(), all.data(), expected.size());
+}
+
+// Test: Sectors are erased in turn, across remounts and an empty queue
+void test_queue_wear(void) {
+    FileFlash flash;
+    TEST_ASSERT_TRUE(flash.open(flash_path, 512, 8, 16));
+    PayloadQueue queue;
+    TEST_ASSERT_TRUE(queue.mount(flash.region()));
+    uint32_t next = 0;
+    for (uint32_t round = 0; round < 60; round++) {
+        for (uint32_t i = 0; i < 5; i++, next++) {
+            std::vector<uint8_t> payload = makePayload(next);
+            TEST_ASSERT_TRUE(queue.enqueue(payload.data(), (uint32_t)payload.size()));
+        }
+        uint32_t payloads;
+        drainAll(queue, 2048, &payloads);
+        TEST_ASSERT_EQUAL_UINT32(5, payloads);
+        if (round % 10 == 9)
+            TEST_ASSERT_TRUE(queue.mount(flash.region()));
+    }
+
+    uint32_t min_erases = UINT32_MAX, max_erases = 0;
+    for (uint32_t sector = 0; sector < 8; sector++) {
+        uint32_t erases = flash.eraseCount(sector);
+        min_erases = erases < min_erases ? erases : min_erases;
+        max_erases = erases > max_erases ? erases : max_erases;
+    }
+    TEST_ASSERT_TRUE(min_erases >= 5);
+    TEST_ASSERT_TRUE(max_erases - min_erases <= 1);
+}
+
+// Cut the power at every byte of a workload, remount and drain. The queue
+// must hold payloads first .. last in order: first between the last confirmed
+// and the last attempted commit (or later, once the ring drops payloads),
+// last between the last confirmed and the last attempted enqueue.
+// Returns: bytes programmed by the workload without a cut
+static uint64_t powerCutSweep(uint32_t sector_count, bool may_drop) {
+    const uint32_t count = 30;
+
+    for (uint64_t cut = 0;; cut++) {
+        unlink(flash_path); // Start from erased flash
+        FileFlash flash;
+        TEST_ASSERT_TRUE(flash.open(flash_path, 512, sector_count, 8));
+        flash.setPowerCut(cut);
+        PayloadQueue queue;
+        TEST_ASSERT_TRUE(queue.mount(flash.region()));
+
+        uint32_t enqueued = 0;   // enqueue() returned true
+        uint32_t attempted = 0;  // enqueue() called
+        uint32_t committed = 0;  // commitDrain() returned true
+        uint32_t committing = 0; // Covered by the last commitDrain() call
+        bool running = true;
+        for (uint32_t i = 0; i < count && running; i++) {
+            std::vector<uint8_t> payload = makePayload(i);
+            attempted = i + 1;
+            running = queue.enqueue(payload.data(), (uint32_t)payload.size());
+            if (!running)
+                break;
+            enqueued = i + 1;
+            if (i % 7 == 6) {
+                uint8_t burst[256];
+                uint32_t drained;
+                TEST_ASSERT_TRUE(queue.drain(burst, sizeof(burst), &drained) > 0);
+                committing = enqueued - queue.pendingCount() + drained;
+                running = queue.commitDrain();
+                if (running)
+                    committed = committing;
+            }
+        }
+        if (running) {
+            TEST_ASSERT_FALSE(flash.powerCut());
+            return queue.getStats().bytes_programmed;
+        }
+        TEST_ASSERT_TRUE(flash.powerCut());
+
+        // Power back on
+        flash.setPowerCut(UINT64_MAX);
+        PayloadQueue recovered;
+        TEST_ASSERT_TRUE(recovered.mount(flash.region()));
+        uint32_t payloads;
+        std::vector<uint8_t> all = drainAll(recovered, 1024, &payloads);
+
+        uint32_t last_first = may_drop ? attempted : committing;
+        bool matched = false;
+        for (uint32_t first = committed; first <= last_first && !matched; first++) {
+            uint32_t last = first + payloads;
+            if (last < enqueued || last > attempted)
+                continue;
+            std::vector<uint8_t> expected = expectedFrames(first, last);
+            matched = expected.size() == all.size() &&
+                      memcmp(expected.data(), all.data(), all.size()) == 0;
+        }
+        TEST_ASSERT_TRUE_MESSAGE(matched, "recovered payloads do not match");
+
+        // Writing goes on after the damage
+        std::vector<uint8_t> payload = makePayload(count);
+        TEST_ASSERT_TRUE(recovered.enqueue(payload.data(), (uint32_t)payload.size()));
+        TEST_ASSERT_EQUAL_UINT32(1, recovered.pendingCount());
+        TEST_ASSERT_TRUE(recovered.mount(flash.region()));
+        TEST_ASSERT_EQUAL_UINT32(1, recovered.pendingCount());
+    }
+}
+
+// Test: Power cuts with room to spare, and with the ring overwriting
+void test_queue_power_loss(void) {
+    TEST_ASSERT_TRUE(powerCutSweep(16, false) > 2000);
+    TEST_ASSERT_TRUE(powerCutSweep(4, true) > 2048);
+}
+
+// Test: Invalid geometry and payload sizes are refused
+void test_queue_invalid(void) {
+    FileFlash flash;
+    TEST_ASSERT_TRUE(flash.open(flash_path, 512, 8, 8));
+    PayloadQueue queue;
+    FlashRegion region = flash.region();
+    region.sector_count = 1;
+    TEST_ASSERT_FALSE(queue.mount(region));
+    region = flash.region();
+    region.program_size = 12;
+    TEST_ASSERT_FALSE(queue.mount(region));
+    region.program_size = 128;
+    TEST_ASSERT_FALSE(queue.mount(region));
+    region = flash.region();
+    region.sector_size = 32;
+    TEST_ASSERT_FALSE(queue.mount(region));
+    region = flash.region();
+    region.erase = nullptr;
+    TEST_ASSERT_FALSE(queue.mount(region));
+
+    TEST_ASSERT_TRUE(queue.mount(flash.region()));
+    // 512 - 16 (sector header) - 12 (record) - 9 (frame)
+    TEST_ASSERT_EQUAL_UINT32(475, queue.maxPayloadSize());
+    uint8_t payload[512];
+    memset(payload, 0x11, sizeof(payload));
+    TEST_ASSERT_FALSE(queue.enqueue(payload, 1));
+    TEST_ASSERT_FALSE(queue.enqueue(payload, 476));
+    TEST_ASSERT_FALSE(queue.enqueue(nullptr, 10));
+    TEST_ASSERT_TRUE(queue.enqueue(payload, 475));
+    TEST_ASSERT_EQUAL_UINT32(1, queue.pendingCount());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_queue_roundtrip);
+    RUN_TEST(test_queue_bursts);
+    RUN_TEST(test_queue_overwrite);
+    RUN_TEST(test_queue_wear);
+    RUN_TEST(test_queue_power_loss);
+    RUN_TEST(test_queue_invalid);
+
+    return UNITY_END();
+}
@@ -0,0 +1,197 @@
+#include "unity.h"
+#include "reading_assembler.h"
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Part of a reading as each sensor task would build it, all fields = value
+static SensorReading pmPart(uint32_t value) {
+    SensorReading part;
+    initSensorReading(&part);
+    setFlag(&part, FLAG_PM_01);
+    setFlag(&part, FLAG_PM_25);
+    setFlag(&part, FLAG_PM_10);
+    part.pm_01[0] = part.pm_25[0] = part.pm_10[0] = (uint16_t)value;
+    part.pm_25[1] = (uint16_t)(value + 1);
+    return part;
+}
+
+static SensorReading gasPart(uint32_t value) {
+    SensorReading part;
+    initSensorReading(&part);
+    setFlag(&part, FLAG_CO2);
+    setFlag(&part, FLAG_TVOC);
+    setFlag(&part, FLAG_NOX);
+    part.co2 = part.tvoc = part.nox = (uint16_t)value;
+    return part;
+}
+
+static SensorReading electrochemPart(uint32_t value) {
+    SensorReading part;
+    initSensorReading(&part);
+    setFlag(&part, FLAG_O3_WE);
+    setFlag(&part, FLAG_NO2_WE);
+    setFlag(&part, FLAG_SIGNAL);
+    part.o3_we = part.no2_we = value;
+    part.signal = (int8_t)(value & 0x7F);
+    return part;
+}
+
+static SensorReading (*const kParts[3])(uint32_t) = {pmPart, gasPart, electrochemPart};
+
+static const uint32_t kPartMasks[3] = {
+    FLAG_BIT(FLAG_PM_01) | FLAG_BIT(FLAG_PM_25) | FLAG_BIT(FLAG_PM_10),
+    FLAG_BIT(FLAG_CO2) | FLAG_BIT(FLAG_TVOC) | FLAG_BIT(FLAG_NOX),
+    FLAG_BIT(FLAG_O3_WE) | FLAG_BIT(FLAG_NO2_WE) | FLAG_BIT(FLAG_SIGNAL),
+};
+
+// Value of part t in reading, or -1 if its fields are torn
+static int64_t partValue(const SensorReading &reading, int t) {
+    if (t == 0) {
+        uint16_t v = reading.pm_01[0];
+        bool whole = reading.pm_25[0] == v && reading.pm_10[0] == v &&
+                     reading.pm_25[1] == (uint16_t)(v + 1);
+        return whole ? v : -1;
+    }
+    if (t == 1) {
+        uint16_t v = reading.co2;
+        return reading.tvoc == v && reading.nox == v ? v : -1;
+    }
+    uint32_t v = reading.o3_we;
+    return reading.no2_we == v && reading.signal == (int8_t)(v & 0x7F) ? v : -1;
+}
+
+// Test: Parts merge into one reading; commit empties it
+void test_merge_and_commit(void) {
+    ReadingAssembler assembler;
+    SensorReading reading;
+    TEST_ASSERT_EQUAL_INT32(0, assembler.commit(&reading));
+
+    assembler.contribute(pmPart(120));
+    assembler.contribute(gasPart(415));
+    SensorReading empty;
+    initSensorReading(&empty);
+    empty.co2 = 9999; // Not flagged: ignored
+    assembler.contribute(empty);
+    assembler.contribute(gasPart(420)); // Overwrites the earlier part
+    TEST_ASSERT_EQUAL_INT32(1, assembler.commit(&reading));
+    TEST_ASSERT_EQUAL_HEX32(kPartMasks[0] | kPartMasks[1], reading.presence_mask);
+    TEST_ASSERT_EQUAL_INT64(120, partValue(reading, 0));
+    TEST_ASSERT_EQUAL_INT64(420, partValue(reading, 1));
+    TEST_ASSERT_EQUAL_UINT16(121, reading.pm_25[1]);
+
+    // The next reading starts empty
+    TEST_ASSERT_EQUAL_INT32(0, assembler.commit(&reading));
+    assembler.contribute(electrochemPart(70000));
+    TEST_ASSERT_EQUAL_INT32(1, assembler.commit(&reading));
+    TEST_ASSERT_EQUAL_HEX32(kPartMasks[2], reading.presence_mask);
+    TEST_ASSERT_EQUAL_INT64(70000, partValue(reading, 2));
+    TEST_ASSERT_EQUAL_UINT16(0, reading.co2);
+}
+
+// Test: One part per sensor task per round: every committed reading holds
+// exactly that round's three parts
+void test_rounds(void) {
+    const uint32_t kRounds = 20000;
+    ReadingAssembler assembler;
+    std::atomic<uint32_t> round(0), contributed(0);
+    std::vector<std::thread> tasks;
+    for (int t = 0; t < 3; t++) {
+        tasks.push_back(std::thread([&, t]() {
+            for (uint32_t r = 0; r < kRounds; r++) {
+                while (round.load() != r)
+                    std::this_thread::yield();
+                assembler.contribute(kParts[t](r));
+                contributed.fetch_add(1);
+            }
+        }));
+    }
+
+    uint32_t complete = 0;
+    for (uint32_t r = 0; r < kRounds; r++) {
+        while (contributed.load() != 3 * (r + 1))
+            std::this_thread::yield();
+        SensorReading reading;
+        bool ok = assembler.commit(&reading) == 1 &&
+                  reading.presence_mask == (kPartMasks[0] | kPartMasks[1] | kPartMasks[2]);
+        for (int t = 0; t < 3 && ok; t++)
+            ok = partValue(reading, t) == (int64_t)r;
+        complete += ok ? 1 : 0;
+        round.store(r + 1);
+    }
+    for (int t = 0; t < 3; t++)
+        tasks[t].join();
+    TEST_ASSERT_EQUAL_UINT32(kRounds, complete);
+}
+
+// Test: Free-running sensor tasks and committer: no torn parts, values only
+// move forward, and the last part of every task is committed
+void test_concurrent_stress(void) {
+    const uint32_t kPartsPerTask = 60000; // 16-bit fields do not wrap
+    ReadingAssembler assembler;
+    std::atomic<int> running(3);
+    std::vector<std::thread> tasks;
+    for (int t = 0; t < 3; t++) {
+        tasks.push_back(std::thread([&, t]() {
+            for (uint32_t i = 1; i <= kPartsPerTask; i++)
+                assembler.contribute(kParts[t](i));
+            running.fetch_sub(1);
+        }));
+    }
+
+    int64_t last[3] = {0, 0, 0};
+    uint64_t readings = 0, torn = 0, backwards = 0;
+    bool drained = false;
+    while (!drained) {
+        bool finished = running.load() == 0;
+        SensorReading reading;
+        int32_t result = assembler.commit(&reading);
+        if (result < 0)
+            continue; // A part is still being copied
+        if (result == 0) {
+            drained = finished; // Empty after every task stopped
+            continue;
+        }
+        readings++;
+        for (int t = 0; t < 3; t++) {
+            if ((reading.presence_mask & kPartMasks[t]) == 0)
+                continue;
+            int64_t value = partValue(reading, t);
+            if (value < 0) {
+                torn++;
+                continue;
+            }
+            // A part lands in exactly one reading
+            if (value <= last[t])
+                backwards++;
+            last[t] = value;
+        }
+    }
+    for (int t = 0; t < 3; t++)
+        tasks[t].join();
+
+    TEST_ASSERT_EQUAL_UINT64(0, torn);
+    TEST_ASSERT_EQUAL_UINT64(0, backwards);
+    TEST_ASSERT_TRUE(readings > 0);
+    for (int t = 0; t < 3; t++)
+        TEST_ASSERT_EQUAL_INT64(kPartsPerTask, last[t]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_merge_and_commit);
+    RUN_TEST(test_rounds);
+    RUN_TEST(test_concurrent_stress);
+
+    return UNITY_END();
+}
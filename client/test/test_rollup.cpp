@@ -0,0 +1,264 @@
+#include "unity.h"
+#include "rollup_scan.h"
+#include "rollup_writer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static const char *kRollupPath = "test_rollup.agr";
+static const uint32_t kGroupRows = 128;
+static const uint32_t kRows = 300;  // Two full groups and a partial one
+
+// Deterministic reading for row i: pm25 always, co2 on even rows,
+// o3_we on every third row, signal constant
+static SensorReading makeReading(uint32_t i) {
+    SensorReading reading;
+    memset(&reading, 0, sizeof(reading));
+    setFlag(&reading, FLAG_PM_25);
+    reading.pm_25[0] = (uint16_t)((i * 37) % 1000);
+    if (i % 2 == 0) {
+        setFlag(&reading, FLAG_CO2);
+        reading.co2 = (uint16_t)(400 + i);
+    }
+    if (i % 3 == 0) {
+        setFlag(&reading, FLAG_O3_WE);
+        reading.o3_we = 100000u * i;
+    }
+    setFlag(&reading, FLAG_SIGNAL);
+    reading.signal = -70;
+    return reading;
+}
+
+static uint64_t countMatches(const RollupReader &reader, uint32_t column,
+                             int64_t lo, int64_t hi) {
+    RollupPredicate predicate = {column, lo, hi};
+    return rollupScan(reader, &predicate, 1, nullptr, nullptr, nullptr);
+}
+
+void setUp(void) {
+    RollupWriter writer;
+    TEST_ASSERT_TRUE(writer.open(kRollupPath, kGroupRows));
+    for (uint32_t i = 0; i < kRows; i++) {
+        SensorReading reading = makeReading(i);
+        TEST_ASSERT_TRUE(writer.addReading(1000 + (i % 7), 1700000000000ULL + i * 60000,
+                                           reading));
+    }
+    TEST_ASSERT_TRUE(writer.close());
+}
+
+void tearDown(void) {
+    rollupForceScalar(false);
+    unlink(kRollupPath);
+}
+
+// Test: Every value reads back with presence preserved
+void test_rollup_round_trip(void) {
+    RollupReader reader;
+    TEST_ASSERT_TRUE(reader.open(kRollupPath));
+    TEST_ASSERT_EQUAL_UINT64(kRows, reader.getRowCount());
+    TEST_ASSERT_EQUAL_UINT32(3, reader.getGroupCount());
+
+    for (uint32_t g = 0; g < reader.getGroupCount(); g++) {
+        const RollupGroup &group = reader.getGroup(g);
+        for (uint32_t row = 0; row < group.row_count; row++) {
+            uint32_t i = (uint32_t)group.first_row + row;
+            SensorReading expected = makeReading(i);
+            int64_t value;
+
+            TEST_ASSERT_TRUE(reader.getValue(group, ROLLUP_COLUMN_DEVICE, row, &value));
+            TEST_ASSERT_EQUAL_INT64(1000 + (i % 7), value);
+            TEST_ASSERT_TRUE(reader.getValue(group, ROLLUP_COLUMN_TIMESTAMP, row, &value));
+            TEST_ASSERT_EQUAL_INT64(1700000000000LL + i * 60000, value);
+
+            for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+                bool present = reader.getValue(group, ROLLUP_COLUMN_FIELD(flag), row, &value);
+                TEST_ASSERT_EQUAL(IS_FLAG_SET(expected.presence_mask, flag), present);
+                if (present) {
+                    TEST_ASSERT_EQUAL_INT64(
+                        getSensorFieldValue(expected, (SensorFlag)flag, 0), value);
+                }
+            }
+        }
+    }
+}
+
+// Test: Codecs are chosen by the value range of each chunk
+void test_rollup_codecs(void) {
+    RollupReader reader;
+    TEST_ASSERT_TRUE(reader.open(kRollupPath));
+    const RollupGroup &group = reader.getGroup(0);
+
+    TEST_ASSERT_EQUAL_UINT8(ROLLUP_CODEC_FOR8, group.chunks[ROLLUP_COLUMN_DEVICE].codec);
+    TEST_ASSERT_EQUAL_UINT8(ROLLUP_CODEC_FOR32, group.chunks[ROLLUP_COLUMN_TIMESTAMP].codec);
+    TEST_ASSERT_EQUAL_UINT8(ROLLUP_CODEC_FOR16, group.chunks[ROLLUP_COLUMN_FIELD(FLAG_PM_25)].codec);
+    TEST_ASSERT_EQUAL_UINT8(ROLLUP_CODEC_FOR32, group.chunks[ROLLUP_COLUMN_FIELD(FLAG_O3_WE)].codec);
+    TEST_ASSERT_EQUAL_UINT8(ROLLUP_CODEC_CONSTANT, group.chunks[ROLLUP_COLUMN_FIELD(FLAG_SIGNAL)].codec);
+    TEST_ASSERT_EQUAL_UINT32(0, group.chunks[ROLLUP_COLUMN_FIELD(FLAG_TEMP)].present_count);
+    TEST_ASSERT_EQUAL_UINT32(64, group.chunks[ROLLUP_COLUMN_FIELD(FLAG_CO2)].present_count);
+}
+
+// Test: Range scans match a brute-force count, with both kernels
+void test_rollup_scan_matches_reference(void) {
+    RollupReader reader;
+    TEST_ASSERT_TRUE(reader.open(kRollupPath));
+
+    const int64_t ranges[][2] = {{350, 999}, {0, 0}, {-5, 10}, {500, 500}, {1001, 2000}};
+    for (int scalar = 0; scalar <= 1; scalar++) {
+        rollupForceScalar(scalar == 1);
+        for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+            int64_t lo = ranges[r][0];
+            int64_t hi = ranges[r][1];
+            uint64_t pm_expected = 0;
+            uint64_t co2_expected = 0;
+            for (uint32_t i = 0; i < kRows; i++) {
+                SensorReading reading = makeReading(i);
+                pm_expected += reading.pm_25[0] >= lo && reading.pm_25[0] <= hi;
+                co2_expected += isFlagSet(&reading, FLAG_CO2) &&
+                                reading.co2 >= 400 + lo && reading.co2 <= 400 + hi;
+            }
+            TEST_ASSERT_EQUAL_UINT64(pm_expected,
+                countMatches(reader, ROLLUP_COLUMN_FIELD(FLAG_PM_25), lo, hi));
+            TEST_ASSERT_EQUAL_UINT64(co2_expected,
+                countMatches(reader, ROLLUP_COLUMN_FIELD(FLAG_CO2), 400 + lo, 400 + hi));
+        }
+    }
+}
+
+// Test: Zone maps skip groups and conjunctions AND the bitmaps
+void test_rollup_zone_maps_and_conjunction(void) {
+    RollupReader reader;
+    TEST_ASSERT_TRUE(reader.open(kRollupPath));
+
+    // Only the last group has timestamps this late
+    RollupPredicate predicates[2] = {
+        {ROLLUP_COLUMN_TIMESTAMP, 1700000000000LL + 256 * 60000, INT64_MAX},
+        {ROLLUP_COLUMN_FIELD(FLAG_O3_WE), 0, INT64_MAX},
+    };
+    RollupScanStats stats;
+    uint64_t matched = rollupScan(reader, predicates, 2, nullptr, nullptr, &stats);
+
+    uint64_t expected = 0;
+    for (uint32_t i = 256; i < kRows; i++) {
+        expected += i % 3 == 0;
+    }
+    TEST_ASSERT_EQUAL_UINT64(expected, matched);
+    TEST_ASSERT_EQUAL_UINT64(3, stats.groups);
+    TEST_ASSERT_EQUAL_UINT64(2, stats.groups_skipped);
+}
+
+// Test: AVX2 and scalar kernels agree for every width and odd row counts
+void test_rollup_kernels_agree(void) {
+    if (!rollupHaveAvx2()) {
+        TEST_IGNORE();
+    }
+
+    const uint32_t rows = 1000;
+    std::vector<uint8_t> data(rows * 8);
+    srand(42);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)rand();
+    }
+
+    for (uint8_t codec = ROLLUP_CODEC_FOR8; codec <= ROLLUP_CODEC_FOR64; codec++) {
+        uint64_t max = codec == ROLLUP_CODEC_FOR64 ? UINT64_MAX
+                                                   : (1ULL << (8 * rollupCodecWidth(codec))) - 1;
+        for (int trial = 0; trial < 50; trial++) {
+            uint64_t a = (uint64_t)rand() * rand() & max;
+            uint64_t b = (uint64_t)rand() * rand() & max;
+            uint64_t lo = a < b ? a : b;
+            uint64_t hi = a < b ? b : a;
+            uint32_t count = rows - (uint32_t)trial;
+
+            uint64_t scalar_bits[16];
+            uint64_t avx2_bits[16];
+            rollupRangeScalar(data.data(), codec, count, lo, hi, scalar_bits);
+            rollupRangeAvx2(data.data(), codec, count, lo, hi, avx2_bits);
+            TEST_ASSERT_EQUAL_MEMORY(scalar_bits, avx2_bits, ((count + 63) / 64) * 8);
+        }
+    }
+}
+
+// Test: Truncated files are rejected
+void test_rollup_rejects_truncated_file(void) {
+    TEST_ASSERT_EQUAL_INT(0, truncate(kRollupPath, 100));
+    RollupReader reader;
+    TEST_ASSERT_FALSE(reader.open(kRollupPath));
+}
+
+// Scan kRollupPath rewritten with one temperature per row
+static uint64_t countTemperature(const int16_t *temps, uint32_t count,
+                                 const char *text) {
+    RollupWriter writer;
+    TEST_ASSERT_TRUE(writer.open(kRollupPath, kGroupRows));
+    for (uint32_t i = 0; i < count; i++) {
+        SensorReading reading;
+        memset(&reading, 0, sizeof(reading));
+        setFlag(&reading, FLAG_TEMP);
+        reading.temp[0] = temps[i];
+        TEST_ASSERT_TRUE(writer.addReading(1000, 1700000000000ULL + i * 60000,
+                                           reading));
+    }
+    TEST_ASSERT_TRUE(writer.close());
+
+    RollupReader reader;
+    TEST_ASSERT_TRUE(reader.open(kRollupPath));
+    RollupPredicate predicate;
+    TEST_ASSERT_TRUE(rollupParsePredicate(text, false, 0, &predicate));
+    return rollupScan(reader, &predicate, 1, nullptr, nullptr, nullptr);
+}
+
+// Test: Decimal predicates are exact in raw units, whatever their binary
+// floating-point value
+void test_rollup_parse_predicate(void) {
+    const int16_t temps[] = {2010, 29, 115, -115, 2000};
+    TEST_ASSERT_EQUAL_UINT64(1, countTemperature(temps, 5, "temperature>=20.1"));
+    TEST_ASSERT_EQUAL_UINT64(3, countTemperature(temps, 5, "temperature>0.29"));
+    TEST_ASSERT_EQUAL_UINT64(1, countTemperature(temps, 5, "temperature=1.15"));
+    TEST_ASSERT_EQUAL_UINT64(3, countTemperature(temps, 5, "temperature<=1.15"));
+    TEST_ASSERT_EQUAL_UINT64(1, countTemperature(temps, 5, "temperature=-1.15"));
+    TEST_ASSERT_EQUAL_UINT64(0, countTemperature(temps, 5, "temperature=1.151"));
+    TEST_ASSERT_EQUAL_UINT64(3, countTemperature(temps, 5, "temperature>1.1499"));
+    TEST_ASSERT_EQUAL_UINT64(1, countTemperature(temps, 5, "temperature<-1.1499"));
+
+    RollupPredicate predicate;
+    TEST_ASSERT_TRUE(rollupParsePredicate("temperature>=20.1", false, 0, &predicate));
+    TEST_ASSERT_EQUAL_INT64(2010, predicate.lo);
+    TEST_ASSERT_TRUE(rollupParsePredicate("temperature<0.295", false, 0, &predicate));
+    TEST_ASSERT_EQUAL_INT64(29, predicate.hi);
+    TEST_ASSERT_TRUE(rollupParsePredicate("pm25=35", true, 0, &predicate));
+    TEST_ASSERT_EQUAL_UINT32(ROLLUP_COLUMN_FIELD(FLAG_PM_25), predicate.column);
+    TEST_ASSERT_EQUAL_INT64(35, predicate.lo);
+    TEST_ASSERT_EQUAL_INT64(35, predicate.hi);
+    TEST_ASSERT_TRUE(rollupParsePredicate("timestamp>=now-1.5m", false,
+                                          1000000, &predicate));
+    TEST_ASSERT_EQUAL_UINT32(ROLLUP_COLUMN_TIMESTAMP, predicate.column);
+    TEST_ASSERT_EQUAL_INT64(1000000 - 90000, predicate.lo);
+    TEST_ASSERT_FALSE(rollupParsePredicate("humidity>1e3", false, 0, &predicate));
+    TEST_ASSERT_FALSE(rollupParsePredicate("nosuch>1", false, 0, &predicate));
+    TEST_ASSERT_FALSE(rollupParsePredicate("timestamp<now-3w", false, 0, &predicate));
+    TEST_ASSERT_FALSE(rollupParsePredicate("temperature>", false, 0, &predicate));
+
+    // A column outside the file is refused rather than read past the chunks
+    RollupReader reader;
+    TEST_ASSERT_TRUE(reader.open(kRollupPath));
+    predicate.column = ROLLUP_COLUMN_COUNT;
+    predicate.lo = INT64_MIN;
+    predicate.hi = INT64_MAX;
+    TEST_ASSERT_EQUAL_UINT64(0, rollupScan(reader, &predicate, 1, nullptr, nullptr,
+                                           nullptr));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_rollup_round_trip);
+    RUN_TEST(test_rollup_codecs);
+    RUN_TEST(test_rollup_scan_matches_reference);
+    RUN_TEST(test_rollup_zone_maps_and_conjunction);
+    RUN_TEST(test_rollup_kernels_agree);
+    RUN_TEST(test_rollup_rejects_truncated_file);
+    RUN_TEST(test_rollup_parse_predicate);
+
+    return UNITY_END();
+}
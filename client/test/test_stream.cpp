@@ -0,0 +1,240 @@
+#include "unity.h"
+#include "decode_plan.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+#include "payload_stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Everything the callbacks saw
+typedef struct {
+    std::vector<SensorReading> readings;
+    std::vector<StreamFrameStatus> frames;
+    std::vector<uint8_t> frame_readings;
+} Received;
+
+static void onReading(const PayloadHeader &, uint8_t index, const SensorReading &reading,
+                      void *user) {
+    Received *received = (Received *)user;
+    // Readings of one frame arrive in order, starting at 0
+    size_t frame_start = received->readings.size();
+    for (size_t i = 0; i < received->frame_readings.size(); i++)
+        frame_start -= received->frame_readings[i];
+    TEST_ASSERT_EQUAL_UINT32(frame_start, index);
+    received->readings.push_back(reading);
+}
+
+static void onFrame(const PayloadHeader &, uint8_t reading_count, StreamFrameStatus status,
+                    void *user) {
+    Received *received = (Received *)user;
+    received->frames.push_back(status);
+    received->frame_readings.push_back(reading_count);
+}
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Payload with count readings of varying masks
+static std::vector<uint8_t> makePayload(bool dual, uint8_t count, uint32_t seed) {
+    if (count == 0) {
+        // The encoder needs a reading: header only
+        std::vector<uint8_t> header;
+        header.push_back(dual ? 0x09 : 0x01);
+        header.push_back(0x05);
+        return header;
+    }
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, dual, false, 5};
+    encoder.init(header);
+    srand(seed);
+    for (uint8_t i = 0; i < count; i++) {
+        SensorReading reading;
+        initSensorReading(&reading);
+        reading.presence_mask = (((uint32_t)rand() << 16) ^ (uint32_t)rand()) & 0x07FFFFFF;
+        if (i == 1)
+            reading.presence_mask = 0;  // Empty reading
+        for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+            for (uint8_t channel = 0; channel < 2; channel++)
+                setSensorFieldValue(reading, (SensorFlag)flag, channel, rand());
+        }
+        encoder.addReading(reading);
+    }
+    std::vector<uint8_t> payload(MAX_PAYLOAD_SIZE);
+    payload.resize((size_t)encoder.encode(payload.data(), (uint32_t)payload.size()));
+    return payload;
+}
+
+static void appendFrame(std::vector<uint8_t> &stream, const std::vector<uint8_t> &payload) {
+    size_t start = stream.size();
+    stream.resize(start + payload.size() + STREAM_FRAME_OVERHEAD);
+    TEST_ASSERT_EQUAL_UINT32(payload.size() + STREAM_FRAME_OVERHEAD,
+                             writeStreamFrame(&stream[start], payload.data(),
+                                              (uint32_t)payload.size()));
+}
+
+// Readings of the payloads, as PayloadDecoder sees them
+static std::vector<SensorReading> decodeAll(const std::vector<std::vector<uint8_t> > &payloads) {
+    std::vector<SensorReading> readings;
+    PayloadDecoder decoder;
+    for (size_t i = 0; i < payloads.size(); i++) {
+        int32_t count = decoder.decode(payloads[i].data(), (uint32_t)payloads[i].size());
+        TEST_ASSERT_TRUE(count >= 0);
+        for (int32_t r = 0; r < count; r++)
+            readings.push_back(decoder.getReading((uint8_t)r));
+    }
+    return readings;
+}
+
+static void assertReadings(const std::vector<SensorReading> &expected,
+                           const std::vector<SensorReading> &actual) {
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++)
+        TEST_ASSERT_EQUAL_MEMORY(&expected[i], &actual[i], sizeof(SensorReading));
+}
+
+// Test: Concatenated frames decode the same for any chunk size
+void test_any_chunk_size(void) {
+    std::vector<std::vector<uint8_t> > payloads;
+    std::vector<uint8_t> stream;
+    for (uint32_t i = 0; i < 6; i++) {
+        payloads.push_back(makePayload(i % 2 == 1, (uint8_t)(i == 3 ? 0 : 1 + i * 3), 50 + i));
+        appendFrame(stream, payloads.back());
+    }
+    std::vector<SensorReading> expected = decodeAll(payloads);
+
+    DecodePlanCache plans;
+    for (uint32_t chunk = 1; chunk <= stream.size(); chunk += (chunk < 100 ? 1 : 97)) {
+        Received received;
+        StreamDecoder decoder;
+        decoder.setCallbacks(onReading, onFrame, &received);
+        if (chunk % 2 == 0)
+            decoder.setPlanCache(&plans);
+        for (size_t offset = 0; offset < stream.size(); offset += chunk) {
+            uint32_t size = (uint32_t)(stream.size() - offset < chunk ? stream.size() - offset : chunk);
+            decoder.feed(&stream[offset], size);
+        }
+
+        assertReadings(expected, received.readings);
+        TEST_ASSERT_EQUAL_UINT32(6, received.frames.size());
+        for (size_t i = 0; i < received.frames.size(); i++)
+            TEST_ASSERT_EQUAL_INT(STREAM_FRAME_OK, received.frames[i]);
+        TEST_ASSERT_EQUAL_UINT8(0, received.frame_readings[3]);
+        TEST_ASSERT_EQUAL_UINT64(6, decoder.getStats().frames);
+        TEST_ASSERT_EQUAL_UINT64(0, decoder.getStats().skipped_bytes);
+        TEST_ASSERT_FALSE(decoder.inFrame());
+    }
+}
+
+// Test: Garbage and damaged frames are skipped, later frames still decode
+void test_resync_after_corruption(void) {
+    std::vector<uint8_t> first = makePayload(false, 3, 60);
+    std::vector<uint8_t> second = makePayload(true, 4, 61);
+    std::vector<uint8_t> third = makePayload(false, 2, 62);
+
+    // Line noise with false syncs, a frame with a flipped payload bit, a
+    // header with a bad check byte, then two good frames
+    const uint8_t noise[] = {0x00, STREAM_FRAME_SYNC0, 0x13, STREAM_FRAME_SYNC0,
+                             STREAM_FRAME_SYNC0, STREAM_FRAME_SYNC1, 0xFF, 0xFF, 0x00};
+    std::vector<uint8_t> stream(noise, noise + sizeof(noise));
+    appendFrame(stream, first);
+    stream[sizeof(noise) + STREAM_FRAME_HEADER_SIZE + 7] ^= 0x10;
+    const uint8_t bad_header[] = {STREAM_FRAME_SYNC0, STREAM_FRAME_SYNC1, 0x10, 0x00, 0x00};
+    stream.insert(stream.end(), bad_header, bad_header + sizeof(bad_header));
+    appendFrame(stream, second);
+    appendFrame(stream, third);
+
+    Received received;
+    StreamDecoder decoder;
+    decoder.setCallbacks(onReading, onFrame, &received);
+    for (size_t offset = 0; offset < stream.size(); offset += 7)
+        decoder.feed(&stream[offset], (uint32_t)(stream.size() - offset < 7 ? stream.size() - offset : 7));
+
+    TEST_ASSERT_EQUAL_UINT32(3, received.frames.size());
+    TEST_ASSERT_EQUAL_INT(STREAM_FRAME_BAD_CRC, received.frames[0]);
+    TEST_ASSERT_EQUAL_INT(STREAM_FRAME_OK, received.frames[1]);
+    TEST_ASSERT_EQUAL_INT(STREAM_FRAME_OK, received.frames[2]);
+
+    std::vector<std::vector<uint8_t> > good_payloads;
+    good_payloads.push_back(second);
+    good_payloads.push_back(third);
+    std::vector<SensorReading> expected = decodeAll(good_payloads);
+    std::vector<SensorReading> tail(received.readings.end() - expected.size(),
+                                    received.readings.end());
+    assertReadings(expected, tail);
+
+    const StreamDecoderStats &stats = decoder.getStats();
+    TEST_ASSERT_EQUAL_UINT64(2, stats.frames);
+    TEST_ASSERT_EQUAL_UINT64(1, stats.crc_errors);
+    // Noise and the bad header, not the damaged frame (it was consumed)
+    TEST_ASSERT_EQUAL_UINT64(sizeof(noise) + sizeof(bad_header), stats.skipped_bytes);
+}
+
+// Test: A frame whose readings overrun its length is abandoned at once
+void test_malformed_frame(void) {
+    std::vector<uint8_t> payload = makePayload(false, 2, 70);
+    std::vector<uint8_t> next = makePayload(false, 1, 71);
+
+    // Claim the frame is 3 bytes shorter: the second reading no longer fits
+    std::vector<uint8_t> stream;
+    appendFrame(stream, payload);
+    uint32_t short_length = (uint32_t)payload.size() - 3;
+    stream[2] = (uint8_t)short_length;
+    stream[3] = (uint8_t)(short_length >> 8);
+    stream[4] = (uint8_t)~(stream[2] ^ stream[3]);
+    appendFrame(stream, next);
+
+    Received received;
+    StreamDecoder decoder;
+    decoder.setCallbacks(onReading, onFrame, &received);
+    decoder.feed(stream.data(), (uint32_t)stream.size());
+
+    TEST_ASSERT_EQUAL_UINT32(2, received.frames.size());
+    TEST_ASSERT_EQUAL_INT(STREAM_FRAME_MALFORMED, received.frames[0]);
+    TEST_ASSERT_EQUAL_UINT8(1, received.frame_readings[0]);
+    TEST_ASSERT_EQUAL_INT(STREAM_FRAME_OK, received.frames[1]);
+    TEST_ASSERT_EQUAL_UINT64(1, decoder.getStats().malformed);
+}
+
+// Test: Frame writer limits and reset() mid-frame
+void test_writer_limits_and_reset(void) {
+    uint8_t buffer[MAX_PAYLOAD_SIZE + STREAM_FRAME_OVERHEAD + 1];
+    uint8_t payload[MAX_PAYLOAD_SIZE + 1];
+    memset(payload, 0, sizeof(payload));
+    TEST_ASSERT_EQUAL_UINT32(0, writeStreamFrame(buffer, payload, 1));
+    TEST_ASSERT_EQUAL_UINT32(0, writeStreamFrame(buffer, payload, MAX_PAYLOAD_SIZE + 1));
+
+    // Header-only payload: a frame with no readings
+    payload[0] = 0x01;
+    payload[1] = 0x05;
+    uint32_t size = writeStreamFrame(buffer, payload, 2);
+    TEST_ASSERT_EQUAL_UINT32(2 + STREAM_FRAME_OVERHEAD, size);
+
+    Received received;
+    StreamDecoder decoder;
+    decoder.setCallbacks(onReading, onFrame, &received);
+    decoder.feed(buffer, 6);
+    TEST_ASSERT_TRUE(decoder.inFrame());
+    decoder.reset();
+    TEST_ASSERT_FALSE(decoder.inFrame());
+    decoder.feed(buffer, size);
+    TEST_ASSERT_EQUAL_UINT32(1, received.frames.size());
+    TEST_ASSERT_EQUAL_INT(STREAM_FRAME_OK, received.frames[0]);
+    TEST_ASSERT_EQUAL_UINT8(0, received.frame_readings[0]);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_any_chunk_size);
+    RUN_TEST(test_resync_after_corruption);
+    RUN_TEST(test_malformed_frame);
+    RUN_TEST(test_writer_limits_and_reset);
+
+    return UNITY_END();
+}
@@ -0,0 +1,256 @@
+#include "unity.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+
+static const PayloadHeader kHeader = {1, false, false, 5};
+
+PayloadEncoder encoder;
+
+void setUp(void) {
+    UrgentThresholds thresholds = {1500, 1200, 555, 350};
+    encoder.init(kHeader);
+    TEST_ASSERT_TRUE(encoder.setUrgentThresholds(thresholds));
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+// Reading with temperature, CO2 and PM2.5
+static SensorReading makeReading(uint16_t co2, uint16_t pm_25) {
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_TEMP);
+    setFlag(&reading, FLAG_CO2);
+    setFlag(&reading, FLAG_PM_25);
+    reading.temp[0] = 2150;
+    reading.co2 = co2;
+    reading.pm_25[0] = pm_25;
+    reading.pm_25[1] = 0;
+    return reading;
+}
+
+// Encode the urgent reading and report it delivered
+static void sendUrgent(void) {
+    uint8_t buffer[URGENT_PAYLOAD_SIZE];
+    TEST_ASSERT_TRUE(encoder.encodeUrgent(buffer, sizeof(buffer)) > 0);
+    encoder.markUrgentSent();
+}
+
+// Test: Alarms are raised on crossings only and re-armed below the clear level
+void test_urgent_trigger(void) {
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+    encoder.addReading(makeReading(800, 100));
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+
+    encoder.addReading(makeReading(1500, 100)); // CO2 crosses
+    TEST_ASSERT_TRUE(encoder.hasUrgent());
+    sendUrgent();
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+
+    encoder.addReading(makeReading(1700, 100)); // Still in alarm
+    encoder.addReading(makeReading(1300, 100)); // Above the clear level
+    encoder.addReading(makeReading(1600, 100));
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+
+    encoder.addReading(makeReading(1100, 100)); // Cleared
+    encoder.addReading(makeReading(1100, 600)); // PM2.5 crosses
+    TEST_ASSERT_TRUE(encoder.hasUrgent());
+    sendUrgent();
+    encoder.addReading(makeReading(1550, 600)); // CO2 crosses again
+    TEST_ASSERT_TRUE(encoder.hasUrgent());
+
+    // Readings without the fields do not clear an alarm
+    SensorReading temp_only;
+    initSensorReading(&temp_only);
+    setFlag(&temp_only, FLAG_TEMP);
+    sendUrgent();
+    encoder.addReading(temp_only);
+    encoder.addReading(makeReading(1550, 600));
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+
+    // Invalid levels are refused; zero disables a field
+    UrgentThresholds thresholds = {1000, 1200, 0, 0};
+    TEST_ASSERT_FALSE(encoder.setUrgentThresholds(thresholds));
+    thresholds.co2_clear = 900;
+    TEST_ASSERT_TRUE(encoder.setUrgentThresholds(thresholds));
+    encoder.init(kHeader);
+    encoder.addReading(makeReading(800, 5000));
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+}
+
+// Test: Urgent payload bytes, sizes and errors
+void test_urgent_payload(void) {
+    uint8_t buffer[URGENT_PAYLOAD_SIZE];
+    TEST_ASSERT_EQUAL_INT32(-1, encoder.encodeUrgent(buffer, sizeof(buffer)));
+
+    encoder.addReading(makeReading(1600, 100));
+    TEST_ASSERT_EQUAL_INT32(-1, encoder.encodeUrgent(nullptr, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_INT32(-1, encoder.encodeUrgent(buffer, URGENT_PAYLOAD_SIZE - 1));
+    int32_t size = encoder.encodeUrgent(buffer, sizeof(buffer));
+
+    // Header (2) + mask (4) + CO2 (2) + PM2.5 (2)
+    TEST_ASSERT_EQUAL_INT32(10, size);
+    TEST_ASSERT_EQUAL_UINT8(0x01, buffer[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x05, buffer[1]);
+    TEST_ASSERT_EQUAL_UINT8(0x04, buffer[2]); // CO2
+    TEST_ASSERT_EQUAL_UINT8(0x01, buffer[3]); // PM2.5
+    TEST_ASSERT_EQUAL_UINT8(0x00, buffer[4]);
+    TEST_ASSERT_EQUAL_UINT8(0x00, buffer[5]);
+    TEST_ASSERT_EQUAL_UINT8(0x40, buffer[6]); // 1600
+    TEST_ASSERT_EQUAL_UINT8(0x06, buffer[7]);
+    TEST_ASSERT_EQUAL_UINT8(0x64, buffer[8]); // 100
+    TEST_ASSERT_EQUAL_UINT8(0x00, buffer[9]);
+
+    // Encoding leaves the batch and the urgent reading as they were
+    TEST_ASSERT_TRUE(encoder.hasUrgent());
+    TEST_ASSERT_EQUAL_UINT8(1, encoder.getReadingCount());
+    TEST_ASSERT_EQUAL_UINT32(2 + 4 + 2 + 2 + 2, encoder.calculateTotalSize());
+
+    // Dual mode: both PM2.5 channels, the second one raising the alarm
+    PayloadHeader dual = {1, true, false, 5};
+    encoder.init(dual);
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+    SensorReading reading = makeReading(1100, 350);
+    reading.pm_25[1] = 700;
+    encoder.addReading(reading);
+    TEST_ASSERT_TRUE(encoder.hasUrgent());
+    size = encoder.encodeUrgent(buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_INT32(URGENT_PAYLOAD_SIZE, size);
+
+    PayloadDecoder decoder;
+    TEST_ASSERT_EQUAL_INT32(1, decoder.decode(buffer, (uint32_t)size));
+    TEST_ASSERT_TRUE(decoder.getHeader().dual_mode);
+    const SensorReading &decoded = decoder.getReading(0);
+    TEST_ASSERT_EQUAL_HEX32(URGENT_FIELD_MASK, decoded.presence_mask);
+    TEST_ASSERT_EQUAL_UINT16(1100, decoded.co2);
+    TEST_ASSERT_EQUAL_UINT16(350, decoded.pm_25[0]);
+    TEST_ASSERT_EQUAL_UINT16(700, decoded.pm_25[1]);
+}
+
+// Test: Urgent and batched readings interleaved; the batch keeps every slot
+// but leaves out the fields already sent urgently
+void test_urgent_interleaved(void) {
+    uint8_t urgent[URGENT_PAYLOAD_SIZE];
+    uint16_t co2[8] = {700, 900, 1600, 1650, 1000, 1000, 1000, 1000};
+    uint16_t pm_25[8] = {50, 60, 70, 80, 90, 800, 820, 900};
+    uint32_t urgent_sent = 0;
+
+    for (uint8_t i = 0; i < 8; i++) {
+        encoder.addReading(makeReading(co2[i], pm_25[i]));
+        if (!encoder.hasUrgent())
+            continue;
+        int32_t size = encoder.encodeUrgent(urgent, sizeof(urgent));
+        TEST_ASSERT_EQUAL_INT32(10, size);
+        PayloadDecoder decoder;
+        TEST_ASSERT_EQUAL_INT32(1, decoder.decode(urgent, (uint32_t)size));
+        TEST_ASSERT_EQUAL_UINT16(co2[i], decoder.getReading(0).co2);
+        TEST_ASSERT_EQUAL_UINT16(pm_25[i], decoder.getReading(0).pm_25[0]);
+        encoder.markUrgentSent();
+        urgent_sent |= 1u << i;
+    }
+    TEST_ASSERT_EQUAL_HEX32((1u << 2) | (1u << 5), urgent_sent);
+
+    // 8 readings of 10 bytes, less 4 bytes for each urgent one
+    uint8_t buffer[256];
+    int32_t size = encoder.encode(buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_INT32(2 + 8 * 10 - 2 * 4, size);
+
+    PayloadDecoder decoder;
+    TEST_ASSERT_EQUAL_INT32(8, decoder.decode(buffer, (uint32_t)size));
+    for (uint8_t i = 0; i < 8; i++) {
+        const SensorReading &reading = decoder.getReading(i);
+        TEST_ASSERT_EQUAL_INT16(2150, reading.temp[0]);
+        if (urgent_sent & (1u << i)) {
+            TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_TEMP), reading.presence_mask);
+        } else {
+            TEST_ASSERT_EQUAL_UINT16(co2[i], reading.co2);
+            TEST_ASSERT_EQUAL_UINT16(pm_25[i], reading.pm_25[0]);
+        }
+    }
+
+    // An urgent payload that was not delivered leaves the batch whole; a new
+    // batch drops it but keeps the alarm state
+    UrgentThresholds thresholds = {1500, 1200, 555, 350};
+    encoder.init(kHeader);
+    TEST_ASSERT_TRUE(encoder.setUrgentThresholds(thresholds));
+    encoder.addReading(makeReading(1600, 100));
+    TEST_ASSERT_TRUE(encoder.hasUrgent());
+    TEST_ASSERT_EQUAL_INT32(10, encoder.encodeUrgent(urgent, sizeof(urgent)));
+    TEST_ASSERT_EQUAL_UINT32(2 + 10, encoder.calculateTotalSize());
+    encoder.init(kHeader);
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+    encoder.markUrgentSent(); // No effect
+    encoder.addReading(makeReading(1700, 100));
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+    TEST_ASSERT_EQUAL_UINT32(2 + 10, encoder.calculateTotalSize());
+
+    // A full batch evaluates nothing
+    for (uint8_t i = 1; i < MAX_BATCH_SIZE; i++)
+        encoder.addReading(makeReading(1100, 100));
+    TEST_ASSERT_FALSE(encoder.addReading(makeReading(1600, 100)));
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+}
+
+// Test: A crossing between encodeUrgent() and markUrgentSent() stays pending,
+// and only the reading that was encoded loses its fields
+void test_urgent_crossing_in_flight(void) {
+    uint8_t urgent[URGENT_PAYLOAD_SIZE];
+    encoder.addReading(makeReading(800, 100));
+    encoder.addReading(makeReading(1600, 100)); // Reading 1: CO2 crosses
+    int32_t size = encoder.encodeUrgent(urgent, sizeof(urgent));
+    TEST_ASSERT_EQUAL_INT32(10, size);
+    PayloadDecoder decoder;
+    TEST_ASSERT_EQUAL_INT32(1, decoder.decode(urgent, (uint32_t)size));
+    TEST_ASSERT_EQUAL_UINT16(1600, decoder.getReading(0).co2);
+
+    // While the modem sends, reading 2 raises PM2.5
+    encoder.addReading(makeReading(1650, 700));
+    encoder.markUrgentSent();
+    TEST_ASSERT_TRUE(encoder.hasUrgent());
+    encoder.markUrgentSent(); // Nothing encoded since: no effect
+
+    size = encoder.encodeUrgent(urgent, sizeof(urgent));
+    TEST_ASSERT_EQUAL_INT32(10, size);
+    TEST_ASSERT_EQUAL_INT32(1, decoder.decode(urgent, (uint32_t)size));
+    TEST_ASSERT_EQUAL_UINT16(1650, decoder.getReading(0).co2);
+    TEST_ASSERT_EQUAL_UINT16(700, decoder.getReading(0).pm_25[0]);
+
+    // Batch before the second send: reading 1 stripped, reading 2 whole
+    uint8_t buffer[256];
+    size = encoder.encode(buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_INT32(3, decoder.decode(buffer, (uint32_t)size));
+    TEST_ASSERT_EQUAL_UINT16(800, decoder.getReading(0).co2);
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_TEMP), decoder.getReading(1).presence_mask);
+    TEST_ASSERT_EQUAL_UINT16(1650, decoder.getReading(2).co2);
+    TEST_ASSERT_EQUAL_UINT16(700, decoder.getReading(2).pm_25[0]);
+
+    encoder.markUrgentSent();
+    TEST_ASSERT_FALSE(encoder.hasUrgent());
+    size = encoder.encode(buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_INT32(3, decoder.decode(buffer, (uint32_t)size));
+    TEST_ASSERT_EQUAL_HEX32(FLAG_BIT(FLAG_TEMP), decoder.getReading(2).presence_mask);
+
+    // A new batch forgets the encoded reading
+    TEST_ASSERT_EQUAL_INT32(-1, encoder.encodeUrgent(urgent, sizeof(urgent)));
+    encoder.addReading(makeReading(1100, 100)); // Clears CO2
+    encoder.addReading(makeReading(1600, 300)); // CO2 crosses at reading 1
+    TEST_ASSERT_EQUAL_INT32(10, encoder.encodeUrgent(urgent, sizeof(urgent)));
+    encoder.init(kHeader);
+    encoder.addReading(makeReading(1100, 100));
+    encoder.markUrgentSent();
+    size = encoder.encode(buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_INT32(1, decoder.decode(buffer, (uint32_t)size));
+    TEST_ASSERT_EQUAL_UINT16(1100, decoder.getReading(0).co2);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_urgent_trigger);
+    RUN_TEST(test_urgent_payload);
+    RUN_TEST(test_urgent_interleaved);
+    RUN_TEST(test_urgent_crossing_in_flight);
+
+    return UNITY_END();
+}
@@ -0,0 +1,218 @@
+#include "unity.h"
+#include "payload_decoder.h"
+#include "payload_encoder.h"
+#include "payload_wal.h"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const char *kLogPath = "test_wal.log";
+
+typedef struct {
+    uint64_t count;
+    uint64_t first_sequence;
+    uint64_t last_sequence;
+    uint64_t co2_sum;
+    bool ordered;
+} ReplayState;
+
+static void replayIntoDecoder(const PayloadRecordHeader &header,
+                              const uint8_t *payload, void *user) {
+    ReplayState *state = (ReplayState *)user;
+    PayloadDecoder decoder;
+
+    if (state->count == 0) {
+        state->first_sequence = header.sequence;
+    } else if (header.sequence != state->last_sequence + 1) {
+        state->ordered = false;
+    }
+    state->last_sequence = header.sequence;
+    state->count++;
+
+    if (decoder.decode(payload, header.length) > 0) {
+        state->co2_sum += decoder.getReading(0).co2;
+    }
+}
+
+static int64_t replay(uint64_t from_sequence, ReplayState *state) {
+    memset(state, 0, sizeof(*state));
+    state->ordered = true;
+    return WriteAheadLog::replay(kLogPath, from_sequence, replayIntoDecoder,
+                                 state);
+}
+
+static int32_t makePayload(uint16_t co2, uint8_t *buffer) {
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, false, false, 5};
+    encoder.init(header);
+
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_CO2);
+    reading.co2 = co2;
+    encoder.addReading(reading);
+
+    return encoder.encode(buffer, MAX_PAYLOAD_SIZE);
+}
+
+static WalConfig testConfig(void) {
+    WalConfig config = WriteAheadLog::defaultConfig();
+    config.sync = false;  // Keep the test fast; durability is the OS's job
+    config.group_window_us = 200;
+    return config;
+}
+
+void setUp(void) {
+    unlink(kLogPath);
+}
+
+void tearDown(void) {
+    unlink(kLogPath);
+}
+
+// Test: Appended payloads replay in order into the decoder
+void test_wal_append_and_replay(void) {
+    WriteAheadLog wal;
+    TEST_ASSERT_TRUE(wal.open(kLogPath, testConfig()));
+
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    for (uint16_t i = 0; i < 10; i++) {
+        int32_t size = makePayload(400 + i, payload);
+        TEST_ASSERT_EQUAL_UINT64(i + 1, wal.append(7, 1000 + i, payload, size));
+    }
+    TEST_ASSERT_EQUAL_UINT64(10, wal.getDurableSequence());
+    wal.close();
+
+    ReplayState state;
+    TEST_ASSERT_EQUAL_INT64(10, replay(0, &state));
+    TEST_ASSERT_TRUE(state.ordered);
+    TEST_ASSERT_EQUAL_UINT64(1, state.first_sequence);
+    TEST_ASSERT_EQUAL_UINT64(10, state.last_sequence);
+    TEST_ASSERT_EQUAL_UINT64(4045, state.co2_sum);
+}
+
+// Test: Replay can start from a sequence number (log tail only)
+void test_wal_replay_from_sequence(void) {
+    WriteAheadLog wal;
+    TEST_ASSERT_TRUE(wal.open(kLogPath, testConfig()));
+
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    int32_t size = makePayload(400, payload);
+    for (int i = 0; i < 20; i++) {
+        wal.append(1, 0, payload, size);
+    }
+    wal.close();
+
+    ReplayState state;
+    TEST_ASSERT_EQUAL_INT64(5, replay(16, &state));
+    TEST_ASSERT_EQUAL_UINT64(16, state.first_sequence);
+    TEST_ASSERT_EQUAL_UINT64(20, state.last_sequence);
+}
+
+// Test: Reopening continues the sequence after the last record
+void test_wal_reopen_continues_sequence(void) {
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    int32_t size = makePayload(400, payload);
+
+    WriteAheadLog wal;
+    TEST_ASSERT_TRUE(wal.open(kLogPath, testConfig()));
+    wal.append(1, 0, payload, size);
+    wal.append(1, 0, payload, size);
+    wal.close();
+
+    TEST_ASSERT_TRUE(wal.open(kLogPath, testConfig()));
+    TEST_ASSERT_EQUAL_UINT64(2, wal.getDurableSequence());
+    TEST_ASSERT_EQUAL_UINT64(3, wal.append(1, 0, payload, size));
+    wal.close();
+
+    ReplayState state;
+    TEST_ASSERT_EQUAL_INT64(3, replay(0, &state));
+    TEST_ASSERT_TRUE(state.ordered);
+}
+
+// Test: A torn tail from a crash is ignored on replay and cut on reopen
+void test_wal_recovers_torn_tail(void) {
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+    int32_t size = makePayload(400, payload);
+
+    WriteAheadLog wal;
+    TEST_ASSERT_TRUE(wal.open(kLogPath, testConfig()));
+    for (int i = 0; i < 3; i++) {
+        wal.append(1, 0, payload, size);
+    }
+    wal.close();
+
+    // Simulate a crash in the middle of writing a fourth record
+    uint8_t record[PAYLOAD_RECORD_HEADER_SIZE + MAX_PAYLOAD_SIZE];
+    PayloadRecordHeader header = {(uint32_t)size, 4, 1, 0};
+    uint32_t record_size = writePayloadRecord(record, header, payload);
+    FILE *file = fopen(kLogPath, "ab");
+    TEST_ASSERT_NOT_NULL(file);
+    fwrite(record, 1, record_size - 3, file);
+    fclose(file);
+
+    ReplayState state;
+    TEST_ASSERT_EQUAL_INT64(3, replay(0, &state));
+
+    TEST_ASSERT_TRUE(wal.open(kLogPath, testConfig()));
+    TEST_ASSERT_EQUAL_UINT64(4, wal.append(1, 0, payload, size));
+    wal.close();
+
+    TEST_ASSERT_EQUAL_INT64(4, replay(0, &state));
+    TEST_ASSERT_TRUE(state.ordered);
+}
+
+// Test: Concurrent appenders share groups and nothing is lost
+void test_wal_concurrent_group_commit(void) {
+    const int kThreads = 8;
+    const int kPerThread = 200;
+
+    WalConfig config = testConfig();
+    config.group_max_records = 16;
+
+    WriteAheadLog wal;
+    TEST_ASSERT_TRUE(wal.open(kLogPath, config));
+
+    std::vector<std::thread> threads;
+    std::vector<int> failures(kThreads, 0);
+    for (int t = 0; t < kThreads; t++) {
+        threads.push_back(std::thread([&wal, &failures, t, kPerThread]() {
+            uint8_t payload[MAX_PAYLOAD_SIZE];
+            int32_t size = makePayload(1, payload);
+            for (int i = 0; i < kPerThread; i++) {
+                if (wal.append(t, i, payload, size) == 0) {
+                    failures[t]++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+        TEST_ASSERT_EQUAL_INT(0, failures[t]);
+    }
+
+    WalStats stats = wal.getStats();
+    wal.close();
+
+    TEST_ASSERT_EQUAL_UINT64(kThreads * kPerThread, stats.records);
+    TEST_ASSERT_LESS_OR_EQUAL(kThreads * kPerThread, stats.groups);
+
+    ReplayState state;
+    TEST_ASSERT_EQUAL_INT64(kThreads * kPerThread, replay(0, &state));
+    TEST_ASSERT_TRUE(state.ordered);
+    TEST_ASSERT_EQUAL_UINT64(kThreads * kPerThread, state.co2_sum);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_wal_append_and_replay);
+    RUN_TEST(test_wal_replay_from_sequence);
+    RUN_TEST(test_wal_reopen_continues_sequence);
+    RUN_TEST(test_wal_recovers_torn_tail);
+    RUN_TEST(test_wal_concurrent_group_commit);
+
+    return UNITY_END();
+}
@@ -0,0 +1,205 @@
+#include "unity.h"
+#include "payload_encoder.h"
+#include "payload_writer.h"
+#include <string.h>
+#include <string>
+
+static uint8_t payload[MAX_PAYLOAD_SIZE];
+
+void setUp(void) {
+    // This is run before each test
+}
+
+void tearDown(void) {
+    // This is run after each test
+}
+
+static SensorReading makeFullReading(void) {
+    SensorReading reading;
+    memset(&reading, 0, sizeof(reading));
+    reading.presence_mask = 0x07FFFFFF;  // All 27 flags
+
+    reading.temp[0] = -1250;
+    reading.temp[1] = 2605;
+    reading.hum[0] = 5000;
+    reading.hum[1] = 5150;
+    reading.co2 = 412;
+    reading.tvoc = 100;
+    reading.tvoc_raw = 30000;
+    reading.nox = 1;
+    reading.nox_raw = 17000;
+    reading.pm_01[0] = 10;
+    reading.pm_01[1] = 11;
+    reading.pm_25[0] = 125;
+    reading.pm_25[1] = 3;
+    reading.pm_10[0] = 50;
+    reading.pm_10[1] = 51;
+    reading.pm_01_sp[0] = 12;
+    reading.pm_01_sp[1] = 13;
+    reading.pm_25_sp[0] = 27;
+    reading.pm_25_sp[1] = 28;
+    reading.pm_10_sp[0] = 52;
+    reading.pm_10_sp[1] = 53;
+    reading.pm_03_pc[0] = 1000;
+    reading.pm_03_pc[1] = 1001;
+    reading.pm_05_pc[0] = 2000;
+    reading.pm_05_pc[1] = 2001;
+    reading.pm_01_pc[0] = 3000;
+    reading.pm_01_pc[1] = 3001;
+    reading.pm_25_pc[0] = 4000;
+    reading.pm_25_pc[1] = 4001;
+    reading.pm_5_pc[0] = 5000;
+    reading.pm_5_pc[1] = 5001;
+    reading.pm_10_pc[0] = 6000;
+    reading.pm_10_pc[1] = 6001;
+    reading.vbat = 3705;
+    reading.vpanel = 5000;
+    reading.o3_we = 0xFFFFFFF0;
+    reading.o3_ae = 2000;
+    reading.no2_we = 3001;
+    reading.no2_ae = 4;
+    reading.afe_temp = 255;
+    reading.signal = -85;
+    return reading;
+}
+
+// Full reading plus a small one with a negative fraction
+static int32_t makePayload(bool dual) {
+    PayloadEncoder encoder;
+    PayloadHeader header = {1, dual, false, 5};
+    encoder.init(header);
+    encoder.addReading(makeFullReading());
+
+    SensorReading reading;
+    initSensorReading(&reading);
+    setFlag(&reading, FLAG_TEMP);
+    setFlag(&reading, FLAG_CO2);
+    reading.temp[0] = -5;
+    reading.temp[1] = 7;
+    reading.co2 = 400;
+    encoder.addReading(reading);
+
+    return encoder.encode(payload, sizeof(payload));
+}
+
+static std::string output(const PayloadWriter &writer) {
+    return std::string(writer.data(), writer.size());
+}
+
+// Test: JSON matches decodePayloadToJSON() from server/src/payload_decoder.js
+void test_json_matches_server_decoder(void) {
+    // Produced by decodePayloadToJSON() for the same bytes
+    const char *expected[2] = {
+        "{\"header\":{\"version\":1,\"dualMode\":false,\"dedicatedTempHumSensor\":false,\"intervalMinutes\":5},"
+        "\"readings\":[{\"presenceMask\":134217727,\"temperature\":-12.5,\"humidity\":50,\"co2\":412,"
+        "\"tvoc\":100,\"tvoc_raw\":30000,\"nox\":1,\"nox_raw\":17000,\"pm01\":1,\"pm25\":12.5,\"pm10\":5,"
+        "\"pm01_sp\":1.2,\"pm25_sp\":2.7,\"pm10_sp\":5.2,\"pm03_pc\":1000,\"pm05_pc\":2000,\"pm01_pc\":3000,"
+        "\"pm25_pc\":4000,\"pm5_pc\":5000,\"pm10_pc\":6000,\"vbat\":37.05,\"vpanel\":50,\"o3_we\":4294967.28,"
+        "\"o3_ae\":2,\"no2_we\":3.001,\"no2_ae\":0.004,\"afe_temp\":25.5,\"signal\":-85},"
+        "{\"presenceMask\":5,\"temperature\":-0.05,\"co2\":400}],\"readingCount\":2}\n",
+        "{\"header\":{\"version\":1,\"dualMode\":true,\"dedicatedTempHumSensor\":false,\"intervalMinutes\":5},"
+        "\"readings\":[{\"presenceMask\":134217727,\"temperature\":[-12.5,26.05],\"humidity\":[50,51.5],"
+        "\"co2\":412,\"tvoc\":100,\"tvoc_raw\":30000,\"nox\":1,\"nox_raw\":17000,\"pm01\":[1,1.1],"
+        "\"pm25\":[12.5,0.3],\"pm10\":[5,5.1],\"pm01_sp\":[1.2,1.3],\"pm25_sp\":[2.7,2.8],\"pm10_sp\":[5.2,5.3],"
+        "\"pm03_pc\":[1000,1001],\"pm05_pc\":[2000,2001],\"pm01_pc\":[3000,3001],\"pm25_pc\":[4000,4001],"
+        "\"pm5_pc\":[5000,5001],\"pm10_pc\":[6000,6001],\"vbat\":37.05,\"vpanel\":50,\"o3_we\":4294967.28,"
+        "\"o3_ae\":2,\"no2_we\":3.001,\"no2_ae\":0.004,\"afe_temp\":25.5,\"signal\":-85},"
+        "{\"presenceMask\":5,\"temperature\":[-0.05,0.07],\"co2\":400}],\"readingCount\":2}\n"};
+
+    for (int dual = 0; dual <= 1; dual++) {
+        PayloadWriter writer(OUTPUT_JSON);
+        int32_t size = makePayload(dual == 1);
+        TEST_ASSERT_EQUAL_INT32(2, writer.write(7, 0, payload, size));
+        TEST_ASSERT_EQUAL_STRING(expected[dual], output(writer).c_str());
+    }
+}
+
+// Test: CSV header and rows, with second channels after all fields
+void test_csv_rows(void) {
+    PayloadWriter writer(OUTPUT_CSV);
+    writer.writeCsvHeader();
+    std::string header = output(writer);
+    TEST_ASSERT_EQUAL_STRING("device_id,timestamp_ms,temperature,humidity,co2,",
+                             header.substr(0, 48).c_str());
+    TEST_ASSERT_EQUAL_STRING(",pm5_pc_2,pm10_pc_2\n", header.c_str() + header.size() - 20);
+
+    // Dedicated temp/hum in dual mode: temperature_2 stays empty
+    uint8_t dedicated[] = {0x19, 0x05, 0x07, 0x01, 0x00, 0x00,
+                           0xF6, 0x09,              // temp 2550
+                           0x88, 0x13,              // hum 5000
+                           0x9C, 0x01,              // co2 412
+                           0x19, 0x00, 0x1A, 0x00,  // pm25 25, 26
+                           0x00, 0x00, 0x00, 0x00}; // empty reading
+    writer.clear();
+    TEST_ASSERT_EQUAL_INT32(2, writer.write(42, 1000000, dedicated, sizeof(dedicated)));
+
+    // 27 field columns, then 14 second-channel columns (pm25_2 is the 4th)
+    std::string expected = "42,700000,25.5,50,412,,,,,,2.5" + std::string(18, ',') +
+                           ",,,,2.6" + std::string(10, ',') + "\n" +
+                           "42,1000000" + std::string(41, ',') + "\n";
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), output(writer).c_str());
+}
+
+// Test: Line protocol uses integer fields for unscaled values
+void test_line_protocol(void) {
+    uint8_t buffer[] = {0x09, 0x01,
+                        0x05, 0x00, 0x00, 0x04,  // temp, co2, signal
+                        0xC4, 0x09, 0x28, 0x0A,  // temp 2500, 2600
+                        0x90, 0x01,              // co2 400
+                        0xB5,                    // signal -75
+                        0x00, 0x00, 0x00, 0x00,  // empty reading: skipped
+                        0x04, 0x00, 0x00, 0x00,  // co2 only
+                        0x9A, 0x01};             // co2 410
+    PayloadWriter writer(OUTPUT_LINE_PROTOCOL);
+    writer.setMeasurement("air");
+    TEST_ASSERT_EQUAL_INT32(3, writer.write(9, 1700000120000ULL, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_STRING(
+        "air,device=9 temperature=25,temperature_2=26,co2=400i,signal=-75i 1700000000000\n"
+        "air,device=9 co2=410i 1700000120000\n",
+        output(writer).c_str());
+}
+
+// Test: Malformed payloads leave the output unchanged; clear() reuses memory
+void test_malformed_and_reuse(void) {
+    PayloadWriter writer(OUTPUT_JSON);
+    int32_t size = makePayload(true);
+    TEST_ASSERT_EQUAL_INT32(2, writer.write(1, 0, payload, size));
+    std::string first = output(writer);
+
+    TEST_ASSERT_EQUAL_INT32(-1, writer.write(1, 0, payload, size - 1));
+    TEST_ASSERT_EQUAL_INT32(-1, writer.write(1, 0, payload, 1));
+    uint8_t short_mask[] = {0x01, 0x05, 0x04, 0x00};
+    TEST_ASSERT_EQUAL_INT32(-1, writer.write(1, 0, short_mask, sizeof(short_mask)));
+    TEST_ASSERT_EQUAL_STRING(first.c_str(), output(writer).c_str());
+
+    // Payloads append as JSON Lines
+    TEST_ASSERT_EQUAL_INT32(2, writer.write(1, 0, payload, size));
+    TEST_ASSERT_EQUAL_STRING((first + first).c_str(), output(writer).c_str());
+
+    const char *data = writer.data();
+    writer.clear();
+    TEST_ASSERT_EQUAL_UINT32(0, writer.size());
+    TEST_ASSERT_EQUAL_INT32(2, writer.write(1, 0, payload, size));
+    TEST_ASSERT_TRUE(data == writer.data());
+    TEST_ASSERT_EQUAL_STRING(first.c_str(), output(writer).c_str());
+
+    // Header only: no readings
+    uint8_t empty[] = {0x01, 0x05};
+    writer.clear();
+    TEST_ASSERT_EQUAL_INT32(0, writer.write(1, 0, empty, sizeof(empty)));
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"header\":{\"version\":1,\"dualMode\":false,\"dedicatedTempHumSensor\":false,"
+        "\"intervalMinutes\":5},\"readings\":[],\"readingCount\":0}\n",
+        output(writer).c_str());
+}
+
+int main(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_json_matches_server_decoder);
+    RUN_TEST(test_csv_rows);
+    RUN_TEST(test_line_protocol);
+    RUN_TEST(test_malformed_and_reuse);
+
+    return UNITY_END();
+}
@@ -0,0 +1,91 @@
+// Offline compaction of payload archive segments.
+//
+// Usage: archive_compact -o PREFIX [-m MB] [-j THREADS] [-s SEGMENT_MB]
+//                        [-t TMPDIR] SEGMENT...
+//
+// Rewrites arrival-ordered segments (or sealed write-ahead logs) into
+// PREFIX-NNNNN.seg segments sorted by device and time, each with a
+// PREFIX-NNNNN.seg.idx per-device index. -m bounds the memory used for
+// buffered records during run generation and for read buffers during merge.
+
+#include "archive_compactor.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// Peak resident set size in MB
+static double peakRssMb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1e6; // bytes
+#else
+  return usage.ru_maxrss / 1e3; // KiB
+#endif
+}
+
+int main(int argc, char **argv) {
+  CompactionConfig config = defaultCompactionConfig();
+  const char *prefix = nullptr;
+  std::vector<std::string> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "-o") == 0 && has_value) {
+      prefix = argv[++i];
+    } else if (strcmp(argv[i], "-m") == 0 && has_value) {
+      config.memory_budget = strtoull(argv[++i], nullptr, 10) << 20;
+    } else if (strcmp(argv[i], "-j") == 0 && has_value) {
+      config.threads = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+      config.output_segment_bytes = strtoull(argv[++i], nullptr, 10) << 20;
+    } else if (strcmp(argv[i], "-t") == 0 && has_value) {
+      config.temp_dir = argv[++i];
+    } else if (argv[i][0] == '-') {
+      prefix = nullptr;
+      break;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+
+  if (prefix == nullptr || inputs.empty()) {
+    fprintf(stderr,
+            "usage: %s -o PREFIX [-m MB] [-j THREADS] [-s SEGMENT_MB] "
+            "[-t TMPDIR] SEGMENT...\n",
+            argv[0]);
+    return 2;
+  }
+
+  CompactionStats stats;
+  std::vector<std::string> outputs;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool ok = compactArchive(inputs, prefix, config, &stats, &outputs);
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  if (!ok) {
+    fprintf(stderr, "compaction failed\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < outputs.size(); i++) {
+    printf("%s\n", outputs[i].c_str());
+  }
+  printf("records %llu, devices %llu, skipped %llu bytes\n",
+         (unsigned long long)stats.input_records,
+         (unsigned long long)stats.devices,
+         (unsigned long long)stats.skipped_bytes);
+  printf("runs %llu, merge passes %u, segments %llu\n",
+         (unsigned long long)stats.runs, stats.merge_passes,
+         (unsigned long long)stats.output_segments);
+  printf("%.1f MB in %.2f s, %.1f MB/s, peak RSS %.1f MB (budget %.1f MB)\n",
+         stats.input_bytes / 1e6, seconds,
+         seconds > 0 ? stats.input_bytes / seconds / 1e6 : 0.0, peakRssMb(),
+         config.memory_budget / 1e6);
+  return 0;
+}
@@ -0,0 +1,314 @@
+// Synthetic fleet traffic for load-testing ingestion.
+//
+// Usage: fleet_gen [-n DEVICES] [-t MINUTES] [-s SEED] [-j THREADS]
+//                  [-m INDOOR,OUTDOOR,SOLAR,GAS] [-d DROPOUT]
+//                  [-o PREFIX | -u HOST:PORT [-r RATE]]
+//
+// Simulates DEVICES devices for MINUTES of device time (see
+// fleet_generator.h). Each thread owns a contiguous range of devices and
+// steps them one simulated minute at a time.
+//
+//   -o PREFIX     write one archive segment per thread, PREFIX-NN.seg, one
+//                 simulated minute at a time (sequence numbers per segment)
+//   -u HOST:PORT  send UDP datagrams to an IPv4 address: 8-byte little-endian
+//                 device id followed by the payload; -r caps the total rate
+//                 in payloads/s (0 = as fast as possible)
+//   neither       generate and discard, to measure the generator itself
+//
+// With the same seed, devices and mix, the set of payloads is the same for
+// any thread count; only how they are split between segments changes.
+
+#include "fleet_generator.h"
+#include "payload_archive.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <memory>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define ROUND_MS 60000
+#define UDP_BATCH 64
+
+typedef struct {
+  FleetGenerator *generator;
+  uint32_t first_device;
+  uint32_t end_device;
+  uint64_t end_ms;
+  std::string segment; // Archive output, or empty
+  const sockaddr_in *udp; // UDP output, or nullptr
+  double rate;            // Payloads/s for this thread, 0 = unlimited
+  uint64_t payloads;
+  uint64_t readings;
+  uint64_t bytes;
+  bool failed;
+} Worker;
+
+// Sends datagrams in batches, pacing them to the worker's rate
+class UdpSink {
+public:
+  UdpSink(const sockaddr_in &address, double rate)
+      : rate(rate), count(0), sent(0),
+        start(std::chrono::steady_clock::now()) {
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd >= 0 &&
+        connect(fd, (const sockaddr *)&address, sizeof(address)) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  ~UdpSink() {
+    flush();
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  bool ok() const { return fd >= 0; }
+
+  uint8_t *next() { return buffers[count]; }
+
+  void commit(uint32_t length) {
+    lengths[count++] = length;
+    if (count == UDP_BATCH) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (fd < 0 || count == 0) {
+      return;
+    }
+#ifdef __linux__
+    mmsghdr messages[UDP_BATCH];
+    iovec vectors[UDP_BATCH];
+    memset(messages, 0, sizeof(messages));
+    for (uint32_t i = 0; i < count; i++) {
+      vectors[i].iov_base = buffers[i];
+      vectors[i].iov_len = lengths[i];
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    // Loopback drops rather than blocks when the receiver is slow, so a
+    // short send is not retried
+    sendmmsg(fd, messages, count, 0);
+#else
+    for (uint32_t i = 0; i < count; i++) {
+      send(fd, buffers[i], lengths[i], 0);
+    }
+#endif
+    sent += count;
+    count = 0;
+    if (rate > 0) {
+      std::chrono::steady_clock::time_point due =
+          start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::duration<double>(sent / rate));
+      std::this_thread::sleep_until(due);
+    }
+  }
+
+private:
+  int fd;
+  double rate;
+  uint32_t count;
+  uint64_t sent;
+  std::chrono::steady_clock::time_point start;
+  uint8_t buffers[UDP_BATCH][8 + MAX_PAYLOAD_SIZE];
+  uint32_t lengths[UDP_BATCH];
+};
+
+static void run(Worker *worker) {
+  FleetGenerator &generator = *worker->generator;
+  ArchiveWriter archive;
+  std::unique_ptr<UdpSink> udp;
+  if (!worker->segment.empty() && !archive.open(worker->segment.c_str())) {
+    worker->failed = true;
+    return;
+  }
+  if (worker->udp != nullptr) {
+    udp.reset(new UdpSink(*worker->udp, worker->rate));
+    if (!udp->ok()) {
+      worker->failed = true;
+      return;
+    }
+  }
+
+  uint8_t payload[MAX_PAYLOAD_SIZE];
+  uint64_t round_end = UINT64_MAX;
+  for (uint32_t d = worker->first_device; d < worker->end_device; d++) {
+    uint64_t first = generator.nextSendTime(d);
+    round_end = first < round_end ? first : round_end;
+  }
+  round_end = (round_end / ROUND_MS + 1) * ROUND_MS;
+
+  PayloadRecordHeader header;
+  header.sequence = 0;
+  for (; round_end - ROUND_MS < worker->end_ms; round_end += ROUND_MS) {
+    uint64_t limit = round_end < worker->end_ms ? round_end : worker->end_ms;
+    for (uint32_t d = worker->first_device; d < worker->end_device; d++) {
+      while (generator.nextSendTime(d) < limit) {
+        FleetPayloadInfo info;
+        uint8_t *buffer = udp ? udp->next() + 8 : payload;
+        int32_t length = generator.generate(d, buffer, MAX_PAYLOAD_SIZE, &info);
+        worker->payloads++;
+        worker->readings += info.reading_count;
+        worker->bytes += (uint32_t)length;
+        if (udp) {
+          uint8_t *id = udp->next();
+          for (int i = 0; i < 8; i++) {
+            id[i] = (uint8_t)(info.device_id >> (8 * i));
+          }
+          udp->commit(8 + (uint32_t)length);
+        } else if (!worker->segment.empty()) {
+          header.length = (uint32_t)length;
+          header.sequence++;
+          header.device_id = info.device_id;
+          header.timestamp_ms = info.timestamp_ms;
+          archive.write(header, payload);
+        }
+      }
+    }
+  }
+  if (!worker->segment.empty() && !archive.close()) {
+    worker->failed = true;
+  }
+}
+
+static bool parseMix(const char *text, FleetConfig &config) {
+  for (int p = 0; p < FLEET_PROFILE_COUNT; p++) {
+    char *end;
+    config.mix[p] = (uint32_t)strtoul(text, &end, 10);
+    if (end == text || (p + 1 < FLEET_PROFILE_COUNT && *end != ',')) {
+      return false;
+    }
+    text = end + 1;
+  }
+  return true;
+}
+
+static bool parseAddress(const char *text, sockaddr_in &address) {
+  std::string host(text);
+  size_t colon = host.rfind(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons((uint16_t)atoi(host.c_str() + colon + 1));
+  return inet_pton(AF_INET, host.substr(0, colon).c_str(),
+                   &address.sin_addr) == 1;
+}
+
+int main(int argc, char **argv) {
+  FleetConfig config;
+  initFleetConfig(config);
+  double minutes = 60;
+  uint32_t threads = std::thread::hardware_concurrency();
+  const char *prefix = nullptr;
+  const char *target = nullptr;
+  double rate = 0;
+  bool usage = false;
+
+  for (int i = 1; i < argc && !usage; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "-n") == 0 && has_value) {
+      config.devices = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-t") == 0 && has_value) {
+      minutes = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+      config.seed = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-j") == 0 && has_value) {
+      threads = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-m") == 0 && has_value) {
+      usage = !parseMix(argv[++i], config);
+    } else if (strcmp(argv[i], "-d") == 0 && has_value) {
+      config.dropout = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && has_value) {
+      prefix = argv[++i];
+    } else if (strcmp(argv[i], "-u") == 0 && has_value) {
+      target = argv[++i];
+    } else if (strcmp(argv[i], "-r") == 0 && has_value) {
+      rate = atof(argv[++i]);
+    } else {
+      usage = true;
+    }
+  }
+
+  sockaddr_in address;
+  FleetGenerator generator;
+  if (usage || (prefix != nullptr && target != nullptr) ||
+      (target != nullptr && !parseAddress(target, address)) ||
+      !generator.init(config)) {
+    fprintf(stderr,
+            "usage: %s [-n DEVICES] [-t MINUTES] [-s SEED] [-j THREADS] "
+            "[-m INDOOR,OUTDOOR,SOLAR,GAS] [-d DROPOUT] "
+            "[-o PREFIX | -u HOST:PORT [-r RATE]]\n",
+            argv[0]);
+    return 2;
+  }
+  if (threads == 0) {
+    threads = 1;
+  }
+  if (threads > config.devices) {
+    threads = config.devices;
+  }
+
+  std::vector<Worker> workers(threads);
+  for (uint32_t t = 0; t < threads; t++) {
+    Worker &worker = workers[t];
+    worker.generator = &generator;
+    worker.first_device = (uint32_t)((uint64_t)config.devices * t / threads);
+    worker.end_device = (uint32_t)((uint64_t)config.devices * (t + 1) / threads);
+    worker.end_ms = config.start_ms + (uint64_t)(minutes * 60000);
+    if (prefix != nullptr) {
+      char name[16];
+      snprintf(name, sizeof(name), "-%02u.seg", t);
+      worker.segment = std::string(prefix) + name;
+    }
+    worker.udp = target != nullptr ? &address : nullptr;
+    worker.rate = rate / threads;
+    worker.payloads = worker.readings = worker.bytes = 0;
+    worker.failed = false;
+  }
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::vector<std::thread> running;
+  for (uint32_t t = 0; t < threads; t++) {
+    running.push_back(std::thread(run, &workers[t]));
+  }
+  uint64_t payloads = 0, readings = 0, bytes = 0;
+  bool failed = false;
+  for (uint32_t t = 0; t < threads; t++) {
+    running[t].join();
+    payloads += workers[t].payloads;
+    readings += workers[t].readings;
+    bytes += workers[t].bytes;
+    failed = failed || workers[t].failed;
+    if (!workers[t].segment.empty()) {
+      printf("%s\n", workers[t].segment.c_str());
+    }
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  if (failed) {
+    fprintf(stderr, "output failed\n");
+    return 1;
+  }
+  printf("devices %u, %.0f minutes, threads %u\n", config.devices, minutes,
+         threads);
+  printf("payloads %llu, readings %llu, %.1f MB of payload\n",
+         (unsigned long long)payloads, (unsigned long long)readings,
+         bytes / 1e6);
+  printf("%.2f s, %.0f payloads/s\n", seconds,
+         seconds > 0 ? payloads / seconds : 0.0);
+  return 0;
+}
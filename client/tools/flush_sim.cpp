@@ -0,0 +1,114 @@
+// Flush policy simulator: replays a device trace under each policy and
+// compares radio sessions, bytes, cost and reporting latency.
+//
+// Usage: flush_sim [-t TRACE | -g HOURS] [-i INTERVAL_S] [-s SEED]
+//                  [-n MEAN_DBM] [-f FADE_PERCENT] [-l FADE_READINGS]
+//                  [-a MAX_AGE_S] [-c SESSION_COST] [-b BYTE_COST]
+//                  [-w TRACE_OUT]
+//
+// TRACE is a file of "time_s signal_dbm presence_mask_hex" lines (see
+// loadFlushTrace). Without it a synthetic trace of HOURS (default 168) is
+// generated with a reading every INTERVAL_S (default 60) and a signal around
+// MEAN_DBM (default -95) that spends FADE_PERCENT (default 10) of the time in
+// deep fades of about FADE_READINGS (default 5) readings; -w saves it. The
+// remaining options override FlushScheduler::defaultConfig().
+
+#include "flush_simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv) {
+  FlushTraceConfig trace_config;
+  initFlushTraceConfig(trace_config);
+  FlushPolicyConfig config = FlushScheduler::defaultConfig();
+  const char *trace_path = nullptr;
+  const char *trace_out = nullptr;
+  bool usage = false;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "-t") == 0 && has_value) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "-g") == 0 && has_value) {
+      trace_config.hours = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-i") == 0 && has_value) {
+      trace_config.interval_s = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+      trace_config.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-n") == 0 && has_value) {
+      trace_config.mean_signal_dbm = (int8_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-f") == 0 && has_value) {
+      trace_config.fade_percent = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && has_value) {
+      trace_config.fade_readings = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-a") == 0 && has_value) {
+      config.max_age_s = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && has_value) {
+      config.session_cost = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-b") == 0 && has_value) {
+      config.byte_cost = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "-w") == 0 && has_value) {
+      trace_out = argv[++i];
+    } else {
+      usage = true;
+      break;
+    }
+  }
+  if (usage || trace_config.interval_s == 0) {
+    fprintf(stderr,
+            "usage: %s [-t TRACE | -g HOURS] [-i INTERVAL_S] [-s SEED] "
+            "[-n MEAN_DBM] [-f FADE_PERCENT] [-l FADE_READINGS] "
+            "[-a MAX_AGE_S] [-c SESSION_COST] [-b BYTE_COST] "
+            "[-w TRACE_OUT]\n",
+            argv[0]);
+    return 2;
+  }
+
+  std::vector<FlushTraceEntry> trace;
+  if (trace_path != nullptr) {
+    if (!loadFlushTrace(trace_path, &trace)) {
+      fprintf(stderr, "cannot read trace %s\n", trace_path);
+      return 1;
+    }
+  } else {
+    generateFlushTrace(trace_config, &trace);
+  }
+  if (trace.empty()) {
+    fprintf(stderr, "empty trace\n");
+    return 1;
+  }
+  if (trace_out != nullptr && !saveFlushTrace(trace_out, trace)) {
+    fprintf(stderr, "cannot write %s\n", trace_out);
+    return 1;
+  }
+
+  PayloadHeader header = {1, false, false,
+                          (uint8_t)((trace_config.interval_s + 59) / 60)};
+  printf("readings %zu over %.1f h, max age %u s, session cost %u, "
+         "byte cost %u\n",
+         trace.size(), (trace.back().time_s - trace.front().time_s) / 3600.0,
+         config.max_age_s, config.session_cost, config.byte_cost);
+  printf("%-10s %9s %11s %14s %10s %10s  %s\n", "policy", "sessions",
+         "bytes", "cost", "mean_lat_s", "max_lat_s",
+         "full/deadline/signal/end");
+  for (int p = 0; p < FLUSH_POLICY_COUNT; p++) {
+    FlushSimResult result;
+    if (!simulateFlushPolicy(trace, header, (FlushPolicy)p, config, &result)) {
+      fprintf(stderr, "invalid configuration or trace out of order\n");
+      return 1;
+    }
+    printf("%-10s %9llu %11llu %14llu %10.0f %10u  %llu/%llu/%llu/%llu\n",
+           flushPolicyName((FlushPolicy)p),
+           (unsigned long long)result.sessions,
+           (unsigned long long)result.payload_bytes,
+           (unsigned long long)result.cost,
+           (double)result.latency_sum_s / result.readings,
+           result.max_latency_s,
+           (unsigned long long)result.decisions[FLUSH_FULL],
+           (unsigned long long)result.decisions[FLUSH_DEADLINE],
+           (unsigned long long)result.decisions[FLUSH_SIGNAL],
+           (unsigned long long)result.decisions[FLUSH_WAIT]);
+  }
+  return 0;
+}
@@ -0,0 +1,454 @@
+// UDP ingest service with per-stage latency tracing and a Prometheus
+// endpoint.
+//
+// Usage: ingest_udp -p PORT [-j WORKERS] [-o PREFIX] [-m METRICS_PORT]
+//                   [-s SAMPLE_SHIFT] [-q QUEUE_BATCHES] [-d SECONDS]
+//
+// Receives fleet_gen datagrams (8-byte little-endian device id, then the
+// payload). A receiver thread reads them with recvmmsg and routes each to
+// a worker by device id, through one bounded batch queue per worker; a
+// full queue drops the datagram. Workers decode the payload, apply it to
+// their own DeviceAggregator and, with -o, append it to PREFIX-NN.seg.
+//
+// Stage latencies (receive is the time spent queued), queue depths and
+// drop counters are served at http://127.0.0.1:METRICS_PORT/metrics
+// (default 9464) and merged once a second. SAMPLE_SHIFT traces 1 payload
+// in 2^SAMPLE_SHIFT (default INGEST_DEFAULT_SAMPLE_SHIFT). Runs for SECONDS,
+// or until SIGINT/SIGTERM.
+
+#include "device_aggregator.h"
+#include "ingest_metrics.h"
+#include "metrics_server.h"
+#include "payload_archive.h"
+#include "payload_decoder.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define RECV_BATCH 64
+#define DATAGRAM_SIZE (8 + MAX_PAYLOAD_SIZE)
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onSignal(int) { interrupted = 1; }
+
+static uint64_t wallClockMs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+typedef struct {
+  uint32_t count;
+  uint64_t received_ms; // Wall clock, for timestamps
+  uint64_t received_ns[RECV_BATCH];
+  uint32_t lengths[RECV_BATCH];
+  uint8_t data[RECV_BATCH][DATAGRAM_SIZE];
+} Batch;
+
+// Bounded queue of batches between the receiver and one worker. Batches are
+// allocated once and cycle between the free list and the queue.
+class BatchQueue {
+public:
+  explicit BatchQueue(uint32_t capacity) : batches(capacity), closed(false) {
+    for (uint32_t i = 0; i < capacity; i++) {
+      free_list.push_back(&batches[i]);
+    }
+  }
+
+  // Receiver: an empty batch, or nullptr if all are queued or in use
+  Batch *acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_list.empty()) {
+      return nullptr;
+    }
+    Batch *batch = free_list.back();
+    free_list.pop_back();
+    batch->count = 0;
+    return batch;
+  }
+
+  // Receiver
+  // Returns: queue depth after the push
+  uint32_t push(Batch *batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ready.push_back(batch);
+    ready_cv.notify_one();
+    return (uint32_t)ready.size();
+  }
+
+  // Worker: next batch, or nullptr once closed and drained
+  Batch *pop(uint32_t *depth) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (ready.empty() && !closed) {
+      ready_cv.wait(lock);
+    }
+    if (ready.empty()) {
+      return nullptr;
+    }
+    Batch *batch = ready.front();
+    ready.pop_front();
+    *depth = (uint32_t)ready.size();
+    return batch;
+  }
+
+  // Worker: hand a processed batch back
+  void release(Batch *batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    free_list.push_back(batch);
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    ready_cv.notify_all();
+  }
+
+private:
+  std::vector<Batch> batches;
+  std::vector<Batch *> free_list;
+  std::deque<Batch *> ready;
+  std::mutex mutex;
+  std::condition_variable ready_cv;
+  bool closed;
+};
+
+// Metric ids
+typedef struct {
+  uint32_t datagrams;
+  uint32_t payloads;
+  uint32_t readings;
+  uint32_t dropped_queue_full;
+  uint32_t dropped_short;
+  uint32_t dropped_malformed;
+  uint32_t dropped_persist;
+  uint32_t dropped_socket;
+} MetricIds;
+
+struct Worker {
+  uint32_t index;
+  std::unique_ptr<BatchQueue> queue;
+  uint32_t depth_gauge;
+  IngestTracer *tracer;
+  DeviceAggregator aggregator;
+  ArchiveWriter archive;
+  bool persist;
+  uint64_t sequence;
+  bool failed;
+};
+
+static void work(Worker *worker, IngestMetrics *metrics,
+                 const MetricIds *ids) {
+  PayloadDecoder decoder;
+  uint32_t depth;
+  Batch *batch;
+  while ((batch = worker->queue->pop(&depth)) != nullptr) {
+    metrics->set(worker->depth_gauge, depth);
+    uint64_t payloads = 0, readings = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+      const uint8_t *datagram = batch->data[i];
+      uint64_t device_id = 0;
+      for (int b = 7; b >= 0; b--) {
+        device_id = (device_id << 8) | datagram[b];
+      }
+      const uint8_t *payload = datagram + 8;
+      uint32_t length = batch->lengths[i] - 8;
+
+      IngestTrace trace(worker->tracer, batch->received_ns[i]);
+      trace.mark(INGEST_STAGE_RECEIVE);
+      int32_t count = decoder.decode(payload, length);
+      if (count < 0) {
+        metrics->add(ids->dropped_malformed, 1);
+        continue;
+      }
+      trace.mark(INGEST_STAGE_DECODE);
+
+      // The last reading was taken at receipt, earlier ones an interval apart
+      uint64_t interval_ms = decoder.getHeader().interval_minutes * 60000ULL;
+      for (int32_t r = 0; r < count; r++) {
+        uint64_t age_ms = (uint64_t)(count - 1 - r) * interval_ms;
+        worker->aggregator.update(
+            device_id,
+            batch->received_ms > age_ms ? batch->received_ms - age_ms : 0,
+            decoder.getReading((uint8_t)r));
+      }
+      trace.mark(INGEST_STAGE_AGGREGATE);
+
+      if (worker->persist && !worker->failed) {
+        PayloadRecordHeader header;
+        header.length = length;
+        header.sequence = ++worker->sequence;
+        header.device_id = device_id;
+        header.timestamp_ms = batch->received_ms;
+        worker->failed = !worker->archive.write(header, payload);
+        if (worker->failed) {
+          fprintf(stderr, "worker %u: archive write failed\n", worker->index);
+        }
+      }
+      if (worker->persist && worker->failed) {
+        metrics->add(ids->dropped_persist, 1);
+        continue;
+      }
+      trace.mark(INGEST_STAGE_PERSIST);
+      payloads++;
+      readings += (uint64_t)count;
+    }
+    worker->aggregator.advance(batch->received_ms, 256);
+    metrics->add(ids->payloads, (int64_t)payloads);
+    metrics->add(ids->readings, (int64_t)readings);
+    worker->queue->release(batch);
+  }
+}
+
+static void receive(int fd, std::vector<std::unique_ptr<Worker> > *workers,
+                    IngestMetrics *metrics, const MetricIds *ids,
+                    const std::atomic<bool> *stopping) {
+  static uint8_t buffers[RECV_BATCH][DATAGRAM_SIZE];
+  mmsghdr messages[RECV_BATCH];
+  iovec vectors[RECV_BATCH];
+  // Room for the SO_RXQ_OVFL drop count of each message
+  char controls[RECV_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+  uint32_t worker_count = (uint32_t)workers->size();
+  std::vector<Batch *> filling(worker_count, nullptr);
+
+  while (!stopping->load()) {
+    memset(messages, 0, sizeof(messages));
+    for (uint32_t i = 0; i < RECV_BATCH; i++) {
+      vectors[i].iov_base = buffers[i];
+      vectors[i].iov_len = DATAGRAM_SIZE;
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_control = controls[i];
+      messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+    int received = recvmmsg(fd, messages, RECV_BATCH, MSG_WAITFORONE, nullptr);
+    if (received <= 0) {
+      continue; // Receive timeout: check for stop
+    }
+    uint64_t now_ns = ingestNowNs();
+    uint64_t now_ms = wallClockMs();
+    metrics->add(ids->datagrams, received);
+
+    for (int i = 0; i < received; i++) {
+      msghdr &header = messages[i].msg_hdr;
+      for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+          uint32_t dropped;
+          memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+          metrics->set(ids->dropped_socket, dropped); // Cumulative
+        }
+      }
+
+      uint32_t length = messages[i].msg_len;
+      if (length < 8 + 2 || (header.msg_flags & MSG_TRUNC)) {
+        metrics->add(ids->dropped_short, 1);
+        continue;
+      }
+      uint64_t device_id;
+      memcpy(&device_id, buffers[i], sizeof(device_id)); // Little-endian host
+      uint32_t w = (uint32_t)((device_id * 0x9E3779B97F4A7C15ULL) >> 32) %
+                   worker_count;
+      Batch *batch = filling[w];
+      if (batch == nullptr) {
+        batch = filling[w] = (*workers)[w]->queue->acquire();
+        if (batch == nullptr) {
+          metrics->add(ids->dropped_queue_full, 1);
+          continue;
+        }
+        batch->received_ms = now_ms;
+      }
+      memcpy(batch->data[batch->count], buffers[i], length);
+      batch->lengths[batch->count] = length;
+      batch->received_ns[batch->count] = now_ns;
+      if (++batch->count == RECV_BATCH) {
+        metrics->set((*workers)[w]->depth_gauge,
+                     (*workers)[w]->queue->push(batch));
+        filling[w] = nullptr;
+      }
+    }
+
+    // Do not hold partial batches back waiting for more traffic
+    for (uint32_t w = 0; w < worker_count; w++) {
+      if (filling[w] != nullptr) {
+        metrics->set((*workers)[w]->depth_gauge,
+                     (*workers)[w]->queue->push(filling[w]));
+        filling[w] = nullptr;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int port = -1, metrics_port = 9464;
+  uint32_t worker_count = 1, sample_shift = INGEST_DEFAULT_SAMPLE_SHIFT;
+  uint32_t queue_batches = 64;
+  double seconds = 0;
+  const char *prefix = nullptr;
+  bool usage = false;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "-p") == 0 && has_value) {
+      port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0 && has_value) {
+      worker_count = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && has_value) {
+      prefix = argv[++i];
+    } else if (strcmp(argv[i], "-m") == 0 && has_value) {
+      metrics_port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+      sample_shift = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-q") == 0 && has_value) {
+      queue_batches = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-d") == 0 && has_value) {
+      seconds = atof(argv[++i]);
+    } else {
+      usage = true;
+      break;
+    }
+  }
+  if (usage || port < 0 || port > 65535 || metrics_port < 0 ||
+      metrics_port > 65535 || worker_count == 0 || queue_batches == 0) {
+    fprintf(stderr,
+            "usage: %s -p PORT [-j WORKERS] [-o PREFIX] [-m METRICS_PORT] "
+            "[-s SAMPLE_SHIFT] [-q QUEUE_BATCHES] [-d SECONDS]\n",
+            argv[0]);
+    return 2;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons((uint16_t)port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  int one = 1, buffer_bytes = 8 << 20;
+  struct timeval timeout = {0, 100000};
+  if (fd < 0 || bind(fd, (const sockaddr *)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "cannot bind UDP port %d\n", port);
+    return 1;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_bytes, sizeof(buffer_bytes));
+  setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  IngestMetrics metrics;
+  MetricIds ids;
+  ids.datagrams =
+      metrics.addCounter("ingest_datagrams_total", "", "Datagrams received");
+  ids.payloads = metrics.addCounter("ingest_payloads_total", "",
+                                    "Payloads decoded, aggregated and stored");
+  ids.readings = metrics.addCounter("ingest_readings_total", "",
+                                    "Readings of ingested payloads");
+  const char *drop_help = "Datagrams dropped, by reason";
+  ids.dropped_queue_full = metrics.addCounter(
+      "ingest_dropped_total", "reason=\"queue_full\"", drop_help);
+  ids.dropped_short =
+      metrics.addCounter("ingest_dropped_total", "reason=\"short\"", drop_help);
+  ids.dropped_malformed = metrics.addCounter(
+      "ingest_dropped_total", "reason=\"malformed\"", drop_help);
+  ids.dropped_persist = metrics.addCounter(
+      "ingest_dropped_total", "reason=\"persist\"", drop_help);
+  ids.dropped_socket = metrics.addCounter(
+      "ingest_dropped_total", "reason=\"socket\"", drop_help);
+
+  std::vector<std::unique_ptr<Worker> > workers;
+  for (uint32_t w = 0; w < worker_count; w++) {
+    std::unique_ptr<Worker> worker(new Worker);
+    char labels[32];
+    snprintf(labels, sizeof(labels), "worker=\"%u\"", w);
+    worker->index = w;
+    worker->queue.reset(new BatchQueue(queue_batches));
+    worker->depth_gauge = metrics.addGauge(
+        "ingest_queue_depth", labels, "Batches waiting for a worker");
+    worker->tracer = metrics.addTracer(sample_shift);
+    worker->aggregator.init(DeviceAggregator::defaultConfig(), nullptr,
+                            nullptr);
+    worker->persist = prefix != nullptr;
+    worker->sequence = 0;
+    worker->failed = false;
+    if (worker->persist) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "-%02u.seg", w);
+      std::string path = std::string(prefix) + suffix;
+      if (!worker->archive.open(path.c_str())) {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return 1;
+      }
+    }
+    workers.push_back(std::move(worker));
+  }
+
+  MetricsServer server;
+  if (!server.start(&metrics, "127.0.0.1", (uint16_t)metrics_port, 1000)) {
+    fprintf(stderr, "cannot serve metrics on port %d\n", metrics_port);
+    return 1;
+  }
+  fprintf(stderr, "udp port %d, %u workers, metrics at "
+                  "http://127.0.0.1:%u/metrics\n",
+          port, worker_count, server.getPort());
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  std::atomic<bool> stopping(false);
+  std::vector<std::thread> threads;
+  for (uint32_t w = 0; w < worker_count; w++) {
+    threads.push_back(std::thread(work, workers[w].get(), &metrics, &ids));
+  }
+  std::thread receiver(receive, fd, &workers, &metrics, &ids, &stopping);
+
+  uint64_t start = ingestNowNs();
+  while (!interrupted &&
+         (seconds <= 0 || ingestNowNs() - start < (uint64_t)(seconds * 1e9))) {
+    usleep(100000);
+  }
+  stopping.store(true);
+  receiver.join();
+  for (uint32_t w = 0; w < worker_count; w++) {
+    workers[w]->queue->close();
+    threads[w].join();
+  }
+  server.stop();
+  ::close(fd);
+
+  bool ok = true;
+  for (uint32_t w = 0; w < worker_count; w++) {
+    if (workers[w]->persist && !workers[w]->archive.close()) {
+      ok = false;
+    }
+  }
+  metrics.collect();
+  for (uint32_t s = 0; s < INGEST_STAGE_COUNT; s++) {
+    LatencyHistogram stage;
+    metrics.getStage((IngestStage)s, &stage);
+    fprintf(stderr, "%-9s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+            ingestStageName((IngestStage)s), stage.quantile(0.5) / 1e3,
+            stage.quantile(0.99) / 1e3, stage.getMax() / 1e3);
+  }
+  fprintf(stderr,
+          "datagrams %lld, payloads %lld, readings %lld, dropped: queue %lld, "
+          "malformed %lld, short %lld, socket %lld\n",
+          (long long)metrics.get(ids.datagrams),
+          (long long)metrics.get(ids.payloads),
+          (long long)metrics.get(ids.readings),
+          (long long)metrics.get(ids.dropped_queue_full),
+          (long long)metrics.get(ids.dropped_malformed),
+          (long long)metrics.get(ids.dropped_short),
+          (long long)metrics.get(ids.dropped_socket));
+  return ok ? 0 : 1;
+}
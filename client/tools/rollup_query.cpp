@@ -0,0 +1,153 @@
+// Range queries over columnar rollup files.
+//
+// Usage: rollup_query [--raw] [--scalar] [--print N] FILE... -- PREDICATE...
+//
+// A predicate is <column><op><value> with op one of > >= < <= =, e.g.
+//   rollup_query week.agr -- 'pm25>35' 'timestamp>=now-7d'
+// Columns are "device", "timestamp" or a field name (temperature, pm25, ...).
+// Field values are exact decimals in physical units (divided by the field
+// scale) unless --raw is given. Timestamps are Unix milliseconds or
+// now[-N{s,m,h,d}]. See rollupParsePredicate().
+
+#include "rollup_scan.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+typedef struct {
+  const RollupReader *reader;
+  const std::vector<RollupPredicate> *predicates;
+  uint32_t remaining; // Rows still to print
+} PrintState;
+
+static const char *columnName(uint32_t column) {
+  if (column == ROLLUP_COLUMN_DEVICE)
+    return "device";
+  if (column == ROLLUP_COLUMN_TIMESTAMP)
+    return "timestamp";
+  return kSensorFields[column - ROLLUP_COLUMN_FIELD(0)].name;
+}
+
+static uint32_t columnScale(uint32_t column) {
+  if (column < ROLLUP_COLUMN_FIELD(0))
+    return 1;
+  return kSensorFields[column - ROLLUP_COLUMN_FIELD(0)].scale;
+}
+
+static int64_t nowMs() {
+  return (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+static void printMatches(const RollupGroup &group, const uint64_t *bits,
+                         void *user) {
+  PrintState *state = (PrintState *)user;
+  for (uint32_t row = 0; row < group.row_count && state->remaining > 0; row++) {
+    if (((bits[row / 64] >> (row & 63)) & 1) == 0)
+      continue;
+
+    int64_t device = 0;
+    int64_t timestamp = 0;
+    state->reader->getValue(group, ROLLUP_COLUMN_DEVICE, row, &device);
+    state->reader->getValue(group, ROLLUP_COLUMN_TIMESTAMP, row, &timestamp);
+    printf("device=%llu timestamp=%lld", (unsigned long long)device,
+           (long long)timestamp);
+
+    for (size_t p = 0; p < state->predicates->size(); p++) {
+      uint32_t column = (*state->predicates)[p].column;
+      int64_t value;
+      if (column >= ROLLUP_COLUMN_FIELD(0) &&
+          state->reader->getValue(group, column, row, &value)) {
+        printf(" %s=%g", columnName(column),
+               (double)value / columnScale(column));
+      }
+    }
+    printf("\n");
+    state->remaining--;
+  }
+}
+
+int main(int argc, char **argv) {
+  bool raw = false;
+  bool scalar = false;
+  uint32_t print_rows = 0;
+  std::vector<const char *> files;
+  std::vector<RollupPredicate> predicates;
+
+  bool in_predicates = false;
+  for (int i = 1; i < argc; i++) {
+    if (in_predicates) {
+      RollupPredicate predicate;
+      if (!rollupParsePredicate(argv[i], raw, nowMs(), &predicate)) {
+        fprintf(stderr, "invalid predicate: %s\n", argv[i]);
+        return 2;
+      }
+      predicates.push_back(predicate);
+    } else if (strcmp(argv[i], "--") == 0) {
+      in_predicates = true;
+    } else if (strcmp(argv[i], "--raw") == 0) {
+      raw = true;
+    } else if (strcmp(argv[i], "--scalar") == 0) {
+      scalar = true;
+      rollupForceScalar(true);
+    } else if (strcmp(argv[i], "--print") == 0 && i + 1 < argc) {
+      print_rows = (uint32_t)atoi(argv[++i]);
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  if (files.empty()) {
+    fprintf(stderr, "usage: %s [--raw] [--scalar] [--print N] FILE... -- "
+                    "PREDICATE...\n",
+            argv[0]);
+    return 2;
+  }
+
+  uint64_t total_rows = 0;
+  uint64_t matched = 0;
+  RollupScanStats totals;
+  memset(&totals, 0, sizeof(totals));
+  double seconds = 0;
+
+  for (size_t f = 0; f < files.size(); f++) {
+    RollupReader reader;
+    if (!reader.open(files[f])) {
+      fprintf(stderr, "cannot open rollup file: %s\n", files[f]);
+      return 1;
+    }
+
+    PrintState state = {&reader, &predicates, print_rows};
+    RollupScanStats stats;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    matched += rollupScan(reader, predicates.data(),
+                          (uint32_t)predicates.size(),
+                          print_rows > 0 ? printMatches : nullptr, &state,
+                          &stats);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count();
+    print_rows = state.remaining;
+
+    total_rows += reader.getRowCount();
+    totals.groups += stats.groups;
+    totals.groups_skipped += stats.groups_skipped;
+    totals.bytes_scanned += stats.bytes_scanned;
+  }
+
+  printf("matched %llu of %llu rows\n", (unsigned long long)matched,
+         (unsigned long long)total_rows);
+  printf("groups %llu (skipped %llu), scanned %.1f MB in %.3f ms, "
+         "%.2f GB/s, %.0f Mrows/s, kernel %s\n",
+         (unsigned long long)totals.groups,
+         (unsigned long long)totals.groups_skipped,
+         totals.bytes_scanned / 1e6, seconds * 1e3,
+         seconds > 0 ? totals.bytes_scanned / seconds / 1e9 : 0.0,
+         seconds > 0 ? total_rows / seconds / 1e6 : 0.0,
+         rollupHaveAvx2() && !scalar ? "avx2" : "scalar");
+  return 0;
+}
@@ -0,0 +1,20 @@
+{
+  "targets": [
+    {
+      "target_name": "payload_decoder_native",
+      "sources": [
+        "native/payload_decoder_addon.cpp",
+        "../client/src/decode_plan.cpp",
+        "../client/src/payload_decoder.cpp",
+        "../client/src/payload_index.cpp",
+        "../client/src/payload_writer.cpp",
+        "../client/src/sensor_fields.cpp"
+      ],
+      "include_dirs": ["../client/src"],
+      "cflags_cc": ["-O2", "-std=c++11"],
+      "xcode_settings": {
+        "OTHER_CPLUSPLUSFLAGS": ["-O2", "-std=c++11"]
+      }
+    }
+  ]
+}
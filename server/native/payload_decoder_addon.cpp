@@ -0,0 +1,435 @@
+// Native payload decoder for Node.js (N-API).
+//
+// Wraps the C++ PayloadDecoder from client/src. A call into N-API costs far
+// more than decoding a field, so no objects are built here: values go into
+// typed arrays, either a flat scratch array that
+// server/src/payload_decoder_native.js turns into the same objects as
+// payload_decoder.js, or caller-owned columns.
+//
+// Exports:
+//   bindColumns(presenceMask, values, values2) -> binding
+//   decodeFlat(buffer, binding, applyScaling) -> reading count
+//   decodeColumns(buffer, binding, row) -> reading count
+//   toJSON(buffer) -> compact JSON text, written by PayloadWriter
+
+#define NAPI_VERSION 8
+#include "payload_decoder.h"
+#include "payload_writer.h"
+#include "sensor_fields.h"
+#include <node_api.h>
+#include <string.h>
+
+namespace {
+
+// A typed array held by a reference. Once its buffer has been fetched the
+// storage does not move, so the pointer stays valid until the ArrayBuffer
+// is detached (transferred).
+typedef struct {
+  napi_typedarray_type type;
+  uint8_t *data;
+  size_t length;
+  napi_ref ref;
+} Column;
+
+// Columns of one bindColumns() call, indexed [flag][channel]. decodeFlat()
+// uses presence_mask as its scratch array.
+typedef struct {
+  Column presence_mask;
+  Column columns[SENSOR_FIELD_COUNT][2];
+  size_t rows; // Shortest bound column
+} ColumnBinding;
+
+// Status checks: on failure throw (unless an exception is already pending)
+// and return nullptr from the calling function
+#define NAPI_CALL(env, call)                                                   \
+  do {                                                                         \
+    if ((call) != napi_ok) {                                                   \
+      throwLastError(env);                                                     \
+      return nullptr;                                                          \
+    }                                                                          \
+  } while (0)
+
+void throwLastError(napi_env env) {
+  bool pending = false;
+  napi_is_exception_pending(env, &pending);
+  if (pending) {
+    return;
+  }
+  const napi_extended_error_info *info = nullptr;
+  napi_get_last_error_info(env, &info);
+  napi_throw_error(env, nullptr,
+                   info != nullptr && info->error_message != nullptr
+                       ? info->error_message
+                       : "N-API call failed");
+}
+
+void deleteBinding(napi_env env, void *data, void *) {
+  ColumnBinding *binding = (ColumnBinding *)data;
+  if (binding->presence_mask.ref != nullptr)
+    napi_delete_reference(env, binding->presence_mask.ref);
+  for (uint32_t flag = 0; flag < SENSOR_FIELD_COUNT; flag++) {
+    for (int channel = 0; channel < 2; channel++) {
+      if (binding->columns[flag][channel].ref != nullptr)
+        napi_delete_reference(env, binding->columns[flag][channel].ref);
+    }
+  }
+  delete binding;
+}
+
+bool isNullish(napi_env env, napi_value value) {
+  napi_valuetype type;
+  return napi_typeof(env, value, &type) != napi_ok ||
+         type == napi_undefined || type == napi_null;
+}
+
+// Bind a typed array; undefined and null leave the column unbound
+// Returns: false with an exception pending on bad input
+bool bindColumn(napi_env env, napi_value value, Column *column) {
+  if (isNullish(env, value))
+    return true;
+
+  bool is_typedarray = false;
+  napi_is_typedarray(env, value, &is_typedarray);
+  if (!is_typedarray) {
+    napi_throw_type_error(env, nullptr, "Columns must be typed arrays");
+    return false;
+  }
+  void *data = nullptr;
+  if (napi_get_typedarray_info(env, value, &column->type, &column->length,
+                               &data, nullptr, nullptr) != napi_ok) {
+    throwLastError(env);
+    return false;
+  }
+  if (column->type == napi_bigint64_array ||
+      column->type == napi_biguint64_array) {
+    napi_throw_type_error(env, nullptr, "BigInt columns are not supported");
+    return false;
+  }
+  if (napi_create_reference(env, value, 1, &column->ref) != napi_ok) {
+    throwLastError(env);
+    return false;
+  }
+  column->data = (uint8_t *)data;
+  return true;
+}
+
+ColumnBinding *getBinding(napi_env env, napi_value value) {
+  ColumnBinding *binding = nullptr;
+  napi_valuetype type;
+  if (napi_typeof(env, value, &type) != napi_ok || type != napi_external ||
+      napi_get_value_external(env, value, (void **)&binding) != napi_ok) {
+    napi_throw_type_error(env, nullptr, "Expected a column binding");
+    return nullptr;
+  }
+  return binding;
+}
+
+// Payload bytes, with the same checks and messages as the JavaScript decoder
+bool getPayload(napi_env env, napi_value value, const uint8_t **buffer,
+                size_t *length) {
+  bool is_buffer = false;
+  napi_is_buffer(env, value, &is_buffer);
+  if (!is_buffer) {
+    napi_throw_error(env, nullptr, "Input must be a Buffer");
+    return false;
+  }
+  napi_get_buffer_info(env, value, (void **)buffer, length);
+  if (*length < 2) {
+    napi_throw_error(env, nullptr,
+                     "Buffer too small (minimum 2 bytes for header)");
+    return false;
+  }
+  return true;
+}
+
+// The JavaScript decoder fails inside Buffer.read*() here
+void throwTruncated(napi_env env) {
+  napi_throw_range_error(env, "ERR_OUT_OF_RANGE",
+                         "Payload truncated inside a reading");
+}
+
+bool dualChannel(const PayloadHeader &header, uint32_t flag) {
+  if (!header.dual_mode || !kSensorFields[flag].expandable)
+    return false;
+  return !((flag == FLAG_TEMP || flag == FLAG_HUM) &&
+           header.dedicated_temphum_sensor);
+}
+
+// Float columns get physical units, integer columns the raw value
+// (truncated to the element type)
+inline void storeValue(const Column &column, size_t row, int64_t raw,
+                       uint16_t scale) {
+  switch (column.type) {
+  case napi_float32_array:
+    ((float *)column.data)[row] = (float)((double)raw / scale);
+    break;
+  case napi_float64_array:
+    ((double *)column.data)[row] = (double)raw / scale;
+    break;
+  case napi_int8_array:
+    ((int8_t *)column.data)[row] = (int8_t)raw;
+    break;
+  case napi_uint8_array:
+  case napi_uint8_clamped_array:
+    ((uint8_t *)column.data)[row] = (uint8_t)raw;
+    break;
+  case napi_int16_array:
+    ((int16_t *)column.data)[row] = (int16_t)raw;
+    break;
+  case napi_uint16_array:
+    ((uint16_t *)column.data)[row] = (uint16_t)raw;
+    break;
+  case napi_int32_array:
+    ((int32_t *)column.data)[row] = (int32_t)raw;
+    break;
+  case napi_uint32_array:
+    ((uint32_t *)column.data)[row] = (uint32_t)raw;
+    break;
+  default:
+    break;
+  }
+}
+
+// bindColumns(presenceMask, values, values2)
+//
+// values and values2 are arrays indexed by flag (either may be undefined);
+// values2 receives channel 1 of dual-channel fields
+napi_value BindColumns(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+  for (size_t i = argc; i < 3; i++)
+    NAPI_CALL(env, napi_get_undefined(env, &argv[i]));
+
+  ColumnBinding *binding = new ColumnBinding();
+  memset(binding, 0, sizeof(*binding));
+  bool ok = bindColumn(env, argv[0], &binding->presence_mask);
+  if (ok && binding->presence_mask.data == nullptr) {
+    napi_throw_type_error(env, nullptr, "presenceMask column is required");
+    ok = false;
+  }
+  binding->rows = binding->presence_mask.length;
+  for (int channel = 0; ok && channel < 2; channel++) {
+    if (isNullish(env, argv[1 + channel]))
+      continue;
+    for (uint32_t flag = 0; ok && flag < SENSOR_FIELD_COUNT; flag++) {
+      napi_value value;
+      Column &column = binding->columns[flag][channel];
+      if (napi_get_element(env, argv[1 + channel], flag, &value) != napi_ok) {
+        throwLastError(env);
+        ok = false;
+      } else {
+        ok = bindColumn(env, value, &column);
+      }
+      if (ok && column.data != nullptr && column.length < binding->rows)
+        binding->rows = column.length;
+    }
+  }
+
+  napi_value result = nullptr;
+  if (ok && napi_create_external(env, binding, deleteBinding, nullptr,
+                                 &result) != napi_ok) {
+    throwLastError(env);
+    ok = false;
+  }
+  if (!ok) {
+    deleteBinding(env, binding, nullptr);
+    return nullptr;
+  }
+  return result;
+}
+
+// decodeFlat(buffer, binding, applyScaling)
+//
+// Writes each reading as its presence mask followed by the present fields
+// in flag order (two entries for dual-channel fields) to the Float64Array
+// bound as presenceMask. A mask takes 4 payload bytes and a value at least
+// one, so buffer.length entries are always enough.
+// Returns: number of readings
+napi_value DecodeFlat(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+  if (argc < 3) {
+    napi_throw_type_error(env, nullptr, "decodeFlat(buffer, binding, scale)");
+    return nullptr;
+  }
+
+  const uint8_t *buffer;
+  size_t length;
+  bool scaled;
+  ColumnBinding *binding = getBinding(env, argv[1]);
+  if (binding == nullptr || !getPayload(env, argv[0], &buffer, &length))
+    return nullptr;
+  NAPI_CALL(env, napi_get_value_bool(env, argv[2], &scaled));
+  const Column &scratch = binding->presence_mask;
+  if (scratch.type != napi_float64_array || scratch.length < length) {
+    napi_throw_range_error(env, nullptr, "Scratch array too small");
+    return nullptr;
+  }
+
+  PayloadDecoder decoder;
+  decoder.decodeMetadata(buffer[0]);
+  const PayloadHeader &header = decoder.getHeader();
+  double *out = (double *)scratch.data;
+  size_t offset = 2;
+  uint32_t count = 0;
+  while (offset < length) {
+    SensorReading reading;
+    int32_t consumed = decoder.decodeReading(
+        buffer + offset, (uint32_t)(length - offset), reading);
+    if (consumed < 0) {
+      throwTruncated(env);
+      return nullptr;
+    }
+    offset += (size_t)consumed;
+    count++;
+
+    *out++ = reading.presence_mask;
+    uint32_t present = reading.presence_mask & ((1u << SENSOR_FIELD_COUNT) - 1);
+    for (; present != 0; present &= present - 1) {
+      uint32_t flag = (uint32_t)__builtin_ctz(present);
+      double scale = scaled ? kSensorFields[flag].scale : 1;
+      *out++ = getSensorFieldValue(reading, (SensorFlag)flag, 0) / scale;
+      if (dualChannel(header, flag))
+        *out++ = getSensorFieldValue(reading, (SensorFlag)flag, 1) / scale;
+    }
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_uint32(env, count, &result));
+  return result;
+}
+
+// decodeColumns(buffer, binding, row)
+//
+// Reading i is written at row + i. Only present fields with a bound column
+// are written. Nothing is written if the payload is truncated or the
+// columns are too short.
+// Returns: number of readings
+napi_value DecodeColumns(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+  if (argc < 3) {
+    napi_throw_type_error(env, nullptr, "decodeColumns(buffer, binding, row)");
+    return nullptr;
+  }
+
+  const uint8_t *buffer;
+  size_t length;
+  uint32_t row;
+  ColumnBinding *binding = getBinding(env, argv[1]);
+  if (binding == nullptr || !getPayload(env, argv[0], &buffer, &length))
+    return nullptr;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &row));
+
+  PayloadDecoder decoder;
+  decoder.decodeMetadata(buffer[0]);
+  const PayloadHeader &header = decoder.getHeader();
+
+  // Walk the payload first so a bad one leaves the columns untouched
+  size_t offset = 2;
+  size_t count = 0;
+  while (offset < length) {
+    SensorReading reading;
+    int32_t consumed = decoder.decodeReading(
+        buffer + offset, (uint32_t)(length - offset), reading);
+    if (consumed < 0) {
+      throwTruncated(env);
+      return nullptr;
+    }
+    offset += (size_t)consumed;
+    count++;
+  }
+  if ((size_t)row + count > binding->rows) {
+    napi_throw_range_error(env, nullptr, "Columns too short");
+    return nullptr;
+  }
+
+  offset = 2;
+  for (size_t at = row; at < row + count; at++) {
+    SensorReading reading;
+    offset += (size_t)decoder.decodeReading(
+        buffer + offset, (uint32_t)(length - offset), reading);
+    storeValue(binding->presence_mask, at, reading.presence_mask, 1);
+
+    uint32_t present = reading.presence_mask & ((1u << SENSOR_FIELD_COUNT) - 1);
+    for (; present != 0; present &= present - 1) {
+      uint32_t flag = (uint32_t)__builtin_ctz(present);
+      const Column *columns = binding->columns[flag];
+      uint16_t scale = kSensorFields[flag].scale;
+      if (columns[0].data != nullptr)
+        storeValue(columns[0], at,
+                   getSensorFieldValue(reading, (SensorFlag)flag, 0), scale);
+      if (columns[1].data != nullptr && dualChannel(header, flag))
+        storeValue(columns[1], at,
+                   getSensorFieldValue(reading, (SensorFlag)flag, 1), scale);
+    }
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_create_uint32(env, (uint32_t)count, &result));
+  return result;
+}
+
+// toJSON(buffer)
+//
+// Same text as JSON.stringify(decodePayload(buffer)), written straight from
+// the payload bytes
+napi_value ToJSON(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+  const uint8_t *buffer;
+  size_t length;
+  if (!getPayload(env, argc >= 1 ? argv[0] : nullptr, &buffer, &length))
+    return nullptr;
+
+  PayloadWriter *writer = nullptr;
+  NAPI_CALL(env, napi_get_instance_data(env, (void **)&writer));
+  writer->clear();
+  if (length > UINT32_MAX ||
+      writer->write(0, 0, buffer, (uint32_t)length) < 0) {
+    throwTruncated(env);
+    return nullptr;
+  }
+
+  // Drop the trailing newline that separates JSON Lines
+  napi_value result;
+  NAPI_CALL(env, napi_create_string_latin1(env, writer->data(),
+                                           writer->size() - 1, &result));
+  return result;
+}
+
+void deleteWriter(napi_env, void *data, void *) {
+  delete (PayloadWriter *)data;
+}
+
+napi_value Init(napi_env env, napi_value exports) {
+  // One output buffer per module instance (worker threads get their own)
+  PayloadWriter *writer = new PayloadWriter(OUTPUT_JSON);
+  if (napi_set_instance_data(env, writer, deleteWriter, nullptr) != napi_ok) {
+    delete writer;
+    throwLastError(env);
+    return nullptr;
+  }
+
+  napi_property_descriptor functions[4] = {
+      {"bindColumns", nullptr, BindColumns, nullptr, nullptr, nullptr,
+       napi_default, nullptr},
+      {"decodeFlat", nullptr, DecodeFlat, nullptr, nullptr, nullptr,
+       napi_default, nullptr},
+      {"decodeColumns", nullptr, DecodeColumns, nullptr, nullptr, nullptr,
+       napi_default, nullptr},
+      {"toJSON", nullptr, ToJSON, nullptr, nullptr, nullptr, napi_default,
+       nullptr},
+  };
+  NAPI_CALL(env, napi_define_properties(env, exports, 4, functions));
+  return exports;
+}
+
+} // namespace
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, Init)
@@ -0,0 +1,75 @@
+/**
+ * Decoder throughput: JavaScript vs native decodePayload vs decodeInto
+ * Run with: node src/bench_decoder.js [payloads] [readings_per_payload]
+ */
+
+const js = require('./payload_decoder');
+const native = require('./payload_decoder_native');
+
+const payloadCount = parseInt(process.argv[2], 10) || 10000;
+const readingsPerPayload = parseInt(process.argv[3], 10) || 10;
+
+// Typical indoor monitor reading: temp, hum, co2, tvoc, nox, pm01/25/10,
+// pm03 count and signal (mask 0x040087bf would be the same shape)
+function makePayload(readings) {
+  const bytes = [0x01, 0x05];
+  for (let r = 0; r < readings; r++) {
+    const mask = (1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 5) |
+      (1 << 7) | (1 << 8) | (1 << 9) | (1 << 13) | (1 << 26);
+    bytes.push(mask & 0xff, (mask >>> 8) & 0xff, (mask >>> 16) & 0xff, mask >>> 24);
+    const u16 = (v) => bytes.push(v & 0xff, (v >>> 8) & 0xff);
+    u16(2500 + r);   // temperature
+    u16(4500 + r);   // humidity
+    u16(420 + r);    // co2
+    u16(100);        // tvoc
+    u16(1);          // nox
+    u16(12);         // pm01
+    u16(35);         // pm25
+    u16(50);         // pm10
+    u16(1200);       // pm03_pc
+    bytes.push(0xb5); // signal (-75 dBm)
+  }
+  return Buffer.from(bytes);
+}
+
+const payloads = [];
+for (let i = 0; i < payloadCount; i++) {
+  payloads.push(makePayload(readingsPerPayload));
+}
+const totalReadings = payloadCount * readingsPerPayload;
+const columns = native.createColumns(readingsPerPayload);
+
+function run(name, fn) {
+  // Warm up, then take the best of five passes
+  fn();
+  let best = Infinity;
+  for (let pass = 0; pass < 5; pass++) {
+    const start = process.hrtime.bigint();
+    fn();
+    const elapsed = Number(process.hrtime.bigint() - start);
+    best = Math.min(best, elapsed);
+  }
+  const perPayloadNs = best / payloadCount;
+  const readingsPerSecond = totalReadings / (best / 1e9);
+  console.log(`${name.padEnd(24)} ${(perPayloadNs / 1000).toFixed(2).padStart(8)} us/payload ` +
+    `${(readingsPerSecond / 1e6).toFixed(2).padStart(8)} M readings/s`);
+  return best;
+}
+
+let sink = 0;
+console.log(`${payloadCount} payloads x ${readingsPerPayload} readings\n`);
+const jsTime = run('js decodePayload', () => {
+  for (const payload of payloads) sink += js.decodePayload(payload).readingCount;
+});
+const nativeTime = run('native decodePayload', () => {
+  for (const payload of payloads) sink += native.decodePayload(payload).readingCount;
+});
+const intoTime = run('native decodeInto', () => {
+  for (const payload of payloads) sink += native.decodeInto(payload, columns);
+});
+
+console.log(`\nnative decodePayload: ${(jsTime / nativeTime).toFixed(2)}x, ` +
+  `decodeInto: ${(jsTime / intoTime).toFixed(2)}x vs JavaScript`);
+if (sink === 0) {
+  console.log('unreachable');
+}
@@ -0,0 +1,165 @@
+/**
+ * Native AirGradient Payload Decoder
+ * Drop-in replacement for payload_decoder.js backed by the C++ decoder in
+ * client/src (build with: npm run build:native)
+ */
+
+const path = require('path');
+const decoder = require('./payload_decoder');
+const { SensorFlag, SensorFieldNames, SensorInfo } = require('./payload_types');
+
+const native = require(path.join(__dirname, '..', 'build', 'Release', 'payload_decoder_native.node'));
+
+const FIELD_COUNT = SensorFlag.FLAG_SIGNAL + 1;
+const FIELD_MASK = (1 << FIELD_COUNT) - 1;
+
+// Flat scratch array for decodeFlat(), grown to the largest payload seen
+let scratch = new Float64Array(4096);
+let scratchBinding = native.bindColumns(scratch);
+
+// Column bindings of decodeInto(), created on first use of a columns object
+const bindings = new WeakMap();
+
+/**
+ * Fields that carry two values in this header's mode, as a bit mask
+ */
+function dualFieldMask(dualMode, dedicatedTempHumSensor) {
+  let mask = 0;
+  if (dualMode) {
+    for (let flag = 0; flag < FIELD_COUNT; flag++) {
+      const info = SensorInfo[flag];
+      if (info.type !== 'int8' && info.type !== 'uint32' &&
+          decoder.isExpandable(flag, dedicatedTempHumSensor)) {
+        mask |= 1 << flag;
+      }
+    }
+  }
+  return mask;
+}
+
+/**
+ * Decode complete payload with multiple readings
+ * Same output and errors as the JavaScript decodePayload()
+ * @param {Buffer} buffer - Complete payload buffer
+ * @param {boolean} applyScaling - Apply scaling factors to sensor values
+ * @returns {Object} Decoded payload with header and readings
+ */
+function decodePayload(buffer, applyScaling = true) {
+  if (Buffer.isBuffer(buffer) && buffer.length > scratch.length) {
+    scratch = new Float64Array(buffer.length);
+    scratchBinding = native.bindColumns(scratch);
+  }
+  const count = native.decodeFlat(buffer, scratchBinding, !!applyScaling);
+
+  const { version, dualMode, dedicatedTempHumSensor } = decoder.decodeMetadata(buffer[0]);
+  const header = {
+    version,
+    dualMode,
+    dedicatedTempHumSensor,
+    intervalMinutes: buffer[1]
+  };
+
+  // Build the objects here: V8 creates them much faster than N-API can
+  const dual = dualFieldMask(dualMode, dedicatedTempHumSensor);
+  const readings = new Array(count);
+  let index = 0;
+  for (let r = 0; r < count; r++) {
+    const presenceMask = scratch[index++];
+    const reading = { presenceMask };
+    for (let bits = presenceMask & FIELD_MASK; bits !== 0; bits &= bits - 1) {
+      const flag = 31 - Math.clz32(bits & -bits);
+      if (dual & (1 << flag)) {
+        reading[SensorFieldNames[flag]] = [scratch[index], scratch[index + 1]];
+        index += 2;
+      } else {
+        reading[SensorFieldNames[flag]] = scratch[index++];
+      }
+    }
+    readings[r] = reading;
+  }
+
+  return {
+    header,
+    readings,
+    readingCount: count
+  };
+}
+
+/**
+ * Decode payload and return raw values (no scaling applied)
+ * @param {Buffer} buffer - Complete payload buffer
+ * @returns {Object} Decoded payload with raw sensor values
+ */
+function decodePayloadRaw(buffer) {
+  return decodePayload(buffer, false);
+}
+
+/**
+ * Convert decoded payload to JSON string
+ * @param {Buffer} buffer - Complete payload buffer
+ * @param {boolean} pretty - Pretty print JSON
+ * @returns {string} JSON string
+ */
+function decodePayloadToJSON(buffer, pretty = false) {
+  // Compact JSON is written natively without building the objects
+  return pretty ? JSON.stringify(decodePayload(buffer), null, 2) : native.toJSON(buffer);
+}
+
+/**
+ * Decode a payload into preallocated columns without creating objects
+ * Reading i goes to row + i. Float32Array/Float64Array columns receive
+ * scaled values, integer columns raw values. Only fields present in a
+ * reading are written: check presenceMask before reading a column. The
+ * arrays of a columns object are captured on its first use; create a new
+ * columns object to change them.
+ * @param {Buffer} buffer - Complete payload buffer
+ * @param {Object} columns - { presenceMask: Uint32Array, values: [], values2: [] }
+ *   values[flag] is a typed array or undefined (field skipped); values2 holds
+ *   the second channel of dual-mode fields and is optional
+ * @param {number} row - First row to write
+ * @returns {number} Number of readings written
+ */
+function decodeInto(buffer, columns, row = 0) {
+  let binding = bindings.get(columns);
+  if (binding === undefined) {
+    binding = native.bindColumns(columns.presenceMask, columns.values, columns.values2);
+    bindings.set(columns, binding);
+  }
+  return native.decodeColumns(buffer, binding, row);
+}
+
+/**
+ * Allocate columns for decodeInto()
+ * @param {number} capacity - Rows per column
+ * @param {Object} options - { fields: [flags] (default all), dual: false,
+ *   type: Float32Array }
+ * @returns {Object} { presenceMask, values, values2 }
+ */
+function createColumns(capacity, options = {}) {
+  const ArrayType = options.type || Float32Array;
+  const fields = options.fields ||
+    Array.from({ length: FIELD_COUNT }, (_, flag) => flag);
+
+  const columns = {
+    presenceMask: new Uint32Array(capacity),
+    values: new Array(FIELD_COUNT).fill(undefined),
+    values2: new Array(FIELD_COUNT).fill(undefined)
+  };
+  for (const flag of fields) {
+    columns.values[flag] = new ArrayType(capacity);
+    if (options.dual) {
+      columns.values2[flag] = new ArrayType(capacity);
+    }
+  }
+  return columns;
+}
+
+// Export all functions
+module.exports = {
+  ...decoder,
+  decodePayload,
+  decodePayloadRaw,
+  decodePayloadToJSON,
+  decodeInto,
+  createColumns
+};
@@ -0,0 +1,160 @@
+/**
+ * Checks the native decoder against the JavaScript decoder
+ * Run with: node src/test_native_decoder.js (after npm run build:native)
+ */
+
+const assert = require('assert');
+const path = require('path');
+const { execFileSync } = require('child_process');
+const js = require('./payload_decoder');
+const native = require('./payload_decoder_native');
+const { SensorFlag, SensorFieldNames, SensorInfo } = require('./payload_types');
+
+const FIELD_COUNT = SensorFlag.FLAG_SIGNAL + 1;
+const WIDTH = { int8: 1, int16: 2, uint16: 2, uint32: 4 };
+
+// Deterministic PRNG so failures are reproducible
+let seed = 12345;
+function random() {
+  seed = (seed * 1103515245 + 12345) >>> 0;
+  return seed / 4294967296;
+}
+
+function randomPayload() {
+  const dualMode = random() < 0.5;
+  const dedicated = random() < 0.3;
+  const metadata = 0x01 | (dualMode ? 0x08 : 0) | (dedicated ? 0x10 : 0);
+  const bytes = [metadata, Math.floor(random() * 256)];
+  const readingCount = 1 + Math.floor(random() * 12);
+
+  for (let r = 0; r < readingCount; r++) {
+    let mask = 0;
+    for (let flag = 0; flag < FIELD_COUNT; flag++) {
+      if (random() < 0.4) {
+        mask |= 1 << flag;
+      }
+    }
+    mask >>>= 0;
+    bytes.push(mask & 0xff, (mask >>> 8) & 0xff, (mask >>> 16) & 0xff, mask >>> 24);
+    for (let flag = 0; flag < FIELD_COUNT; flag++) {
+      if (!js.isFlagSet(mask, flag)) {
+        continue;
+      }
+      const info = SensorInfo[flag];
+      const count = dualMode && js.isExpandable(flag, dedicated) &&
+        info.type !== 'int8' && info.type !== 'uint32' ? 2 : 1;
+      for (let i = 0; i < count * WIDTH[info.type]; i++) {
+        bytes.push(Math.floor(random() * 256));
+      }
+    }
+  }
+  return Buffer.from(bytes);
+}
+
+function errorOf(fn) {
+  try {
+    fn();
+  } catch (err) {
+    return err;
+  }
+  return null;
+}
+
+// Test 1: test_decoder.js prints the same output with either decoder
+console.log('=== Test 1: test_decoder.js output ===');
+const testScript = path.join(__dirname, 'test_decoder.js');
+const preload = path.join(__dirname, 'use_native_decoder.js');
+const jsOutput = execFileSync(process.execPath, [testScript]).toString();
+const nativeOutput = execFileSync(process.execPath, ['-r', preload, testScript]).toString();
+assert.strictEqual(nativeOutput, jsOutput);
+console.log('OK');
+
+// Test 2: random payloads decode identically, scaled and raw
+console.log('=== Test 2: Random payloads ===');
+const payloads = [];
+for (let i = 0; i < 2000; i++) {
+  payloads.push(randomPayload());
+}
+for (const payload of payloads) {
+  assert.deepStrictEqual(native.decodePayload(payload), js.decodePayload(payload));
+  assert.deepStrictEqual(native.decodePayloadRaw(payload), js.decodePayloadRaw(payload));
+  assert.strictEqual(native.decodePayloadToJSON(payload, true), js.decodePayloadToJSON(payload, true));
+  assert.strictEqual(native.decodePayloadToJSON(payload), js.decodePayloadToJSON(payload));
+}
+console.log('OK');
+
+// Test 3: invalid input throws like the JavaScript decoder
+console.log('=== Test 3: Errors ===');
+for (const input of ['abc', null, Buffer.from([0x01])]) {
+  const expected = errorOf(() => js.decodePayload(input));
+  for (const fn of [native.decodePayload, native.decodePayloadToJSON]) {
+    const actual = errorOf(() => fn(input));
+    assert.strictEqual(actual.constructor, expected.constructor);
+    assert.strictEqual(actual.message, expected.message);
+  }
+}
+for (const payload of payloads.slice(0, 200)) {
+  // Cut inside the last reading
+  const truncated = payload.subarray(0, payload.length - 1);
+  if (truncated.length <= 2) {
+    continue;
+  }
+  const expected = errorOf(() => js.decodePayload(truncated));
+  for (const fn of [native.decodePayload, native.decodePayloadToJSON]) {
+    const actual = errorOf(() => fn(truncated));
+    assert.strictEqual(actual === null, expected === null);
+    if (expected !== null) {
+      assert.ok(actual instanceof RangeError);
+    }
+  }
+}
+console.log('OK');
+
+// Test 4: decodeInto fills columns with the decodePayload values
+console.log('=== Test 4: decodeInto ===');
+const capacity = 64;
+const scaled = native.createColumns(capacity, { dual: true, type: Float64Array });
+const single = native.createColumns(capacity, { type: Float32Array });
+const raw = native.createColumns(capacity, { fields: [SensorFlag.FLAG_TEMP, SensorFlag.FLAG_CO2], type: Int32Array });
+
+for (const payload of payloads.slice(0, 500)) {
+  const expected = js.decodePayload(payload);
+  const expectedRaw = js.decodePayloadRaw(payload);
+  const row = 3;
+  assert.strictEqual(native.decodeInto(payload, scaled, row), expected.readingCount);
+  assert.strictEqual(native.decodeInto(payload, single, row), expected.readingCount);
+  assert.strictEqual(native.decodeInto(payload, raw, row), expected.readingCount);
+
+  expected.readings.forEach((reading, i) => {
+    assert.strictEqual(scaled.presenceMask[row + i], reading.presenceMask);
+    for (let flag = 0; flag < FIELD_COUNT; flag++) {
+      if (!js.isFlagSet(reading.presenceMask, flag)) {
+        continue;
+      }
+      const value = reading[SensorFieldNames[flag]];
+      const first = Array.isArray(value) ? value[0] : value;
+      assert.strictEqual(scaled.values[flag][row + i], first);
+      assert.strictEqual(single.values[flag][row + i], Math.fround(first));
+      if (Array.isArray(value)) {
+        assert.strictEqual(scaled.values2[flag][row + i], value[1]);
+      }
+    }
+    const rawReading = expectedRaw.readings[i];
+    if (js.isFlagSet(rawReading.presenceMask, SensorFlag.FLAG_CO2)) {
+      assert.strictEqual(raw.values[SensorFlag.FLAG_CO2][row + i], rawReading.co2);
+    }
+  });
+}
+
+// Columns too short for the payload are rejected before anything is written
+const small = native.createColumns(1);
+const twoReadings = Buffer.from([
+  0x01, 0x05,
+  0x01, 0x00, 0x00, 0x00, 0xC4, 0x09,
+  0x01, 0x00, 0x00, 0x00, 0x28, 0x0A
+]);
+assert.throws(() => native.decodeInto(twoReadings, small), RangeError);
+assert.strictEqual(small.presenceMask[0], 0);
+console.log('OK');
+
+console.log('\nAll native decoder tests passed');
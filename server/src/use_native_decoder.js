@@ -0,0 +1,17 @@
+/**
+ * Preload that makes require('./payload_decoder') return the native decoder
+ * Run with: node -r ./src/use_native_decoder.js src/test_decoder.js
+ */
+
+const path = require('path');
+const Module = require('module');
+
+const jsPath = require.resolve('./payload_decoder');
+const nativeModule = require('./payload_decoder_native');
+
+const entry = new Module(jsPath, module);
+entry.filename = jsPath;
+entry.paths = Module._nodeModulePaths(path.dirname(jsPath));
+entry.exports = nativeModule;
+entry.loaded = true;
+require.cache[jsPath] = entry;